@@ -0,0 +1,57 @@
+#version 450 core
+
+layout(local_size_x = 256) in;
+
+// 对应 C++ 中的 GpuBvhConstants
+layout(push_constant) uniform BuildConstants {
+    uint prim_count;
+    uint shift;// radix 排序本轮的最低位
+    uint in_offset;// 本轮读取的 key/value 在 ping-pong 缓冲中的起点
+    uint out_offset;// 本轮写入的起点
+    uint group_count;// radix 排序的工作组数
+    uint watertight;// 三角形记录为顶点而不是预计算的边
+} build;
+
+// 工作组数超过单维上限时按二维派发
+uint invocation_index() {
+    return gl_GlobalInvocationID.x + gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+}
+
+layout(std430, set = 0, binding = 0) readonly buffer Positions {
+    float positions[];// 每个顶点 3 个 float，与 C++ 中的 Vec3f 一致
+};
+layout(std430, set = 0, binding = 1) readonly buffer Indices {
+    uint indices[];
+};
+
+vec3 vertex(uint triangle, uint corner) {
+    uint index = indices[3 * triangle + corner];
+    return vec3(positions[3 * index], positions[3 * index + 1], positions[3 * index + 2]);
+}
+
+layout(std430, set = 0, binding = 2) buffer BuildState {
+    uint centroid_min[3];// 保序映射后的 uint，初始为 0xffffffff
+    uint centroid_max[3];// 初始为 0
+};
+
+// gpu bvh 构建第一步：三角形质心的包围盒
+// float 映射为大小关系不变的 uint，再用整数原子操作归约
+uint float_to_ordered(float f) {
+    uint u = floatBitsToUint(f);
+    return (u & 0x80000000u) != 0 ? ~u : u | 0x80000000u;
+}
+
+void main() {
+    uint i = invocation_index();
+    if (i >= build.prim_count) {
+        return;
+    }
+    vec3 p0 = vertex(i, 0);
+    vec3 p1 = vertex(i, 1);
+    vec3 p2 = vertex(i, 2);
+    vec3 centroid = (min(min(p0, p1), p2) + max(max(p0, p1), p2)) * 0.5f;
+    for (int axis = 0; axis < 3; ++axis) {
+        atomicMin(centroid_min[axis], float_to_ordered(centroid[axis]));
+        atomicMax(centroid_max[axis], float_to_ordered(centroid[axis]));
+    }
+}
@@ -0,0 +1,125 @@
+#version 450 core
+
+layout(local_size_x = 256) in;
+
+// 对应 C++ 中的 GpuBvhConstants
+layout(push_constant) uniform BuildConstants {
+    uint prim_count;
+    uint shift;// radix 排序本轮的最低位
+    uint in_offset;// 本轮读取的 key/value 在 ping-pong 缓冲中的起点
+    uint out_offset;// 本轮写入的起点
+    uint group_count;// radix 排序的工作组数
+    uint watertight;// 三角形记录为顶点而不是预计算的边
+} build;
+
+// 工作组数超过单维上限时按二维派发
+uint invocation_index() {
+    return gl_GlobalInvocationID.x + gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+}
+
+layout(std430, set = 0, binding = 0) readonly buffer Positions {
+    float positions[];// 每个顶点 3 个 float，与 C++ 中的 Vec3f 一致
+};
+layout(std430, set = 0, binding = 1) readonly buffer Indices {
+    uint indices[];
+};
+
+vec3 vertex(uint triangle, uint corner) {
+    uint index = indices[3 * triangle + corner];
+    return vec3(positions[3 * index], positions[3 * index + 1], positions[3 * index + 2]);
+}
+
+layout(std430, set = 0, binding = 4) readonly buffer Values {
+    uint values[];
+};
+layout(std430, set = 0, binding = 6) readonly buffer InternalNodes {
+    uvec4 internal_nodes[];
+};
+layout(std430, set = 0, binding = 7) readonly buffer Parents {
+    uint parents[];
+};
+layout(std430, set = 0, binding = 8) readonly buffer Bounds {
+    float bounds[];
+};
+
+// 输出与 CPU 构建相同的格式，可直接绑定到 rt.frag.glsl 的 BvhNodes 与 BvhTriangles
+struct BvhNode {
+    vec3 bounds_min;
+    uint offset;
+    vec3 bounds_max;
+    uint prim_count;
+};
+layout(std430, set = 0, binding = 10) writeonly buffer BvhNodes {
+    BvhNode bvh_nodes[];
+};
+layout(std430, set = 0, binding = 11) writeonly buffer PrimIndices {
+    uint prim_indices[];
+};
+layout(std430, set = 0, binding = 12) writeonly buffer BvhTriangles {
+    uint triangle_count;
+    uint first_sphere;// 只有三角形，解析图元的起始编号都等于三角形数
+    uint first_box;
+    uint first_quad;
+    vec4 triangle_streams[];
+};
+
+// gpu bvh 构建第五步：按深度优先顺序写出节点，每个叶子一个三角形
+// 节点覆盖的首个叶子为 first 时，它之前的节点是覆盖叶子 [0, first) 的完整子树（每个叶子计 2 个节点，
+// 每棵子树少 1 个）和全部祖先，合起来等于 2 * first 加上它位于左子树中的祖先个数
+
+uint first_leaf(uint node) {
+    uint leaf_base = build.prim_count - 1;
+    return node < leaf_base ? internal_nodes[node].z : node - leaf_base;
+}
+
+void main() {
+    uint node = invocation_index();
+    if (node >= 2 * build.prim_count - 1) {
+        return;
+    }
+    uint leaf_base = build.prim_count - 1;
+
+    uint left_ancestors = 0;
+    uint child = node;
+    uint parent = parents[node];
+    while (parent != 0xffffffffu) {
+        left_ancestors += internal_nodes[parent].x == child ? 1 : 0;
+        child = parent;
+        parent = parents[child];
+    }
+    uint index = 2 * first_leaf(node) + left_ancestors;
+
+    BvhNode out_node;
+    out_node.bounds_min = vec3(bounds[6 * node + 0], bounds[6 * node + 1], bounds[6 * node + 2]);
+    out_node.bounds_max = vec3(bounds[6 * node + 3], bounds[6 * node + 4], bounds[6 * node + 5]);
+    if (node < leaf_base) {
+        // 右子节点与本节点位于相同个数的左子树中
+        out_node.offset = 2 * first_leaf(internal_nodes[node].y) + left_ancestors;
+        out_node.prim_count = 0;
+    } else {
+        uint leaf = node - leaf_base;
+        uint triangle = values[leaf];
+        out_node.offset = leaf;
+        out_node.prim_count = 1;
+        prim_indices[leaf] = triangle;
+
+        // 对应 C++ 中的 TriangleRecords
+        vec3 p0 = vertex(triangle, 0);
+        vec3 p1 = vertex(triangle, 1);
+        vec3 p2 = vertex(triangle, 2);
+        if (build.watertight == 0) {
+            p1 -= p0;
+            p2 -= p0;
+        }
+        triangle_streams[leaf] = vec4(p0, uintBitsToFloat(triangle));
+        triangle_streams[build.prim_count + leaf] = vec4(p1, 0.0f);
+        triangle_streams[2 * build.prim_count + leaf] = vec4(p2, 0.0f);
+    }
+    bvh_nodes[index] = out_node;
+    if (node == 0) {
+        triangle_count = build.prim_count;
+        first_sphere = build.prim_count;
+        first_box = build.prim_count;
+        first_quad = build.prim_count;
+    }
+}
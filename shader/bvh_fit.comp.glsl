@@ -0,0 +1,89 @@
+#version 450 core
+
+layout(local_size_x = 256) in;
+
+// 对应 C++ 中的 GpuBvhConstants
+layout(push_constant) uniform BuildConstants {
+    uint prim_count;
+    uint shift;// radix 排序本轮的最低位
+    uint in_offset;// 本轮读取的 key/value 在 ping-pong 缓冲中的起点
+    uint out_offset;// 本轮写入的起点
+    uint group_count;// radix 排序的工作组数
+    uint watertight;// 三角形记录为顶点而不是预计算的边
+} build;
+
+// 工作组数超过单维上限时按二维派发
+uint invocation_index() {
+    return gl_GlobalInvocationID.x + gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+}
+
+layout(std430, set = 0, binding = 0) readonly buffer Positions {
+    float positions[];// 每个顶点 3 个 float，与 C++ 中的 Vec3f 一致
+};
+layout(std430, set = 0, binding = 1) readonly buffer Indices {
+    uint indices[];
+};
+
+vec3 vertex(uint triangle, uint corner) {
+    uint index = indices[3 * triangle + corner];
+    return vec3(positions[3 * index], positions[3 * index + 1], positions[3 * index + 2]);
+}
+
+layout(std430, set = 0, binding = 4) readonly buffer Values {
+    uint values[];// 排序后第 i 个叶子的三角形
+};
+layout(std430, set = 0, binding = 6) readonly buffer InternalNodes {
+    uvec4 internal_nodes[];
+};
+layout(std430, set = 0, binding = 7) readonly buffer Parents {
+    uint parents[];
+};
+layout(std430, set = 0, binding = 8) coherent buffer Bounds {
+    float bounds[];// 每个节点 6 个 float：min xyz，max xyz
+};
+layout(std430, set = 0, binding = 9) coherent buffer Visits {
+    uint visits[];// 每个内部节点已到达的子节点数，初始为 0
+};
+
+// gpu bvh 构建第四步：从叶子向上合并包围盒，第二个到达内部节点的线程负责合并
+void store_bounds(uint node, vec3 lo, vec3 hi) {
+    bounds[6 * node + 0] = lo.x;
+    bounds[6 * node + 1] = lo.y;
+    bounds[6 * node + 2] = lo.z;
+    bounds[6 * node + 3] = hi.x;
+    bounds[6 * node + 4] = hi.y;
+    bounds[6 * node + 5] = hi.z;
+}
+
+void main() {
+    uint leaf = invocation_index();
+    if (leaf >= build.prim_count) {
+        return;
+    }
+    uint triangle = values[leaf];
+    vec3 p0 = vertex(triangle, 0);
+    vec3 p1 = vertex(triangle, 1);
+    vec3 p2 = vertex(triangle, 2);
+    vec3 lo = min(min(p0, p1), p2);
+    vec3 hi = max(max(p0, p1), p2);
+
+    uint node = build.prim_count - 1 + leaf;
+    store_bounds(node, lo, hi);
+    uint parent = parents[node];
+    while (parent != 0xffffffffu) {
+        // 先让本节点的包围盒对另一个子节点的线程可见，再计数
+        memoryBarrierBuffer();
+        if (atomicAdd(visits[parent], 1u) == 0u) {
+            return;
+        }
+        memoryBarrierBuffer();
+
+        uvec4 internal = internal_nodes[parent];
+        uint sibling = internal.x == node ? internal.y : internal.x;
+        lo = min(lo, vec3(bounds[6 * sibling + 0], bounds[6 * sibling + 1], bounds[6 * sibling + 2]));
+        hi = max(hi, vec3(bounds[6 * sibling + 3], bounds[6 * sibling + 4], bounds[6 * sibling + 5]));
+        node = parent;
+        store_bounds(node, lo, hi);
+        parent = parents[node];
+    }
+}
@@ -0,0 +1,89 @@
+#version 450 core
+
+layout(local_size_x = 256) in;
+
+// 对应 C++ 中的 GpuBvhConstants
+layout(push_constant) uniform BuildConstants {
+    uint prim_count;
+    uint shift;// radix 排序本轮的最低位
+    uint in_offset;// 本轮读取的 key/value 在 ping-pong 缓冲中的起点
+    uint out_offset;// 本轮写入的起点
+    uint group_count;// radix 排序的工作组数
+    uint watertight;// 三角形记录为顶点而不是预计算的边
+} build;
+
+// 工作组数超过单维上限时按二维派发
+uint invocation_index() {
+    return gl_GlobalInvocationID.x + gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+}
+
+layout(std430, set = 0, binding = 3) readonly buffer Keys {
+    uint keys[];// 排序后的 morton 码位于前一半
+};
+// 内部节点为 [0, prim_count - 1)，叶子 i 为节点 prim_count - 1 + i
+layout(std430, set = 0, binding = 6) writeonly buffer InternalNodes {
+    uvec4 internal_nodes[];// (左子节点, 右子节点, 首个叶子, 末个叶子)
+};
+layout(std430, set = 0, binding = 7) writeonly buffer Parents {
+    uint parents[];// 根节点为 0xffffffff
+};
+
+// gpu bvh 构建第三步：每个内部节点独立求出其覆盖的叶子区间与分割位置（Karras 2012）
+// 与 C++ 中 LbvhBuilder::emit_internal 相同，morton 码为 30 位
+
+// key i 与 key j 的公共前缀长度，相同的码以下标区分
+int delta(int i, int j) {
+    if (j < 0 || j >= int(build.prim_count)) {
+        return -1;
+    }
+    uint a = keys[i];
+    uint b = keys[j];
+    if (a == b) {
+        return 32 + 31 - findMSB(uint(i ^ j));
+    }
+    return 31 - findMSB(a ^ b);
+}
+
+void main() {
+    uint index = invocation_index();
+    if (index + 1 >= build.prim_count) {
+        return;
+    }
+    int i = int(index);
+
+    // 区间的方向与另一端
+    int d = delta(i, i + 1) - delta(i, i - 1) >= 0 ? 1 : -1;
+    int delta_min = delta(i, i - d);
+    int l_max = 2;
+    while (delta(i, i + l_max * d) > delta_min) {
+        l_max *= 2;
+    }
+    int l = 0;
+    for (int t = l_max / 2; t >= 1; t /= 2) {
+        if (delta(i, i + (l + t) * d) > delta_min) {
+            l += t;
+        }
+    }
+    int j = i + l * d;
+
+    // 分割位置
+    int delta_node = delta(i, j);
+    int s = 0;
+    int t = l;
+    do {
+        t = (t + 1) / 2;
+        if (delta(i, i + (s + t) * d) > delta_node) {
+            s += t;
+        }
+    } while (t > 1);
+    uint split = uint(i + s * d + min(d, 0));
+
+    uint first = uint(min(i, j));
+    uint last = uint(max(i, j));
+    uint leaf_base = build.prim_count - 1;
+    uint left = first == split ? leaf_base + split : split;
+    uint right = last == split + 1 ? leaf_base + split + 1 : split + 1;
+    internal_nodes[index] = uvec4(left, right, first, last);
+    parents[left] = index;
+    parents[right] = index;
+}
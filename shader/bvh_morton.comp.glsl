@@ -0,0 +1,75 @@
+#version 450 core
+
+layout(local_size_x = 256) in;
+
+// 对应 C++ 中的 GpuBvhConstants
+layout(push_constant) uniform BuildConstants {
+    uint prim_count;
+    uint shift;// radix 排序本轮的最低位
+    uint in_offset;// 本轮读取的 key/value 在 ping-pong 缓冲中的起点
+    uint out_offset;// 本轮写入的起点
+    uint group_count;// radix 排序的工作组数
+    uint watertight;// 三角形记录为顶点而不是预计算的边
+} build;
+
+// 工作组数超过单维上限时按二维派发
+uint invocation_index() {
+    return gl_GlobalInvocationID.x + gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+}
+
+layout(std430, set = 0, binding = 0) readonly buffer Positions {
+    float positions[];// 每个顶点 3 个 float，与 C++ 中的 Vec3f 一致
+};
+layout(std430, set = 0, binding = 1) readonly buffer Indices {
+    uint indices[];
+};
+
+vec3 vertex(uint triangle, uint corner) {
+    uint index = indices[3 * triangle + corner];
+    return vec3(positions[3 * index], positions[3 * index + 1], positions[3 * index + 2]);
+}
+
+layout(std430, set = 0, binding = 2) readonly buffer BuildState {
+    uint centroid_min[3];
+    uint centroid_max[3];
+};
+layout(std430, set = 0, binding = 3) writeonly buffer Keys {
+    uint keys[];// 2 * prim_count，两半轮流作为 radix 排序的输入与输出
+};
+layout(std430, set = 0, binding = 4) writeonly buffer Values {
+    uint values[];
+};
+
+// gpu bvh 构建第二步：质心在质心包围盒中的 30 位 morton 码，每轴 10 位
+float ordered_to_float(uint u) {
+    return uintBitsToFloat((u & 0x80000000u) != 0 ? u & 0x7fffffffu : ~u);
+}
+
+uint expand_bits_10(uint v) {
+    v = (v * 0x00010001u) & 0xff0000ffu;
+    v = (v * 0x00000101u) & 0x0f00f00fu;
+    v = (v * 0x00000011u) & 0xc30c30c3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+void main() {
+    uint i = invocation_index();
+    if (i >= build.prim_count) {
+        return;
+    }
+    vec3 lo = vec3(ordered_to_float(centroid_min[0]), ordered_to_float(centroid_min[1]), ordered_to_float(centroid_min[2]));
+    vec3 hi = vec3(ordered_to_float(centroid_max[0]), ordered_to_float(centroid_max[1]), ordered_to_float(centroid_max[2]));
+    vec3 extent = hi - lo;
+    vec3 inv_extent = vec3(extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+                           extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+                           extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+    vec3 p0 = vertex(i, 0);
+    vec3 p1 = vertex(i, 1);
+    vec3 p2 = vertex(i, 2);
+    vec3 centroid = (min(min(p0, p1), p2) + max(max(p0, p1), p2)) * 0.5f;
+    uvec3 q = uvec3(clamp((centroid - lo) * inv_extent, 0.0f, 1.0f) * 1023.0f);
+    keys[i] = expand_bits_10(q.x) << 2 | expand_bits_10(q.y) << 1 | expand_bits_10(q.z);
+    values[i] = i;
+}
@@ -0,0 +1,54 @@
+#version 450 core
+
+layout(local_size_x = 256) in;
+
+// 对应 C++ 中的 GpuBvhConstants
+layout(push_constant) uniform BuildConstants {
+    uint prim_count;
+    uint shift;// radix 排序本轮的最低位
+    uint in_offset;// 本轮读取的 key/value 在 ping-pong 缓冲中的起点
+    uint out_offset;// 本轮写入的起点
+    uint group_count;// radix 排序的工作组数
+    uint watertight;// 三角形记录为顶点而不是预计算的边
+} build;
+
+// 工作组数超过单维上限时按二维派发
+uint invocation_index() {
+    return gl_GlobalInvocationID.x + gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+}
+
+uint group_index() {
+    return gl_WorkGroupID.x + gl_WorkGroupID.y * gl_NumWorkGroups.x;
+}
+
+layout(std430, set = 0, binding = 3) readonly buffer Keys {
+    uint keys[];
+};
+layout(std430, set = 0, binding = 5) writeonly buffer Histogram {
+    uint histogram[];// [digit * group_count + group]
+};
+
+// radix 排序每轮 4 位，第一步：每个工作组统计其 256 个 key 的数位直方图
+shared uint counts[16];
+
+void main() {
+    uint group = group_index();
+    if (group >= build.group_count) {
+        return;
+    }
+    uint local = gl_LocalInvocationIndex;
+    if (local < 16) {
+        counts[local] = 0;
+    }
+    barrier();
+
+    uint i = group * 256 + local;
+    if (i < build.prim_count) {
+        atomicAdd(counts[(keys[build.in_offset + i] >> build.shift) & 15u], 1u);
+    }
+    barrier();
+
+    if (local < 16) {
+        histogram[local * build.group_count + group] = counts[local];
+    }
+}
@@ -0,0 +1,58 @@
+#version 450 core
+
+layout(local_size_x = 256) in;
+
+// 对应 C++ 中的 GpuBvhConstants
+layout(push_constant) uniform BuildConstants {
+    uint prim_count;
+    uint shift;// radix 排序本轮的最低位
+    uint in_offset;// 本轮读取的 key/value 在 ping-pong 缓冲中的起点
+    uint out_offset;// 本轮写入的起点
+    uint group_count;// radix 排序的工作组数
+    uint watertight;// 三角形记录为顶点而不是预计算的边
+} build;
+
+// 工作组数超过单维上限时按二维派发
+uint invocation_index() {
+    return gl_GlobalInvocationID.x + gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+}
+
+layout(std430, set = 0, binding = 5) buffer Histogram {
+    uint histogram[];
+};
+
+// radix 排序第二步：单个工作组对整个直方图做 exclusive 前缀和
+// 直方图按数位优先存放，结果即为每个 (数位, 工作组) 在输出中的起点，排序保持稳定
+shared uint partial[256];
+
+void main() {
+    uint local = gl_LocalInvocationIndex;
+    uint total = 16 * build.group_count;
+    uint chunk = (total + 255) / 256;
+    uint begin = min(local * chunk, total);
+    uint end = min(begin + chunk, total);
+
+    uint sum = 0;
+    for (uint i = begin; i < end; ++i) {
+        sum += histogram[i];
+    }
+    partial[local] = sum;
+    barrier();
+
+    if (local == 0) {
+        uint offset = 0;
+        for (uint j = 0; j < 256; ++j) {
+            uint count = partial[j];
+            partial[j] = offset;
+            offset += count;
+        }
+    }
+    barrier();
+
+    uint offset = partial[local];
+    for (uint i = begin; i < end; ++i) {
+        uint count = histogram[i];
+        histogram[i] = offset;
+        offset += count;
+    }
+}
@@ -0,0 +1,71 @@
+#version 450 core
+
+layout(local_size_x = 256) in;
+
+// 对应 C++ 中的 GpuBvhConstants
+layout(push_constant) uniform BuildConstants {
+    uint prim_count;
+    uint shift;// radix 排序本轮的最低位
+    uint in_offset;// 本轮读取的 key/value 在 ping-pong 缓冲中的起点
+    uint out_offset;// 本轮写入的起点
+    uint group_count;// radix 排序的工作组数
+    uint watertight;// 三角形记录为顶点而不是预计算的边
+} build;
+
+// 工作组数超过单维上限时按二维派发
+uint invocation_index() {
+    return gl_GlobalInvocationID.x + gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+}
+
+uint group_index() {
+    return gl_WorkGroupID.x + gl_WorkGroupID.y * gl_NumWorkGroups.x;
+}
+
+layout(std430, set = 0, binding = 3) buffer Keys {
+    uint keys[];
+};
+layout(std430, set = 0, binding = 4) buffer Values {
+    uint values[];
+};
+layout(std430, set = 0, binding = 5) readonly buffer Histogram {
+    uint histogram[];
+};
+
+// radix 排序第三步：按前缀和把 key/value 写到输出的一半
+// 组内名次为同一数位中排在前面的线程数，由每个数位的 256 位掩码的 bitCount 得出
+shared uint digit_masks[16][8];
+
+void main() {
+    uint group = group_index();
+    if (group >= build.group_count) {
+        return;
+    }
+    uint local = gl_LocalInvocationIndex;
+    if (local < 128) {
+        digit_masks[local / 8][local % 8] = 0;
+    }
+    barrier();
+
+    uint i = group * 256 + local;
+    bool valid = i < build.prim_count;
+    uint key = 0;
+    uint value = 0;
+    uint digit = 0;
+    if (valid) {
+        key = keys[build.in_offset + i];
+        value = values[build.in_offset + i];
+        digit = (key >> build.shift) & 15u;
+        atomicOr(digit_masks[digit][local / 32], 1u << (local % 32));
+    }
+    barrier();
+
+    if (valid) {
+        uint rank = bitCount(digit_masks[digit][local / 32] & ((1u << (local % 32)) - 1u));
+        for (uint word = 0; word < local / 32; ++word) {
+            rank += bitCount(digit_masks[digit][word]);
+        }
+        uint dst = build.out_offset + histogram[digit * build.group_count + group] + rank;
+        keys[dst] = key;
+        values[dst] = value;
+    }
+}
@@ -21,6 +21,599 @@ void result_commit(ivec2 grid, vec3 color) {
     imageStore(resultImage, grid, vec4(current_color, 1.0f));
 }
 
+// bvh 节点宽度，须与 BvhScene 的 width 一致，由 cmake 的 BVH_WIDTH 传入
+#ifndef BVH_WIDTH
+#define BVH_WIDTH 2
+#endif
+// 为 1 时宽节点的子节点包围盒量化为 8 位，由 cmake 的 BVH_QUANTIZED 传入
+#ifndef BVH_QUANTIZED
+#define BVH_QUANTIZED 0
+#endif
+// 为 1 时二叉 bvh 使用 skip link 无栈遍历，由 cmake 的 BVH_STACKLESS 传入
+#ifndef BVH_STACKLESS
+#define BVH_STACKLESS 0
+#endif
+// 为 1 时使用水密的三角形求交，共享边与顶点上不会漏掉交点，由 cmake 的 BVH_WATERTIGHT 传入
+#ifndef BVH_WATERTIGHT
+#define BVH_WATERTIGHT 0
+#endif
+
+// 为 1 时三角形由顶点下标与压缩顶点解码，由 cmake 的 BVH_COMPACT_VERTICES 传入
+#ifndef BVH_COMPACT_VERTICES
+#define BVH_COMPACT_VERTICES 0
+#endif
+
+// 叶子的最大深度，根为 0，构建时保证，对应 C++ 中的 BVH_MAX_DEPTH
+#define BVH_MAX_DEPTH 64
+#if BVH_WIDTH == 2
+// 带实例时顶层与网格 bvh 共用一个栈
+#define BVH_STACK_SIZE (2 * BVH_MAX_DEPTH)
+#else
+// 每层最多留下 BVH_WIDTH - 1 个子节点
+#define BVH_STACK_SIZE (BVH_MAX_DEPTH * (BVH_WIDTH - 1) + 1)
+#endif
+
+struct Ray {
+    vec3 origin;
+    vec3 direction;
+    float t_max;
+};
+
+// 远端距离乘以 1 + 2 * gamma(3)，使浮点舍入下的包围盒测试保持保守（Ize 2013），
+// 穿过包围盒面、边或角的射线不会被剔除，对应 C++ 中的 SLAB_T_FAR_SCALE
+#define SLAB_T_FAR_SCALE 1.0000004f
+
+bool hit_aabb(Ray ray, vec3 inv_dir, vec3 bounds_min, vec3 bounds_max, out float t_near) {
+    vec3 t0 = (bounds_min - ray.origin) * inv_dir;
+    vec3 t1 = (bounds_max - ray.origin) * inv_dir;
+    vec3 t_enter = min(t0, t1);
+    vec3 t_exit = max(t0, t1);
+    t_near = max(max(t_enter.x, t_enter.y), max(t_enter.z, 0.0f));
+    float t_far = min(min(t_exit.x, t_exit.y), min(t_exit.z, ray.t_max));
+    return t_near <= t_far * SLAB_T_FAR_SCALE;
+}
+
+// 三角形记录，对应 C++ 中的 TriangleRecords，按叶子引用的顺序存放
+// 分为 a、b、c 三段 SoA 数据流，每段 triangle_count 个 vec4，叶子的图元下标直接索引
+// a.xyz 为 p0，a.w 为场景中的三角形下标；非水密模式 b、c 为预计算的边 p1 - p0、p2 - p0，
+// 水密模式为顶点 p1、p2
+// 解析图元（球、盒、四边形）同样按记录存放，a.w 为场景中的图元编号，不小于 first_sphere：
+// 球 a.xyz 为球心、b.x 为半径；盒 a.xyz、b.xyz 为最小、最大角点；四边形 a.xyz 为角点、b、c 为两条边
+// 压缩顶点模式下改为每个三角形一个 uvec4：xyz 为三个顶点下标，w 为场景中的三角形下标，没有解析图元
+layout(std430, set = 1, binding = 2) readonly buffer BvhTriangles {
+    uint triangle_count;
+    uint first_sphere;
+    uint first_box;
+    uint first_quad;
+#if BVH_COMPACT_VERTICES
+    uvec4 triangle_indices[];
+#else
+    vec4 triangle_streams[];
+#endif
+};
+
+#if BVH_COMPACT_VERTICES
+// 压缩顶点，对应 C++ 中的 CompactVertices，每个顶点 14 字节
+// vertex_data 依次为各块的量化网格（origin、step 各一个 vec4）、每顶点 3 个 16 位定点坐标、
+// 2 x snorm16 的八面体法线与 2 x half 的 uv，偏移以 uint 计，为 0 表示没有该属性
+layout(std430, set = 1, binding = 3) readonly buffer BvhVertices {
+    uint vertex_count;
+    uint position_offset;
+    uint normal_offset;
+    uint uv_offset;
+    uint vertex_data[];
+};
+
+// 共用一个量化网格的连续顶点数，对应 C++ 中的 COMPACT_VERTEX_BLOCK_SIZE
+#define COMPACT_VERTEX_BLOCK_SIZE 256u
+
+// 16 位数组的第 i 个元素，按小端存放在 uint 的低位与高位
+uint vertex_u16(uint i) {
+    uint word = vertex_data[position_offset + (i >> 1)];
+    return (i & 1u) == 0u ? word & 0xffffu : word >> 16;
+}
+
+// step 为 2 的幂且 origin 为其整数倍，解码结果与 C++ 端完全一致
+vec3 vertex_position(uint vertex) {
+    uint block = vertex / COMPACT_VERTEX_BLOCK_SIZE * 8u;
+    vec3 origin = uintBitsToFloat(uvec3(vertex_data[block], vertex_data[block + 1u], vertex_data[block + 2u]));
+    vec3 grid_step = uintBitsToFloat(uvec3(vertex_data[block + 4u], vertex_data[block + 5u], vertex_data[block + 6u]));
+    uvec3 q = uvec3(vertex_u16(3u * vertex), vertex_u16(3u * vertex + 1u), vertex_u16(3u * vertex + 2u));
+    return origin + vec3(q) * grid_step;
+}
+
+// 八面体映射（Cigolle et al. 2014）
+vec3 vertex_normal(uint vertex) {
+    if (normal_offset == 0u) {
+        return vec3(0.0f);
+    }
+    vec2 e = unpackSnorm2x16(vertex_data[normal_offset + vertex]);
+    vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+    if (n.z < 0.0f) {
+        n.xy = (1.0f - abs(n.yx)) * vec2(e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return normalize(n);
+}
+
+vec2 vertex_uv(uint vertex) {
+    return uv_offset == 0u ? vec2(0.0f) : unpackHalf2x16(vertex_data[uv_offset + vertex]);
+}
+#endif
+
+#if !BVH_COMPACT_VERTICES
+// 解析图元的精确求交，对应 C++ 中 analytic.h 的同名函数，返回新的 t_max
+// 射线起点在球或盒内部时命中其远端
+
+// 判别式由球心到射线所在直线的距离求得，远处的球不会相消，近根由 c / q 求得（Haines et al. 2019）
+float intersect_sphere(vec3 center, float radius, Ray ray) {
+    vec3 f = ray.origin - center;
+    float a = dot(ray.direction, ray.direction);
+    float b = -dot(f, ray.direction);
+    float c = dot(f, f) - radius * radius;
+    vec3 l = f + ray.direction * (b / a);
+    float discriminant = a * (radius * radius - dot(l, l));
+    if (discriminant < 0.0f) {
+        return ray.t_max;
+    }
+    float q = b + (b >= 0.0f ? sqrt(discriminant) : -sqrt(discriminant));
+    float t0 = min(c / q, q / a);
+    float t1 = max(c / q, q / a);
+    float t = t0 > 0.0f ? t0 : t1;
+    return t > 0.0f && t < ray.t_max ? t : ray.t_max;
+}
+
+float intersect_box(vec3 bounds_min, vec3 bounds_max, Ray ray) {
+    vec3 inv_dir = 1.0f / ray.direction;
+    vec3 t0 = (bounds_min - ray.origin) * inv_dir;
+    vec3 t1 = (bounds_max - ray.origin) * inv_dir;
+    vec3 t_near = min(t0, t1);
+    vec3 t_far = max(t0, t1);
+    float t_enter = max(max(t_near.x, t_near.y), t_near.z);
+    float t_exit = min(min(t_far.x, t_far.y), t_far.z);
+    if (t_enter > t_exit) {
+        return ray.t_max;
+    }
+    float t = t_enter > 0.0f ? t_enter : t_exit;
+    return t > 0.0f && t < ray.t_max ? t : ray.t_max;
+}
+
+// 平行四边形上的 moller-trumbore，u、v 各自在 [0, 1] 内
+float intersect_quad(vec3 corner, vec3 edge_u, vec3 edge_v, Ray ray) {
+    vec3 p = cross(ray.direction, edge_v);
+    float det = dot(edge_u, p);
+    if (det == 0.0f) {
+        return ray.t_max;
+    }
+    float inv_det = 1.0f / det;
+    vec3 s = ray.origin - corner;
+    float u = dot(s, p) * inv_det;
+    vec3 q = cross(s, edge_u);
+    float v = dot(ray.direction, q) * inv_det;
+    if (u < 0.0f || u > 1.0f || v < 0.0f || v > 1.0f) {
+        return ray.t_max;
+    }
+    float t = dot(edge_v, q) * inv_det;
+    return t > 0.0f && t < ray.t_max ? t : ray.t_max;
+}
+#endif
+
+// 叶子求交，返回新的 t_max
+float intersect_leaf(uint first_prim, uint prim_count, Ray ray) {
+#if BVH_WATERTIGHT
+    // Woop et al. 2013：置换坐标轴使 z 为方向的最大分量，再剪切使射线方向变为 (0, 0, 1)
+    vec3 d = abs(ray.direction);
+    int kz = d.x > d.y ? (d.x > d.z ? 0 : 2) : (d.y > d.z ? 1 : 2);
+    int kx = kz == 2 ? 0 : kz + 1;
+    int ky = kx == 2 ? 0 : kx + 1;
+    if (ray.direction[kz] < 0.0f) {
+        int k = kx;
+        kx = ky;
+        ky = k;
+    }
+    vec3 shear = vec3(ray.direction[kx], ray.direction[ky], 1.0f) / ray.direction[kz];
+#endif
+    for (uint i = first_prim; i < first_prim + prim_count; ++i) {
+#if BVH_COMPACT_VERTICES
+        uvec4 triangle = triangle_indices[i];
+        vec3 p0 = vertex_position(triangle.x);
+        vec3 b = vertex_position(triangle.y);
+        vec3 c = vertex_position(triangle.z);
+#if !BVH_WATERTIGHT
+        b -= p0;
+        c -= p0;
+#endif
+#else
+        vec4 a0 = triangle_streams[i];
+        vec3 p0 = a0.xyz;
+        vec3 b = triangle_streams[triangle_count + i].xyz;
+        vec3 c = triangle_streams[2 * triangle_count + i].xyz;
+        uint prim = floatBitsToUint(a0.w);
+        if (prim >= first_sphere) {
+            if (prim >= first_quad) {
+                ray.t_max = intersect_quad(p0, b, c, ray);
+            } else if (prim >= first_box) {
+                ray.t_max = intersect_box(p0, b, ray);
+            } else {
+                ray.t_max = intersect_sphere(p0, b.x, ray);
+            }
+            continue;
+        }
+#endif
+#if BVH_WATERTIGHT
+        // 顶点变换到射线空间后，由三条边函数的符号判断是否相交
+        vec3 a = p0 - ray.origin;
+        b -= ray.origin;
+        c -= ray.origin;
+        vec2 a2 = vec2(a[kx], a[ky]) - shear.xy * a[kz];
+        vec2 b2 = vec2(b[kx], b[ky]) - shear.xy * b[kz];
+        vec2 c2 = vec2(c[kx], c[ky]) - shear.xy * c[kz];
+        vec3 e = vec3(c2.x * b2.y - c2.y * b2.x,
+                      a2.x * c2.y - a2.y * c2.x,
+                      b2.x * a2.y - b2.y * a2.x);
+        if (any(lessThan(e, vec3(0.0f))) && any(greaterThan(e, vec3(0.0f)))) {
+            continue;
+        }
+        float det = e.x + e.y + e.z;
+        if (det == 0.0f) {
+            continue;
+        }
+        float t = shear.z * dot(e, vec3(a[kz], b[kz], c[kz])) / det;
+#else
+        // moller-trumbore，边已预计算，每个三角形只需 3 次 vec4 读取
+        vec3 p = cross(ray.direction, c);
+        float det = dot(b, p);
+        if (det == 0.0f) {
+            continue;
+        }
+        float inv_det = 1.0f / det;
+        vec3 s = ray.origin - p0;
+        float u = dot(s, p) * inv_det;
+        vec3 q = cross(s, b);
+        float v = dot(ray.direction, q) * inv_det;
+        if (u < 0.0f || v < 0.0f || u + v > 1.0f) {
+            continue;
+        }
+        float t = dot(c, q) * inv_det;
+#endif
+        if (t > 0.0f && t < ray.t_max) {
+            ray.t_max = t;
+        }
+    }
+    return ray.t_max;
+}
+
+#if BVH_WIDTH == 2
+// bvh descriptor set，对应 BvhScene::descriptor_set()
+struct BvhNode {
+    vec3 bounds_min;
+    uint offset;// 内部节点为右子节点下标（左子节点紧跟在父节点之后），无栈布局中为 skip link；叶子为首个图元下标
+    vec3 bounds_max;
+    uint prim_count;// 0 表示内部节点
+};
+layout(std430, set = 1, binding = 0) readonly buffer BvhNodes {
+    BvhNode bvh_nodes[];
+};
+
+// 两级 bvh 的实例，对应 C++ 中的 BvhInstance
+// instance_count 为 0 时 bvh_nodes 是整个场景的单个 bvh；否则 bvh_nodes 先存放
+// 实例之上的顶层 bvh（叶子的 offset 为实例下标），之后依次是各网格的 bvh
+struct BvhInstance {
+    vec4 world_to_object[3];// 3x4 行主序矩阵
+    uint node_offset;// 网格 bvh 的根节点下标
+    uint prim_offset;// 网格 bvh 叶子的 offset 已加上该值
+    uint first_triangle;
+    uint node_count;// 网格 bvh 的节点数，无栈遍历到 node_offset + node_count 时结束
+};
+layout(std430, set = 1, binding = 1) readonly buffer BvhInstances {
+    uint instance_count;
+    uint tlas_node_count;
+    BvhInstance bvh_instances[];
+};
+
+// 射线变换到实例的物体空间，方向不归一化，t 在两个空间中一致
+Ray instance_ray(BvhInstance instance, vec3 origin, vec3 direction, float t_max) {
+    Ray ray;
+    ray.origin = vec3(dot(instance.world_to_object[0], vec4(origin, 1.0f)),
+                      dot(instance.world_to_object[1], vec4(origin, 1.0f)),
+                      dot(instance.world_to_object[2], vec4(origin, 1.0f)));
+    ray.direction = vec3(dot(instance.world_to_object[0].xyz, direction),
+                         dot(instance.world_to_object[1].xyz, direction),
+                         dot(instance.world_to_object[2].xyz, direction));
+    ray.t_max = t_max;
+    return ray;
+}
+
+#if BVH_STACKLESS
+// 无栈遍历：命中内部节点时进入紧随其后的左子节点，未命中或处理完叶子时跳到 skip link
+// 子节点总是先左后右，没有按距离排序，但不需要栈，寄存器压力小
+float bvh_trace(Ray ray) {
+    vec3 inv_dir = 1.0f / ray.direction;
+    vec3 world_origin = ray.origin;
+    vec3 world_direction = ray.direction;
+
+    // 当前树的结束下标，进入实例时保存顶层的下一个节点
+    uint end = instance_count > 0 ? tlas_node_count : uint(bvh_nodes.length());
+    uint tlas_next = 0;
+    bool in_blas = false;
+    uint index = 0;
+
+    while (true) {
+        if (index == end) {
+            if (!in_blas) {
+                break;
+            }
+            // 网格 bvh 遍历完毕，回到世界空间继续遍历顶层
+            in_blas = false;
+            ray.origin = world_origin;
+            ray.direction = world_direction;
+            inv_dir = 1.0f / ray.direction;
+            end = tlas_node_count;
+            index = tlas_next;
+            continue;
+        }
+
+        BvhNode node = bvh_nodes[index];
+        float t_near;
+        if (!hit_aabb(ray, inv_dir, node.bounds_min, node.bounds_max, t_near)) {
+            index = node.prim_count > 0 ? index + 1 : node.offset;
+        } else if (node.prim_count == 0) {
+            index = index + 1;
+        } else if (instance_count > 0 && !in_blas) {
+            BvhInstance instance = bvh_instances[node.offset];
+            ray = instance_ray(instance, world_origin, world_direction, ray.t_max);
+            inv_dir = 1.0f / ray.direction;
+            in_blas = true;
+            tlas_next = index + 1;
+            index = instance.node_offset;
+            end = instance.node_offset + instance.node_count;
+        } else {
+            ray.t_max = intersect_leaf(node.offset, node.prim_count, ray);
+            index = index + 1;
+        }
+    }
+    return ray.t_max;
+}
+#else
+
+// 遍历 bvh，返回最近交点的 t，未命中时返回 ray.t_max
+float bvh_trace(Ray ray) {
+    vec3 inv_dir = 1.0f / ray.direction;
+    uint stack[BVH_STACK_SIZE];
+    uint stack_size = 0;
+    uint index = 0;
+
+    float t_near;
+    if (!hit_aabb(ray, inv_dir, bvh_nodes[0].bounds_min, bvh_nodes[0].bounds_max, t_near)) {
+        return ray.t_max;
+    }
+
+    // 进入实例时保存世界空间的射线，栈回到 blas_stack_base 时恢复
+    bool in_blas = false;
+    uint blas_stack_base = 0;
+    vec3 world_origin = ray.origin;
+    vec3 world_direction = ray.direction;
+
+    while (true) {
+        BvhNode node = bvh_nodes[index];
+        if (node.prim_count > 0) {
+            if (instance_count > 0 && !in_blas) {
+                // 顶层叶子：射线变换到物体空间后遍历网格的 bvh
+                BvhInstance instance = bvh_instances[node.offset];
+                ray = instance_ray(instance, world_origin, world_direction, ray.t_max);
+                inv_dir = 1.0f / ray.direction;
+                in_blas = true;
+                blas_stack_base = stack_size;
+                index = instance.node_offset;
+                if (hit_aabb(ray, inv_dir, bvh_nodes[index].bounds_min, bvh_nodes[index].bounds_max, t_near)) {
+                    continue;
+                }
+            } else {
+                ray.t_max = intersect_leaf(node.offset, node.prim_count, ray);
+            }
+        } else {
+            float t_left, t_right;
+            bool hit_left = hit_aabb(ray, inv_dir, bvh_nodes[index + 1].bounds_min, bvh_nodes[index + 1].bounds_max, t_left);
+            bool hit_right = hit_aabb(ray, inv_dir, bvh_nodes[node.offset].bounds_min, bvh_nodes[node.offset].bounds_max, t_right);
+            if (hit_left && hit_right) {
+                bool left_first = t_left <= t_right;
+                stack[stack_size++] = left_first ? node.offset : index + 1;
+                index = left_first ? index + 1 : node.offset;
+                t_near = min(t_left, t_right);
+                continue;
+            }
+            if (hit_left || hit_right) {
+                index = hit_left ? index + 1 : node.offset;
+                t_near = hit_left ? t_left : t_right;
+                continue;
+            }
+        }
+
+        // 出栈，跳过已经在最近交点之后的节点
+        bool found = false;
+        while (!found) {
+            if (in_blas && stack_size == blas_stack_base) {
+                // 网格 bvh 遍历完毕，回到世界空间继续遍历顶层
+                in_blas = false;
+                ray.origin = world_origin;
+                ray.direction = world_direction;
+                inv_dir = 1.0f / ray.direction;
+            }
+            if (stack_size == 0) {
+                break;
+            }
+            index = stack[--stack_size];
+            found = hit_aabb(ray, inv_dir, bvh_nodes[index].bounds_min, bvh_nodes[index].bounds_max, t_near);
+        }
+        if (!found) {
+            break;
+        }
+    }
+    return ray.t_max;
+}
+#endif
+#elif BVH_QUANTIZED
+// 量化宽节点，对应 C++ 中的 QuantizedBvhNode<BVH_WIDTH>
+// 子节点包围盒为 origin + q * 2^exponent，q 为 8 位整数，每个 uint 存放 4 个子节点
+// 内部子节点从 child_base 起连续存放，叶子子节点的图元从 prim_base 起连续存放，均按槽位顺序
+#define BVH_GROUPS (BVH_WIDTH / 4)
+struct BvhQuantizedNode {
+    vec3 origin;
+    uint exponents;// 每轴 8 位有符号指数
+    uint child_base;
+    uint prim_base;
+    uint meta[BVH_GROUPS];// 0 为空槽，0xff 为内部子节点，否则为叶子的图元数
+    uint lo[3 * BVH_GROUPS];// [axis * BVH_GROUPS + group]
+    uint hi[3 * BVH_GROUPS];
+};
+layout(std430, set = 1, binding = 0) readonly buffer BvhQuantizedNodes {
+    BvhQuantizedNode bvh_quantized_nodes[];
+};
+
+uvec4 unpack_bytes(uint word) {
+    return (uvec4(word) >> uvec4(0, 8, 16, 24)) & 0xffu;
+}
+
+float bvh_trace(Ray ray) {
+    vec3 inv_dir = 1.0f / ray.direction;
+    // 方向分量为 -0 时 inv_dir 为 -inf，入口平面须按 inv_dir 的符号选取
+    bvec3 negative = lessThan(inv_dir, vec3(0.0f));
+
+    uvec2 stack[BVH_STACK_SIZE];// (child, prim_count)
+    float stack_t[BVH_STACK_SIZE];
+    uint stack_size = 1;
+    stack[0] = uvec2(0, 0);
+    stack_t[0] = 0.0f;
+
+    while (stack_size > 0) {
+        --stack_size;
+        uvec2 entry = stack[stack_size];
+        float t_entry = stack_t[stack_size];
+        if (t_entry > ray.t_max) {
+            continue;
+        }
+        if (entry.y > 0) {
+            ray.t_max = intersect_leaf(entry.x, entry.y, ray);
+            continue;
+        }
+
+        // 一次读取整个节点，解码的 alu 开销换取更小的带宽
+        BvhQuantizedNode node = bvh_quantized_nodes[entry.x];
+        vec3 scale = vec3(exp2(float(bitfieldExtract(int(node.exponents), 0, 8))),
+                          exp2(float(bitfieldExtract(int(node.exponents), 8, 8))),
+                          exp2(float(bitfieldExtract(int(node.exponents), 16, 8))));
+        uint next_child = node.child_base;
+        uint next_prim = node.prim_base;
+        // 按 t 从远到近插入，最近的子节点先出栈，与 CPU 的顺序一致
+        uint first = stack_size;
+        for (uint group = 0; group < BVH_GROUPS; ++group) {
+            vec4 t0 = vec4(0.0f);
+            vec4 t1 = vec4(ray.t_max);
+            for (int axis = 0; axis < 3; ++axis) {
+                // 2 的幂缩放下乘法是精确的，解码结果与 CPU 一致，包围盒保持保守
+                vec4 lo = node.origin[axis] + vec4(unpack_bytes(node.lo[axis * BVH_GROUPS + group])) * scale[axis];
+                vec4 hi = node.origin[axis] + vec4(unpack_bytes(node.hi[axis * BVH_GROUPS + group])) * scale[axis];
+                vec4 t_enter = ((negative[axis] ? hi : lo) - ray.origin[axis]) * inv_dir[axis];
+                vec4 t_exit = ((negative[axis] ? lo : hi) - ray.origin[axis]) * inv_dir[axis];
+                t0 = max(t0, t_enter);
+                t1 = min(t1, t_exit);
+            }
+
+            bvec4 hit = lessThanEqual(t0, t1 * SLAB_T_FAR_SCALE);
+            uvec4 meta = unpack_bytes(node.meta[group]);
+            for (int i = 0; i < 4; ++i) {
+                // 子节点下标由之前的槽位推出，空槽不参与
+                uint child = meta[i] == 0xffu ? next_child : next_prim;
+                uint prim_count = meta[i] == 0xffu ? 0 : meta[i];
+                next_child += meta[i] == 0xffu ? 1 : 0;
+                next_prim += prim_count;
+                if (meta[i] != 0 && hit[i]) {
+                    uint j = stack_size++;
+                    while (j > first && stack_t[j - 1] < t0[i]) {
+                        stack[j] = stack[j - 1];
+                        stack_t[j] = stack_t[j - 1];
+                        --j;
+                    }
+                    stack[j] = uvec2(child, prim_count);
+                    stack_t[j] = t0[i];
+                }
+            }
+        }
+    }
+    return ray.t_max;
+}
+#else
+// 宽节点不支持实例，带实例的场景总是使用二叉 bvh
+// 宽节点，子节点包围盒按 SoA 存放，每个 vec4 保存 4 个子节点同一轴的坐标
+// 对应 C++ 中的 WideBvhNode<BVH_WIDTH>，空位的包围盒是反向的，永远不会命中
+#define BVH_GROUPS (BVH_WIDTH / 4)
+struct BvhWideNode {
+    vec4 bounds_min[3 * BVH_GROUPS];// [axis * BVH_GROUPS + group]
+    vec4 bounds_max[3 * BVH_GROUPS];
+    uvec4 child[BVH_GROUPS];// 内部子节点为节点下标，叶子为首个图元下标
+    uvec4 prim_count[BVH_GROUPS];// 0 表示内部子节点
+};
+layout(std430, set = 1, binding = 0) readonly buffer BvhWideNodes {
+    BvhWideNode bvh_wide_nodes[];
+};
+
+float bvh_trace(Ray ray) {
+    vec3 inv_dir = 1.0f / ray.direction;
+    // 与宽 bvh 相同，按 inv_dir 的符号选取入口平面，-0 方向对应 -inf
+    bvec3 negative = lessThan(inv_dir, vec3(0.0f));
+
+    uvec2 stack[BVH_STACK_SIZE];// (child, prim_count)
+    float stack_t[BVH_STACK_SIZE];
+    uint stack_size = 1;
+    stack[0] = uvec2(0, 0);
+    stack_t[0] = 0.0f;
+
+    while (stack_size > 0) {
+        --stack_size;
+        uvec2 entry = stack[stack_size];
+        float t_entry = stack_t[stack_size];
+        if (t_entry > ray.t_max) {
+            continue;
+        }
+        if (entry.y > 0) {
+            ray.t_max = intersect_leaf(entry.x, entry.y, ray);
+            continue;
+        }
+
+        // 按 t 从远到近插入，最近的子节点先出栈，与 CPU 的顺序一致
+        uint first = stack_size;
+        for (uint group = 0; group < BVH_GROUPS; ++group) {
+            // 按射线方向的符号选择进入面与离开面，一次 vec4 运算测试 4 个子节点
+            vec4 t0 = vec4(0.0f);
+            vec4 t1 = vec4(ray.t_max);
+            for (int axis = 0; axis < 3; ++axis) {
+                vec4 lo = bvh_wide_nodes[entry.x].bounds_min[axis * BVH_GROUPS + group];
+                vec4 hi = bvh_wide_nodes[entry.x].bounds_max[axis * BVH_GROUPS + group];
+                vec4 t_enter = ((negative[axis] ? hi : lo) - ray.origin[axis]) * inv_dir[axis];
+                vec4 t_exit = ((negative[axis] ? lo : hi) - ray.origin[axis]) * inv_dir[axis];
+                t0 = max(t0, t_enter);
+                t1 = min(t1, t_exit);
+            }
+
+            bvec4 hit = lessThanEqual(t0, t1 * SLAB_T_FAR_SCALE);
+            uvec4 child = bvh_wide_nodes[entry.x].child[group];
+            uvec4 prim_count = bvh_wide_nodes[entry.x].prim_count[group];
+            for (int i = 0; i < 4; ++i) {
+                if (hit[i]) {
+                    uint j = stack_size++;
+                    while (j > first && stack_t[j - 1] < t0[i]) {
+                        stack[j] = stack[j - 1];
+                        stack_t[j] = stack_t[j - 1];
+                        --j;
+                    }
+                    stack[j] = uvec2(child[i], prim_count[i]);
+                    stack_t[j] = t0[i];
+                }
+            }
+        }
+    }
+    return ray.t_max;
+}
+#endif
 
 // 光追，将颜色写入 result image，并返回最终的颜色值
 vec3 trace() {
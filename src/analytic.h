@@ -0,0 +1,105 @@
+#ifndef ANALYTIC_H
+#define ANALYTIC_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "scene.h"
+#include "util.h"
+
+// exact ray tests of the analytic primitives, same outputs as
+// intersect_triangle_edges: false for t outside (0, t_max). a ray starting
+// inside a sphere or box hits its far side. u and v are 0 for spheres and
+// boxes.
+
+// the roots as in haines et al. 2019 (ray tracing gems, chapter 7): the
+// discriminant from the distance of the center to the ray line, which does
+// not cancel for far away spheres, and the near root from c / q
+inline bool intersect_sphere(const Sphere& sphere, const Ray& ray, float* t,
+                             float* u, float* v) {
+  const Vec3f f = ray.origin - sphere.center;
+  const float a = Vec3f::dot(ray.direction, ray.direction);
+  const float b = -Vec3f::dot(f, ray.direction);
+  const float c = Vec3f::dot(f, f) - sphere.radius * sphere.radius;
+  const Vec3f l = f + ray.direction * (b / a);
+  const float discriminant =
+      a * (sphere.radius * sphere.radius - Vec3f::dot(l, l));
+  if (discriminant < 0.0f) {
+    return false;
+  }
+  const float q =
+      b + (b >= 0.0f ? std::sqrt(discriminant) : -std::sqrt(discriminant));
+  float t0 = c / q;
+  float t1 = q / a;
+  if (t0 > t1) {
+    std::swap(t0, t1);
+  }
+  const float bt = t0 > 0.0f ? t0 : t1;
+  if (!(bt > 0.0f && bt < ray.t_max)) {
+    return false;
+  }
+  *t = bt;
+  *u = 0.0f;
+  *v = 0.0f;
+  return true;
+}
+
+inline bool intersect_box(const Box& box, const Ray& ray, float* t, float* u,
+                          float* v) {
+  float t_enter = -std::numeric_limits<float>::max();
+  float t_exit = std::numeric_limits<float>::max();
+  for (int axis = 0; axis < 3; ++axis) {
+    const float inv_dir = 1.0f / ray.direction[axis];
+    float t0 = (box.min[axis] - ray.origin[axis]) * inv_dir;
+    float t1 = (box.max[axis] - ray.origin[axis]) * inv_dir;
+    if (t0 > t1) {
+      std::swap(t0, t1);
+    }
+    // a nan from a ray in the plane of a face keeps the other axes
+    t_enter = t0 > t_enter ? t0 : t_enter;
+    t_exit = t1 < t_exit ? t1 : t_exit;
+  }
+  if (t_enter > t_exit) {
+    return false;
+  }
+  const float bt = t_enter > 0.0f ? t_enter : t_exit;
+  if (!(bt > 0.0f && bt < ray.t_max)) {
+    return false;
+  }
+  *t = bt;
+  *u = 0.0f;
+  *v = 0.0f;
+  return true;
+}
+
+// moller-trumbore over the parallelogram, u and v are s and t of the quad
+inline bool intersect_quad(const Quad& quad, const Ray& ray, float* t,
+                           float* u, float* v) {
+  const Vec3f p = Vec3f::cross(ray.direction, quad.edge_v);
+  const float det = Vec3f::dot(quad.edge_u, p);
+  if (det == 0.0f) {
+    return false;
+  }
+  const float inv_det = 1.0f / det;
+  const Vec3f s = ray.origin - quad.corner;
+  const float bu = Vec3f::dot(s, p) * inv_det;
+  if (bu < 0.0f || bu > 1.0f) {
+    return false;
+  }
+  const Vec3f q = Vec3f::cross(s, quad.edge_u);
+  const float bv = Vec3f::dot(ray.direction, q) * inv_det;
+  if (bv < 0.0f || bv > 1.0f) {
+    return false;
+  }
+  const float bt = Vec3f::dot(quad.edge_v, q) * inv_det;
+  if (bt <= 0.0f || bt >= ray.t_max) {
+    return false;
+  }
+  *t = bt;
+  *u = bu;
+  *v = bv;
+  return true;
+}
+
+#endif  // ANALYTIC_H
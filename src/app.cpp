@@ -4,20 +4,44 @@
 
 #include "app.h"
 
+#include <cstdio>
+
+namespace {
+
+const char* const APP_TITLE = "glfw-raytracing";
+// the full model is traced again once the camera rested this long
+const double PREVIEW_SECONDS = 0.25;
+
+}  // namespace
+
 void App::startup(int width, int height) {
   if (!glfwInit()) {
     return;
   }
 
   // create window
-  const char* title = "glfw-raytracing";
   glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-  window_ = glfwCreateWindow(width, height, title, nullptr, nullptr);
+  window_ = glfwCreateWindow(width, height, APP_TITLE, nullptr, nullptr);
+  if (window_) {
+    // camera moves start the preview, see traced_bvh_scene
+    glfwSetWindowUserPointer(window_, this);
+    glfwSetCursorPosCallback(window_, [](GLFWwindow* window, double, double) {
+      static_cast<App*>(glfwGetWindowUserPointer(window))->on_cursor_pos();
+    });
+  }
+
+  has_device_ = device_.create();
+  if (has_device_) {
+    printf("app: %s\n", device_.name());
+  } else {
+    printf("app: no vulkan device with a compute queue\n");
+  }
 
   // create camera
 }
 
 void App::shutdown() {
+  loader_.stop();
   // TODO
   // destroy scene
   // destroy render and swap chain
@@ -25,16 +49,71 @@ void App::shutdown() {
   glfwTerminate();
 }
 
-void App::load_model(const char* path) {
-  // TODO
-  // scene = new Scene(path);
-  // bvh_scene_ = new BvhScene(scene);
+void App::load_model(const char* path, const BvhBuildSettings& settings,
+                     size_t preview_triangles) {
+  std::function<void(BvhScene*)> prepare;
+  if (has_device_) {
+    // nothing else records on the device while the worker uploads
+    prepare = [this](BvhScene* bvh_scene) {
+      bvh_scene->create_device_objects(device_.vk_physical_device(),
+                                       device_.vk_device(),
+                                       device_.queue_family());
+    };
+  }
+  loader_.load(path, settings, preview_triangles, std::move(prepare));
+  set_title(std::string("loading ") + path);
 }
 
 void App::run() {
   while (!glfwWindowShouldClose(window_)) {
     glfwPollEvents();
+    poll_loader();
+    // the accumulated frames of one level of detail don't fit the other
+    const BvhScene* traced = traced_bvh_scene();
+    if (traced != traced_bvh_scene_) {
+      traced_bvh_scene_ = traced;
+      on_scene_changed();
+    }
+  }
+}
+
+const BvhScene* App::traced_bvh_scene() const {
+  if (preview_bvh_scene_ && last_camera_move_ >= 0.0 &&
+      glfwGetTime() - last_camera_move_ < PREVIEW_SECONDS) {
+    return preview_bvh_scene_.get();
+  }
+  return bvh_scene_.get();
+}
+
+void App::poll_loader() {
+  std::unique_ptr<LoadedModel> model = loader_.take();
+  if (!model) {
+    return;
+  }
+  if (!model->scene) {
+    printf("app: can't load %s, keeping the current scene\n",
+           model->path.c_str());
+    set_title(model_path_);
+    return;
+  }
+  // the old bvhs reference the old scenes, so they go first
+  preview_bvh_scene_ = std::move(model->preview_bvh_scene);
+  bvh_scene_ = std::move(model->bvh_scene);
+  preview_scene_ = std::move(model->preview_scene);
+  scene_ = std::move(model->scene);
+  model_path_ = model->path;
+  set_title(model_path_);
+  traced_bvh_scene_ = traced_bvh_scene();
+  on_scene_changed();
+}
+
+void App::set_title(const std::string& status) {
+  if (!window_) {
+    return;
   }
+  const std::string title =
+      status.empty() ? APP_TITLE : std::string(APP_TITLE) + " - " + status;
+  glfwSetWindowTitle(window_, title.c_str());
 }
 
 void App::on_window_size() {
@@ -44,8 +123,11 @@ void App::on_window_size() {
 
 void App::on_cursor_pos() {
   // TODO update camera
+  last_camera_move_ = glfwGetTime();
 }
 
+void App::on_scene_changed() { renderer_.reset_trace_buffer(); }
+
 App2::App2(int width, int height, const char* title, const char* model_path) {
   if (!glfwInit()) {
     std::abort();
@@ -5,28 +5,65 @@
 #ifndef APP_H
 #define APP_H
 
+#include <memory>
 #include <string>
 
 #include "bvh.h"
+#include "bvh_cache.h"
 #include "camera.h"
+#include "model_loader.h"
 #include "render.h"
 #include "scene.h"
 #include "vkut.h"
+#include "vkut/compute.h"
 
 class App {
  public:
   void startup(int width, int height);
   void shutdown();
 
-  void load_model(const char* path);
+  // starts loading the model file at path and building its bvh in the
+  // background, the bvh arrays are cached next to the file and uploaded to
+  // the device on the same worker. run() keeps
+  // showing the current scene and swaps the new one in when it is ready, or
+  // keeps it when the file can't be loaded. models of more than
+  // preview_triangles triangles are traced simplified to about that many
+  // while the camera moves, 0 always traces the full model.
+  void load_model(const char* path,
+                  const BvhBuildSettings& settings = BvhBuildSettings(),
+                  size_t preview_triangles = 0);
+  // scene files loaded from now on keep at most bytes of their geometry
+  // resident, 0 maps them whole
+  void set_memory_budget(size_t bytes) { loader_.set_memory_budget(bytes); }
 
   void run();
 
  private:
   GLFWwindow* window_{nullptr};
+  // the bvh buffers live on it, declared first so it outlives them. not
+  // created when there is no vulkan device, the bvhs then stay on the host.
+  vkut::ComputeDevice device_;
+  bool has_device_{false};
+  Renderer renderer_;
+  std::unique_ptr<Scene> scene_;
+  std::unique_ptr<BvhScene> bvh_scene_;
+  std::unique_ptr<Scene> preview_scene_;
+  std::unique_ptr<BvhScene> preview_bvh_scene_;
+  const BvhScene* traced_bvh_scene_{nullptr};
+  double last_camera_move_{-1.0};  // glfwGetTime() seconds
+  std::string model_path_;  // of the scene shown
+  // declared last, so its worker stops before the scene goes away
+  AsyncModelLoader loader_;
+
+  // swaps in a model the loader finished, once per frame
+  void poll_loader();
+  void set_title(const std::string& status);
+  // the preview while the camera moves, the full model otherwise
+  [[nodiscard]] const BvhScene* traced_bvh_scene() const;
 
   void on_window_size();
   void on_cursor_pos();
+  void on_scene_changed();
 };
 
 class App2 {
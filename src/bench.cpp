@@ -0,0 +1,777 @@
+#include "bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "analytic.h"
+#include "bvh_stats.h"
+#include "gpu_bvh.h"
+#include "simplify.h"
+
+namespace {
+
+std::vector<Ray> make_rays(const Scene* scene, uint32_t ray_count) {
+  Aabb bounds;
+  for (const auto& p : scene->positions()) {
+    bounds.grow(p);
+  }
+  for (size_t prim = scene->triangle_count(); prim < scene->primitive_count();
+       ++prim) {
+    bounds.grow(scene->primitive_bounds(prim));
+  }
+
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  std::normal_distribution<float> normal(0.0f, 1.0f);
+  std::vector<Ray> rays(ray_count);
+  Vec3f extent = bounds.extent();
+  for (auto& ray : rays) {
+    ray.origin = bounds.min + Vec3f(extent.x * unit(rng), extent.y * unit(rng),
+                                    extent.z * unit(rng));
+    Vec3f dir;
+    do {
+      dir = Vec3f(normal(rng), normal(rng), normal(rng));
+    } while (Vec3f::dot(dir, dir) < 1e-6f);
+    ray.direction = Vec3f::normalize(dir);
+  }
+  return rays;
+}
+
+// closest hit t of ray against the scene triangles through bvh
+float trace(const Scene* scene, const Bvh& bvh, const Ray& ray) {
+  const auto& positions = scene->positions();
+  const auto& indices = scene->indices();
+  float closest = ray.t_max;
+  bvh.traverse(ray, [&](uint32_t prim, const Ray& r) {
+    const Vec3f& p0 = positions[indices[prim * 3 + 0]];
+    float t, u, v;
+    if (intersect_triangle_edges(p0, positions[indices[prim * 3 + 1]] - p0,
+                                 positions[indices[prim * 3 + 2]] - p0, r, &t,
+                                 &u, &v)) {
+      closest = t;
+    }
+    return closest;
+  });
+  return closest;
+}
+
+// same prim at the same t up to rounding, the watertight test moves t on
+// grazing triangles
+bool same_hit(const Hit& a, const Hit& b) {
+  if (a.prim != b.prim) {
+    return false;
+  }
+  return a.prim == ~0u ||
+         std::abs(a.t - b.t) <= 1e-4f * std::max(1.0f, std::abs(b.t));
+}
+
+// the device build in host code at its precision: 30-bit morton codes, ties
+// kept in triangle order like the radix sort, the karras hierarchy over
+// 32-bit keys and the depth first layout of bvh_emit. the tree should come
+// out node for node the same as GpuBvhBuilder's.
+uint32_t expand_bits_10(uint32_t v) {
+  v = (v * 0x00010001u) & 0xff0000ffu;
+  v = (v * 0x00000101u) & 0x0f00f00fu;
+  v = (v * 0x00000011u) & 0xc30c30c3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+int count_leading_zeros(uint32_t v) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  return _BitScanReverse(&index, v) ? 31 - int(index) : 32;
+#else
+  return v ? __builtin_clz(v) : 32;
+#endif
+}
+
+Bvh build_device_reference(const Scene* scene) {
+  const auto n = static_cast<uint32_t>(scene->triangle_count());
+  if (n == 0) {
+    return Bvh();
+  }
+  std::vector<Aabb> prim_bounds(n);
+  Aabb centroid_bounds;
+  for (uint32_t i = 0; i < n; ++i) {
+    prim_bounds[i] = scene->triangle_bounds(i);
+    centroid_bounds.grow(prim_bounds[i].centroid());
+  }
+  const Vec3f extent = centroid_bounds.extent();
+  const Vec3f inv_extent(extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+                         extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+                         extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+  std::vector<uint32_t> codes(n);
+  for (uint32_t i = 0; i < n; ++i) {
+    const Vec3f p = prim_bounds[i].centroid() - centroid_bounds.min;
+    auto quantize = [](float x) {
+      return static_cast<uint32_t>(std::clamp(x, 0.0f, 1.0f) * 1023.0f);
+    };
+    codes[i] = expand_bits_10(quantize(p.x * inv_extent.x)) << 2 |
+               expand_bits_10(quantize(p.y * inv_extent.y)) << 1 |
+               expand_bits_10(quantize(p.z * inv_extent.z));
+  }
+  std::vector<uint32_t> values(n);
+  for (uint32_t i = 0; i < n; ++i) {
+    values[i] = i;
+  }
+  std::stable_sort(values.begin(), values.end(),
+                   [&](uint32_t a, uint32_t b) { return codes[a] < codes[b]; });
+  std::vector<uint32_t> keys(n);
+  for (uint32_t i = 0; i < n; ++i) {
+    keys[i] = codes[values[i]];
+  }
+
+  // same as bvh_hierarchy, internal nodes are [0, n - 1), leaf i is node
+  // n - 1 + i
+  auto delta = [&](int64_t i, int64_t j) {
+    if (j < 0 || j >= int64_t(n)) {
+      return -1;
+    }
+    if (keys[i] == keys[j]) {
+      return 32 + count_leading_zeros(uint32_t(i ^ j));
+    }
+    return count_leading_zeros(keys[i] ^ keys[j]);
+  };
+  const uint32_t leaf_base = n - 1;
+  struct Internal {
+    uint32_t children[2];
+    uint32_t first;
+  };
+  std::vector<Internal> internal(leaf_base);
+  std::vector<uint32_t> parents(2 * size_t(n) - 1, ~0u);
+  for (int64_t i = 0; i < int64_t(leaf_base); ++i) {
+    const int64_t d = delta(i, i + 1) - delta(i, i - 1) >= 0 ? 1 : -1;
+    const int delta_min = delta(i, i - d);
+    int64_t l_max = 2;
+    while (delta(i, i + l_max * d) > delta_min) {
+      l_max *= 2;
+    }
+    int64_t l = 0;
+    for (int64_t t = l_max / 2; t >= 1; t /= 2) {
+      if (delta(i, i + (l + t) * d) > delta_min) {
+        l += t;
+      }
+    }
+    const int64_t j = i + l * d;
+    const int delta_node = delta(i, j);
+    int64_t s = 0;
+    int64_t t = l;
+    do {
+      t = (t + 1) / 2;
+      if (delta(i, i + (s + t) * d) > delta_node) {
+        s += t;
+      }
+    } while (t > 1);
+    const auto split =
+        static_cast<uint32_t>(i + s * d + std::min<int64_t>(d, 0));
+    const auto first = static_cast<uint32_t>(std::min(i, j));
+    const auto last = static_cast<uint32_t>(std::max(i, j));
+    Internal& node = internal[i];
+    node.children[0] = first == split ? leaf_base + split : split;
+    node.children[1] = last == split + 1 ? leaf_base + split + 1 : split + 1;
+    node.first = first;
+    parents[node.children[0]] = uint32_t(i);
+    parents[node.children[1]] = uint32_t(i);
+  }
+
+  // bounds bottom up like bvh_fit, children before parents in post order
+  std::vector<Aabb> bounds(parents.size());
+  std::vector<std::pair<uint32_t, bool>> stack{{0, false}};
+  while (!stack.empty()) {
+    auto [node, expanded] = stack.back();
+    stack.pop_back();
+    if (node >= leaf_base) {
+      bounds[node] = prim_bounds[values[node - leaf_base]];
+    } else if (expanded) {
+      bounds[node] = bounds[internal[node].children[0]];
+      bounds[node].grow(bounds[internal[node].children[1]]);
+    } else {
+      stack.emplace_back(node, true);
+      stack.emplace_back(internal[node].children[0], false);
+      stack.emplace_back(internal[node].children[1], false);
+    }
+  }
+
+  // depth first position of bvh_emit: twice the first leaf plus the left
+  // turns on the way from the root
+  auto first_leaf = [&](uint32_t node) {
+    return node < leaf_base ? internal[node].first : node - leaf_base;
+  };
+  std::vector<BvhNode> nodes(parents.size());
+  for (uint32_t node = 0; node < nodes.size(); ++node) {
+    uint32_t left_ancestors = 0;
+    for (uint32_t child = node, parent = parents[node]; parent != ~0u;
+         child = parent, parent = parents[parent]) {
+      left_ancestors += internal[parent].children[0] == child ? 1 : 0;
+    }
+    BvhNode& out = nodes[2 * first_leaf(node) + left_ancestors];
+    for (int axis = 0; axis < 3; ++axis) {
+      out.bounds_min[axis] = bounds[node].min[axis];
+      out.bounds_max[axis] = bounds[node].max[axis];
+    }
+    if (node < leaf_base) {
+      out.offset = 2 * first_leaf(internal[node].children[1]) + left_ancestors;
+      out.prim_count = 0;
+    } else {
+      out.offset = node - leaf_base;
+      out.prim_count = 1;
+    }
+  }
+  return Bvh::from_arrays(std::move(nodes), std::move(values));
+}
+
+bool expect(bool ok, const char* what) {
+  if (!ok) {
+    printf("check: %s failed\n", what);
+  }
+  return ok;
+}
+
+// a sphere straight ahead of the camera is one visited leaf with one prim
+// at the center pixel and no prim at the corner
+bool check_heatmap() {
+  Scene scene;
+  scene.add_sphere(Vec3f(0.0f, 0.0f, 0.0f), 1.0f);
+  CameraData camera;
+  camera.look_from = Vec3f(0.0f, 0.0f, 5.0f);
+  camera.look_to = Vec3f(0.0f, 0.0f, 0.0f);
+  camera.up_dir = Vec3f(0.0f, 1.0f, 0.0f);
+  camera.fov_angle_y = 60.0f;
+  const uint32_t size = 33;
+  bool ok = true;
+  for (uint32_t width : {2u, 4u, 8u}) {
+    BvhBuildSettings settings;
+    settings.width = width;
+    const BvhScene bvh_scene(&scene, settings);
+    const TraversalHeatmap heatmap =
+        TraversalHeatmap::trace(bvh_scene, camera, size, size);
+    const TraversalCounters& center =
+        heatmap.counters()[(size / 2) * size + size / 2];
+    const TraversalCounters& corner = heatmap.counters()[0];
+    ok = expect(center.nodes >= 1 && center.prims == 1,
+                "heatmap of a ray through a sphere") &&
+         ok;
+    // wide roots hold their children's bounds, so they are always visited
+    const uint32_t root_visits = width == 2 ? 0 : 1;
+    ok = expect(corner.nodes == root_visits && corner.prims == 0,
+                "heatmap of a ray past a sphere") &&
+         ok;
+  }
+  return ok;
+}
+
+Ray make_ray(const Vec3f& origin, const Vec3f& direction) {
+  Ray ray;
+  ray.origin = origin;
+  ray.direction = direction;
+  return ray;
+}
+
+bool near(float a, float b, float tolerance) {
+  return std::abs(a - b) <= tolerance;
+}
+
+// known rays against one sphere, box and quad, then the closest of the
+// three through every layout
+bool check_analytic() {
+  const Vec3f z(0.0f, 0.0f, 1.0f);
+  float t = 0.0f;
+  float u = 0.0f;
+  float v = 0.0f;
+  bool ok = true;
+
+  const Sphere sphere{Vec3f(0.0f, 0.0f, 10.0f), 2.0f, NO_MATERIAL};
+  ok = expect(intersect_sphere(sphere, make_ray(Vec3f(), z), &t, &u, &v) &&
+                  near(t, 8.0f, 1e-5f),
+              "sphere front") &&
+       ok;
+  ok = expect(intersect_sphere(sphere,
+                               make_ray(Vec3f(1.0f, 0.0f, 0.0f), z), &t, &u,
+                               &v) &&
+                  near(t, 10.0f - std::sqrt(3.0f), 1e-5f),
+              "sphere off center") &&
+       ok;
+  ok = expect(intersect_sphere(sphere, make_ray(sphere.center, z), &t, &u,
+                               &v) &&
+                  near(t, 2.0f, 1e-5f),
+              "sphere from inside") &&
+       ok;
+  ok = expect(!intersect_sphere(sphere, make_ray(Vec3f(3.0f, 0.0f, 0.0f), z),
+                                &t, &u, &v),
+              "sphere miss") &&
+       ok;
+  const Sphere far_sphere{Vec3f(0.0f, 0.0f, 1e5f), 1.0f, NO_MATERIAL};
+  ok = expect(intersect_sphere(far_sphere,
+                               make_ray(Vec3f(0.5f, 0.0f, 0.0f), z), &t, &u,
+                               &v) &&
+                  near(t, 1e5f - std::sqrt(0.75f), 0.02f),
+              "far sphere") &&
+       ok;
+
+  const Box box{Vec3f(-1.0f, -1.0f, 9.0f), Vec3f(1.0f, 1.0f, 11.0f),
+                NO_MATERIAL};
+  ok = expect(intersect_box(box, make_ray(Vec3f(), z), &t, &u, &v) &&
+                  near(t, 9.0f, 1e-5f),
+              "box front") &&
+       ok;
+  ok = expect(intersect_box(box, make_ray(Vec3f(0.0f, 0.0f, 10.0f), z), &t,
+                            &u, &v) &&
+                  near(t, 1.0f, 1e-5f),
+              "box from inside") &&
+       ok;
+  ok = expect(!intersect_box(box, make_ray(Vec3f(2.0f, 0.0f, 0.0f), z), &t,
+                             &u, &v),
+              "box miss") &&
+       ok;
+  ok = expect(!intersect_box(box, make_ray(Vec3f(), z * -1.0f), &t, &u, &v),
+              "box behind") &&
+       ok;
+
+  const Quad quad{Vec3f(0.0f, 0.0f, 5.0f), Vec3f(2.0f, 0.0f, 0.0f),
+                  Vec3f(0.0f, 4.0f, 0.0f), NO_MATERIAL};
+  ok = expect(intersect_quad(quad, make_ray(Vec3f(1.0f, 1.0f, 0.0f), z), &t,
+                             &u, &v) &&
+                  near(t, 5.0f, 1e-5f) && near(u, 0.5f, 1e-5f) &&
+                  near(v, 0.25f, 1e-5f),
+              "quad front") &&
+       ok;
+  ok = expect(!intersect_quad(quad, make_ray(Vec3f(3.0f, 1.0f, 0.0f), z), &t,
+                              &u, &v),
+              "quad miss") &&
+       ok;
+  ok = expect(!intersect_quad(quad,
+                              make_ray(Vec3f(-1.0f, 1.0f, 5.0f),
+                                       Vec3f(1.0f, 0.0f, 0.0f)),
+                              &t, &u, &v),
+              "quad parallel") &&
+       ok;
+
+  // the quad is in front of the box, the box in front of the sphere
+  Scene scene;
+  scene.add_sphere(Vec3f(0.0f, 0.0f, 20.0f), 2.0f);
+  Aabb bounds;
+  bounds.grow(box.min);
+  bounds.grow(box.max);
+  scene.add_box(bounds);
+  scene.add_quad(quad.corner, quad.edge_u, quad.edge_v);
+  struct Layout {
+    uint32_t width;
+    bool quantized;
+    bool stackless;
+  };
+  const Layout layouts[] = {{2, false, false}, {4, false, false},
+                            {8, false, false}, {4, true, false},
+                            {8, true, false},  {2, false, true}};
+  for (const auto& layout : layouts) {
+    BvhBuildSettings settings;
+    settings.width = layout.width;
+    settings.quantized = layout.quantized;
+    settings.stackless = layout.stackless;
+    const BvhScene bvh_scene(&scene, settings);
+    size_t index = 0;
+    Hit hit;
+    ok = expect(bvh_scene.intersect(make_ray(Vec3f(1.0f, 1.0f, 0.0f), z),
+                                    hit) &&
+                    scene.primitive_kind(hit.prim, &index) == PRIMITIVE_QUAD &&
+                    near(hit.t, 5.0f, 1e-5f),
+                "closest analytic primitive") &&
+         ok;
+    hit = Hit();
+    ok = expect(bvh_scene.intersect(make_ray(Vec3f(0.0f, -1.5f, 0.0f), z),
+                                    hit) &&
+                    scene.primitive_kind(hit.prim, &index) ==
+                        PRIMITIVE_SPHERE &&
+                    near(hit.t, 20.0f - std::sqrt(1.75f), 1e-4f),
+                "analytic primitive behind a miss") &&
+         ok;
+  }
+  return ok;
+}
+
+// axis aligned rays with -0 components from inside the scene bounds, through
+// the wide and quantized layouts against the binary one. the entry plane of a -0 axis
+// follows the -inf of its inverse.
+bool check_signed_zero() {
+  Scene scene;
+  make_random_scene(&scene, 4000);
+  const float z = -0.0f;
+  const Vec3f directions[] = {
+      Vec3f(z, z, 1.0f),  Vec3f(z, z, -1.0f), Vec3f(z, 1.0f, z),
+      Vec3f(z, -1.0f, z), Vec3f(1.0f, z, z),  Vec3f(-1.0f, z, z)};
+  std::vector<Ray> rays;
+  for (const Ray& ray : make_rays(&scene, 2000)) {
+    for (const Vec3f& direction : directions) {
+      rays.push_back(make_ray(ray.origin, direction));
+    }
+  }
+
+  const BvhScene reference(&scene);
+  std::vector<Hit> reference_hits(rays.size());
+  uint32_t hit_count = 0;
+  for (size_t i = 0; i < rays.size(); ++i) {
+    reference.intersect(rays[i], reference_hits[i]);
+    hit_count += reference_hits[i].prim != ~0u ? 1 : 0;
+  }
+  bool ok = expect(hit_count > 0, "-0 rays hitting the binary bvh");
+
+  struct Layout {
+    uint32_t width;
+    bool quantized;
+  };
+  const Layout layouts[] = {{4, false}, {8, false}, {4, true}, {8, true}};
+  for (const auto& layout : layouts) {
+    BvhBuildSettings settings;
+    settings.width = layout.width;
+    settings.quantized = layout.quantized;
+    const BvhScene bvh_scene(&scene, settings);
+    uint32_t mismatches = 0;
+    for (size_t i = 0; i < rays.size(); ++i) {
+      Hit hit;
+      bvh_scene.intersect(rays[i], hit);
+      mismatches += same_hit(hit, reference_hits[i]) ? 0 : 1;
+    }
+    printf("check: %u of %zu -0 rays hit differently at width %u%s\n",
+           mismatches, rays.size(), layout.width,
+           layout.quantized ? " quantized" : "");
+    ok = expect(mismatches == 0, "-0 rays through a wide bvh") && ok;
+  }
+  return ok;
+}
+
+float total_area(const Scene& scene) {
+  const auto& positions = scene.positions();
+  const auto& indices = scene.indices();
+  double area = 0.0;
+  for (size_t i = 0; i < scene.triangle_count(); ++i) {
+    const Vec3f& p0 = positions[indices[i * 3 + 0]];
+    const Vec3f n = Vec3f::cross(positions[indices[i * 3 + 1]] - p0,
+                                 positions[indices[i * 3 + 2]] - p0);
+    area += 0.5 * std::sqrt(double(Vec3f::dot(n, n)));
+  }
+  return float(area);
+}
+
+// a flat grid with a locked border reduces to about the target and keeps
+// its area, a fold over would add to it. the sphere carries over.
+bool check_simplify() {
+  Scene scene;
+  const uint32_t size = 128;
+  for (uint32_t y = 0; y < size; ++y) {
+    for (uint32_t x = 0; x < size; ++x) {
+      scene.add_vertex(Vec3f(float(x), float(y), 0.0f));
+    }
+  }
+  for (uint32_t y = 0; y + 1 < size; ++y) {
+    for (uint32_t x = 0; x + 1 < size; ++x) {
+      const uint32_t v = y * size + x;
+      scene.add_triangle(v, v + 1, v + size + 1);
+      scene.add_triangle(v, v + size + 1, v + size);
+    }
+  }
+  scene.add_sphere(Vec3f(64.0f, 64.0f, 4.0f), 1.0f);
+
+  const size_t target = 2000;
+  Scene lod;
+  simplify_scene(scene, target, &lod);
+  const float area = total_area(scene);
+  printf("check: lod of %zu triangles to %zu, target %zu\n",
+         scene.triangle_count(), lod.triangle_count(), target);
+  bool ok = expect(lod.triangle_count() <= target * 5 / 4,
+                   "lod triangle count");
+  ok = expect(std::abs(total_area(lod) - area) <= 1e-4f * area,
+              "lod area") &&
+       ok;
+  ok = expect(lod.spheres().size() == 1, "lod analytic primitives") && ok;
+  return ok;
+}
+
+bool same_bounds(const BvhNode& node, const Aabb& bounds) {
+  Aabb b = node.bounds();
+  return b.min.x == bounds.min.x && b.min.y == bounds.min.y &&
+         b.min.z == bounds.min.z && b.max.x == bounds.max.x &&
+         b.max.y == bounds.max.y && b.max.z == bounds.max.z;
+}
+
+}  // namespace
+
+void make_random_scene(Scene* scene, uint32_t triangle_count) {
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> position(0.0f, 100.0f);
+  std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+  for (uint32_t i = 0; i < triangle_count; ++i) {
+    Vec3f center(position(rng), position(rng), position(rng));
+    uint32_t v[3];
+    for (auto& index : v) {
+      index = scene->add_vertex(
+          center + Vec3f(offset(rng), offset(rng), offset(rng)));
+    }
+    scene->add_triangle(v[0], v[1], v[2]);
+  }
+}
+
+void make_random_spheres(Scene* scene, uint32_t sphere_count) {
+  std::mt19937 rng(2);
+  std::uniform_real_distribution<float> position(0.0f, 100.0f);
+  std::uniform_real_distribution<float> radius(0.1f, 1.0f);
+  for (uint32_t i = 0; i < sphere_count; ++i) {
+    scene->add_sphere(Vec3f(position(rng), position(rng), position(rng)),
+                      radius(rng));
+  }
+}
+
+void bench_traversal(const Scene* scene, const BvhBuildSettings& settings,
+                     uint32_t ray_count, const std::string& cache_path) {
+  const std::vector<Ray> rays = make_rays(scene, ray_count);
+  std::vector<Hit> reference;
+
+  // quantized nodes trade decode alu for node bandwidth, stackless traversal
+  // trades front to back order for state, the watertight test trades flops
+  // for robustness
+  struct Layout {
+    const char* name;
+    uint32_t width;
+    bool quantized;
+    bool stackless;
+    bool watertight;
+  };
+  const Layout layouts[] = {
+      {"bvh2", 2, false, false, false},
+      {"bvh4", 4, false, false, false},
+      {"bvh8", 8, false, false, false},
+      {"qbvh4", 4, true, false, false},
+      {"qbvh8", 8, true, false, false},
+      {"rope bvh2", 2, false, true, false},
+      {"watertight bvh2", 2, false, false, true},
+  };
+  for (const auto& layout : layouts) {
+    const uint32_t width = layout.width;
+    BvhBuildSettings s = settings;
+    s.width = width;
+    s.quantized = layout.quantized;
+    s.stackless = layout.stackless;
+    s.watertight = layout.watertight;
+    if (!cache_path.empty()) {
+      std::remove(cache_path.c_str());
+      BvhScene writer(scene, s, cache_path);
+    }
+    BvhScene bvh_scene(scene, s, cache_path);
+
+    std::vector<Hit> hits(rays.size());
+    auto start = std::chrono::steady_clock::now();
+    parallel_for(0, rays.size(), 1024, [&](size_t b, size_t e, uint32_t) {
+      for (size_t i = b; i < e; ++i) {
+        bvh_scene.intersect(rays[i], hits[i]);
+      }
+    });
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+
+    const BvhStats stats = bvh_scene.stats(false);
+
+    uint32_t hit_count = 0;
+    uint32_t mismatches = 0;
+    for (size_t i = 0; i < hits.size(); ++i) {
+      hit_count += hits[i].prim != ~0u ? 1 : 0;
+      if (!reference.empty() && !same_hit(hits[i], reference[i])) {
+        ++mismatches;
+      }
+    }
+    if (reference.empty()) {
+      reference = std::move(hits);
+    }
+
+    printf("bench: %s %.2f Mrays/s, %.2f ms, %zu node bytes, %.1f MiB, "
+           "%u hits, %u mismatches\n",
+           layout.name, double(rays.size()) / ms / 1000.0, ms,
+           stats.node_bytes,
+           double(stats.memory_bytes) / (1024.0 * 1024.0), hit_count,
+           mismatches);
+  }
+}
+
+void bench_builders(const Scene* scene, const BvhBuildSettings& settings,
+                    uint32_t ray_count) {
+  const std::vector<Ray> rays = make_rays(scene, ray_count);
+  const BvhBuildMode modes[] = {BvhBuildMode::SAH, BvhBuildMode::LBVH,
+                                BvhBuildMode::SBVH, BvhBuildMode::PLOC};
+  for (BvhBuildMode mode : modes) {
+    BvhBuildSettings s = settings;
+    s.mode = mode;
+    BvhScene bvh_scene(scene, s);
+
+    std::vector<Hit> hits(rays.size());
+    auto start = std::chrono::steady_clock::now();
+    parallel_for(0, rays.size(), 1024, [&](size_t b, size_t e, uint32_t) {
+      for (size_t i = b; i < e; ++i) {
+        bvh_scene.intersect(rays[i], hits[i]);
+      }
+    });
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+
+    printf("bench: %s build %.2f ms, sah cost %.3f, %.2f Mrays/s\n",
+           build_mode_name(mode), bvh_scene.build_time_ms(),
+           bvh_scene.stats(false).sah_cost,
+           double(rays.size()) / ms / 1000.0);
+  }
+}
+
+bool check_device_build(const Scene* scene, const BvhBuildSettings& settings,
+                        uint32_t ray_count) {
+  vkut::ComputeDevice device;
+  if (!device.create()) {
+    printf("check: no vulkan device with a compute queue\n");
+    return false;
+  }
+  printf("check: %s\n", device.name());
+
+  GpuBvhBuilder builder(device.vk_physical_device(), device.vk_device(),
+                        device.queue_family());
+  builder.build(*scene, settings.watertight);
+  const Bvh gpu = builder.download_bvh();
+  const Blob gpu_triangles = builder.download_triangles();
+
+  // children follow their parent in depth first order, so walking
+  // backwards checks every child before its parent
+  const size_t prim_count = scene->triangle_count();
+  const auto& nodes = gpu.nodes();
+  const auto& prim_indices = gpu.prim_indices();
+  uint32_t structure_errors = 0;
+  uint32_t bounds_errors = 0;
+  if (nodes.size() != (prim_count > 0 ? 2 * prim_count - 1 : 0) ||
+      prim_indices.size() != prim_count) {
+    ++structure_errors;
+  }
+  std::vector<uint8_t> seen(prim_count, 0);
+  for (size_t i = nodes.size(); i-- > 0 && structure_errors == 0;) {
+    const BvhNode& node = nodes[i];
+    if (node.is_leaf()) {
+      if (node.prim_count != 1 || node.offset >= prim_count ||
+          prim_indices[node.offset] >= prim_count ||
+          seen[prim_indices[node.offset]]++) {
+        ++structure_errors;
+        continue;
+      }
+      if (!same_bounds(node, scene->triangle_bounds(
+                                 prim_indices[node.offset]))) {
+        ++bounds_errors;
+      }
+    } else {
+      if (node.offset <= i + 1 || node.offset >= nodes.size()) {
+        ++structure_errors;
+        continue;
+      }
+      Aabb bounds = nodes[i + 1].bounds();
+      bounds.grow(nodes[node.offset].bounds());
+      if (!same_bounds(node, bounds)) {
+        ++bounds_errors;
+      }
+    }
+  }
+
+  // the same build on the cpu, compared node by node
+  auto start = std::chrono::steady_clock::now();
+  const Bvh cpu = build_device_reference(scene);
+  double cpu_ms = std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  uint32_t node_differences = 0;
+  if (cpu.nodes().size() != nodes.size() ||
+      cpu.prim_indices() != prim_indices) {
+    ++node_differences;
+  } else {
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      if (memcmp(&nodes[i], &cpu.nodes()[i], sizeof(BvhNode)) != 0) {
+        if (node_differences++ == 0) {
+          printf("check: node %zu differs first\n", i);
+        }
+      }
+    }
+  }
+
+  TriangleRecords records(settings.watertight);
+  records.append(*scene, prim_indices);
+  const Blob cpu_triangles = records.pack();
+  const bool same_triangles =
+      structure_errors == 0 && cpu_triangles.size() == gpu_triangles.size() &&
+      memcmp(cpu_triangles.data(), gpu_triangles.data(),
+             cpu_triangles.size()) == 0;
+
+  uint32_t mismatches = 0;
+  if (structure_errors == 0) {
+    const std::vector<Ray> rays = make_rays(scene, ray_count);
+    std::vector<uint8_t> mismatch(rays.size(), 0);
+    parallel_for(0, rays.size(), 1024, [&](size_t b, size_t e, uint32_t) {
+      for (size_t i = b; i < e; ++i) {
+        mismatch[i] = trace(scene, gpu, rays[i]) != trace(scene, cpu, rays[i]);
+      }
+    });
+    for (uint8_t m : mismatch) {
+      mismatches += m;
+    }
+  }
+
+  printf("check: device lbvh %zu nodes, %.2f ms; cpu reference %zu nodes, "
+         "%.2f ms\n",
+         nodes.size(), builder.build_time_ms(), cpu.nodes().size(), cpu_ms);
+  printf("check: %u structure errors, %u bounds errors, %u nodes differ from "
+         "the reference, triangle records %s, %u of %u rays hit "
+         "differently\n",
+         structure_errors, bounds_errors, node_differences,
+         same_triangles ? "equal" : "differ", mismatches, ray_count);
+  return structure_errors == 0 && bounds_errors == 0 &&
+         node_differences == 0 && same_triangles && mismatches == 0;
+}
+
+bool run_self_checks() {
+  bool ok = check_analytic();
+  ok = check_signed_zero() && ok;
+  ok = check_heatmap() && ok;
+  ok = check_simplify() && ok;
+  printf("check: self checks %s\n", ok ? "passed" : "failed");
+  return ok;
+}
+
+void report_bvh_stats(const Scene* scene, const BvhBuildSettings& settings,
+                      const std::string& heatmap_path, bool heatmap_prims) {
+  BvhScene bvh_scene(scene, settings);
+  auto start = std::chrono::steady_clock::now();
+  BvhStats stats = bvh_scene.stats();
+  printf("bvh: stats %.2f ms\n",
+         std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+             .count());
+  stats.print();
+  if (heatmap_path.empty()) {
+    return;
+  }
+
+  // looks at the center of the scene from outside its bounds
+  Aabb bounds;
+  for (const auto& p : scene->positions()) {
+    bounds.grow(p);
+  }
+  const Vec3f extent = bounds.extent();
+  const float size = std::max(extent.x, std::max(extent.y, extent.z));
+  CameraData camera;
+  camera.look_to = bounds.centroid();
+  camera.look_from =
+      camera.look_to + Vec3f::normalize(Vec3f(0.4f, 0.3f, 1.0f)) * size * 1.5f;
+  camera.up_dir = Vec3f(0.0f, 1.0f, 0.0f);
+  camera.fov_angle_y = 60.0f;
+  TraversalHeatmap heatmap =
+      TraversalHeatmap::trace(bvh_scene, camera, 640, 480);
+  if (!heatmap.write_ppm(heatmap_path.c_str(), heatmap_prims)) {
+    printf("bvh: can't write %s\n", heatmap_path.c_str());
+  }
+}
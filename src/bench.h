@@ -0,0 +1,51 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+
+#include "bvh.h"
+#include "scene.h"
+
+// random triangle soup inside a 100^3 box, for benchmarking without a model
+void make_random_scene(Scene* scene, uint32_t triangle_count);
+// analytic spheres of radius 0.1 to 1 in the same box
+void make_random_spheres(Scene* scene, uint32_t sphere_count);
+
+// traces the same random rays through the binary, 4-wide, 8-wide, quantized
+// and stackless layouts and prints throughput, node memory and any hit
+// mismatch. with a cache_path every layout is written to that bvh cache
+// file and the tree loaded back from it is traced.
+void bench_traversal(const Scene* scene, const BvhBuildSettings& settings,
+                     uint32_t ray_count,
+                     const std::string& cache_path = std::string());
+
+// builds the scene with every BvhBuildMode at the width and other settings
+// given, and prints build time, sah cost and throughput over the same random
+// rays
+void bench_builders(const Scene* scene, const BvhBuildSettings& settings,
+                    uint32_t ray_count);
+
+// builds the scene with GpuBvhBuilder on the first vulkan device with a
+// compute queue (lavapipe works) and checks the downloaded tree: every
+// triangle in exactly one leaf, leaf bounds equal to the triangle bounds,
+// interior bounds equal to the union of their children, node for node the
+// same tree as the same 30-bit build in host code, the same closest hits
+// and the same triangle records. prints the result and returns false on any
+// error.
+bool check_device_build(const Scene* scene, const BvhBuildSettings& settings,
+                        uint32_t ray_count);
+
+// known answers for what the benchmarks can't compare against another
+// layout: known rays against spheres, boxes and quads, axis aligned rays
+// with -0 components through the wide and quantized layouts, the heatmap
+// counters of analytic primitives and the triangle count and area of a
+// simplified grid. prints every failure and returns false on any.
+bool run_self_checks();
+
+// builds the scene and prints BvhScene::stats(). with a heatmap_path the
+// node visits of a 640x480 view of the whole scene, or the prim visits with
+// heatmap_prims, are written there as a ppm image.
+void report_bvh_stats(const Scene* scene, const BvhBuildSettings& settings,
+                      const std::string& heatmap_path, bool heatmap_prims);
+
+#endif  // BENCH_H
@@ -3,3 +3,2622 @@
 //
 
 #include "bvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <mutex>
+#include <tuple>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "analytic.h"
+#include "bvh_cache.h"
+#include "bvh_stats.h"
+#include "gpu_bvh.h"
+#include "vkut/common.h"
+
+namespace {
+
+const uint32_t MAX_BIN_COUNT = 64;
+
+// ranges at least this large are binned with parallel_for
+const uint32_t PARALLEL_BINNING_THRESHOLD = 64 * 1024;
+// subtrees at least this large are built on their own thread
+const uint32_t PARALLEL_SUBTREE_THRESHOLD = 16 * 1024;
+
+struct Bin {
+  Aabb bounds;
+  uint32_t count{0};
+};
+
+struct Split {
+  int axis{-1};
+  uint32_t bin{0};
+  float cost{std::numeric_limits<float>::max()};
+  float position{0.0f};  // split plane, used by the sbvh builder
+};
+
+class SahBuilder {
+ public:
+  SahBuilder(const std::vector<Aabb>& prim_bounds,
+             const BvhBuildSettings& settings,
+             std::vector<BvhBuildNode>& nodes,
+             std::vector<uint32_t>& prim_indices)
+      : prim_bounds_(prim_bounds),
+        settings_(settings),
+        nodes_(nodes),
+        prim_indices_(prim_indices) {
+    bin_count_ = std::clamp(settings.bin_count, 2u, MAX_BIN_COUNT);
+    max_leaf_size_ = std::max(1u, settings.max_leaf_size);
+
+    uint32_t threads = worker_count();
+    while (threads > 1) {
+      threads >>= 1;
+      ++max_parallel_depth_;
+    }
+    max_parallel_depth_ += 2;
+  }
+
+  void build() {
+    const auto prim_count = static_cast<uint32_t>(prim_bounds_.size());
+    centroids_.resize(prim_count);
+    prim_indices_.resize(prim_count);
+    parallel_for(0, prim_count, 4096, [&](size_t b, size_t e, uint32_t) {
+      for (size_t i = b; i < e; ++i) {
+        centroids_[i] = prim_bounds_[i].centroid();
+        prim_indices_[i] = static_cast<uint32_t>(i);
+      }
+    });
+
+    // a binary tree with at least one primitive per leaf never needs more
+    nodes_.resize(2 * size_t(prim_count) - 1);
+    node_count_ = 1;
+    build_node(0, 0, prim_count, 0);
+    nodes_.resize(node_count_);
+  }
+
+ private:
+  const std::vector<Aabb>& prim_bounds_;
+  const BvhBuildSettings& settings_;
+  std::vector<BvhBuildNode>& nodes_;
+  std::vector<uint32_t>& prim_indices_;
+
+  std::vector<Vec3f> centroids_;
+  std::atomic<uint32_t> node_count_{0};
+  uint32_t bin_count_{0};
+  uint32_t max_leaf_size_{0};
+  uint32_t max_parallel_depth_{0};
+
+  void compute_bounds(uint32_t begin, uint32_t end, Aabb& bounds,
+                      Aabb& centroid_bounds) const {
+    auto body = [&](size_t b, size_t e, Aabb& out_bounds,
+                    Aabb& out_centroid_bounds) {
+      for (size_t i = b; i < e; ++i) {
+        uint32_t prim = prim_indices_[i];
+        out_bounds.grow(prim_bounds_[prim]);
+        out_centroid_bounds.grow(centroids_[prim]);
+      }
+    };
+
+    if (end - begin < PARALLEL_BINNING_THRESHOLD) {
+      body(begin, end, bounds, centroid_bounds);
+      return;
+    }
+
+    std::vector<Aabb> partial(2 * worker_count());
+    parallel_for(begin, end, PARALLEL_BINNING_THRESHOLD / 4,
+                 [&](size_t b, size_t e, uint32_t worker) {
+                   body(b, e, partial[2 * worker], partial[2 * worker + 1]);
+                 });
+    for (size_t i = 0; i < partial.size(); i += 2) {
+      bounds.grow(partial[i]);
+      centroid_bounds.grow(partial[i + 1]);
+    }
+  }
+
+  [[nodiscard]] uint32_t bin_index(const Vec3f& centroid, int axis,
+                                   const Aabb& centroid_bounds,
+                                   float scale) const {
+    auto bin = static_cast<int>((centroid[axis] - centroid_bounds.min[axis]) *
+                                scale);
+    return static_cast<uint32_t>(
+        std::clamp(bin, 0, static_cast<int>(bin_count_) - 1));
+  }
+
+  void fill_bins(uint32_t begin, uint32_t end, const Aabb& centroid_bounds,
+                 const float* scales, Bin (*bins)[MAX_BIN_COUNT]) const {
+    auto body = [&](size_t b, size_t e, Bin(*out_bins)[MAX_BIN_COUNT]) {
+      for (size_t i = b; i < e; ++i) {
+        uint32_t prim = prim_indices_[i];
+        for (int axis = 0; axis < 3; ++axis) {
+          if (scales[axis] <= 0.0f) {
+            continue;
+          }
+          Bin& bin = out_bins[axis][bin_index(centroids_[prim], axis,
+                                              centroid_bounds, scales[axis])];
+          bin.bounds.grow(prim_bounds_[prim]);
+          ++bin.count;
+        }
+      }
+    };
+
+    if (end - begin < PARALLEL_BINNING_THRESHOLD) {
+      body(begin, end, bins);
+      return;
+    }
+
+    std::vector<Bin> partial(size_t(worker_count()) * 3 * MAX_BIN_COUNT);
+    parallel_for(begin, end, PARALLEL_BINNING_THRESHOLD / 4,
+                 [&](size_t b, size_t e, uint32_t worker) {
+                   body(b, e,
+                        reinterpret_cast<Bin(*)[MAX_BIN_COUNT]>(
+                            &partial[size_t(worker) * 3 * MAX_BIN_COUNT]));
+                 });
+    for (uint32_t w = 0; w < worker_count(); ++w) {
+      for (int axis = 0; axis < 3; ++axis) {
+        for (uint32_t i = 0; i < bin_count_; ++i) {
+          const Bin& src = partial[(size_t(w) * 3 + axis) * MAX_BIN_COUNT + i];
+          bins[axis][i].bounds.grow(src.bounds);
+          bins[axis][i].count += src.count;
+        }
+      }
+    }
+  }
+
+  [[nodiscard]] Split find_split(const Bin (*bins)[MAX_BIN_COUNT],
+                                 const float* scales, float inv_area) const {
+    Split best;
+    for (int axis = 0; axis < 3; ++axis) {
+      if (scales[axis] <= 0.0f) {
+        continue;
+      }
+
+      // sweep from the right, then evaluate every plane from the left
+      float right_cost[MAX_BIN_COUNT];
+      Aabb right_bounds;
+      uint32_t right_count = 0;
+      for (uint32_t i = bin_count_ - 1; i > 0; --i) {
+        right_bounds.grow(bins[axis][i].bounds);
+        right_count += bins[axis][i].count;
+        right_cost[i] = right_bounds.surface_area() * float(right_count);
+      }
+
+      Aabb left_bounds;
+      uint32_t left_count = 0;
+      for (uint32_t i = 1; i < bin_count_; ++i) {
+        left_bounds.grow(bins[axis][i - 1].bounds);
+        left_count += bins[axis][i - 1].count;
+        float cost =
+            settings_.traversal_cost +
+            settings_.intersection_cost * inv_area *
+                (left_bounds.surface_area() * float(left_count) +
+                 right_cost[i]);
+        if (cost < best.cost) {
+          best.axis = axis;
+          best.bin = i;
+          best.cost = cost;
+        }
+      }
+    }
+    return best;
+  }
+
+  void make_leaf(uint32_t node_index, uint32_t begin, uint32_t end) {
+    BvhBuildNode& node = nodes_[node_index];
+    node.first_prim = begin;
+    node.prim_count = end - begin;
+  }
+
+  void build_node(uint32_t node_index, uint32_t begin, uint32_t end,
+                  uint32_t depth) {
+    const uint32_t count = end - begin;
+    Aabb centroid_bounds;
+    nodes_[node_index].bounds = Aabb();
+    compute_bounds(begin, end, nodes_[node_index].bounds, centroid_bounds);
+
+    if (count == 1) {
+      make_leaf(node_index, begin, end);
+      return;
+    }
+
+    float scales[3];
+    Vec3f extent = centroid_bounds.extent();
+    for (int axis = 0; axis < 3; ++axis) {
+      scales[axis] = extent[axis] > 0.0f ? float(bin_count_) / extent[axis]
+                                         : 0.0f;
+    }
+
+    uint32_t mid = begin;
+    if (scales[0] > 0.0f || scales[1] > 0.0f || scales[2] > 0.0f) {
+      Bin bins[3][MAX_BIN_COUNT];
+      fill_bins(begin, end, centroid_bounds, scales, bins);
+
+      float area = nodes_[node_index].bounds.surface_area();
+      float inv_area = area > 0.0f ? 1.0f / area : 0.0f;
+      Split split = find_split(bins, scales, inv_area);
+
+      float leaf_cost = settings_.intersection_cost * float(count);
+      if (count <= max_leaf_size_ && leaf_cost <= split.cost) {
+        make_leaf(node_index, begin, end);
+        return;
+      }
+
+      if (split.axis >= 0) {
+        auto it = std::partition(
+            prim_indices_.begin() + begin, prim_indices_.begin() + end,
+            [&](uint32_t prim) {
+              return bin_index(centroids_[prim], split.axis, centroid_bounds,
+                               scales[split.axis]) < split.bin;
+            });
+        mid = static_cast<uint32_t>(it - prim_indices_.begin());
+      }
+    } else if (count <= max_leaf_size_) {
+      // every centroid coincides, nothing to split on
+      make_leaf(node_index, begin, end);
+      return;
+    }
+
+    if (mid == begin || mid == end) {
+      mid = begin + count / 2;
+    }
+
+    const uint32_t left = node_count_.fetch_add(2);
+    nodes_[node_index].children[0] = left;
+    nodes_[node_index].children[1] = left + 1;
+    nodes_[node_index].prim_count = 0;
+
+    if (count >= PARALLEL_SUBTREE_THRESHOLD && depth < max_parallel_depth_) {
+      auto task = std::async(std::launch::async, [&] {
+        build_node(left, begin, mid, depth + 1);
+      });
+      build_node(left + 1, mid, end, depth + 1);
+      task.get();
+    } else {
+      build_node(left, begin, mid, depth + 1);
+      build_node(left + 1, mid, end, depth + 1);
+    }
+  }
+};
+
+// morton code helpers
+uint64_t expand_bits_21(uint64_t v) {
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffffull;
+  v = (v | v << 16) & 0x1f0000ff0000ffull;
+  v = (v | v << 8) & 0x100f00f00f00f00full;
+  v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+  v = (v | v << 2) & 0x1249249249249249ull;
+  return v;
+}
+
+// 63-bit code, 21 bits per axis, p in [0, 1]
+uint64_t morton_code(const Vec3f& p) {
+  const float scale = float((1u << 21) - 1);
+  auto quantize = [&](float x) {
+    return static_cast<uint64_t>(std::clamp(x, 0.0f, 1.0f) * scale);
+  };
+  return expand_bits_21(quantize(p.x)) << 2 |
+         expand_bits_21(quantize(p.y)) << 1 | expand_bits_21(quantize(p.z));
+}
+
+int count_leading_zeros(uint64_t v) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  return _BitScanReverse64(&index, v) ? 63 - int(index) : 64;
+#else
+  return v ? __builtin_clzll(v) : 64;
+#endif
+}
+
+// parallel lsd radix sort of (key, value) pairs, 8 bits per pass. passes
+// whose digit is the same for every key are skipped.
+void radix_sort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values) {
+  const size_t n = keys.size();
+  const size_t min_chunk = 64 * 1024;
+  std::vector<uint64_t> tmp_keys(n);
+  std::vector<uint32_t> tmp_values(n);
+  std::vector<size_t> histograms(size_t(worker_count()) * 256);
+
+  for (int shift = 0; shift < 64; shift += 8) {
+    std::fill(histograms.begin(), histograms.end(), 0);
+    parallel_for(0, n, min_chunk, [&](size_t b, size_t e, uint32_t worker) {
+      size_t* histogram = &histograms[size_t(worker) * 256];
+      for (size_t i = b; i < e; ++i) {
+        ++histogram[(keys[i] >> shift) & 0xff];
+      }
+    });
+
+    // exclusive prefix over (digit, worker) keeps the sort stable
+    bool single_digit = false;
+    size_t offset = 0;
+    for (size_t digit = 0; digit < 256; ++digit) {
+      size_t digit_total = 0;
+      for (uint32_t w = 0; w < worker_count(); ++w) {
+        size_t count = histograms[size_t(w) * 256 + digit];
+        histograms[size_t(w) * 256 + digit] = offset;
+        offset += count;
+        digit_total += count;
+      }
+      single_digit = single_digit || digit_total == n;
+    }
+    if (single_digit) {
+      continue;
+    }
+
+    parallel_for(0, n, min_chunk, [&](size_t b, size_t e, uint32_t worker) {
+      size_t* offsets = &histograms[size_t(worker) * 256];
+      for (size_t i = b; i < e; ++i) {
+        size_t dst = offsets[(keys[i] >> shift) & 0xff]++;
+        tmp_keys[dst] = keys[i];
+        tmp_values[dst] = values[i];
+      }
+    });
+    keys.swap(tmp_keys);
+    values.swap(tmp_values);
+  }
+}
+
+// prim_indices sorted along the morton curve over the primitive centroids,
+// codes holds the sorted keys
+void sort_by_morton_code(const std::vector<Aabb>& prim_bounds,
+                         std::vector<uint64_t>& codes,
+                         std::vector<uint32_t>& prim_indices) {
+  const size_t n = prim_bounds.size();
+  std::vector<Aabb> partial(worker_count());
+  parallel_for(0, n, 4096, [&](size_t b, size_t e, uint32_t worker) {
+    for (size_t i = b; i < e; ++i) {
+      partial[worker].grow(prim_bounds[i].centroid());
+    }
+  });
+  Aabb centroid_bounds;
+  for (const auto& b : partial) {
+    centroid_bounds.grow(b);
+  }
+  Vec3f extent = centroid_bounds.extent();
+  Vec3f inv_extent(extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+                   extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+                   extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+  codes.resize(n);
+  prim_indices.resize(n);
+  parallel_for(0, n, 4096, [&](size_t b, size_t e, uint32_t) {
+    for (size_t i = b; i < e; ++i) {
+      Vec3f p = prim_bounds[i].centroid() - centroid_bounds.min;
+      codes[i] = morton_code(
+          Vec3f(p.x * inv_extent.x, p.y * inv_extent.y, p.z * inv_extent.z));
+      prim_indices[i] = static_cast<uint32_t>(i);
+    }
+  });
+  radix_sort(codes, prim_indices);
+}
+
+// linear bvh: primitives sorted along a morton curve, hierarchy emitted in
+// parallel (karras 2012), bounds fitted bottom up. subtrees that are cheaper
+// as a leaf under the sah are collapsed on the way up.
+class LbvhBuilder {
+ public:
+  LbvhBuilder(const std::vector<Aabb>& prim_bounds,
+              const BvhBuildSettings& settings,
+              std::vector<BvhBuildNode>& nodes,
+              std::vector<uint32_t>& prim_indices)
+      : prim_bounds_(prim_bounds),
+        settings_(settings),
+        nodes_(nodes),
+        prim_indices_(prim_indices) {}
+
+  void build() {
+    n_ = static_cast<uint32_t>(prim_bounds_.size());
+    if (n_ == 1) {
+      nodes_.resize(1);
+      nodes_[0].bounds = prim_bounds_[0];
+      nodes_[0].first_prim = 0;
+      nodes_[0].prim_count = 1;
+      prim_indices_.assign(1, 0);
+      return;
+    }
+
+    sort_by_morton_code(prim_bounds_, codes_, prim_indices_);
+
+    // internal nodes are [0, n - 1), leaf i is node n - 1 + i
+    nodes_.resize(2 * size_t(n_) - 1);
+    parents_.resize(nodes_.size());
+    parents_[0] = ~0u;
+    parallel_for(0, n_ - 1, 4096, [&](size_t b, size_t e, uint32_t) {
+      for (size_t i = b; i < e; ++i) {
+        emit_internal(static_cast<int64_t>(i));
+      }
+    });
+
+    costs_.resize(nodes_.size());
+    visits_ = std::vector<std::atomic<uint32_t>>(n_ - 1);
+    for (auto& visit : visits_) {
+      visit.store(0, std::memory_order_relaxed);
+    }
+    parallel_for(0, n_, 4096, [&](size_t b, size_t e, uint32_t) {
+      for (size_t i = b; i < e; ++i) {
+        fit_from_leaf(static_cast<uint32_t>(i));
+      }
+    });
+  }
+
+ private:
+  const std::vector<Aabb>& prim_bounds_;
+  const BvhBuildSettings& settings_;
+  std::vector<BvhBuildNode>& nodes_;
+  std::vector<uint32_t>& prim_indices_;
+
+  uint32_t n_{0};
+  std::vector<uint64_t> codes_;
+  std::vector<uint32_t> parents_;
+  std::vector<float> costs_;
+  std::vector<std::atomic<uint32_t>> visits_;
+
+  // length of the common prefix of keys i and j, equal codes fall back to
+  // the index so every key is unique
+  [[nodiscard]] int delta(int64_t i, int64_t j) const {
+    if (j < 0 || j >= int64_t(n_)) {
+      return -1;
+    }
+    if (codes_[i] == codes_[j]) {
+      return 64 + count_leading_zeros(uint64_t(i ^ j) << 32);
+    }
+    return count_leading_zeros(codes_[i] ^ codes_[j]);
+  }
+
+  void emit_internal(int64_t i) {
+    // direction of the range and its other end
+    const int64_t d = delta(i, i + 1) - delta(i, i - 1) >= 0 ? 1 : -1;
+    const int delta_min = delta(i, i - d);
+    int64_t l_max = 2;
+    while (delta(i, i + l_max * d) > delta_min) {
+      l_max *= 2;
+    }
+    int64_t l = 0;
+    for (int64_t t = l_max / 2; t >= 1; t /= 2) {
+      if (delta(i, i + (l + t) * d) > delta_min) {
+        l += t;
+      }
+    }
+    const int64_t j = i + l * d;
+
+    // split position
+    const int delta_node = delta(i, j);
+    int64_t s = 0;
+    for (int64_t t = (l + 1) / 2;; t = (t + 1) / 2) {
+      if (delta(i, i + (s + t) * d) > delta_node) {
+        s += t;
+      }
+      if (t == 1) {
+        break;
+      }
+    }
+    const int64_t gamma = i + s * d + std::min<int64_t>(d, 0);
+
+    const auto first = static_cast<uint32_t>(std::min(i, j));
+    const auto last = static_cast<uint32_t>(std::max(i, j));
+    const auto split = static_cast<uint32_t>(gamma);
+    BvhBuildNode& node = nodes_[i];
+    node.children[0] = first == split ? n_ - 1 + split : split;
+    node.children[1] = last == split + 1 ? n_ - 1 + split + 1 : split + 1;
+    node.first_prim = first;
+    node.prim_count = 0;
+    parents_[node.children[0]] = static_cast<uint32_t>(i);
+    parents_[node.children[1]] = static_cast<uint32_t>(i);
+  }
+
+  void fit_from_leaf(uint32_t leaf) {
+    uint32_t index = n_ - 1 + leaf;
+    BvhBuildNode& node = nodes_[index];
+    node.bounds = prim_bounds_[prim_indices_[leaf]];
+    node.first_prim = leaf;
+    node.prim_count = 1;
+    costs_[index] = settings_.intersection_cost * node.bounds.surface_area();
+
+    // the second child to arrive fits the parent
+    index = parents_[index];
+    while (index != ~0u &&
+           visits_[index].fetch_add(1, std::memory_order_acq_rel) == 1) {
+      BvhBuildNode& parent = nodes_[index];
+      const uint32_t left = parent.children[0];
+      const uint32_t right = parent.children[1];
+      parent.bounds = nodes_[left].bounds;
+      parent.bounds.grow(nodes_[right].bounds);
+
+      const float area = parent.bounds.surface_area();
+      const uint32_t count =
+          subtree_prim_count(left) + subtree_prim_count(right);
+      const float split_cost =
+          settings_.traversal_cost * area + costs_[left] + costs_[right];
+      const float leaf_cost = settings_.intersection_cost * area * float(count);
+      if (count <= settings_.max_leaf_size && leaf_cost <= split_cost) {
+        parent.prim_count = count;
+        costs_[index] = leaf_cost;
+      } else {
+        costs_[index] = split_cost;
+      }
+      index = parents_[index];
+    }
+  }
+
+  [[nodiscard]] uint32_t subtree_prim_count(uint32_t index) const {
+    const BvhBuildNode& node = nodes_[index];
+    if (node.is_leaf()) {
+      return node.prim_count;
+    }
+    // not collapsed, so larger than any leaf
+    return std::numeric_limits<uint32_t>::max() / 4;
+  }
+};
+
+// spatial split bvh (stich et al. 2009). references to primitives carry their
+// own, possibly clipped, bounds. a spatial split is tried when the children of
+// the best object split overlap, and straddling references are clipped into
+// both children while the duplication budget lasts.
+class SbvhBuilder {
+ public:
+  SbvhBuilder(const std::vector<Aabb>& prim_bounds,
+              const BvhBuildSettings& settings, const PrimClipper& clipper,
+              std::vector<BvhBuildNode>& nodes,
+              std::vector<uint32_t>& prim_indices)
+      : prim_bounds_(prim_bounds),
+        settings_(settings),
+        clipper_(clipper),
+        nodes_(nodes),
+        prim_indices_(prim_indices) {
+    bin_count_ = std::clamp(settings.bin_count, 2u, MAX_BIN_COUNT);
+    max_leaf_size_ = std::max(1u, settings.max_leaf_size);
+
+    uint32_t threads = worker_count();
+    while (threads > 1) {
+      threads >>= 1;
+      ++max_parallel_depth_;
+    }
+    max_parallel_depth_ += 2;
+  }
+
+  void build() {
+    const auto prim_count = static_cast<uint32_t>(prim_bounds_.size());
+    std::vector<Ref> refs(prim_count);
+    Aabb root_bounds;
+    for (uint32_t i = 0; i < prim_count; ++i) {
+      refs[i].bounds = prim_bounds_[i];
+      refs[i].prim = i;
+      root_bounds.grow(prim_bounds_[i]);
+    }
+    root_area_ = root_bounds.surface_area();
+
+    const float duplication = std::max(0.0f, settings_.sbvh_max_duplication);
+    const auto max_refs =
+        static_cast<size_t>(double(prim_count) * (1.0 + duplication));
+    split_budget_ = static_cast<int64_t>(max_refs) - prim_count;
+
+    nodes_.resize(2 * std::max<size_t>(max_refs, prim_count) - 1);
+    node_count_ = 1;
+    prim_indices_.clear();
+    prim_indices_.reserve(max_refs);
+    build_node(0, std::move(refs), root_bounds, 0);
+    nodes_.resize(node_count_);
+  }
+
+ private:
+  struct Ref {
+    Aabb bounds;
+    uint32_t prim{0};
+  };
+
+  struct SpatialBin {
+    Aabb bounds;
+    uint32_t enter{0};
+    uint32_t exit{0};
+  };
+
+  const std::vector<Aabb>& prim_bounds_;
+  const BvhBuildSettings& settings_;
+  const PrimClipper& clipper_;
+  std::vector<BvhBuildNode>& nodes_;
+  std::vector<uint32_t>& prim_indices_;
+
+  std::atomic<uint32_t> node_count_{0};
+  std::atomic<int64_t> split_budget_{0};
+  std::mutex prim_indices_mutex_;
+  float root_area_{0.0f};
+  uint32_t bin_count_{0};
+  uint32_t max_leaf_size_{0};
+  uint32_t max_parallel_depth_{0};
+
+  [[nodiscard]] Aabb clip(const Ref& ref, int axis, float lo, float hi) const {
+    Aabb clipped;
+    if (clipper_) {
+      clipped = clipper_(ref.prim, axis, lo, hi);
+    } else {
+      clipped = ref.bounds;
+    }
+    // never grow past the reference, nor past the slab
+    clipped.min = Vec3f::max(clipped.min, ref.bounds.min);
+    clipped.max = Vec3f::min(clipped.max, ref.bounds.max);
+    clipped.min[axis] = std::max(clipped.min[axis], lo);
+    clipped.max[axis] = std::min(clipped.max[axis], hi);
+    return clipped;
+  }
+
+  void make_leaf(uint32_t node_index, const std::vector<Ref>& refs) {
+    BvhBuildNode& node = nodes_[node_index];
+    std::lock_guard<std::mutex> lock(prim_indices_mutex_);
+    node.first_prim = static_cast<uint32_t>(prim_indices_.size());
+    node.prim_count = static_cast<uint32_t>(refs.size());
+    for (const auto& ref : refs) {
+      prim_indices_.push_back(ref.prim);
+    }
+  }
+
+  // binned object split over reference centroids, fills the child bounds of
+  // the winning split for the overlap test
+  Split find_object_split(const std::vector<Ref>& refs, const Aabb& bounds,
+                          Aabb& left_bounds, Aabb& right_bounds) const {
+    Aabb centroid_bounds;
+    for (const auto& ref : refs) {
+      centroid_bounds.grow(ref.bounds.centroid());
+    }
+
+    const float inv_area = 1.0f / std::max(bounds.surface_area(), 1e-30f);
+    Vec3f extent = centroid_bounds.extent();
+    Split best;
+    for (int axis = 0; axis < 3; ++axis) {
+      if (extent[axis] <= 0.0f) {
+        continue;
+      }
+      const float scale = float(bin_count_) / extent[axis];
+      Bin bins[MAX_BIN_COUNT];
+      for (const auto& ref : refs) {
+        auto b = static_cast<int>(
+            (ref.bounds.centroid()[axis] - centroid_bounds.min[axis]) * scale);
+        Bin& bin = bins[std::clamp(b, 0, int(bin_count_) - 1)];
+        bin.bounds.grow(ref.bounds);
+        ++bin.count;
+      }
+
+      Aabb right_acc[MAX_BIN_COUNT];
+      uint32_t right_count[MAX_BIN_COUNT];
+      Aabb acc;
+      uint32_t count = 0;
+      for (uint32_t i = bin_count_ - 1; i > 0; --i) {
+        acc.grow(bins[i].bounds);
+        count += bins[i].count;
+        right_acc[i] = acc;
+        right_count[i] = count;
+      }
+      acc = Aabb();
+      count = 0;
+      for (uint32_t i = 1; i < bin_count_; ++i) {
+        acc.grow(bins[i - 1].bounds);
+        count += bins[i - 1].count;
+        float cost = settings_.traversal_cost +
+                     settings_.intersection_cost * inv_area *
+                         (acc.surface_area() * float(count) +
+                          right_acc[i].surface_area() * float(right_count[i]));
+        if (count > 0 && right_count[i] > 0 && cost < best.cost) {
+          best.axis = axis;
+          best.bin = i;
+          best.cost = cost;
+          best.position = centroid_bounds.min[axis] + float(i) / scale;
+          left_bounds = acc;
+          right_bounds = right_acc[i];
+        }
+      }
+    }
+    return best;
+  }
+
+  Split find_spatial_split(const std::vector<Ref>& refs,
+                           const Aabb& bounds) const {
+    const float inv_area = 1.0f / std::max(bounds.surface_area(), 1e-30f);
+    Vec3f extent = bounds.extent();
+    Split best;
+    for (int axis = 0; axis < 3; ++axis) {
+      if (extent[axis] <= 0.0f) {
+        continue;
+      }
+      const float origin = bounds.min[axis];
+      const float bin_width = extent[axis] / float(bin_count_);
+      auto bin_of = [&](float x) {
+        return std::clamp(static_cast<int>((x - origin) / bin_width), 0,
+                          int(bin_count_) - 1);
+      };
+
+      SpatialBin bins[MAX_BIN_COUNT];
+      for (const auto& ref : refs) {
+        int first = bin_of(ref.bounds.min[axis]);
+        int last = bin_of(ref.bounds.max[axis]);
+        for (int b = first; b <= last; ++b) {
+          float lo = origin + float(b) * bin_width;
+          float hi = b + 1 == int(bin_count_) ? bounds.max[axis]
+                                              : lo + bin_width;
+          bins[b].bounds.grow(first == last ? ref.bounds
+                                            : clip(ref, axis, lo, hi));
+        }
+        ++bins[first].enter;
+        ++bins[last].exit;
+      }
+
+      float right_cost[MAX_BIN_COUNT];
+      Aabb acc;
+      uint32_t count = 0;
+      for (uint32_t i = bin_count_ - 1; i > 0; --i) {
+        acc.grow(bins[i].bounds);
+        count += bins[i].exit;
+        right_cost[i] = count ? acc.surface_area() * float(count) : -1.0f;
+      }
+      acc = Aabb();
+      count = 0;
+      for (uint32_t i = 1; i < bin_count_; ++i) {
+        acc.grow(bins[i - 1].bounds);
+        count += bins[i - 1].enter;
+        if (count == 0 || right_cost[i] < 0.0f) {
+          continue;
+        }
+        float cost = settings_.traversal_cost +
+                     settings_.intersection_cost * inv_area *
+                         (acc.surface_area() * float(count) + right_cost[i]);
+        if (cost < best.cost) {
+          best.axis = axis;
+          best.bin = i;
+          best.cost = cost;
+          best.position = origin + float(i) * bin_width;
+        }
+      }
+    }
+    return best;
+  }
+
+  void split_spatial(std::vector<Ref>& refs, const Split& split,
+                     std::vector<Ref>& left, std::vector<Ref>& right) {
+    const int axis = split.axis;
+    const float pos = split.position;
+
+    Aabb left_bounds;
+    Aabb right_bounds;
+    std::vector<Ref> straddling;
+    for (auto& ref : refs) {
+      if (ref.bounds.max[axis] <= pos) {
+        left_bounds.grow(ref.bounds);
+        left.push_back(ref);
+      } else if (ref.bounds.min[axis] >= pos) {
+        right_bounds.grow(ref.bounds);
+        right.push_back(ref);
+      } else {
+        straddling.push_back(ref);
+      }
+    }
+
+    for (auto& ref : straddling) {
+      // unsplitting: keep the whole reference on one side when that is
+      // cheaper than duplicating it, or when the budget has run out
+      float left_count = float(left.size());
+      float right_count = float(right.size());
+      Aabb left_with = left_bounds;
+      left_with.grow(ref.bounds);
+      Aabb right_with = right_bounds;
+      right_with.grow(ref.bounds);
+      Aabb left_piece = clip(ref, axis, -std::numeric_limits<float>::max(),
+                             pos);
+      Aabb right_piece = clip(ref, axis, pos,
+                              std::numeric_limits<float>::max());
+      Aabb left_split = left_bounds;
+      left_split.grow(left_piece);
+      Aabb right_split = right_bounds;
+      right_split.grow(right_piece);
+
+      float cost_split = left_split.surface_area() * (left_count + 1) +
+                         right_split.surface_area() * (right_count + 1);
+      float cost_left = left_with.surface_area() * (left_count + 1) +
+                        right_bounds.surface_area() * right_count;
+      float cost_right = left_bounds.surface_area() * left_count +
+                         right_with.surface_area() * (right_count + 1);
+
+      bool duplicate = cost_split < cost_left && cost_split < cost_right &&
+                       !left_piece.empty() && !right_piece.empty() &&
+                       split_budget_.fetch_sub(1) > 0;
+      if (duplicate) {
+        left_bounds = left_split;
+        right_bounds = right_split;
+        left.push_back(Ref{left_piece, ref.prim});
+        right.push_back(Ref{right_piece, ref.prim});
+      } else if (cost_left <= cost_right) {
+        left_bounds = left_with;
+        left.push_back(ref);
+      } else {
+        right_bounds = right_with;
+        right.push_back(ref);
+      }
+    }
+  }
+
+  void build_node(uint32_t node_index, std::vector<Ref> refs,
+                  const Aabb& bounds, uint32_t depth) {
+    nodes_[node_index].bounds = bounds;
+    const auto count = static_cast<uint32_t>(refs.size());
+    if (count == 1) {
+      make_leaf(node_index, refs);
+      return;
+    }
+
+    Aabb object_left;
+    Aabb object_right;
+    Split split = find_object_split(refs, bounds, object_left, object_right);
+
+    bool spatial = false;
+    if (split_budget_.load(std::memory_order_relaxed) > 0) {
+      Aabb overlap;
+      overlap.min = Vec3f::max(object_left.min, object_right.min);
+      overlap.max = Vec3f::min(object_left.max, object_right.max);
+      if (split.axis < 0 ||
+          overlap.surface_area() > settings_.sbvh_alpha * root_area_) {
+        Split spatial_split = find_spatial_split(refs, bounds);
+        if (spatial_split.cost < split.cost) {
+          split = spatial_split;
+          spatial = true;
+        }
+      }
+    }
+
+    const float leaf_cost = settings_.intersection_cost * float(count);
+    if (count <= max_leaf_size_ && leaf_cost <= split.cost) {
+      make_leaf(node_index, refs);
+      return;
+    }
+
+    std::vector<Ref> left;
+    std::vector<Ref> right;
+    if (spatial) {
+      split_spatial(refs, split, left, right);
+    } else if (split.axis >= 0) {
+      for (auto& ref : refs) {
+        (ref.bounds.centroid()[split.axis] < split.position ? left : right)
+            .push_back(ref);
+      }
+    }
+    if (left.empty() || right.empty()) {
+      if (count <= max_leaf_size_) {
+        make_leaf(node_index, refs);
+        return;
+      }
+      left.assign(refs.begin(), refs.begin() + count / 2);
+      right.assign(refs.begin() + count / 2, refs.end());
+    }
+    refs.clear();
+    refs.shrink_to_fit();
+
+    Aabb left_bounds;
+    for (const auto& ref : left) {
+      left_bounds.grow(ref.bounds);
+    }
+    Aabb right_bounds;
+    for (const auto& ref : right) {
+      right_bounds.grow(ref.bounds);
+    }
+
+    const uint32_t child = node_count_.fetch_add(2);
+    nodes_[node_index].children[0] = child;
+    nodes_[node_index].children[1] = child + 1;
+    nodes_[node_index].prim_count = 0;
+
+    if (count >= PARALLEL_SUBTREE_THRESHOLD && depth < max_parallel_depth_) {
+      auto task = std::async(std::launch::async, [&] {
+        build_node(child, std::move(left), left_bounds, depth + 1);
+      });
+      build_node(child + 1, std::move(right), right_bounds, depth + 1);
+      task.get();
+    } else {
+      build_node(child, std::move(left), left_bounds, depth + 1);
+      build_node(child + 1, std::move(right), right_bounds, depth + 1);
+    }
+  }
+};
+
+// parallel locally ordered clustering (meister and bittner 2018). clusters
+// start as single primitives in morton order, every round each cluster finds
+// the neighbor within settings.ploc_radius positions whose merged box has the
+// smallest area, and mutual nearest neighbors merge. the hierarchy is built
+// bottom up, better than the lbvh it starts from but short of the binned sah
+// build, see --bench_builders. leaves hold one primitive and are collapsed
+// under the sah at the end.
+class PlocBuilder {
+ public:
+  PlocBuilder(const std::vector<Aabb>& prim_bounds,
+              const BvhBuildSettings& settings,
+              std::vector<BvhBuildNode>& nodes,
+              std::vector<uint32_t>& prim_indices)
+      : prim_bounds_(prim_bounds),
+        settings_(settings),
+        nodes_(nodes),
+        prim_indices_(prim_indices) {
+    radius_ = std::max(1u, settings.ploc_radius);
+  }
+
+  void build() {
+    const auto n = static_cast<uint32_t>(prim_bounds_.size());
+    std::vector<uint64_t> codes;
+    sort_by_morton_code(prim_bounds_, codes, prim_indices_);
+
+    // leaves are [0, n), merged nodes follow. the root is moved to node 0
+    // at the end.
+    nodes_.resize(2 * size_t(n) - 1);
+    clusters_.resize(n);
+    cluster_bounds_.resize(n);
+    parallel_for(0, n, 4096, [&](size_t b, size_t e, uint32_t) {
+      for (size_t i = b; i < e; ++i) {
+        BvhBuildNode& leaf = nodes_[i];
+        leaf.bounds = prim_bounds_[prim_indices_[i]];
+        leaf.first_prim = static_cast<uint32_t>(i);
+        leaf.prim_count = 1;
+        clusters_[i] = static_cast<uint32_t>(i);
+        cluster_bounds_[i] = leaf.bounds;
+      }
+    });
+
+    uint32_t node_count = n;
+    while (clusters_.size() > 1) {
+      find_nearest_neighbors();
+      node_count = merge(node_count);
+    }
+
+    const uint32_t root = clusters_[0];
+    if (root != 0) {
+      std::swap(nodes_[0], nodes_[root]);
+      replace_child(0, root);
+    }
+    collapse_leaves();
+  }
+
+ private:
+  const std::vector<Aabb>& prim_bounds_;
+  const BvhBuildSettings& settings_;
+  std::vector<BvhBuildNode>& nodes_;
+  std::vector<uint32_t>& prim_indices_;
+
+  uint32_t radius_{0};
+  // current clusters in morton order, as node indices
+  std::vector<uint32_t> clusters_;
+  std::vector<Aabb> cluster_bounds_;
+  std::vector<uint32_t> neighbors_;
+
+  void find_nearest_neighbors() {
+    const auto count = static_cast<int64_t>(clusters_.size());
+    neighbors_.resize(clusters_.size());
+    parallel_for(0, clusters_.size(), 1024, [&](size_t b, size_t e, uint32_t) {
+      for (auto i = static_cast<int64_t>(b); i < int64_t(e); ++i) {
+        // ties go to the lower neighbor, so the globally smallest pair is
+        // always mutual and every round merges at least once
+        float best_area = std::numeric_limits<float>::max();
+        int64_t best = -1;
+        const int64_t lo = std::max<int64_t>(0, i - radius_);
+        const int64_t hi = std::min<int64_t>(count - 1, i + radius_);
+        for (int64_t j = lo; j <= hi; ++j) {
+          if (j == i) {
+            continue;
+          }
+          Aabb merged = cluster_bounds_[i];
+          merged.grow(cluster_bounds_[j]);
+          float area = merged.surface_area();
+          if (area < best_area) {
+            best_area = area;
+            best = j;
+          }
+        }
+        neighbors_[i] = static_cast<uint32_t>(best);
+      }
+    });
+  }
+
+  // merges mutual nearest neighbors into the lower cluster and compacts the
+  // cluster list, returns the new node count. chunks of the two parallel_for
+  // calls are the same, so each chunk knows its output offsets.
+  uint32_t merge(uint32_t node_count) {
+    const size_t count = clusters_.size();
+    const size_t min_chunk = 4096;
+    std::vector<uint32_t> kept(worker_count() + 1, 0);
+    std::vector<uint32_t> merged(worker_count() + 1, 0);
+    parallel_for(0, count, min_chunk, [&](size_t b, size_t e, uint32_t worker) {
+      for (size_t i = b; i < e; ++i) {
+        const uint32_t j = neighbors_[i];
+        const bool mutual = neighbors_[j] == i;
+        if (!mutual || i < j) {
+          ++kept[worker + 1];
+        }
+        if (mutual && i < j) {
+          ++merged[worker + 1];
+        }
+      }
+    });
+    for (size_t w = 1; w < kept.size(); ++w) {
+      kept[w] += kept[w - 1];
+      merged[w] += merged[w - 1];
+    }
+
+    std::vector<uint32_t> clusters(kept.back());
+    std::vector<Aabb> cluster_bounds(kept.back());
+    parallel_for(0, count, min_chunk, [&](size_t b, size_t e, uint32_t worker) {
+      uint32_t out = kept[worker];
+      uint32_t node = node_count + merged[worker];
+      for (size_t i = b; i < e; ++i) {
+        const uint32_t j = neighbors_[i];
+        const bool mutual = neighbors_[j] == i;
+        if (mutual && i > j) {
+          continue;
+        }
+        if (mutual) {
+          BvhBuildNode& parent = nodes_[node];
+          parent.bounds = cluster_bounds_[i];
+          parent.bounds.grow(cluster_bounds_[j]);
+          parent.children[0] = clusters_[i];
+          parent.children[1] = clusters_[j];
+          parent.prim_count = 0;
+          clusters[out] = node++;
+          cluster_bounds[out] = parent.bounds;
+        } else {
+          clusters[out] = clusters_[i];
+          cluster_bounds[out] = cluster_bounds_[i];
+        }
+        ++out;
+      }
+    });
+    clusters_.swap(clusters);
+    cluster_bounds_.swap(cluster_bounds);
+    return node_count + merged.back();
+  }
+
+  // the node that moved from index 0 to from still has a parent pointing at
+  // index 0
+  void replace_child(uint32_t root, uint32_t from) {
+    std::vector<uint32_t> stack{root};
+    while (!stack.empty()) {
+      BvhBuildNode& node = nodes_[stack.back()];
+      stack.pop_back();
+      if (node.is_leaf()) {
+        continue;
+      }
+      for (auto& child : node.children) {
+        if (child == 0) {
+          child = from;
+          return;
+        }
+        stack.push_back(child);
+      }
+    }
+  }
+
+  // orders prim_indices depth first so every subtree is a contiguous range,
+  // then turns subtrees that are cheaper as a leaf under the sah into leaves
+  void collapse_leaves() {
+    std::vector<uint32_t> order;
+    order.reserve(nodes_.size());
+    std::vector<uint32_t> stack{0};
+    while (!stack.empty()) {
+      uint32_t index = stack.back();
+      stack.pop_back();
+      order.push_back(index);
+      if (!nodes_[index].is_leaf()) {
+        stack.push_back(nodes_[index].children[1]);
+        stack.push_back(nodes_[index].children[0]);
+      }
+    }
+
+    std::vector<uint32_t> sorted;
+    sorted.reserve(prim_indices_.size());
+    for (uint32_t index : order) {
+      BvhBuildNode& node = nodes_[index];
+      if (node.is_leaf()) {
+        sorted.push_back(prim_indices_[node.first_prim]);
+        node.first_prim = static_cast<uint32_t>(sorted.size() - 1);
+      }
+    }
+    prim_indices_.swap(sorted);
+
+    std::vector<float> costs(nodes_.size());
+    std::vector<uint32_t> counts(nodes_.size());
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+      BvhBuildNode& node = nodes_[*it];
+      const float area = node.bounds.surface_area();
+      if (node.is_leaf()) {
+        counts[*it] = 1;
+        costs[*it] = settings_.intersection_cost * area;
+        continue;
+      }
+      const uint32_t left = node.children[0];
+      const uint32_t right = node.children[1];
+      counts[*it] = counts[left] + counts[right];
+      const float split_cost =
+          settings_.traversal_cost * area + costs[left] + costs[right];
+      const float leaf_cost =
+          settings_.intersection_cost * area * float(counts[*it]);
+      node.first_prim = nodes_[left].first_prim;
+      if (counts[*it] <= settings_.max_leaf_size && leaf_cost <= split_cost) {
+        node.prim_count = counts[*it];
+        costs[*it] = leaf_cost;
+      } else {
+        costs[*it] = split_cost;
+      }
+    }
+  }
+};
+
+// leaves of a restructured treelet, the dynamic program visits 3^n subsets
+const uint32_t TREELET_LEAF_COUNT = 7;
+// optimization passes over the whole tree while the time budget lasts
+const uint32_t TREELET_MAX_PASSES = 3;
+
+// treelet restructuring after karras and aila. every interior node, bottom
+// up, grows a treelet of up to TREELET_LEAF_COUNT leaves by opening its
+// largest children and replaces the treelet by its lowest sah topology. the
+// bounds of a treelet root never change, so the pass can stop anywhere.
+class TreeletOptimizer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  TreeletOptimizer(std::vector<BvhBuildNode>& nodes,
+                   const BvhBuildSettings& settings, Clock::time_point deadline)
+      : nodes_(nodes), settings_(settings), deadline_(deadline) {
+    costs_.resize(nodes_.size());
+    compute_cost(0);
+  }
+
+  // returns the number of finished passes
+  uint32_t optimize() {
+    uint32_t passes = 0;
+    while (passes < TREELET_MAX_PASSES && Clock::now() < deadline_) {
+      // subtrees below the cut are independent, the nodes above it go last
+      uint32_t cut_depth = 2;
+      for (uint32_t n = worker_count() * 4; n > 1; n >>= 1) {
+        ++cut_depth;
+      }
+      std::vector<uint32_t> subtrees;
+      std::vector<uint32_t> top;
+      std::vector<std::pair<uint32_t, uint32_t>> stack;
+      stack.emplace_back(0, 0);
+      while (!stack.empty()) {
+        auto [index, depth] = stack.back();
+        stack.pop_back();
+        const BvhBuildNode& node = nodes_[index];
+        if (node.is_leaf() || depth == cut_depth) {
+          subtrees.push_back(index);
+          continue;
+        }
+        top.push_back(index);
+        stack.emplace_back(node.children[1], depth + 1);
+        stack.emplace_back(node.children[0], depth + 1);
+      }
+
+      std::atomic<bool> finished{true};
+      parallel_for(0, subtrees.size(), 1, [&](size_t b, size_t e, uint32_t) {
+        for (size_t i = b; i < e; ++i) {
+          if (!optimize_subtree(subtrees[i])) {
+            finished = false;
+          }
+        }
+      });
+      for (auto it = top.rbegin(); it != top.rend(); ++it) {
+        if (Clock::now() >= deadline_) {
+          finished = false;
+          break;
+        }
+        optimize_treelet(*it);
+      }
+      if (!finished) {
+        break;
+      }
+      ++passes;
+    }
+    return passes;
+  }
+
+ private:
+  std::vector<BvhBuildNode>& nodes_;
+  const BvhBuildSettings& settings_;
+  const Clock::time_point deadline_;
+  // sah cost of every subtree, scaled by area instead of normalized
+  std::vector<float> costs_;
+
+  void compute_cost(uint32_t root) {
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> stack{root};
+    while (!stack.empty()) {
+      uint32_t index = stack.back();
+      stack.pop_back();
+      order.push_back(index);
+      if (!nodes_[index].is_leaf()) {
+        stack.push_back(nodes_[index].children[0]);
+        stack.push_back(nodes_[index].children[1]);
+      }
+    }
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+      const BvhBuildNode& node = nodes_[*it];
+      const float area = node.bounds.surface_area();
+      if (node.is_leaf()) {
+        costs_[*it] =
+            settings_.intersection_cost * area * float(node.prim_count);
+      } else {
+        costs_[*it] = settings_.traversal_cost * area +
+                      costs_[node.children[0]] + costs_[node.children[1]];
+      }
+    }
+  }
+
+  // post order over the subtree, false when the deadline cut it short
+  bool optimize_subtree(uint32_t root) {
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> stack{root};
+    while (!stack.empty()) {
+      uint32_t index = stack.back();
+      stack.pop_back();
+      if (!nodes_[index].is_leaf()) {
+        order.push_back(index);
+        stack.push_back(nodes_[index].children[0]);
+        stack.push_back(nodes_[index].children[1]);
+      }
+    }
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+      if (Clock::now() >= deadline_) {
+        return false;
+      }
+      optimize_treelet(*it);
+    }
+    return true;
+  }
+
+  void optimize_treelet(uint32_t root) {
+    // open the largest interior leaf until the treelet is full, the opened
+    // nodes are reused as the interior nodes of the new topology
+    uint32_t leaves[TREELET_LEAF_COUNT];
+    uint32_t interiors[TREELET_LEAF_COUNT - 1];
+    uint32_t leaf_count = 0;
+    uint32_t interior_count = 0;
+    interiors[interior_count++] = root;
+    leaves[leaf_count++] = nodes_[root].children[0];
+    leaves[leaf_count++] = nodes_[root].children[1];
+    while (leaf_count < TREELET_LEAF_COUNT) {
+      int largest = -1;
+      float largest_area = -1.0f;
+      for (uint32_t i = 0; i < leaf_count; ++i) {
+        const BvhBuildNode& node = nodes_[leaves[i]];
+        float area = node.bounds.surface_area();
+        if (!node.is_leaf() && area > largest_area) {
+          largest = static_cast<int>(i);
+          largest_area = area;
+        }
+      }
+      if (largest < 0) {
+        break;
+      }
+      const BvhBuildNode& opened = nodes_[leaves[largest]];
+      interiors[interior_count++] = leaves[largest];
+      leaves[largest] = opened.children[0];
+      leaves[leaf_count++] = opened.children[1];
+    }
+    if (leaf_count < 3) {
+      return;
+    }
+
+    // lowest cost of every subset of leaves. a subset only splits into
+    // numerically smaller subsets, so one ascending sweep is enough
+    const uint32_t subset_count = 1u << leaf_count;
+    Aabb bounds[1u << TREELET_LEAF_COUNT];
+    float cost[1u << TREELET_LEAF_COUNT];
+    uint8_t partition[1u << TREELET_LEAF_COUNT];
+    for (uint32_t subset = 1; subset < subset_count; ++subset) {
+      const uint32_t lowest = subset & (0u - subset);
+      if (subset == lowest) {
+        uint32_t leaf = 0;
+        while (!(subset & (1u << leaf))) {
+          ++leaf;
+        }
+        bounds[subset] = nodes_[leaves[leaf]].bounds;
+        cost[subset] = costs_[leaves[leaf]];
+        continue;
+      }
+      bounds[subset] = bounds[subset ^ lowest];
+      bounds[subset].grow(bounds[lowest]);
+
+      // the side holding the lowest leaf, so every split is seen once
+      float best = std::numeric_limits<float>::max();
+      uint32_t best_part = lowest;
+      for (uint32_t part = (subset - 1) & subset; part;
+           part = (part - 1) & subset) {
+        if (!(part & lowest)) {
+          continue;
+        }
+        float c = cost[part] + cost[subset ^ part];
+        if (c < best) {
+          best = c;
+          best_part = part;
+        }
+      }
+      cost[subset] =
+          settings_.traversal_cost * bounds[subset].surface_area() + best;
+      partition[subset] = static_cast<uint8_t>(best_part);
+    }
+
+    const uint32_t all = subset_count - 1;
+    if (!(cost[all] < costs_[root] * (1.0f - 1e-5f))) {
+      return;
+    }
+
+    // emit the new topology top down into the reused interior nodes
+    std::pair<uint32_t, uint32_t> stack[TREELET_LEAF_COUNT];
+    uint32_t stack_size = 0;
+    uint32_t next_interior = 1;
+    stack[stack_size++] = {all, root};
+    while (stack_size > 0) {
+      auto [subset, index] = stack[--stack_size];
+      BvhBuildNode& node = nodes_[index];
+      node.bounds = bounds[subset];
+      node.prim_count = 0;
+      costs_[index] = cost[subset];
+      const uint32_t sides[2] = {partition[subset], subset ^ partition[subset]};
+      for (int i = 0; i < 2; ++i) {
+        const uint32_t side = sides[i];
+        if ((side & (side - 1)) == 0) {
+          uint32_t leaf = 0;
+          while (!(side & (1u << leaf))) {
+            ++leaf;
+          }
+          node.children[i] = leaves[leaf];
+        } else {
+          node.children[i] = interiors[next_interior++];
+          stack[stack_size++] = {side, node.children[i]};
+        }
+      }
+    }
+  }
+};
+
+// a balanced tree over at most 2^32 leaves is at most this deep
+const uint32_t BALANCED_BVH_MAX_DEPTH = 32;
+
+// replaces the subtree at target by a balanced one over the leaves, split at
+// the median leaf centroid on the widest axis. new interior nodes are
+// appended.
+void build_balanced(std::vector<BvhBuildNode>& nodes, uint32_t* leaves,
+                    uint32_t count, uint32_t target) {
+  if (count == 1) {
+    nodes[target] = nodes[leaves[0]];
+    return;
+  }
+  Aabb bounds;
+  Aabb centroid_bounds;
+  for (uint32_t i = 0; i < count; ++i) {
+    bounds.grow(nodes[leaves[i]].bounds);
+    centroid_bounds.grow(nodes[leaves[i]].bounds.centroid());
+  }
+  const int axis = centroid_bounds.max_axis();
+  const uint32_t mid = count / 2;
+  std::nth_element(leaves, leaves + mid, leaves + count,
+                   [&](uint32_t a, uint32_t b) {
+                     return nodes[a].bounds.centroid()[axis] <
+                            nodes[b].bounds.centroid()[axis];
+                   });
+  const auto left = static_cast<uint32_t>(nodes.size());
+  nodes.resize(nodes.size() + 2);
+  BvhBuildNode& node = nodes[target];
+  node.bounds = bounds;
+  node.children[0] = left;
+  node.children[1] = left + 1;
+  node.first_prim = 0;
+  node.prim_count = 0;
+  build_balanced(nodes, leaves, mid, left);
+  build_balanced(nodes, leaves + mid, count - mid, left + 1);
+}
+
+// keeps every leaf within BVH_MAX_DEPTH of the root rooted at nodes[0], the
+// traversal stacks are sized for it. degenerate builds, e.g. an lbvh over
+// many equal morton codes, get the subtrees that reach too deep rebuilt
+// balanced below depth BVH_MAX_DEPTH - BALANCED_BVH_MAX_DEPTH.
+void limit_depth(std::vector<BvhBuildNode>& nodes) {
+  // preorder with depths, then heights back to front
+  std::vector<uint32_t> order;
+  std::vector<uint32_t> depths(nodes.size(), 0);
+  std::vector<uint32_t> stack = {0};
+  while (!stack.empty()) {
+    const uint32_t index = stack.back();
+    stack.pop_back();
+    order.push_back(index);
+    if (!nodes[index].is_leaf()) {
+      for (uint32_t child : nodes[index].children) {
+        depths[child] = depths[index] + 1;
+        stack.push_back(child);
+      }
+    }
+  }
+  std::vector<uint32_t> heights(nodes.size(), 0);
+  for (auto it = order.rbegin(); it != order.rend(); ++it) {
+    const BvhBuildNode& node = nodes[*it];
+    if (!node.is_leaf()) {
+      heights[*it] = 1 + std::max(heights[node.children[0]],
+                                  heights[node.children[1]]);
+    }
+  }
+  if (heights[0] <= BVH_MAX_DEPTH) {
+    return;
+  }
+
+  const uint32_t cut = BVH_MAX_DEPTH - BALANCED_BVH_MAX_DEPTH;
+  std::vector<uint32_t> leaves;
+  for (uint32_t index : order) {
+    if (depths[index] != cut || cut + heights[index] <= BVH_MAX_DEPTH) {
+      continue;
+    }
+    leaves.clear();
+    stack.push_back(index);
+    while (!stack.empty()) {
+      const BvhBuildNode& node = nodes[stack.back()];
+      stack.pop_back();
+      if (node.is_leaf()) {
+        leaves.push_back(uint32_t(&node - nodes.data()));
+      } else {
+        stack.push_back(node.children[0]);
+        stack.push_back(node.children[1]);
+      }
+    }
+    build_balanced(nodes, leaves.data(), uint32_t(leaves.size()), index);
+  }
+}
+
+}  // namespace
+
+bool parse_build_mode(const char* name, BvhBuildMode* out_mode) {
+  if (strcmp(name, "sah") == 0) {
+    *out_mode = BvhBuildMode::SAH;
+  } else if (strcmp(name, "lbvh") == 0) {
+    *out_mode = BvhBuildMode::LBVH;
+  } else if (strcmp(name, "sbvh") == 0) {
+    *out_mode = BvhBuildMode::SBVH;
+  } else if (strcmp(name, "ploc") == 0) {
+    *out_mode = BvhBuildMode::PLOC;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char* build_mode_name(BvhBuildMode mode) {
+  switch (mode) {
+    case BvhBuildMode::SAH:
+      return "sah";
+    case BvhBuildMode::LBVH:
+      return "lbvh";
+    case BvhBuildMode::SBVH:
+      return "sbvh";
+    case BvhBuildMode::PLOC:
+      return "ploc";
+  }
+  return "unknown";
+}
+
+Bvh Bvh::build(const std::vector<Aabb>& prim_bounds,
+               const BvhBuildSettings& settings, const PrimClipper& clipper) {
+  switch (settings.mode) {
+    case BvhBuildMode::LBVH:
+      return build_lbvh(prim_bounds, settings);
+    case BvhBuildMode::SBVH:
+      return build_sbvh(prim_bounds, settings, clipper);
+    case BvhBuildMode::PLOC:
+      return build_ploc(prim_bounds, settings);
+    default:
+      return build_sah(prim_bounds, settings);
+  }
+}
+
+Bvh Bvh::from_arrays(std::vector<BvhNode> nodes,
+                     std::vector<uint32_t> prim_indices) {
+  Bvh bvh;
+  bvh.nodes_ = std::move(nodes);
+  bvh.prim_indices_ = std::move(prim_indices);
+  return bvh;
+}
+
+Bvh Bvh::build_sah(const std::vector<Aabb>& prim_bounds,
+                   const BvhBuildSettings& settings) {
+  Bvh bvh;
+  if (!prim_bounds.empty()) {
+    std::vector<BvhBuildNode> build_nodes;
+    SahBuilder(prim_bounds, settings, build_nodes, bvh.prim_indices_).build();
+    bvh.flatten(build_nodes);
+  }
+  return bvh;
+}
+
+Bvh Bvh::build_lbvh(const std::vector<Aabb>& prim_bounds,
+                    const BvhBuildSettings& settings) {
+  Bvh bvh;
+  if (!prim_bounds.empty()) {
+    std::vector<BvhBuildNode> build_nodes;
+    LbvhBuilder(prim_bounds, settings, build_nodes, bvh.prim_indices_).build();
+    bvh.flatten(build_nodes);
+  }
+  return bvh;
+}
+
+Bvh Bvh::build_sbvh(const std::vector<Aabb>& prim_bounds,
+                    const BvhBuildSettings& settings,
+                    const PrimClipper& clipper) {
+  Bvh bvh;
+  if (!prim_bounds.empty()) {
+    std::vector<BvhBuildNode> build_nodes;
+    SbvhBuilder(prim_bounds, settings, clipper, build_nodes, bvh.prim_indices_)
+        .build();
+    bvh.flatten(build_nodes);
+  }
+  return bvh;
+}
+
+Bvh Bvh::build_ploc(const std::vector<Aabb>& prim_bounds,
+                    const BvhBuildSettings& settings) {
+  Bvh bvh;
+  if (!prim_bounds.empty()) {
+    std::vector<BvhBuildNode> build_nodes;
+    PlocBuilder(prim_bounds, settings, build_nodes, bvh.prim_indices_).build();
+    bvh.flatten(build_nodes);
+  }
+  return bvh;
+}
+
+void Bvh::refit(const std::vector<Aabb>& prim_bounds) {
+  if (nodes_.empty()) {
+    return;
+  }
+
+  auto refit_node = [&](uint32_t index) {
+    BvhNode& node = nodes_[index];
+    Aabb bounds;
+    if (node.is_leaf()) {
+      for (uint32_t i = 0; i < node.prim_count; ++i) {
+        bounds.grow(prim_bounds[prim_indices_[node.offset + i]]);
+      }
+    } else {
+      bounds = nodes_[index + 1].bounds();
+      bounds.grow(nodes_[node.offset].bounds());
+    }
+    for (int axis = 0; axis < 3; ++axis) {
+      node.bounds_min[axis] = bounds.min[axis];
+      node.bounds_max[axis] = bounds.max[axis];
+    }
+  };
+
+  // a subtree is a contiguous range in depth first order and every node sits
+  // before its descendants, so each range is refit back to front. ranges
+  // below the cut are independent, the few nodes above it go last.
+  uint32_t cut_depth = 2;
+  for (uint32_t n = worker_count() * 4; n > 1; n >>= 1) {
+    ++cut_depth;
+  }
+  std::vector<std::pair<uint32_t, uint32_t>> subtrees;
+  std::vector<uint32_t> top;
+  std::vector<std::tuple<uint32_t, uint32_t, uint32_t>> stack;
+  stack.emplace_back(0, static_cast<uint32_t>(nodes_.size()), 0);
+  while (!stack.empty()) {
+    auto [index, end, depth] = stack.back();
+    stack.pop_back();
+    const BvhNode& node = nodes_[index];
+    if (node.is_leaf() || depth == cut_depth) {
+      subtrees.emplace_back(index, end);
+      continue;
+    }
+    top.push_back(index);
+    stack.emplace_back(node.offset, end, depth + 1);
+    stack.emplace_back(index + 1, node.offset, depth + 1);
+  }
+
+  parallel_for(0, subtrees.size(), 1, [&](size_t b, size_t e, uint32_t) {
+    for (size_t i = b; i < e; ++i) {
+      for (uint32_t index = subtrees[i].second; index > subtrees[i].first;) {
+        refit_node(--index);
+      }
+    }
+  });
+  for (auto it = top.rbegin(); it != top.rend(); ++it) {
+    refit_node(*it);
+  }
+}
+
+uint32_t Bvh::optimize(const BvhBuildSettings& settings, double budget_ms) {
+  if (nodes_.size() < 3 || budget_ms <= 0.0) {
+    return 0;
+  }
+  const auto deadline =
+      std::chrono::steady_clock::now() +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double, std::milli>(budget_ms));
+
+  // explicit children, node i keeps index i
+  std::vector<BvhBuildNode> build_nodes(nodes_.size());
+  for (size_t i = 0; i < nodes_.size(); ++i) {
+    const BvhNode& src = nodes_[i];
+    BvhBuildNode& dst = build_nodes[i];
+    dst.bounds = src.bounds();
+    dst.prim_count = src.prim_count;
+    if (src.is_leaf()) {
+      dst.first_prim = src.offset;
+    } else {
+      dst.children[0] = static_cast<uint32_t>(i + 1);
+      dst.children[1] = src.offset;
+    }
+  }
+
+  const uint32_t passes =
+      TreeletOptimizer(build_nodes, settings, deadline).optimize();
+  flatten(build_nodes);
+  return passes;
+}
+
+std::vector<BvhNode> Bvh::rope_nodes() const {
+  // the subtree of node i spans [i, i + size), so its skip link is i + size.
+  // back to front, both children come before their parent.
+  std::vector<BvhNode> nodes = nodes_;
+  std::vector<uint32_t> sizes(nodes_.size());
+  for (auto index = static_cast<uint32_t>(nodes_.size()); index > 0;) {
+    --index;
+    const BvhNode& node = nodes_[index];
+    if (node.is_leaf()) {
+      sizes[index] = 1;
+    } else {
+      sizes[index] = 1 + sizes[index + 1] + sizes[node.offset];
+      nodes[index].offset = index + sizes[index];
+    }
+  }
+  return nodes;
+}
+
+void Bvh::flatten(std::vector<BvhBuildNode>& build_nodes) {
+  limit_depth(build_nodes);
+  nodes_.resize(build_nodes.size());
+
+  // (build node, parent slot that wants the right child offset)
+  std::vector<std::pair<uint32_t, uint32_t>> stack;
+  stack.emplace_back(0, ~0u);
+  uint32_t next = 0;
+  while (!stack.empty()) {
+    auto [build_index, parent] = stack.back();
+    stack.pop_back();
+
+    const uint32_t index = next++;
+    if (parent != ~0u) {
+      nodes_[parent].offset = index;
+    }
+
+    const BvhBuildNode& src = build_nodes[build_index];
+    BvhNode& dst = nodes_[index];
+    for (int axis = 0; axis < 3; ++axis) {
+      dst.bounds_min[axis] = src.bounds.min[axis];
+      dst.bounds_max[axis] = src.bounds.max[axis];
+    }
+    dst.prim_count = src.prim_count;
+    if (src.is_leaf()) {
+      dst.offset = src.first_prim;
+    } else {
+      // the left child is emitted right after its parent
+      stack.emplace_back(src.children[1], index);
+      stack.emplace_back(src.children[0], ~0u);
+    }
+  }
+  // builders may leave nodes below collapsed leaves unreferenced
+  nodes_.resize(next);
+}
+
+float Bvh::sah_cost(const BvhBuildSettings& settings) const {
+  if (nodes_.empty()) {
+    return 0.0f;
+  }
+
+  float root_area = nodes_[0].bounds().surface_area();
+  if (root_area <= 0.0f) {
+    return settings.intersection_cost * float(prim_indices_.size());
+  }
+
+  double cost = 0.0;
+  for (const auto& node : nodes_) {
+    float area = node.bounds().surface_area();
+    if (node.is_leaf()) {
+      cost += settings.intersection_cost * area * float(node.prim_count);
+    } else {
+      cost += settings.traversal_cost * area;
+    }
+  }
+  return static_cast<float>(cost / root_area);
+}
+
+BvhScene::BvhScene(const Scene* scene, const BvhBuildSettings& settings,
+                   const std::string& cache_path)
+    : scene_(scene), settings_(settings) {
+  if (instanced() && settings_.width != 2) {
+    printf("bvh: instanced scenes use the binary layout\n");
+    settings_.width = 2;
+  }
+  if (settings_.quantized && settings_.width == 2) {
+    printf("bvh: quantized nodes need width 4 or 8\n");
+    settings_.quantized = false;
+  }
+  if (settings_.stackless && settings_.width != 2) {
+    printf("bvh: stackless traversal needs width 2\n");
+    settings_.stackless = false;
+  }
+  if (settings_.quantized) {
+    settings_.max_leaf_size =
+        std::min(settings_.max_leaf_size, QUANTIZED_BVH_MAX_LEAF_SIZE);
+  }
+  if (settings_.stackless) {
+    layout_ = Layout::ROPES;
+  } else if (settings_.width == 8) {
+    layout_ = settings_.quantized ? Layout::QBVH8 : Layout::BVH8;
+  } else if (settings_.width == 4) {
+    layout_ = settings_.quantized ? Layout::QBVH4 : Layout::BVH4;
+  }
+  const bool analytic = scene_->analytic_count() > 0;
+  if (analytic && instanced()) {
+    printf("bvh: analytic primitives are not traced in instanced scenes\n");
+  }
+  if (settings_.device_build && (instanced() || analytic ||
+                                 settings_.width != 2 || settings_.stackless)) {
+    printf("bvh: device builds need width 2, no instances and no analytic "
+           "primitives\n");
+    settings_.device_build = false;
+  }
+  if (settings_.compact_vertices &&
+      (settings_.device_build || analytic ||
+       scene_->compact_vertices().size() != scene_->positions().size())) {
+    printf("bvh: compact vertices need a host build and an encoded scene "
+           "without analytic primitives\n");
+    settings_.compact_vertices = false;
+  }
+  if (settings_.device_build) {
+    // built by create_device_objects
+  } else if (load_embedded_cache()) {
+    // came with the scene file
+  } else if (cache_path.empty()) {
+    build();
+  } else if (!load_cache(cache_path)) {
+    build();
+    save_cache(cache_path);
+  }
+  // the spatial splits and the cache key read a paged scene past its batches
+  if (scene_->pager()) {
+    scene_->pager()->trim();
+  }
+}
+
+BvhScene::~BvhScene() { destroy_device_objects(); }
+
+void BvhScene::build() {
+  auto start = std::chrono::steady_clock::now();
+
+  size_t node_count = 0;
+  if (instanced()) {
+    const auto& meshes = scene_->meshes();
+    blases_.resize(meshes.size());
+    blas_sah_costs_.resize(meshes.size());
+    for (uint32_t mesh = 0; mesh < meshes.size(); ++mesh) {
+      build_blas(mesh);
+      node_count += blases_[mesh].nodes().size();
+    }
+    build_tlas();
+    node_count += tlas_.nodes().size();
+    built_sah_cost_ = tlas_.sah_cost(settings_);
+  } else {
+    std::vector<Aabb> prim_bounds =
+        compute_prim_bounds(0, uint32_t(scene_->primitive_count()));
+    bvh_ = Bvh::build(
+        prim_bounds, settings_,
+        [this](uint32_t prim, int axis, float lo, float hi) {
+          return clip_primitive(prim, axis, lo, hi);
+        });
+    if (settings_.optimize_budget_ms > 0.0f) {
+      auto optimize_start = std::chrono::steady_clock::now();
+      const float cost = bvh_.sah_cost(settings_);
+      const uint32_t passes =
+          bvh_.optimize(settings_, settings_.optimize_budget_ms);
+      printf("bvh: treelet optimization %u passes, %.2f ms, sah cost %.3f -> "
+             "%.3f\n",
+             passes,
+             std::chrono::duration<double, std::milli>(
+                 std::chrono::steady_clock::now() - optimize_start)
+                 .count(),
+             cost, bvh_.sah_cost(settings_));
+    }
+    collapse();
+    node_count = bvh_.nodes().size();
+    built_sah_cost_ = bvh_.sah_cost(settings_);
+  }
+
+  build_time_ms_ = std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  printf("bvh: %s, %zu triangles, %zu analytic, %zu instances, %zu nodes, "
+         "sah cost %.3f, build %.2f ms\n",
+         build_mode_name(settings_.mode), scene_->triangle_count(),
+         instanced() ? size_t(0) : scene_->analytic_count(),
+         scene_->instances().size(), node_count, built_sah_cost_,
+         build_time_ms_);
+}
+
+bool BvhScene::load_cache(const std::string& path) {
+  auto start = std::chrono::steady_clock::now();
+  BvhCacheReader reader;
+  return reader.open(path.c_str(), bvh_cache_key(*scene_, settings_)) &&
+         load_cache(reader, path.c_str(), start);
+}
+
+bool BvhScene::load_embedded_cache() {
+  const auto& cache = scene_->bvh_cache();
+  if (cache.empty()) {
+    return false;
+  }
+  auto start = std::chrono::steady_clock::now();
+  BvhCacheReader reader;
+  return reader.open(cache.data(), cache.size(),
+                     bvh_cache_key(*scene_, settings_)) &&
+         load_cache(reader, "the scene file", start);
+}
+
+bool BvhScene::load_cache(const BvhCacheReader& reader, const char* name,
+                          std::chrono::steady_clock::time_point start) {
+  // sections in the order of save_cache
+  std::vector<BvhNode> nodes;
+  std::vector<uint32_t> prim_indices;
+  size_t node_count = 0;
+  if (instanced()) {
+    const size_t mesh_count = scene_->meshes().size();
+    if (reader.section_count() != mesh_count * 2) {
+      return false;
+    }
+    blases_.resize(mesh_count);
+    blas_sah_costs_.resize(mesh_count);
+    for (uint32_t mesh = 0; mesh < mesh_count; ++mesh) {
+      if (!reader.read(mesh * 2, &nodes) ||
+          !reader.read(mesh * 2 + 1, &prim_indices)) {
+        return false;
+      }
+      node_count += nodes.size();
+      blases_[mesh] =
+          Bvh::from_arrays(std::move(nodes), std::move(prim_indices));
+      blas_sah_costs_[mesh] = blases_[mesh].sah_cost(settings_);
+    }
+    build_tlas();
+    built_sah_cost_ = tlas_.sah_cost(settings_);
+  } else {
+    // wide layouts share the prim_indices of the binary bvh, quantized ones
+    // reorder them
+    uint32_t section_count = 2;
+    switch (layout_) {
+      case Layout::BVH2:
+      case Layout::ROPES:
+        break;
+      case Layout::BVH4:
+      case Layout::BVH8:
+        section_count = 3;
+        break;
+      case Layout::QBVH4:
+      case Layout::QBVH8:
+        section_count = 4;
+        break;
+    }
+    if (reader.section_count() != section_count || !reader.read(0, &nodes) ||
+        !reader.read(1, &prim_indices)) {
+      return false;
+    }
+    node_count = nodes.size();
+    bvh_ = Bvh::from_arrays(std::move(nodes), std::move(prim_indices));
+    switch (layout_) {
+      case Layout::BVH2:
+        break;
+      case Layout::ROPES:
+        // the skip links are rederived, they cost one pass over the nodes
+        rope_nodes_ = bvh_.rope_nodes();
+        break;
+      case Layout::BVH4: {
+        std::vector<WideBvhNode<4>> wide_nodes;
+        if (!reader.read(2, &wide_nodes)) {
+          return false;
+        }
+        bvh4_ = WideBvh<4>::from_arrays(std::move(wide_nodes),
+                                        bvh_.prim_indices());
+        break;
+      }
+      case Layout::BVH8: {
+        std::vector<WideBvhNode<8>> wide_nodes;
+        if (!reader.read(2, &wide_nodes)) {
+          return false;
+        }
+        bvh8_ = WideBvh<8>::from_arrays(std::move(wide_nodes),
+                                        bvh_.prim_indices());
+        break;
+      }
+      case Layout::QBVH4: {
+        std::vector<QuantizedBvhNode<4>> quantized_nodes;
+        if (!reader.read(2, &quantized_nodes) ||
+            !reader.read(3, &prim_indices)) {
+          return false;
+        }
+        qbvh4_ = QuantizedBvh<4>::from_arrays(std::move(quantized_nodes),
+                                              std::move(prim_indices));
+        break;
+      }
+      case Layout::QBVH8: {
+        std::vector<QuantizedBvhNode<8>> quantized_nodes;
+        if (!reader.read(2, &quantized_nodes) ||
+            !reader.read(3, &prim_indices)) {
+          return false;
+        }
+        qbvh8_ = QuantizedBvh<8>::from_arrays(std::move(quantized_nodes),
+                                              std::move(prim_indices));
+        break;
+      }
+    }
+    built_sah_cost_ = bvh_.sah_cost(settings_);
+  }
+
+  build_time_ms_ = std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  printf("bvh: loaded %s, %zu nodes, %.2f ms\n", name, node_count,
+         build_time_ms_);
+  return true;
+}
+
+void BvhScene::save_cache(const std::string& path) const {
+  if (!cache_writer().write(path.c_str(), bvh_cache_key(*scene_, settings_))) {
+    printf("bvh: failed to write %s\n", path.c_str());
+  }
+}
+
+Blob BvhScene::cache_data() const {
+  return cache_writer().pack(bvh_cache_key(*scene_, settings_));
+}
+
+BvhCacheWriter BvhScene::cache_writer() const {
+  BvhCacheWriter writer;
+  if (instanced()) {
+    for (const auto& blas : blases_) {
+      writer.add(blas.nodes());
+      writer.add(blas.prim_indices());
+    }
+  } else {
+    writer.add(bvh_.nodes());
+    writer.add(bvh_.prim_indices());
+    switch (layout_) {
+      case Layout::BVH2:
+      case Layout::ROPES:
+        break;
+      case Layout::BVH4:
+        writer.add(bvh4_.nodes());
+        break;
+      case Layout::BVH8:
+        writer.add(bvh8_.nodes());
+        break;
+      case Layout::QBVH4:
+        writer.add(qbvh4_.nodes());
+        writer.add(qbvh4_.prim_indices());
+        break;
+      case Layout::QBVH8:
+        writer.add(qbvh8_.nodes());
+        writer.add(qbvh8_.prim_indices());
+        break;
+    }
+  }
+  return writer;
+}
+
+void BvhScene::build_blas(uint32_t mesh) {
+  const Mesh& m = scene_->meshes()[mesh];
+  blases_[mesh] = Bvh::build(
+      compute_prim_bounds(m.first_triangle, m.triangle_count), settings_,
+      [this, &m](uint32_t prim, int axis, float lo, float hi) {
+        return clip_primitive(m.first_triangle + prim, axis, lo, hi);
+      });
+  // each mesh gets its share of the budget by triangle count
+  if (settings_.optimize_budget_ms > 0.0f) {
+    blases_[mesh].optimize(settings_, double(settings_.optimize_budget_ms) *
+                                          m.triangle_count /
+                                          scene_->triangle_count());
+  }
+  blas_sah_costs_[mesh] = blases_[mesh].sah_cost(settings_);
+}
+
+void BvhScene::build_tlas() {
+  const auto& instances = scene_->instances();
+  std::vector<Aabb> instance_bounds(instances.size());
+  world_to_object_.resize(instances.size());
+  for (size_t i = 0; i < instances.size(); ++i) {
+    const Bvh& blas = blases_[instances[i].mesh];
+    if (!blas.empty()) {
+      instance_bounds[i] =
+          instances[i].transform.apply(blas.nodes()[0].bounds());
+    }
+    world_to_object_[i] = instances[i].transform.inverse();
+  }
+
+  // one instance per leaf, so a leaf offset is enough to find the instance
+  BvhBuildSettings tlas_settings = settings_;
+  tlas_settings.mode = BvhBuildMode::SAH;
+  tlas_settings.max_leaf_size = 1;
+  tlas_ = Bvh::build(instance_bounds, tlas_settings);
+}
+
+void BvhScene::collapse() {
+  // the wide tree is only an intermediate step of the quantized one
+  switch (layout_) {
+    case Layout::BVH2:
+      break;
+    case Layout::ROPES:
+      rope_nodes_ = bvh_.rope_nodes();
+      break;
+    case Layout::BVH4:
+      bvh4_ = WideBvh<4>::collapse(bvh_);
+      break;
+    case Layout::BVH8:
+      bvh8_ = WideBvh<8>::collapse(bvh_);
+      break;
+    case Layout::QBVH4:
+      qbvh4_ = QuantizedBvh<4>::quantize(WideBvh<4>::collapse(bvh_));
+      break;
+    case Layout::QBVH8:
+      qbvh8_ = QuantizedBvh<8>::quantize(WideBvh<8>::collapse(bvh_));
+      break;
+  }
+}
+
+BvhScene::NodeArray BvhScene::node_array() const {
+  // the wide and rope layouts keep the leaves of bvh_
+  switch (layout_) {
+    case Layout::ROPES:
+      return {rope_nodes_.data(), rope_nodes_.size() * sizeof(BvhNode),
+              &bvh_.prim_indices()};
+    case Layout::BVH4:
+      return {bvh4_.nodes().data(),
+              bvh4_.nodes().size() * sizeof(WideBvhNode<4>),
+              &bvh_.prim_indices()};
+    case Layout::BVH8:
+      return {bvh8_.nodes().data(),
+              bvh8_.nodes().size() * sizeof(WideBvhNode<8>),
+              &bvh_.prim_indices()};
+    case Layout::QBVH4:
+      return {qbvh4_.nodes().data(),
+              qbvh4_.nodes().size() * sizeof(QuantizedBvhNode<4>),
+              &qbvh4_.prim_indices()};
+    case Layout::QBVH8:
+      return {qbvh8_.nodes().data(),
+              qbvh8_.nodes().size() * sizeof(QuantizedBvhNode<8>),
+              &qbvh8_.prim_indices()};
+    case Layout::BVH2:
+      break;
+  }
+  return {bvh_.nodes().data(), bvh_.nodes().size() * sizeof(BvhNode),
+          &bvh_.prim_indices()};
+}
+
+std::vector<Aabb> BvhScene::compute_prim_bounds(uint32_t first_prim,
+                                                uint32_t prim_count) const {
+  std::vector<Aabb> prim_bounds(prim_count);
+  parallel_for(0, prim_bounds.size(), 4096,
+               [&](size_t b, size_t e, uint32_t) {
+                 // a paged scene brings in a batch at a time
+                 for (size_t batch = b; batch < e; batch += 4096) {
+                   const size_t batch_end = std::min(e, batch + 4096);
+                   scene_->page_in(first_prim + batch, batch_end - batch);
+                   for (size_t i = batch; i < batch_end; ++i) {
+                     prim_bounds[i] = scene_->primitive_bounds(first_prim + i);
+                   }
+                 }
+               });
+  return prim_bounds;
+}
+
+bool BvhScene::update() {
+  if (settings_.device_build) {
+    if (vk_device_ != VK_NULL_HANDLE) {
+      wait_for_frames();
+      build_on_device();
+    }
+    return true;
+  }
+  auto start = std::chrono::steady_clock::now();
+
+  float cost = 0.0f;
+  bool rebuild = false;
+  if (instanced()) {
+    // mesh bvhs past the threshold are rebuilt on their own, the top level
+    // is always rebuilt since every instance box may have moved
+    uint32_t rebuilt = 0;
+    for (uint32_t mesh = 0; mesh < blases_.size(); ++mesh) {
+      const Mesh& m = scene_->meshes()[mesh];
+      blases_[mesh].refit(
+          compute_prim_bounds(m.first_triangle, m.triangle_count));
+      if (blases_[mesh].sah_cost(settings_) >
+          settings_.rebuild_threshold * blas_sah_costs_[mesh]) {
+        build_blas(mesh);
+        ++rebuilt;
+      }
+    }
+    build_tlas();
+    cost = tlas_.sah_cost(settings_);
+    printf("bvh: refit %zu meshes, rebuilt %u\n", blases_.size(), rebuilt);
+  } else {
+    bvh_.refit(compute_prim_bounds(0, uint32_t(scene_->primitive_count())));
+    collapse();
+    cost = bvh_.sah_cost(settings_);
+    rebuild = cost > settings_.rebuild_threshold * built_sah_cost_;
+  }
+
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  printf("bvh: refit %.2f ms, sah cost %.3f (%.2fx of last build)%s\n", ms,
+         cost, built_sah_cost_ > 0.0f ? cost / built_sah_cost_ : 1.0f,
+         rebuild ? ", rebuilding" : "");
+
+  if (rebuild) {
+    build();
+  }
+  if (vk_device_ != VK_NULL_HANDLE) {
+    wait_for_frames();
+    upload_nodes();
+    upload_instances();
+    upload_triangles();
+  }
+  return rebuild;
+}
+
+void BvhScene::update_instances() {
+  if (!instanced()) {
+    return;
+  }
+  auto start = std::chrono::steady_clock::now();
+  build_tlas();
+  if (vk_device_ != VK_NULL_HANDLE) {
+    wait_for_frames();
+    upload_nodes();
+    upload_instances();
+  }
+  printf("bvh: top level rebuild %.2f ms\n",
+         std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+             .count());
+}
+
+bool BvhScene::intersect(const Ray& ray, Hit& hit,
+                         TraversalCounters* counters) const {
+  const WatertightRay shear(ray.direction);
+  auto intersect_prim = [&](uint32_t prim, const Ray& r) {
+    return intersect_primitive(prim, r, shear, hit) ? hit.t : r.t_max;
+  };
+
+  if (instanced()) {
+    const auto& instances = scene_->instances();
+    tlas_.traverse(ray, [&](uint32_t instance, const Ray& r) {
+      // the direction is not normalized, so t carries over between spaces
+      const Transform& to_object = world_to_object_[instance];
+      Ray local;
+      local.origin = to_object.apply_point(r.origin);
+      local.direction = to_object.apply_vector(r.direction);
+      local.t_max = r.t_max;
+      const WatertightRay local_shear(local.direction);
+
+      const Mesh& mesh = scene_->meshes()[instances[instance].mesh];
+      bool found = false;
+      blases_[instances[instance].mesh].traverse(
+          local,
+          [&](uint32_t prim, const Ray& lr) {
+            if (intersect_primitive(mesh.first_triangle + prim, lr,
+                                    local_shear, hit)) {
+              found = true;
+              return hit.t;
+            }
+            return lr.t_max;
+          },
+          counters);
+      if (found) {
+        hit.instance = instance;
+        return hit.t;
+      }
+      return r.t_max;
+    }, counters);
+  } else {
+    switch (layout_) {
+      case Layout::BVH2:
+        bvh_.traverse(ray, intersect_prim, counters);
+        break;
+      case Layout::ROPES:
+        bvh_.traverse_ropes(rope_nodes_, ray, intersect_prim, counters);
+        break;
+      case Layout::BVH4:
+        bvh4_.traverse(ray, intersect_prim, counters);
+        break;
+      case Layout::BVH8:
+        bvh8_.traverse(ray, intersect_prim, counters);
+        break;
+      case Layout::QBVH4:
+        qbvh4_.traverse(ray, intersect_prim, counters);
+        break;
+      case Layout::QBVH8:
+        qbvh8_.traverse(ray, intersect_prim, counters);
+        break;
+    }
+  }
+  return hit.prim != ~0u;
+}
+Aabb BvhScene::clip_primitive(uint32_t prim, int axis, float lo,
+                              float hi) const {
+  // analytic primitives keep their bounds cut to the slab
+  if (prim >= scene_->triangle_count()) {
+    Aabb bounds = scene_->primitive_bounds(prim);
+    bounds.min[axis] = std::max(bounds.min[axis], lo);
+    bounds.max[axis] = std::min(bounds.max[axis], hi);
+    return bounds;
+  }
+  const auto& positions = scene_->positions();
+  const auto& indices = scene_->indices();
+
+  // sutherland-hodgman against both slab planes, keeping only the bounds
+  Vec3f polygon[9];
+  int count = 3;
+  for (int i = 0; i < 3; ++i) {
+    polygon[i] = positions[indices[prim * 3 + i]];
+  }
+
+  Vec3f clipped[9];
+  for (int side = 0; side < 2; ++side) {
+    auto inside = [&](const Vec3f& p) {
+      return side == 0 ? p[axis] >= lo : p[axis] <= hi;
+    };
+    const float plane = side == 0 ? lo : hi;
+    int clipped_count = 0;
+    for (int i = 0; i < count; ++i) {
+      const Vec3f& a = polygon[i];
+      const Vec3f& b = polygon[(i + 1) % count];
+      if (inside(a)) {
+        clipped[clipped_count++] = a;
+      }
+      if (inside(a) != inside(b)) {
+        float t = (plane - a[axis]) / (b[axis] - a[axis]);
+        Vec3f p = a + (b - a) * t;
+        p[axis] = plane;
+        clipped[clipped_count++] = p;
+      }
+    }
+    count = clipped_count;
+    std::copy(clipped, clipped + count, polygon);
+  }
+
+  Aabb bounds;
+  for (int i = 0; i < count; ++i) {
+    bounds.grow(polygon[i]);
+  }
+  return bounds;
+}
+
+bool BvhScene::intersect_primitive(uint32_t prim, const Ray& ray,
+                                   const WatertightRay& shear,
+                                   Hit& hit) const {
+  size_t index = 0;
+  float t, u, v;
+  bool found = false;
+  switch (scene_->primitive_kind(prim, &index)) {
+    case PRIMITIVE_TRIANGLE: {
+      const auto& positions = scene_->positions();
+      const auto& indices = scene_->indices();
+      const Vec3f& p0 = positions[indices[index * 3 + 0]];
+      const Vec3f& p1 = positions[indices[index * 3 + 1]];
+      const Vec3f& p2 = positions[indices[index * 3 + 2]];
+      found = settings_.watertight
+                  ? intersect_triangle_watertight(p0, p1, p2, ray, shear, &t,
+                                                  &u, &v)
+                  : intersect_triangle_edges(p0, p1 - p0, p2 - p0, ray, &t,
+                                             &u, &v);
+      break;
+    }
+    case PRIMITIVE_SPHERE:
+      found = intersect_sphere(scene_->spheres()[index], ray, &t, &u, &v);
+      break;
+    case PRIMITIVE_BOX:
+      found = intersect_box(scene_->boxes()[index], ray, &t, &u, &v);
+      break;
+    case PRIMITIVE_QUAD:
+      found = intersect_quad(scene_->quads()[index], ray, &t, &u, &v);
+      break;
+  }
+  if (!found) {
+    return false;
+  }
+  hit.t = t;
+  hit.prim = prim;
+  hit.u = u;
+  hit.v = v;
+  return true;
+}
+
+TriangleRecords BvhScene::triangle_records() const {
+  TriangleRecords records(settings_.watertight);
+  records.append(*scene_, leaf_triangles());
+  return records;
+}
+
+std::vector<uint32_t> BvhScene::leaf_triangles() const {
+  if (instanced()) {
+    std::vector<uint32_t> triangles;
+    const auto& meshes = scene_->meshes();
+    for (size_t mesh = 0; mesh < blases_.size(); ++mesh) {
+      for (uint32_t prim : blases_[mesh].prim_indices()) {
+        triangles.push_back(meshes[mesh].first_triangle + prim);
+      }
+    }
+    return triangles;
+  }
+  return *node_array().prim_indices;
+}
+
+BvhStats BvhScene::stats(bool with_epo) const {
+  BvhStats stats;
+  const size_t triangle_count = scene_->triangle_count();
+  size_t record_count = 0;
+  if (settings_.device_build) {
+    // one triangle per leaf, see GpuBvhBuilder
+    record_count = triangle_count;
+    stats.node_bytes =
+        triangle_count > 0 ? (2 * triangle_count - 1) * sizeof(BvhNode) : 0;
+  } else if (instanced()) {
+    double overlap = 0.0;
+    double area = 0.0;
+    const auto& meshes = scene_->meshes();
+    for (size_t mesh = 0; mesh < blases_.size(); ++mesh) {
+      add_tree_stats(blases_[mesh], &stats);
+      if (with_epo) {
+        add_end_point_overlap(blases_[mesh], *scene_,
+                              meshes[mesh].first_triangle, settings_,
+                              &overlap, &area);
+      }
+      record_count += blases_[mesh].prim_indices().size();
+    }
+    stats.node_count += static_cast<uint32_t>(tlas_.nodes().size());
+    stats.sah_cost = tlas_.sah_cost(settings_);
+    stats.epo = area > 0.0 ? float(overlap / area) : 0.0f;
+    stats.node_bytes = stats.node_count * sizeof(BvhNode);
+  } else {
+    add_tree_stats(bvh_, &stats);
+    stats.sah_cost = bvh_.sah_cost(settings_);
+    if (with_epo) {
+      double overlap = 0.0;
+      double area = 0.0;
+      add_end_point_overlap(bvh_, *scene_, 0, settings_, &overlap, &area);
+      stats.epo = area > 0.0 ? float(overlap / area) : 0.0f;
+    }
+    const NodeArray array = node_array();
+    stats.node_bytes = array.size_bytes;
+    record_count = array.prim_indices->size();
+  }
+
+  // same sizes as upload_instances and TriangleRecords::pack, or
+  // pack_triangle_indices and CompactVertices::pack
+  stats.memory_bytes = stats.node_bytes + 16 +
+                       scene_->instances().size() * sizeof(BvhInstance) + 16;
+  if (settings_.compact_vertices) {
+    stats.memory_bytes += record_count * 4 * sizeof(uint32_t) +
+                          scene_->compact_vertices().packed_size();
+  } else {
+    stats.memory_bytes += record_count * 3 * sizeof(TriangleVec);
+  }
+  return stats;
+}
+
+void BvhScene::create_device_objects(VkPhysicalDevice physical_device,
+                                     VkDevice device,
+                                     uint32_t queue_family) {
+  destroy_device_objects();
+  vk_physical_device_ = physical_device;
+  vk_device_ = device;
+  queue_family_ = queue_family;
+
+  VkDescriptorSetLayoutBinding bindings[BVH_BINDING_COUNT] = {};
+  for (uint32_t i = 0; i < BVH_BINDING_COUNT; ++i) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags =
+        VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+
+  VkDescriptorSetLayoutCreateInfo layout_info = {};
+  layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layout_info.bindingCount = BVH_BINDING_COUNT;
+  layout_info.pBindings = bindings;
+  VKUT_CHECK_RESULT(vkCreateDescriptorSetLayout(
+      device, &layout_info, nullptr, &vk_descriptor_set_layout_));
+
+  VkDescriptorPoolSize pool_size = {};
+  pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  pool_size.descriptorCount = BVH_BINDING_COUNT;
+
+  VkDescriptorPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  pool_info.maxSets = 1;
+  pool_info.poolSizeCount = 1;
+  pool_info.pPoolSizes = &pool_size;
+  VKUT_CHECK_RESULT(vkCreateDescriptorPool(device, &pool_info, nullptr,
+                                           &vk_descriptor_pool_));
+
+  VkDescriptorSetAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  alloc_info.descriptorPool = vk_descriptor_pool_;
+  alloc_info.descriptorSetCount = 1;
+  alloc_info.pSetLayouts = &vk_descriptor_set_layout_;
+  VKUT_CHECK_RESULT(
+      vkAllocateDescriptorSets(device, &alloc_info, &vk_descriptor_set_));
+
+  upload_nodes();
+  upload_instances();
+  upload_triangles();
+}
+
+void BvhScene::upload_nodes() {
+  // one memcpy of the flattened node array
+  if (settings_.device_build) {
+    build_on_device();
+  } else if (instanced()) {
+    // top level first, then every mesh bvh with its node and leaf offsets
+    // rebased into the shared arrays. top level leaves point at instances.
+    std::vector<BvhNode> nodes =
+        settings_.stackless ? tlas_.rope_nodes() : tlas_.nodes();
+    for (auto& node : nodes) {
+      if (node.is_leaf()) {
+        node.offset = tlas_.prim_indices()[node.offset];
+      }
+    }
+    uint32_t prim_offset = 0;
+    for (const auto& blas : blases_) {
+      const auto node_offset = static_cast<uint32_t>(nodes.size());
+      for (BvhNode node :
+           settings_.stackless ? blas.rope_nodes() : blas.nodes()) {
+        node.offset += node.is_leaf() ? prim_offset : node_offset;
+        nodes.push_back(node);
+      }
+      prim_offset += static_cast<uint32_t>(blas.prim_indices().size());
+    }
+    upload(BVH_BINDING_NODES, nodes.data(), nodes.size() * sizeof(BvhNode));
+  } else {
+    const NodeArray array = node_array();
+    upload(BVH_BINDING_NODES, array.data, array.size_bytes);
+  }
+}
+
+void BvhScene::upload_instances() {
+  // uint instance_count, uint tlas_node_count padded to 16 bytes, then the
+  // records. an instance count of 0 tells the shader the scene is a single
+  // bvh.
+  const auto& instances = scene_->instances();
+  const size_t header_size = 16;
+  std::vector<uint8_t> data(header_size +
+                            instances.size() * sizeof(BvhInstance));
+  const uint32_t header[2] = {static_cast<uint32_t>(instances.size()),
+                              static_cast<uint32_t>(tlas_.nodes().size())};
+  memcpy(data.data(), header, sizeof(header));
+
+  std::vector<uint32_t> node_offsets(blases_.size());
+  std::vector<uint32_t> prim_offsets(blases_.size());
+  auto node_offset = static_cast<uint32_t>(tlas_.nodes().size());
+  uint32_t prim_offset = 0;
+  for (size_t mesh = 0; mesh < blases_.size(); ++mesh) {
+    node_offsets[mesh] = node_offset;
+    prim_offsets[mesh] = prim_offset;
+    node_offset += static_cast<uint32_t>(blases_[mesh].nodes().size());
+    prim_offset += static_cast<uint32_t>(blases_[mesh].prim_indices().size());
+  }
+
+  for (size_t i = 0; i < instances.size(); ++i) {
+    BvhInstance record = {};
+    memcpy(record.world_to_object, world_to_object_[i].m,
+           sizeof(record.world_to_object));
+    record.node_offset = node_offsets[instances[i].mesh];
+    record.prim_offset = prim_offsets[instances[i].mesh];
+    record.first_triangle = scene_->meshes()[instances[i].mesh].first_triangle;
+    record.node_count =
+        static_cast<uint32_t>(blases_[instances[i].mesh].nodes().size());
+    memcpy(data.data() + header_size + i * sizeof(BvhInstance), &record,
+           sizeof(record));
+  }
+  upload(BVH_BINDING_INSTANCES, data.data(), data.size());
+}
+
+void BvhScene::upload_triangles() {
+  // the packing reads a paged scene in leaf order
+  PagedFile* pager = scene_->pager();
+  if (settings_.compact_vertices) {
+    Blob vertices = scene_->compact_vertices().pack();
+    upload(BVH_BINDING_VERTICES, vertices.data(), vertices.size());
+    Blob data = pack_triangle_indices(*scene_, leaf_triangles());
+    upload(BVH_BINDING_TRIANGLES, data.data(), data.size());
+    if (pager) {
+      pager->trim();
+    }
+    return;
+  }
+  if (!buffers_[BVH_BINDING_VERTICES]) {
+    // unused by the shaders without BVH_COMPACT_VERTICES
+    upload(BVH_BINDING_VERTICES, nullptr, 0);
+  }
+  if (settings_.device_build) {
+    // written by build_on_device together with the nodes
+    return;
+  }
+  Blob data = triangle_records().pack();
+  upload(BVH_BINDING_TRIANGLES, data.data(), data.size());
+  if (pager) {
+    pager->trim();
+  }
+}
+
+void BvhScene::build_on_device() {
+  // the pipelines are kept for the rebuilds of update()
+  if (!gpu_builder_) {
+    gpu_builder_ = std::make_unique<GpuBvhBuilder>(vk_physical_device_,
+                                                   vk_device_, queue_family_);
+  }
+  gpu_builder_->build(*scene_, settings_.watertight);
+  build_time_ms_ = gpu_builder_->build_time_ms();
+  buffers_[BVH_BINDING_NODES] = gpu_builder_->take_nodes();
+  buffers_[BVH_BINDING_TRIANGLES] = gpu_builder_->take_triangles();
+  write_descriptor(BVH_BINDING_NODES);
+  write_descriptor(BVH_BINDING_TRIANGLES);
+}
+
+void BvhScene::wait_for_frames() const {
+  // the buffers are host visible and bound through a single descriptor set,
+  // nothing is double buffered. updates are rare enough to stall for.
+  vkDeviceWaitIdle(vk_device_);
+}
+
+void BvhScene::upload(uint32_t binding, const void* data, size_t size) {
+  // an empty array still gets a valid buffer to bind
+  auto& buffer = buffers_[binding];
+  if (buffer && size > 0 && buffer->size() == size) {
+    buffer->update(data, size);
+    return;
+  }
+  buffer = std::make_unique<vkut::Buffer>(
+      vk_physical_device_, vk_device_, std::max<size_t>(size, 16),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, size > 0 ? data : nullptr);
+  write_descriptor(binding);
+}
+
+void BvhScene::write_descriptor(uint32_t binding) {
+  VkDescriptorBufferInfo buffer_info = {};
+  buffer_info.buffer = buffers_[binding]->vk_buffer();
+  buffer_info.offset = 0;
+  buffer_info.range = VK_WHOLE_SIZE;
+
+  VkWriteDescriptorSet write = {};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = vk_descriptor_set_;
+  write.dstBinding = binding;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  write.pBufferInfo = &buffer_info;
+  vkUpdateDescriptorSets(vk_device_, 1, &write, 0, nullptr);
+}
+
+void BvhScene::destroy_device_objects() {
+  if (vk_device_ == VK_NULL_HANDLE) {
+    return;
+  }
+  // the set is freed together with its pool
+  vkDestroyDescriptorPool(vk_device_, vk_descriptor_pool_, nullptr);
+  vkDestroyDescriptorSetLayout(vk_device_, vk_descriptor_set_layout_, nullptr);
+  for (auto& buffer : buffers_) {
+    buffer.reset();
+  }
+  gpu_builder_.reset();
+  vk_descriptor_pool_ = VK_NULL_HANDLE;
+  vk_descriptor_set_layout_ = VK_NULL_HANDLE;
+  vk_descriptor_set_ = VK_NULL_HANDLE;
+  vk_device_ = VK_NULL_HANDLE;
+}
@@ -5,11 +5,471 @@
 #ifndef BVH_H
 #define BVH_H
 
-#include "bvh.h"
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
 
+#include "scene.h"
+#include "util.h"
+#include "vkut.h"
+#include "vkut/buffer.h"
+#include "quantized_bvh.h"
+#include "triangle.h"
+#include "wide_bvh.h"
+
+class BvhCacheReader;
+class BvhCacheWriter;
+class GpuBvhBuilder;
+struct BvhStats;
+
+enum class BvhBuildMode {
+  SAH,   // binned sah, top down
+  LBVH,  // morton code sort, for fast interactive rebuilds
+  SBVH,  // sah with spatial splits, for offline renders of large triangles
+  PLOC,  // bottom up clustering, between lbvh and sah in speed and quality
+};
+
+// "sah", "lbvh", "sbvh", "ploc"; returns false for an unknown name
+bool parse_build_mode(const char* name, BvhBuildMode* out_mode);
+const char* build_mode_name(BvhBuildMode mode);
+
+struct BvhBuildSettings {
+  BvhBuildMode mode{BvhBuildMode::SAH};
+  uint32_t width{2};  // children per node of the traversed layout: 2, 4 or 8
+  bool quantized{false};  // 8-bit child bounds for width 4 and 8
+  bool stackless{false};  // width 2: interior offsets are skip links
+  // watertight triangle test for renders that can't tolerate cracks
+  bool watertight{false};
+  // BvhScene builds an lbvh with compute shaders when its device objects
+  // are created, the tree never exists in host memory and intersect()
+  // finds nothing. needs width 2 and a scene without instances. the viewer
+  // has no flag for it until --check_device_build has passed on a device.
+  bool device_build{false};
+  // the shaders decode the triangles from indices into the compact vertices
+  // of the scene, see Scene::encode_compact_vertices. needs a host build.
+  bool compact_vertices{false};
+  uint32_t bin_count{32};
+  uint32_t max_leaf_size{8};
+  float traversal_cost{1.0f};
+  float intersection_cost{1.0f};
+
+  // sbvh: spatial splits are tried when the object split children overlap by
+  // more than sbvh_alpha of the root area, and may add at most
+  // sbvh_max_duplication * primitive count extra references
+  float sbvh_alpha{1e-5f};
+  float sbvh_max_duplication{0.3f};
+
+  // ploc: clusters search this many neighbors on each side in morton order
+  uint32_t ploc_radius{16};
+
+  // time spent restructuring treelets after a build, 0 disables
+  float optimize_budget_ms{0.0f};
+
+  // BvhScene::update rebuilds instead of refitting past this sah cost ratio
+  float rebuild_threshold{1.5f};
+};
+
+// bounds of the part of prim inside the slab lo <= p[axis] <= hi
+using PrimClipper =
+    std::function<Aabb(uint32_t prim, int axis, float lo, float hi)>;
+
+// intermediate node produced by the builders, children are explicit
+struct BvhBuildNode {
+  Aabb bounds;
+  uint32_t children[2]{0, 0};
+  uint32_t first_prim{0};
+  uint32_t prim_count{0};  // 0 for interior nodes
+
+  [[nodiscard]] bool is_leaf() const { return prim_count > 0; }
+};
+
+// flattened node, matches BvhNode in rt.frag.glsl (std430).
+// nodes are stored depth first: the left child of an interior node directly
+// follows it and offset holds the index of the right child. for leaves offset
+// is the first entry in prim_indices. in the rope layout of
+// Bvh::rope_nodes the offset of an interior node is its skip link instead,
+// the node that follows its subtree.
+struct alignas(32) BvhNode {
+  float bounds_min[3];
+  uint32_t offset;
+  float bounds_max[3];
+  uint32_t prim_count;  // 0 for interior nodes
+
+  [[nodiscard]] bool is_leaf() const { return prim_count > 0; }
+  [[nodiscard]] Aabb bounds() const {
+    Aabb b;
+    b.min = Vec3f(bounds_min[0], bounds_min[1], bounds_min[2]);
+    b.max = Vec3f(bounds_max[0], bounds_max[1], bounds_max[2]);
+    return b;
+  }
+};
+static_assert(sizeof(BvhNode) == 32, "BvhNode must match the shader layout");
+
+struct Hit {
+  float t{std::numeric_limits<float>::max()};
+  uint32_t prim{~0u};      // scene triangle or analytic primitive
+  uint32_t instance{~0u};  // scene instance, ~0u for scenes without instances
+  float u{0.0f};
+  float v{0.0f};
+};
+
+// binary bvh over a set of primitive bounds, nodes_[0] is the root
+class Bvh {
+ public:
+  // builds with settings.mode, clipper is only used by the sbvh builder and
+  // falls back to clipping the primitive bounds when empty
+  static Bvh build(const std::vector<Aabb>& prim_bounds,
+                   const BvhBuildSettings& settings,
+                   const PrimClipper& clipper = PrimClipper());
+
+  // binned surface area heuristic builder
+  static Bvh build_sah(const std::vector<Aabb>& prim_bounds,
+                       const BvhBuildSettings& settings);
+  // linear bvh over 63-bit morton codes
+  static Bvh build_lbvh(const std::vector<Aabb>& prim_bounds,
+                        const BvhBuildSettings& settings);
+  // spatial split bvh, leaves may reference a primitive more than once
+  static Bvh build_sbvh(const std::vector<Aabb>& prim_bounds,
+                        const BvhBuildSettings& settings,
+                        const PrimClipper& clipper);
+  // parallel locally ordered clustering
+  static Bvh build_ploc(const std::vector<Aabb>& prim_bounds,
+                        const BvhBuildSettings& settings);
+
+  // arrays of a previous build, e.g. from the bvh cache
+  static Bvh from_arrays(std::vector<BvhNode> nodes,
+                         std::vector<uint32_t> prim_indices);
+
+  [[nodiscard]] bool empty() const { return nodes_.empty(); }
+  [[nodiscard]] const std::vector<BvhNode>& nodes() const { return nodes_; }
+  [[nodiscard]] const std::vector<uint32_t>& prim_indices() const {
+    return prim_indices_;
+  }
+
+  [[nodiscard]] float sah_cost(const BvhBuildSettings& settings) const;
+
+  // lowers the sah cost by restructuring small treelets in parallel until
+  // budget_ms runs out, returns the number of finished passes
+  uint32_t optimize(const BvhBuildSettings& settings, double budget_ms);
+
+  // recomputes node bounds bottom up for moved primitives, the topology is
+  // kept. subtrees below the top levels are refit in parallel.
+  void refit(const std::vector<Aabb>& prim_bounds);
+
+  // calls intersect_prim(prim, ray) for every primitive in a leaf the ray
+  // reaches, intersect_prim returns the new ray.t_max. visits are added to
+  // counters when given.
+  template <typename IntersectPrim>
+  void traverse(Ray ray, IntersectPrim&& intersect_prim,
+                TraversalCounters* counters = nullptr) const;
+
+  // nodes with skip links for stackless traversal. a hit moves to the next
+  // node, a miss or a leaf to the skip link, which is nodes().size() past
+  // the last subtree. children are always visited left first.
+  [[nodiscard]] std::vector<BvhNode> rope_nodes() const;
+
+  // same contract as traverse, over rope_nodes()
+  template <typename IntersectPrim>
+  void traverse_ropes(const std::vector<BvhNode>& rope_nodes, Ray ray,
+                      IntersectPrim&& intersect_prim,
+                      TraversalCounters* counters = nullptr) const;
+
+ private:
+  std::vector<BvhNode> nodes_;
+  std::vector<uint32_t> prim_indices_;
+
+  // depth first flattening of the builder output rooted at build_nodes[0],
+  // subtrees deeper than BVH_MAX_DEPTH are rebuilt balanced first
+  void flatten(std::vector<BvhBuildNode>& build_nodes);
+};
+
+// per instance record of the two level layout, matches BvhInstance in
+// rt.frag.glsl (std430)
+struct BvhInstance {
+  float world_to_object[3][4];
+  uint32_t node_offset;     // root of the mesh bvh in the node array
+  uint32_t prim_offset;     // leaf offsets of the mesh bvh are rebased by it
+  uint32_t first_triangle;  // of the mesh
+  uint32_t node_count;      // of the mesh bvh, ends its stackless traversal
+};
+static_assert(sizeof(BvhInstance) == 64, "BvhInstance must match the shader");
+
+// bindings of BvhScene::descriptor_set(), see rt.frag.glsl
+const uint32_t BVH_BINDING_NODES = 0;
+const uint32_t BVH_BINDING_INSTANCES = 1;
+const uint32_t BVH_BINDING_TRIANGLES = 2;
+const uint32_t BVH_BINDING_VERTICES = 3;
+const uint32_t BVH_BINDING_COUNT = 4;
+
+// acceleration structure of a scene. scenes without instances get a single
+// bvh over all triangles. scenes with instances get one bottom level bvh per
+// mesh and a top level bvh over the instances, so memory scales with the
+// unique geometry and moving an instance only rebuilds the top level.
 class BvhScene {
  public:
-  void* descriptor_set() { return nullptr; }
+  NOCOPYABLE(BvhScene)
+
+  // with a cache_path the arrays are loaded from that file when it was
+  // written for the same scene and settings, otherwise they are built and
+  // the file is (re)written. a cache embedded in the scene is used first.
+  explicit BvhScene(const Scene* scene,
+                    const BvhBuildSettings& settings = BvhBuildSettings(),
+                    const std::string& cache_path = std::string());
+  ~BvhScene();
+
+  [[nodiscard]] const Bvh& bvh() const { return bvh_; }
+  [[nodiscard]] const WideBvh<4>& bvh4() const { return bvh4_; }
+  [[nodiscard]] const WideBvh<8>& bvh8() const { return bvh8_; }
+  [[nodiscard]] const QuantizedBvh<4>& qbvh4() const { return qbvh4_; }
+  [[nodiscard]] const QuantizedBvh<8>& qbvh8() const { return qbvh8_; }
+  [[nodiscard]] uint32_t width() const { return settings_.width; }
+  [[nodiscard]] bool quantized() const { return settings_.quantized; }
+  [[nodiscard]] bool instanced() const { return !scene_->instances().empty(); }
+  [[nodiscard]] bool watertight() const { return settings_.watertight; }
+  [[nodiscard]] bool compact_vertices() const {
+    return settings_.compact_vertices;
+  }
+  [[nodiscard]] double build_time_ms() const { return build_time_ms_; }
+
+  // closest triangle hit on the cpu, visits are added to counters when
+  // given
+  bool intersect(const Ray& ray, Hit& hit,
+                 TraversalCounters* counters = nullptr) const;
+
+  // quality of the built trees, see bvh_stats.h. instanced scenes report
+  // the mesh bvhs and the top level together, with the sah cost of the top
+  // level. the epo walks every triangle down its tree, which costs about as
+  // much as a build. device builds have no host copy and report memory only.
+  [[nodiscard]] BvhStats stats(bool with_epo = true) const;
+
+  // the bvh cache file contents of the built arrays, e.g. to embed them in
+  // a scene file
+  [[nodiscard]] Blob cache_data() const;
+
+  // triangles in the order the leaves of the uploaded node array reference
+  // them, so a leaf offset indexes the records directly. instanced scenes
+  // get the records of every mesh bvh in node array order.
+  [[nodiscard]] TriangleRecords triangle_records() const;
+
+  // vertex positions of the scene changed but its topology did not. refits
+  // the node bounds bottom up and rebuilds instead once the sah cost exceeds
+  // settings.rebuild_threshold times the cost of the last build. instanced
+  // scenes refit or rebuild every mesh bvh on its own and rebuild the top
+  // level. uploaded buffers are updated in place when their size is kept,
+  // after the device went idle, so frames in flight never read a half
+  // written buffer or a freed one. returns true when the whole tree was
+  // rebuilt.
+  bool update();
+
+  // instance transforms of the scene changed, rebuilds the top level only.
+  // waits for the device like update().
+  void update_instances();
+
+  // uploads the node array of width(), the instance records and the
+  // triangle records, or with compact_vertices() the vertex indices of the
+  // triangles and the compact vertices. the shaders must be compiled with
+  // the same BVH_WIDTH, BVH_QUANTIZED, BVH_STACKLESS, BVH_WATERTIGHT and
+  // BVH_COMPACT_VERTICES, instanced scenes always use the binary layout.
+  // with settings.device_build the nodes and triangle records are built on
+  // a queue of queue_family instead.
+  void create_device_objects(VkPhysicalDevice physical_device,
+                             VkDevice device, uint32_t queue_family = 0);
+  void destroy_device_objects();
+
+  [[nodiscard]] VkDescriptorSetLayout descriptor_set_layout() const {
+    return vk_descriptor_set_layout_;
+  }
+  [[nodiscard]] VkDescriptorSet descriptor_set() const {
+    return vk_descriptor_set_;
+  }
+
+ private:
+  // the array traced and uploaded for a scene without instances, fixed once
+  // the constructor has normalized the settings
+  enum class Layout { BVH2, ROPES, BVH4, BVH8, QBVH4, QBVH8 };
+
+  // the node array of layout_ as raw bytes and the leaf order it references
+  struct NodeArray {
+    const void* data;
+    size_t size_bytes;
+    const std::vector<uint32_t>* prim_indices;
+  };
+
+  const Scene* scene_{nullptr};
+  BvhBuildSettings settings_;
+  Layout layout_{Layout::BVH2};
+  Bvh bvh_;
+  WideBvh<4> bvh4_;
+  WideBvh<8> bvh8_;
+  // replace bvh4_ / bvh8_ when settings.quantized
+  QuantizedBvh<4> qbvh4_;
+  QuantizedBvh<8> qbvh8_;
+  // bvh_ with skip links when settings.stackless
+  std::vector<BvhNode> rope_nodes_;
+  double build_time_ms_{0.0};
+  float built_sah_cost_{0.0f};
+
+  // two level, prims of a mesh bvh are mesh local triangles
+  std::vector<Bvh> blases_;
+  std::vector<float> blas_sah_costs_;
+  Bvh tlas_;
+  std::vector<Transform> world_to_object_;
+
+  void build();
+  bool load_cache(const std::string& path);
+  bool load_embedded_cache();
+  bool load_cache(const BvhCacheReader& reader, const char* name,
+                  std::chrono::steady_clock::time_point start);
+  void save_cache(const std::string& path) const;
+  [[nodiscard]] BvhCacheWriter cache_writer() const;
+  void build_blas(uint32_t mesh);
+  void build_tlas();
+  void collapse();
+  [[nodiscard]] NodeArray node_array() const;
+  // prims in the whole scene numbering, see Scene::primitive_kind
+  [[nodiscard]] std::vector<Aabb> compute_prim_bounds(
+      uint32_t first_prim, uint32_t prim_count) const;
+  bool intersect_primitive(uint32_t prim, const Ray& ray,
+                           const WatertightRay& shear, Hit& hit) const;
+  Aabb clip_primitive(uint32_t prim, int axis, float lo, float hi) const;
+
+  // device objects
+  void upload_nodes();
+  void upload_instances();
+  void upload_triangles();
+  // scene triangles in the order of triangle_records()
+  [[nodiscard]] std::vector<uint32_t> leaf_triangles() const;
+  void build_on_device();
+  // before buffers or the descriptor set are rewritten
+  void wait_for_frames() const;
+  void upload(uint32_t binding, const void* data, size_t size);
+  void write_descriptor(uint32_t binding);
+
+  VkPhysicalDevice vk_physical_device_{VK_NULL_HANDLE};
+  VkDevice vk_device_{VK_NULL_HANDLE};
+  uint32_t queue_family_{0};
+  std::unique_ptr<GpuBvhBuilder> gpu_builder_;  // settings.device_build
+  std::unique_ptr<vkut::Buffer> buffers_[BVH_BINDING_COUNT];
+  VkDescriptorSetLayout vk_descriptor_set_layout_{VK_NULL_HANDLE};
+  VkDescriptorPool vk_descriptor_pool_{VK_NULL_HANDLE};
+  VkDescriptorSet vk_descriptor_set_{VK_NULL_HANDLE};
 };
 
+template <typename IntersectPrim>
+void Bvh::traverse(Ray ray, IntersectPrim&& intersect_prim,
+                   TraversalCounters* counters) const {
+  if (nodes_.empty()) {
+    return;
+  }
+
+  Vec3f inv_dir(1.0f / ray.direction.x, 1.0f / ray.direction.y,
+                1.0f / ray.direction.z);
+  auto hit_node = [&](const BvhNode& node, float& t_near) {
+    float t0 = 0.0f;
+    float t1 = ray.t_max;
+    for (int axis = 0; axis < 3; ++axis) {
+      float t_enter =
+          (node.bounds_min[axis] - ray.origin[axis]) * inv_dir[axis];
+      float t_exit = (node.bounds_max[axis] - ray.origin[axis]) * inv_dir[axis];
+      if (t_enter > t_exit) {
+        std::swap(t_enter, t_exit);
+      }
+      t0 = t_enter > t0 ? t_enter : t0;
+      t1 = t_exit < t1 ? t_exit : t1;
+    }
+    t_near = t0;
+    return t0 <= t1 * SLAB_T_FAR_SCALE;
+  };
+
+  uint32_t stack[BVH_MAX_DEPTH];
+  uint32_t stack_size = 0;
+  uint32_t index = 0;
+  float t_near = 0.0f;
+  if (!hit_node(nodes_[0], t_near)) {
+    return;
+  }
+
+  while (true) {
+    const BvhNode& node = nodes_[index];
+    if (counters) {
+      ++counters->nodes;
+      counters->prims += node.prim_count;
+    }
+    if (node.is_leaf()) {
+      for (uint32_t i = 0; i < node.prim_count; ++i) {
+        ray.t_max = intersect_prim(prim_indices_[node.offset + i], ray);
+      }
+    } else {
+      float t_left = 0.0f;
+      float t_right = 0.0f;
+      bool hit_left = hit_node(nodes_[index + 1], t_left);
+      bool hit_right = hit_node(nodes_[node.offset], t_right);
+      if (hit_left && hit_right) {
+        bool left_first = t_left <= t_right;
+        stack[stack_size++] = left_first ? node.offset : index + 1;
+        index = left_first ? index + 1 : node.offset;
+        continue;
+      }
+      if (hit_left || hit_right) {
+        index = hit_left ? index + 1 : node.offset;
+        continue;
+      }
+    }
+
+    // pop until a node that is still in front of the closest hit
+    bool found = false;
+    while (stack_size > 0 && !found) {
+      index = stack[--stack_size];
+      found = hit_node(nodes_[index], t_near);
+    }
+    if (!found) {
+      return;
+    }
+  }
+}
+
+template <typename IntersectPrim>
+void Bvh::traverse_ropes(const std::vector<BvhNode>& rope_nodes, Ray ray,
+                         IntersectPrim&& intersect_prim,
+                         TraversalCounters* counters) const {
+  Vec3f inv_dir(1.0f / ray.direction.x, 1.0f / ray.direction.y,
+                1.0f / ray.direction.z);
+  const auto end = static_cast<uint32_t>(rope_nodes.size());
+  uint32_t index = 0;
+  while (index != end) {
+    const BvhNode& node = rope_nodes[index];
+    if (counters) {
+      ++counters->nodes;
+    }
+    float t0 = 0.0f;
+    float t1 = ray.t_max;
+    for (int axis = 0; axis < 3; ++axis) {
+      float t_enter =
+          (node.bounds_min[axis] - ray.origin[axis]) * inv_dir[axis];
+      float t_exit = (node.bounds_max[axis] - ray.origin[axis]) * inv_dir[axis];
+      if (t_enter > t_exit) {
+        std::swap(t_enter, t_exit);
+      }
+      t0 = t_enter > t0 ? t_enter : t0;
+      t1 = t_exit < t1 ? t_exit : t1;
+    }
+
+    if (t0 > t1 * SLAB_T_FAR_SCALE) {
+      index = node.is_leaf() ? index + 1 : node.offset;
+    } else if (node.is_leaf()) {
+      if (counters) {
+        counters->prims += node.prim_count;
+      }
+      for (uint32_t i = 0; i < node.prim_count; ++i) {
+        ray.t_max = intersect_prim(prim_indices_[node.offset + i], ray);
+      }
+      ++index;
+    } else {
+      ++index;
+    }
+  }
+}
+
 #endif  // BVH_H
@@ -0,0 +1,179 @@
+#include "bvh_cache.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+const uint32_t BVH_CACHE_MAGIC = 0x43485642;  // "BVHC"
+const uint64_t BVH_CACHE_ALIGNMENT = 32;
+
+uint64_t align_up(uint64_t offset) {
+  return (offset + BVH_CACHE_ALIGNMENT - 1) & ~(BVH_CACHE_ALIGNMENT - 1);
+}
+
+// std::vector or MappedArray
+template <typename Array>
+uint64_t hash_array(const Array& array, uint64_t seed) {
+  return hash_bytes(array.data(), array.size() * sizeof(*array.data()), seed);
+}
+
+// same hash a page at a time through the pager, hash_bytes continues over
+// pieces that are a multiple of 8 bytes
+uint64_t hash_paged(PagedFile* pager, const void* data, size_t size,
+                    uint64_t seed) {
+  if (!pager) {
+    return hash_bytes(data, size, seed);
+  }
+  const auto* bytes = static_cast<const uint8_t*>(data);
+  for (size_t offset = 0; offset < size; offset += PAGED_FILE_PAGE_SIZE) {
+    const size_t n = std::min(PAGED_FILE_PAGE_SIZE, size - offset);
+    pager->touch(bytes + offset, n);
+    seed = hash_bytes(bytes + offset, n, seed);
+  }
+  return seed;
+}
+
+template <typename T>
+uint64_t hash_value(const T& value, uint64_t seed) {
+  return hash_bytes(&value, sizeof(T), seed);
+}
+
+}  // namespace
+
+BvhCacheKey bvh_cache_key(const Scene& scene,
+                          const BvhBuildSettings& settings) {
+  uint64_t key = hash_value(BVH_CACHE_VERSION, hash_bytes(nullptr, 0));
+  key = hash_paged(scene.pager(), scene.positions().data(),
+                   scene.positions().size() * sizeof(Vec3f), key);
+  key = hash_paged(scene.pager(), scene.indices().data(),
+                   scene.indices().size() * sizeof(uint32_t), key);
+  // keys of triangle only scenes stay as they were
+  if (scene.analytic_count() > 0) {
+    key = hash_array(scene.spheres(), key);
+    key = hash_array(scene.boxes(), key);
+    key = hash_array(scene.quads(), key);
+  }
+  // only the meshes matter for the cached arrays of an instanced scene
+  const bool instanced = !scene.instances().empty();
+  key = hash_value(instanced, key);
+  if (instanced) {
+    key = hash_array(scene.meshes(), key);
+  }
+
+  // rebuild_threshold does not change what gets built. stackless,
+  // watertight and compact_vertices don't change the cached arrays either,
+  // but a cache is only reused for the layout that wrote it.
+  key = hash_value(settings.mode, key);
+  key = hash_value(settings.width, key);
+  key = hash_value(settings.quantized, key);
+  key = hash_value(settings.stackless, key);
+  key = hash_value(settings.watertight, key);
+  key = hash_value(settings.compact_vertices, key);
+  key = hash_value(settings.bin_count, key);
+  key = hash_value(settings.max_leaf_size, key);
+  key = hash_value(settings.traversal_cost, key);
+  key = hash_value(settings.intersection_cost, key);
+  key = hash_value(settings.sbvh_alpha, key);
+  key = hash_value(settings.sbvh_max_duplication, key);
+  key = hash_value(settings.ploc_radius, key);
+  key = hash_value(settings.optimize_budget_ms, key);
+  return BvhCacheKey{key, scene.positions().size(), scene.primitive_count()};
+}
+
+std::string bvh_cache_path(const char* model_path) {
+  return std::string(model_path) + ".bvhcache";
+}
+
+Blob BvhCacheWriter::pack(const BvhCacheKey& key) const {
+  BvhCacheHeader header = {};
+  header.magic = BVH_CACHE_MAGIC;
+  header.version = BVH_CACHE_VERSION;
+  header.key = key.hash;
+  header.vertex_count = key.vertex_count;
+  header.primitive_count = key.primitive_count;
+  header.section_count = static_cast<uint32_t>(sections_.size());
+
+  std::vector<BvhCacheSection> table(sections_.size());
+  uint64_t offset =
+      align_up(sizeof(header) + table.size() * sizeof(BvhCacheSection));
+  for (size_t i = 0; i < sections_.size(); ++i) {
+    table[i].offset = offset;
+    table[i].size = sections_[i].second;
+    offset = align_up(offset + table[i].size);
+  }
+
+  Blob blob(offset, 0);
+  memcpy(blob.data(), &header, sizeof(header));
+  memcpy(blob.data() + sizeof(header), table.data(),
+         table.size() * sizeof(BvhCacheSection));
+  for (size_t i = 0; i < sections_.size(); ++i) {
+    if (table[i].size > 0) {
+      memcpy(blob.data() + table[i].offset, sections_[i].first,
+             table[i].size);
+    }
+  }
+  return blob;
+}
+
+bool BvhCacheWriter::write(const char* path, const BvhCacheKey& key) const {
+  Blob blob = pack(key);
+
+  // written under a temporary name so a crash never leaves a truncated cache
+  std::string temp_path = std::string(path) + ".tmp";
+  if (!write_file(temp_path.c_str(), blob.data(), blob.size())) {
+    remove(temp_path.c_str());
+    return false;
+  }
+  remove(path);
+  return rename(temp_path.c_str(), path) == 0;
+}
+
+bool BvhCacheReader::open(const char* path, const BvhCacheKey& key) {
+  if (!file_.open(path)) {
+    sections_ = nullptr;
+    section_count_ = 0;
+    return false;
+  }
+  if (!open(file_.data(), file_.size(), key)) {
+    file_.close();
+    return false;
+  }
+  return true;
+}
+
+bool BvhCacheReader::open(const uint8_t* data, size_t size,
+                          const BvhCacheKey& key) {
+  sections_ = nullptr;
+  section_count_ = 0;
+  data_ = nullptr;
+  size_ = 0;
+
+  BvhCacheHeader header = {};
+  if (size < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, data, sizeof(header));
+  const uint64_t table_end =
+      sizeof(header) + uint64_t(header.section_count) * sizeof(BvhCacheSection);
+  if (header.magic != BVH_CACHE_MAGIC || header.version != BVH_CACHE_VERSION ||
+      header.key != key.hash || header.vertex_count != key.vertex_count ||
+      header.primitive_count != key.primitive_count || table_end > size) {
+    return false;
+  }
+
+  // mappings and embedded caches are at least 8 byte aligned, so the table
+  // can be used in place
+  sections_ = reinterpret_cast<const BvhCacheSection*>(data + sizeof(header));
+  for (uint32_t i = 0; i < header.section_count; ++i) {
+    if (sections_[i].offset > size ||
+        sections_[i].size > size - sections_[i].offset) {
+      sections_ = nullptr;
+      return false;
+    }
+  }
+  data_ = data;
+  size_ = size;
+  section_count_ = header.section_count;
+  return true;
+}
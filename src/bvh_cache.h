@@ -0,0 +1,103 @@
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include <cstring>
+#include <string>
+
+#include "bvh.h"
+#include "scene.h"
+#include "util.h"
+
+// bump whenever the layout of BvhNode, WideBvhNode, the header, the key
+// hash or the section order of BvhScene::save_cache changes, older files are
+// then rebuilt
+const uint32_t BVH_CACHE_VERSION = 3;
+
+// what a cache file was written for. the counts are checked next to the
+// hash, so a collision still needs a scene of the same size.
+struct BvhCacheKey {
+  uint64_t hash{0};
+  uint64_t vertex_count{0};
+  uint64_t primitive_count{0};  // triangles and analytic primitives
+};
+
+// hash of everything the cached arrays depend on: vertex positions, indices,
+// analytic primitives, meshes and the build settings. instance transforms
+// are left out, the top level is rebuilt on load.
+BvhCacheKey bvh_cache_key(const Scene& scene,
+                          const BvhBuildSettings& settings);
+
+// cache file next to a model, "<model_path>.bvhcache"
+std::string bvh_cache_path(const char* model_path);
+
+// cache file layout, every section starts 32 byte aligned:
+//   BvhCacheHeader
+//   BvhCacheSection[section_count]
+//   section data
+struct BvhCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint32_t section_count;
+  uint32_t pad;
+  uint64_t vertex_count;
+  uint64_t primitive_count;
+};
+
+struct BvhCacheSection {
+  uint64_t offset;  // from the start of the file
+  uint64_t size;    // in bytes
+};
+
+// collects arrays and writes them as one cache file
+class BvhCacheWriter {
+ public:
+  template <typename T>
+  void add(const std::vector<T>& array) {
+    sections_.emplace_back(array.data(), array.size() * sizeof(T));
+  }
+
+  // the file contents, e.g. to embed the cache in a scene file
+  [[nodiscard]] Blob pack(const BvhCacheKey& key) const;
+  bool write(const char* path, const BvhCacheKey& key) const;
+
+ private:
+  std::vector<std::pair<const void*, size_t>> sections_;
+};
+
+// maps a cache file and hands out its sections
+class BvhCacheReader {
+ public:
+  // false when the file is missing, truncated, from another version or was
+  // written for another key
+  bool open(const char* path, const BvhCacheKey& key);
+  // same over cache bytes the caller keeps alive, e.g. embedded in a scene
+  // file
+  bool open(const uint8_t* data, size_t size, const BvhCacheKey& key);
+
+  [[nodiscard]] uint32_t section_count() const { return section_count_; }
+
+  // copies a section out of the mapping, false if its size is not a multiple
+  // of sizeof(T)
+  template <typename T>
+  bool read(uint32_t section, std::vector<T>* out) const {
+    const BvhCacheSection& s = sections_[section];
+    if (s.size % sizeof(T) != 0) {
+      return false;
+    }
+    out->resize(s.size / sizeof(T));
+    if (s.size > 0) {
+      memcpy(out->data(), data_ + s.offset, s.size);
+    }
+    return true;
+  }
+
+ private:
+  MappedFile file_;
+  const uint8_t* data_{nullptr};  // file_ or the caller's bytes
+  size_t size_{0};
+  const BvhCacheSection* sections_{nullptr};
+  uint32_t section_count_{0};
+};
+
+#endif  // BVH_CACHE_H
@@ -0,0 +1,300 @@
+#include "bvh_stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+// area of the part of triangle p inside bounds, sutherland-hodgman against
+// the six planes of the box
+float clipped_area(const Vec3f* p, const Aabb& bounds) {
+  Vec3f polygon[9] = {p[0], p[1], p[2]};
+  Vec3f clipped[9];
+  int count = 3;
+  for (int plane = 0; plane < 6 && count > 0; ++plane) {
+    const int axis = plane / 2;
+    const bool is_min = plane % 2 == 0;
+    const float value = is_min ? bounds.min[axis] : bounds.max[axis];
+    auto inside = [&](const Vec3f& v) {
+      return is_min ? v[axis] >= value : v[axis] <= value;
+    };
+    int clipped_count = 0;
+    for (int i = 0; i < count; ++i) {
+      const Vec3f& a = polygon[i];
+      const Vec3f& b = polygon[(i + 1) % count];
+      if (inside(a)) {
+        clipped[clipped_count++] = a;
+      }
+      if (inside(a) != inside(b)) {
+        float t = (value - a[axis]) / (b[axis] - a[axis]);
+        Vec3f v = a + (b - a) * t;
+        v[axis] = value;
+        clipped[clipped_count++] = v;
+      }
+    }
+    count = clipped_count;
+    std::copy(clipped, clipped + count, polygon);
+  }
+
+  Vec3f sum;
+  for (int i = 0; i < count; ++i) {
+    sum += Vec3f::cross(polygon[i], polygon[(i + 1) % count]);
+  }
+  return 0.5f * std::sqrt(Vec3f::dot(sum, sum));
+}
+
+bool overlaps(const Aabb& a, const Aabb& b) {
+  return a.min.x <= b.max.x && a.max.x >= b.min.x && a.min.y <= b.max.y &&
+         a.max.y >= b.min.y && a.min.z <= b.max.z && a.max.z >= b.min.z;
+}
+
+bool contains(const Aabb& outer, const Aabb& inner) {
+  return outer.min.x <= inner.min.x && outer.max.x >= inner.max.x &&
+         outer.min.y <= inner.min.y && outer.max.y >= inner.max.y &&
+         outer.min.z <= inner.min.z && outer.max.z >= inner.max.z;
+}
+
+// blue, cyan, green, yellow, red for heat in [0, 1]
+void heat_color(float heat, uint8_t* rgb) {
+  const float stops[5][3] = {{0.0f, 0.0f, 1.0f},
+                             {0.0f, 1.0f, 1.0f},
+                             {0.0f, 1.0f, 0.0f},
+                             {1.0f, 1.0f, 0.0f},
+                             {1.0f, 0.0f, 0.0f}};
+  const float x = std::min(std::max(heat, 0.0f), 1.0f) * 4.0f;
+  const int i = std::min(int(x), 3);
+  const float f = x - float(i);
+  for (int c = 0; c < 3; ++c) {
+    const float value = stops[i][c] + (stops[i + 1][c] - stops[i][c]) * f;
+    rgb[c] = static_cast<uint8_t>(value * 255.0f + 0.5f);
+  }
+}
+
+}  // namespace
+
+uint32_t BvhStats::max_depth() const {
+  return leaf_depths.empty() ? 0 : uint32_t(leaf_depths.size() - 1);
+}
+
+float BvhStats::average_leaf_depth() const {
+  double sum = 0.0;
+  for (size_t depth = 0; depth < leaf_depths.size(); ++depth) {
+    sum += double(depth) * leaf_depths[depth];
+  }
+  return leaf_count > 0 ? float(sum / leaf_count) : 0.0f;
+}
+
+void BvhStats::print() const {
+  printf("bvh: %u nodes, %u leaves, %u prim refs, sah cost %.3f, epo %.3f\n",
+         node_count, leaf_count, prim_refs, sah_cost, epo);
+  printf("bvh: nodes %.2f MiB, all buffers %.2f MiB\n",
+         double(node_bytes) / (1024.0 * 1024.0),
+         double(memory_bytes) / (1024.0 * 1024.0));
+  printf("bvh: leaf depth average %.2f, max %u\n", average_leaf_depth(),
+         max_depth());
+
+  // histograms as percentages of the leaves, empty rows skipped
+  auto print_histogram = [&](const char* name,
+                             const std::vector<uint32_t>& histogram) {
+    for (size_t i = 0; i < histogram.size(); ++i) {
+      if (histogram[i] > 0) {
+        printf("bvh: %s %3zu: %9u %5.1f%%\n", name, i, histogram[i],
+               100.0 * histogram[i] / leaf_count);
+      }
+    }
+  };
+  print_histogram("leaf size ", leaf_sizes);
+  print_histogram("leaf depth", leaf_depths);
+}
+
+void add_tree_stats(const Bvh& bvh, BvhStats* stats) {
+  const auto& nodes = bvh.nodes();
+  if (nodes.empty()) {
+    return;
+  }
+  stats->node_count += static_cast<uint32_t>(nodes.size());
+
+  // depth first, so the depth of a node is known before its children
+  std::vector<uint32_t> depths(nodes.size(), 0);
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    const BvhNode& node = nodes[i];
+    if (node.is_leaf()) {
+      ++stats->leaf_count;
+      stats->prim_refs += node.prim_count;
+      if (stats->leaf_sizes.size() <= node.prim_count) {
+        stats->leaf_sizes.resize(node.prim_count + 1, 0);
+      }
+      ++stats->leaf_sizes[node.prim_count];
+      if (stats->leaf_depths.size() <= depths[i]) {
+        stats->leaf_depths.resize(depths[i] + 1, 0);
+      }
+      ++stats->leaf_depths[depths[i]];
+    } else {
+      depths[i + 1] = depths[i] + 1;
+      depths[node.offset] = depths[i] + 1;
+    }
+  }
+}
+
+void add_end_point_overlap(const Bvh& bvh, const Scene& scene,
+                           uint32_t first_triangle,
+                           const BvhBuildSettings& settings, double* overlap,
+                           double* area) {
+  const auto& nodes = bvh.nodes();
+  if (nodes.empty()) {
+    return;
+  }
+
+  // a subtree is the range [node, subtree_end) in depth first order
+  const auto node_count = static_cast<uint32_t>(nodes.size());
+  std::vector<uint32_t> subtree_end(node_count);
+  for (uint32_t i = node_count; i-- > 0;) {
+    subtree_end[i] =
+        nodes[i].is_leaf() ? i + 1 : subtree_end[nodes[i].offset];
+  }
+
+  // leaves referencing each prim, sorted by prim
+  std::vector<std::pair<uint32_t, uint32_t>> refs;
+  for (uint32_t i = 0; i < node_count; ++i) {
+    for (uint32_t j = 0; j < nodes[i].prim_count; ++j) {
+      refs.emplace_back(bvh.prim_indices()[nodes[i].offset + j], i);
+    }
+  }
+  std::sort(refs.begin(), refs.end());
+  // analytic primitives sort after the triangles and are left out
+  std::vector<uint32_t> unique_prims;
+  std::vector<uint32_t> first_ref;
+  uint32_t ref_end = 0;
+  for (; ref_end < refs.size() &&
+         first_triangle + refs[ref_end].first < scene.triangle_count();
+       ++ref_end) {
+    if (ref_end == 0 || refs[ref_end].first != refs[ref_end - 1].first) {
+      unique_prims.push_back(refs[ref_end].first);
+      first_ref.push_back(ref_end);
+    }
+  }
+  first_ref.push_back(ref_end);
+
+  const auto& positions = scene.positions();
+  const auto& indices = scene.indices();
+  std::vector<double> worker_overlap(worker_count(), 0.0);
+  std::vector<double> worker_area(worker_count(), 0.0);
+  parallel_for(0, unique_prims.size(), 64, [&](size_t begin, size_t end,
+                                               uint32_t worker) {
+    std::vector<uint32_t> stack;
+    for (size_t k = begin; k < end; ++k) {
+      const uint32_t triangle = first_triangle + unique_prims[k];
+      const Vec3f p[3] = {positions[indices[triangle * 3 + 0]],
+                          positions[indices[triangle * 3 + 1]],
+                          positions[indices[triangle * 3 + 2]]};
+      Aabb triangle_bounds;
+      for (const auto& v : p) {
+        triangle_bounds.grow(v);
+      }
+      const Vec3f normal = Vec3f::cross(p[1] - p[0], p[2] - p[0]);
+      const float triangle_area = 0.5f * std::sqrt(Vec3f::dot(normal, normal));
+      worker_area[worker] += triangle_area;
+
+      // children lie inside their parent, a subtree the triangle misses is
+      // skipped as a whole
+      stack.assign(1, 0);
+      while (!stack.empty()) {
+        const uint32_t index = stack.back();
+        stack.pop_back();
+        const BvhNode& node = nodes[index];
+        const Aabb bounds = node.bounds();
+        if (!overlaps(bounds, triangle_bounds)) {
+          continue;
+        }
+        const float inside = contains(bounds, triangle_bounds)
+                                 ? triangle_area
+                                 : clipped_area(p, bounds);
+        if (inside <= 0.0f) {
+          continue;
+        }
+
+        bool referenced = false;
+        for (uint32_t r = first_ref[k]; r < first_ref[k + 1]; ++r) {
+          referenced |= refs[r].second >= index &&
+                        refs[r].second < subtree_end[index];
+        }
+        if (!referenced) {
+          const float cost =
+              node.is_leaf()
+                  ? settings.intersection_cost * float(node.prim_count)
+                  : settings.traversal_cost;
+          worker_overlap[worker] += double(cost) * inside;
+        }
+        if (!node.is_leaf()) {
+          stack.push_back(node.offset);
+          stack.push_back(index + 1);
+        }
+      }
+    }
+  });
+  for (uint32_t worker = 0; worker < worker_count(); ++worker) {
+    *overlap += worker_overlap[worker];
+    *area += worker_area[worker];
+  }
+}
+
+TraversalHeatmap TraversalHeatmap::trace(const BvhScene& bvh_scene,
+                                         const CameraData& camera,
+                                         uint32_t width, uint32_t height) {
+  TraversalHeatmap heatmap;
+  heatmap.width_ = width;
+  heatmap.height_ = height;
+  heatmap.counters_.resize(size_t(width) * height);
+
+  const Vec3f forward = Vec3f::normalize(camera.look_to - camera.look_from);
+  const Vec3f right = Vec3f::normalize(Vec3f::cross(forward, camera.up_dir));
+  const Vec3f up = Vec3f::cross(right, forward);
+  const float half_height =
+      std::tan(camera.fov_angle_y * 0.5f * 3.14159265f / 180.0f);
+  const float half_width = half_height * float(width) / float(height);
+
+  parallel_for(0, height, 1, [&](size_t begin, size_t end, uint32_t) {
+    for (size_t y = begin; y < end; ++y) {
+      for (uint32_t x = 0; x < width; ++x) {
+        const float sx = (2.0f * (float(x) + 0.5f) / float(width) - 1.0f) *
+                         half_width;
+        const float sy = (1.0f - 2.0f * (float(y) + 0.5f) / float(height)) *
+                         half_height;
+        Ray ray;
+        ray.origin = camera.look_from;
+        ray.direction = Vec3f::normalize(forward + right * sx + up * sy);
+        Hit hit;
+        bvh_scene.intersect(ray, hit, &heatmap.counters_[y * width + x]);
+      }
+    }
+  });
+  return heatmap;
+}
+
+bool TraversalHeatmap::write_ppm(const char* path, bool prims) const {
+  uint32_t max_count = 0;
+  uint64_t sum = 0;
+  for (const auto& c : counters_) {
+    const uint32_t count = prims ? c.prims : c.nodes;
+    max_count = std::max(max_count, count);
+    sum += count;
+  }
+  printf("bvh: heatmap %ux%u, %s visits per ray average %.1f, max %u\n",
+         width_, height_, prims ? "prim" : "node",
+         counters_.empty() ? 0.0 : double(sum) / counters_.size(), max_count);
+
+  char header[64];
+  const int header_size =
+      snprintf(header, sizeof(header), "P6\n%u %u\n255\n", width_, height_);
+  Blob data(header_size + counters_.size() * 3);
+  memcpy(data.data(), header, header_size);
+  for (size_t i = 0; i < counters_.size(); ++i) {
+    const uint32_t count = prims ? counters_[i].prims : counters_[i].nodes;
+    heat_color(max_count > 0 ? float(count) / float(max_count) : 0.0f,
+               data.data() + header_size + i * 3);
+  }
+  return write_file(path, data.data(), data.size());
+}
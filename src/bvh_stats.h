@@ -0,0 +1,72 @@
+#ifndef BVH_STATS_H
+#define BVH_STATS_H
+
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+#include "camera.h"
+#include "scene.h"
+
+// quality report of a built tree, so build settings can be compared on
+// numbers instead of render times alone
+struct BvhStats {
+  uint32_t node_count{0};  // binary nodes, interior and leaves
+  uint32_t leaf_count{0};
+  uint32_t prim_refs{0};  // leaf entries, sbvh may reference a prim twice
+  std::vector<uint32_t> leaf_sizes;   // leaf count by primitive count
+  std::vector<uint32_t> leaf_depths;  // leaf count by depth, the root is 0
+  float sah_cost{0.0f};
+  // end-point overlap (aila et al. 2013): triangle area inside the bounds of
+  // nodes the triangle is not referenced below, weighted like the sah cost
+  // and divided by the total area. the part of the traversal cost that
+  // sah cannot see.
+  float epo{0.0f};
+  size_t node_bytes{0};    // node array of the uploaded layout
+  size_t memory_bytes{0};  // every buffer BvhScene uploads
+
+  [[nodiscard]] uint32_t max_depth() const;
+  [[nodiscard]] float average_leaf_depth() const;
+  void print() const;
+};
+
+// adds the counts and histograms of bvh to stats, the sah and memory fields
+// are left alone
+void add_tree_stats(const Bvh& bvh, BvhStats* stats);
+
+// adds the weighted overlap and the total area of the triangles
+// first_triangle + prim of bvh, epo is overlap / area. every triangle walks
+// down all nodes its bounds overlap, about a traversal per triangle.
+// analytic primitives are left out.
+void add_end_point_overlap(const Bvh& bvh, const Scene& scene,
+                           uint32_t first_triangle,
+                           const BvhBuildSettings& settings, double* overlap,
+                           double* area);
+
+// node and primitive visits of one primary ray per pixel, a debug view of
+// where the tree is expensive to traverse
+class TraversalHeatmap {
+ public:
+  // pinhole camera through the pixel centers, camera.fov_angle_y in degrees.
+  // the aspect ratio follows width and height.
+  static TraversalHeatmap trace(const BvhScene& bvh_scene,
+                                const CameraData& camera, uint32_t width,
+                                uint32_t height);
+
+  [[nodiscard]] uint32_t width() const { return width_; }
+  [[nodiscard]] uint32_t height() const { return height_; }
+  [[nodiscard]] const std::vector<TraversalCounters>& counters() const {
+    return counters_;
+  }
+
+  // binary ppm, blue for few visits to red for the most visited pixel.
+  // prims picks the primitive visits instead of the node visits.
+  bool write_ppm(const char* path, bool prims) const;
+
+ private:
+  uint32_t width_{0};
+  uint32_t height_{0};
+  std::vector<TraversalCounters> counters_;  // row major, top row first
+};
+
+#endif  // BVH_STATS_H
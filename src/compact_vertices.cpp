@@ -0,0 +1,225 @@
+#include "compact_vertices.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+const float QUANTIZED_MAX = 65535.0f;
+// keeps the steps and decoded positions clear of denormals, which the gpu
+// may flush
+const float MIN_STEP = 0x1p-100f;
+
+// smallest power of two >= value
+float power_of_two_at_least(float value) {
+  int exponent = 0;
+  const float mantissa = std::frexp(value, &exponent);
+  return mantissa == 0.5f ? value : std::ldexp(1.0f, exponent);
+}
+
+// a power of two step that spans [lo, hi] in 65536 values from an origin
+// that is a multiple of it. the step is at least the float spacing around
+// the coordinates so that origin / step + q stays below 2^24 and the
+// decoding is exact.
+float grid_step(float lo, float hi) {
+  const float max_abs = std::max(std::abs(lo), std::abs(hi));
+  float step = std::max((hi - lo) / QUANTIZED_MAX, std::ldexp(max_abs, -23));
+  step = power_of_two_at_least(std::max(step, MIN_STEP));
+  // flooring the origin may have pushed hi out of range
+  if ((hi - std::floor(lo / step) * step) / step > QUANTIZED_MAX) {
+    step *= 2.0f;
+  }
+  return step;
+}
+
+uint16_t quantize(float value, float origin, float step) {
+  // nan becomes 0
+  const float q = (value - origin) / step;
+  return q > 0.0f ? uint16_t(std::nearbyint(std::min(q, QUANTIZED_MAX))) : 0;
+}
+
+uint32_t float_bits(float value) {
+  uint32_t bits = 0;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+float bits_float(uint32_t bits) {
+  float value = 0.0f;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// ieee half, rounded to nearest even like packHalf2x16
+uint16_t float_to_half(float value) {
+  uint32_t bits = float_bits(value);
+  const auto sign = uint16_t((bits >> 16) & 0x8000);
+  bits &= 0x7fffffff;
+  if (bits > 0x7f800000) {
+    return sign | 0x7e00;  // nan
+  }
+  if (bits >= 0x477ff000) {
+    return sign | 0x7c00;  // rounds to 65536 or more
+  }
+  if (bits < 0x38800000) {
+    // denormal half, the scaling by 2^24 is exact
+    return sign | uint16_t(std::nearbyint(bits_float(bits) * 0x1p24f));
+  }
+  uint32_t half = (bits - 0x38000000) >> 13;
+  const uint32_t rest = bits & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+    ++half;
+  }
+  return sign | uint16_t(half);
+}
+
+float half_to_float(uint16_t half) {
+  const uint32_t sign = uint32_t(half & 0x8000) << 16;
+  const uint32_t exponent = (half >> 10) & 0x1f;
+  const uint32_t mantissa = half & 0x3ff;
+  if (exponent == 0) {
+    const float value = float(mantissa) * 0x1p-24f;
+    return sign ? -value : value;
+  }
+  if (exponent == 0x1f) {
+    return bits_float(sign | 0x7f800000 | (mantissa << 13));
+  }
+  return bits_float(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+int16_t snorm16(float value) {
+  return int16_t(std::nearbyint(std::min(std::max(value, -1.0f), 1.0f) *
+                                32767.0f));
+}
+
+float sign_not_zero(float value) { return value < 0.0f ? -1.0f : 1.0f; }
+
+// octahedral map of the unit sphere onto [-1, 1]^2 (cigolle et al. 2014),
+// as two snorm16 in the layout of packSnorm2x16
+uint32_t encode_octahedral(const Vec3f& n) {
+  const float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+  float x = 0.0f;
+  float y = 0.0f;
+  if (l1 > 0.0f) {
+    x = n.x / l1;
+    y = n.y / l1;
+    if (n.z < 0.0f) {
+      const float folded_x = (1.0f - std::abs(y)) * sign_not_zero(x);
+      y = (1.0f - std::abs(x)) * sign_not_zero(y);
+      x = folded_x;
+    }
+  }
+  return uint32_t(uint16_t(snorm16(x))) | uint32_t(uint16_t(snorm16(y))) << 16;
+}
+
+Vec3f decode_octahedral(uint32_t packed) {
+  const float x = std::max(float(int16_t(packed & 0xffff)) / 32767.0f, -1.0f);
+  const float y = std::max(float(int16_t(packed >> 16)) / 32767.0f, -1.0f);
+  Vec3f n(x, y, 1.0f - std::abs(x) - std::abs(y));
+  if (n.z < 0.0f) {
+    n.x = (1.0f - std::abs(y)) * sign_not_zero(x);
+    n.y = (1.0f - std::abs(x)) * sign_not_zero(y);
+  }
+  const float length = std::sqrt(Vec3f::dot(n, n));
+  return Vec3f(n.x / length, n.y / length, n.z / length);
+}
+
+}  // namespace
+
+void CompactVertices::encode(const MappedArray<Vec3f>& positions,
+                             const MappedArray<Vec3f>& normals,
+                             const MappedArray<Vec2f>& uvs) {
+  vertex_count_ = positions.size();
+  const size_t block_count =
+      (vertex_count_ + COMPACT_VERTEX_BLOCK_SIZE - 1) /
+      COMPACT_VERTEX_BLOCK_SIZE;
+  blocks_.assign(block_count, CompactVertexBlock{});
+  positions_.resize(3 * vertex_count_);
+  normals_.resize(normals.empty() ? 0 : vertex_count_);
+  uvs_.resize(uvs.empty() ? 0 : vertex_count_);
+
+  parallel_for(0, block_count, 64, [&](size_t b, size_t e, uint32_t) {
+    for (size_t block = b; block < e; ++block) {
+      const size_t first = block * COMPACT_VERTEX_BLOCK_SIZE;
+      const size_t last =
+          std::min(first + COMPACT_VERTEX_BLOCK_SIZE, vertex_count_);
+      Aabb bounds;
+      for (size_t i = first; i < last; ++i) {
+        bounds.grow(positions[i]);
+      }
+      CompactVertexBlock& grid = blocks_[block];
+      for (int axis = 0; axis < 3; ++axis) {
+        const float step = grid_step(bounds.min[axis], bounds.max[axis]);
+        grid.origin[axis] = std::floor(bounds.min[axis] / step) * step;
+        grid.step[axis] = step;
+      }
+      for (size_t i = first; i < last; ++i) {
+        for (int axis = 0; axis < 3; ++axis) {
+          positions_[3 * i + axis] = quantize(
+              positions[i][axis], grid.origin[axis], grid.step[axis]);
+        }
+        if (!normals_.empty()) {
+          normals_[i] = encode_octahedral(normals[i]);
+        }
+        if (!uvs_.empty()) {
+          uvs_[i] = uint32_t(float_to_half(uvs[i].x)) |
+                    uint32_t(float_to_half(uvs[i].y)) << 16;
+        }
+      }
+    }
+  });
+}
+
+Vec3f CompactVertices::position(size_t vertex) const {
+  const CompactVertexBlock& grid = blocks_[vertex / COMPACT_VERTEX_BLOCK_SIZE];
+  const uint16_t* q = positions_.data() + 3 * vertex;
+  return Vec3f(grid.origin[0] + float(q[0]) * grid.step[0],
+               grid.origin[1] + float(q[1]) * grid.step[1],
+               grid.origin[2] + float(q[2]) * grid.step[2]);
+}
+
+Vec3f CompactVertices::normal(size_t vertex) const {
+  return normals_.empty() ? Vec3f() : decode_octahedral(normals_[vertex]);
+}
+
+Vec2f CompactVertices::uv(size_t vertex) const {
+  if (uvs_.empty()) {
+    return Vec2f();
+  }
+  return Vec2f(half_to_float(uint16_t(uvs_[vertex] & 0xffff)),
+               half_to_float(uint16_t(uvs_[vertex] >> 16)));
+}
+
+size_t CompactVertices::packed_size() const {
+  return 16 + blocks_.size() * sizeof(CompactVertexBlock) +
+         (positions_.size() + 1) / 2 * 4 + normals_.size() * 4 +
+         uvs_.size() * 4;
+}
+
+Blob CompactVertices::pack() const {
+  // offsets in uints from the start of the array after the header
+  const size_t header_size = 16;
+  const size_t position_offset =
+      blocks_.size() * sizeof(CompactVertexBlock) / 4;
+  const size_t normal_offset = position_offset + (positions_.size() + 1) / 2;
+  const size_t uv_offset = normal_offset + normals_.size();
+  Blob data(packed_size());
+  const uint32_t header[4] = {uint32_t(vertex_count_),
+                              uint32_t(position_offset),
+                              normals_.empty() ? 0 : uint32_t(normal_offset),
+                              uvs_.empty() ? 0 : uint32_t(uv_offset)};
+  memcpy(data.data(), header, sizeof(header));
+  uint8_t* array = data.data() + header_size;
+  // the 16 bit positions are read back as the halves of little endian uints
+  auto put = [&](size_t offset, const void* source, size_t bytes) {
+    if (bytes > 0) {
+      memcpy(array + offset * 4, source, bytes);
+    }
+  };
+  put(0, blocks_.data(), blocks_.size() * sizeof(CompactVertexBlock));
+  put(position_offset, positions_.data(), positions_.size() * 2);
+  put(normal_offset, normals_.data(), normals_.size() * 4);
+  put(uv_offset, uvs_.data(), uvs_.size() * 4);
+  return data;
+}
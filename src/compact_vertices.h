@@ -0,0 +1,58 @@
+#ifndef COMPACT_VERTICES_H
+#define COMPACT_VERTICES_H
+
+#include "util.h"
+
+// consecutive vertices sharing the bounds their positions are quantized to,
+// matches COMPACT_VERTEX_BLOCK_SIZE in rt.frag.glsl
+const uint32_t COMPACT_VERTEX_BLOCK_SIZE = 256;
+
+// quantization grid of a vertex block: a position decodes to
+// origin + q * step with q the 16 bit value of each axis
+struct CompactVertexBlock {
+  float origin[3];
+  uint32_t pad0;
+  float step[3];
+  uint32_t pad1;
+};
+static_assert(sizeof(CompactVertexBlock) == 32,
+              "CompactVertexBlock must be two vec4");
+
+// vertices encoded for the gpu in 14 bytes instead of 32: positions as 3 x
+// 16 bit fixed point on the grid of their block, normals as 2 x 16 bit
+// snorm octahedral coordinates and uvs as 2 half floats. the steps are
+// powers of two and the origins multiples of them, so origin + q * step is
+// exact in float arithmetic and the shaders decode bit identical positions.
+// encoding positions that were already decoded returns them unchanged.
+class CompactVertices {
+ public:
+  // normals and uvs may be empty
+  void encode(const MappedArray<Vec3f>& positions,
+              const MappedArray<Vec3f>& normals,
+              const MappedArray<Vec2f>& uvs);
+
+  [[nodiscard]] bool empty() const { return vertex_count_ == 0; }
+  [[nodiscard]] size_t size() const { return vertex_count_; }
+  [[nodiscard]] bool has_normals() const { return !normals_.empty(); }
+  [[nodiscard]] bool has_uvs() const { return !uvs_.empty(); }
+
+  [[nodiscard]] Vec3f position(size_t vertex) const;
+  [[nodiscard]] Vec3f normal(size_t vertex) const;
+  [[nodiscard]] Vec2f uv(size_t vertex) const;
+
+  // uint vertex_count, position_offset, normal_offset and uv_offset, then
+  // the blocks, positions, normals and uvs as one uint array the offsets
+  // index into. an offset of 0 marks missing normals or uvs. matches
+  // BvhVertices in rt.frag.glsl.
+  [[nodiscard]] Blob pack() const;
+  [[nodiscard]] size_t packed_size() const;
+
+ private:
+  size_t vertex_count_{0};
+  std::vector<CompactVertexBlock> blocks_;
+  std::vector<uint16_t> positions_;  // 3 per vertex
+  std::vector<uint32_t> normals_;
+  std::vector<uint32_t> uvs_;
+};
+
+#endif  // COMPACT_VERTICES_H
@@ -0,0 +1,1021 @@
+#include "gltf_loader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+
+namespace {
+
+const uint32_t GLB_MAGIC = 0x46546c67;       // "glTF"
+const uint32_t GLB_CHUNK_JSON = 0x4e4f534a;  // "JSON"
+const uint32_t GLB_CHUNK_BIN = 0x004e4942;   // "BIN\0"
+
+// accessor component types
+const uint32_t GLTF_UNSIGNED_BYTE = 5121;
+const uint32_t GLTF_UNSIGNED_SHORT = 5123;
+const uint32_t GLTF_UNSIGNED_INT = 5125;
+const uint32_t GLTF_FLOAT = 5126;
+
+const uint32_t GLTF_TRIANGLES = 4;
+
+// the spec limits buffer view strides to 252 bytes
+const uint64_t GLTF_MAX_STRIDE = 252;
+
+// json nesting limit
+const int GLTF_MAX_DEPTH = 256;
+
+// vertices or indices converted per parallel chunk
+const size_t GLTF_MIN_CHUNK = 1 << 16;
+
+// extensions that change how vertex data is stored
+const char* const GLTF_UNSUPPORTED_EXTENSIONS[] = {
+    "KHR_draco_mesh_compression", "EXT_meshopt_compression",
+    "KHR_mesh_quantization"};
+
+//----
+// json
+
+struct JsonValue {
+  enum Type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT };
+
+  Type type{NUL};
+  bool boolean{false};
+  double number{0.0};
+  std::string string;
+  std::vector<JsonValue> items;   // array items or object member values
+  std::vector<std::string> keys;  // object member names
+
+  // a member or item, null when missing
+  const JsonValue& operator[](const char* key) const;
+  [[nodiscard]] const JsonValue& at(int64_t i) const;
+  [[nodiscard]] size_t size() const {
+    return type == ARRAY ? items.size() : 0;
+  }
+
+  [[nodiscard]] double number_or(double fallback) const {
+    return type == NUMBER ? number : fallback;
+  }
+  // a non-negative integer, fallback when missing and -1 when it is
+  // something else
+  [[nodiscard]] int64_t integer(int64_t fallback = -1) const {
+    if (type == NUL) {
+      return fallback;
+    }
+    if (type != NUMBER || !(number >= 0.0 && number < 9007199254740992.0) ||
+        number != std::floor(number)) {
+      return -1;
+    }
+    return static_cast<int64_t>(number);
+  }
+};
+
+const JsonValue& json_null() {
+  static const JsonValue value;
+  return value;
+}
+
+const JsonValue& JsonValue::operator[](const char* key) const {
+  if (type == OBJECT) {
+    for (size_t i = 0; i < keys.size(); ++i) {
+      if (keys[i] == key) {
+        return items[i];
+      }
+    }
+  }
+  return json_null();
+}
+
+const JsonValue& JsonValue::at(int64_t i) const {
+  return type == ARRAY && i >= 0 && size_t(i) < items.size() ? items[i]
+                                                              : json_null();
+}
+
+const char* skip_space(const char* p, const char* end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+    ++p;
+  }
+  return p;
+}
+
+const char* parse_hex4(const char* p, const char* end, uint32_t* out) {
+  if (end - p < 4) {
+    return nullptr;
+  }
+  uint32_t value = 0;
+  for (int i = 0; i < 4; ++i) {
+    const char c = p[i];
+    value <<= 4;
+    if (c >= '0' && c <= '9') {
+      value |= uint32_t(c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      value |= uint32_t(c - 'a' + 10);
+    } else if (c >= 'A' && c <= 'F') {
+      value |= uint32_t(c - 'A' + 10);
+    } else {
+      return nullptr;
+    }
+  }
+  *out = value;
+  return p + 4;
+}
+
+void append_utf8(uint32_t code, std::string* out) {
+  if (code < 0x80) {
+    out->push_back(char(code));
+  } else if (code < 0x800) {
+    out->push_back(char(0xc0 | code >> 6));
+    out->push_back(char(0x80 | (code & 0x3f)));
+  } else if (code < 0x10000) {
+    out->push_back(char(0xe0 | code >> 12));
+    out->push_back(char(0x80 | (code >> 6 & 0x3f)));
+    out->push_back(char(0x80 | (code & 0x3f)));
+  } else {
+    out->push_back(char(0xf0 | code >> 18));
+    out->push_back(char(0x80 | (code >> 12 & 0x3f)));
+    out->push_back(char(0x80 | (code >> 6 & 0x3f)));
+    out->push_back(char(0x80 | (code & 0x3f)));
+  }
+}
+
+// p is after the opening quote, returns the character after the closing one
+const char* parse_json_string(const char* p, const char* end,
+                              std::string* out) {
+  while (p < end && *p != '"') {
+    if (*p != '\\') {
+      out->push_back(*p++);
+      continue;
+    }
+    if (++p == end) {
+      return nullptr;
+    }
+    const char c = *p++;
+    switch (c) {
+      case '"':
+      case '\\':
+      case '/':
+        out->push_back(c);
+        break;
+      case 'b':
+        out->push_back('\b');
+        break;
+      case 'f':
+        out->push_back('\f');
+        break;
+      case 'n':
+        out->push_back('\n');
+        break;
+      case 'r':
+        out->push_back('\r');
+        break;
+      case 't':
+        out->push_back('\t');
+        break;
+      case 'u': {
+        uint32_t code = 0;
+        if (!(p = parse_hex4(p, end, &code))) {
+          return nullptr;
+        }
+        // the low half of a surrogate pair follows as another escape
+        if (code >= 0xd800 && code < 0xdc00 && end - p >= 6 && p[0] == '\\' &&
+            p[1] == 'u') {
+          uint32_t low = 0;
+          const char* next = parse_hex4(p + 2, end, &low);
+          if (next && low >= 0xdc00 && low < 0xe000) {
+            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+            p = next;
+          }
+        }
+        append_utf8(code, out);
+        break;
+      }
+      default:
+        return nullptr;
+    }
+  }
+  return p < end ? p + 1 : nullptr;
+}
+
+// returns the first character after the value, or nullptr on an error
+const char* parse_json(const char* p, const char* end, int depth,
+                       JsonValue* out) {
+  p = skip_space(p, end);
+  if (p == end || depth > GLTF_MAX_DEPTH) {
+    return nullptr;
+  }
+  auto literal = [&](const char* word) -> const char* {
+    const size_t length = strlen(word);
+    return size_t(end - p) >= length && memcmp(p, word, length) == 0
+               ? p + length
+               : nullptr;
+  };
+
+  switch (*p) {
+    case '{':
+      out->type = JsonValue::OBJECT;
+      p = skip_space(p + 1, end);
+      if (p < end && *p == '}') {
+        return p + 1;
+      }
+      while (true) {
+        p = skip_space(p, end);
+        if (p == end || *p != '"') {
+          return nullptr;
+        }
+        out->keys.emplace_back();
+        if (!(p = parse_json_string(p + 1, end, &out->keys.back()))) {
+          return nullptr;
+        }
+        p = skip_space(p, end);
+        if (p == end || *p != ':') {
+          return nullptr;
+        }
+        out->items.emplace_back();
+        if (!(p = parse_json(p + 1, end, depth + 1, &out->items.back()))) {
+          return nullptr;
+        }
+        p = skip_space(p, end);
+        if (p == end || *p != ',') {
+          return p < end && *p == '}' ? p + 1 : nullptr;
+        }
+        ++p;
+      }
+    case '[':
+      out->type = JsonValue::ARRAY;
+      p = skip_space(p + 1, end);
+      if (p < end && *p == ']') {
+        return p + 1;
+      }
+      while (true) {
+        out->items.emplace_back();
+        if (!(p = parse_json(p, end, depth + 1, &out->items.back()))) {
+          return nullptr;
+        }
+        p = skip_space(p, end);
+        if (p == end || *p != ',') {
+          return p < end && *p == ']' ? p + 1 : nullptr;
+        }
+        ++p;
+      }
+    case '"':
+      out->type = JsonValue::STRING;
+      return parse_json_string(p + 1, end, &out->string);
+    case 't':
+      out->type = JsonValue::BOOLEAN;
+      out->boolean = true;
+      return literal("true");
+    case 'f':
+      out->type = JsonValue::BOOLEAN;
+      return literal("false");
+    case 'n':
+      return literal("null");
+    default: {
+      // strtod needs a terminated copy, gltf numbers are short
+      char digits[64];
+      size_t length = 0;
+      while (p + length < end && length + 1 < sizeof(digits) &&
+             p[length] != '\0' && strchr("+-.0123456789eE", p[length])) {
+        ++length;
+      }
+      memcpy(digits, p, length);
+      digits[length] = '\0';
+      char* number_end = nullptr;
+      out->number = strtod(digits, &number_end);
+      if (number_end == digits) {
+        return nullptr;
+      }
+      out->type = JsonValue::NUMBER;
+      return p + (number_end - digits);
+    }
+  }
+}
+
+//----
+// buffers
+
+struct GltfBuffer {
+  std::shared_ptr<const void> keep_alive;
+  const uint8_t* data{nullptr};
+  size_t size{0};
+};
+
+int base64_value(char c) {
+  if (c >= 'A' && c <= 'Z') {
+    return c - 'A';
+  }
+  if (c >= 'a' && c <= 'z') {
+    return c - 'a' + 26;
+  }
+  if (c >= '0' && c <= '9') {
+    return c - '0' + 52;
+  }
+  return c == '+' ? 62 : c == '/' ? 63 : -1;
+}
+
+bool decode_base64(const char* p, const char* end, Blob* out) {
+  out->reserve((end - p) / 4 * 3);
+  uint32_t bits = 0;
+  int bit_count = 0;
+  for (; p < end && *p != '='; ++p) {
+    const int value = base64_value(*p);
+    if (value < 0) {
+      return false;
+    }
+    bits = bits << 6 | uint32_t(value);
+    bit_count += 6;
+    if (bit_count >= 8) {
+      bit_count -= 8;
+      out->push_back(uint8_t(bits >> bit_count));
+    }
+  }
+  return true;
+}
+
+// relative uris are percent encoded
+std::string decode_uri(const std::string& uri) {
+  std::string out;
+  for (size_t i = 0; i < uri.size(); ++i) {
+    uint32_t code = 0;
+    const char hex[4] = {'0', '0', i + 2 < uri.size() ? uri[i + 1] : 'x',
+                         i + 2 < uri.size() ? uri[i + 2] : 'x'};
+    if (uri[i] == '%' && parse_hex4(hex, hex + 4, &code)) {
+      out.push_back(char(code));
+      i += 2;
+    } else {
+      out.push_back(uri[i]);
+    }
+  }
+  return out;
+}
+
+// buffer 0 of a glb without an uri is the binary chunk
+bool load_buffers(const JsonValue& gltf, const char* path,
+                  const std::shared_ptr<MappedFile>& file, const uint8_t* bin,
+                  size_t bin_size, std::vector<GltfBuffer>* buffers) {
+  std::string directory(path);
+  const size_t slash = directory.find_last_of("/\\");
+  directory.resize(slash == std::string::npos ? 0 : slash + 1);
+
+  const JsonValue& buffer_list = gltf["buffers"];
+  buffers->resize(buffer_list.size());
+  for (size_t i = 0; i < buffer_list.size(); ++i) {
+    const JsonValue& buffer = buffer_list.at(i);
+    const std::string& uri = buffer["uri"].string;
+    GltfBuffer& out = (*buffers)[i];
+    if (buffer["uri"].type != JsonValue::STRING) {
+      if (i != 0 || !bin) {
+        printf("gltf: %s: buffer %zu has no data\n", path, i);
+        return false;
+      }
+      out = GltfBuffer{file, bin, bin_size};
+    } else if (uri.compare(0, 5, "data:") == 0) {
+      // "data:" [mediatype] ";base64," data, the percent encoded form is
+      // not supported
+      const size_t comma = uri.find(',');
+      if (comma == std::string::npos || comma < 5 + 7 ||
+          uri.compare(comma - 7, 7, ";base64") != 0) {
+        printf("gltf: %s: buffer %zu has an unsupported data uri\n", path, i);
+        return false;
+      }
+      auto blob = std::make_shared<Blob>();
+      if (!decode_base64(uri.data() + comma + 1, uri.data() + uri.size(),
+                         blob.get())) {
+        printf("gltf: %s: buffer %zu has a malformed data uri\n", path, i);
+        return false;
+      }
+      out = GltfBuffer{blob, blob->data(), blob->size()};
+    } else {
+      auto external = std::make_shared<MappedFile>();
+      const std::string external_path = directory + decode_uri(uri);
+      if (!external->open(external_path.c_str())) {
+        printf("gltf: can't open %s\n", external_path.c_str());
+        return false;
+      }
+      out = GltfBuffer{external, external->data(), external->size()};
+    }
+
+    const int64_t length = buffer["byteLength"].integer();
+    if (length < 0 || uint64_t(length) > out.size) {
+      printf("gltf: %s: buffer %zu is truncated\n", path, i);
+      return false;
+    }
+    out.size = size_t(length);
+  }
+  return true;
+}
+
+// finds the json and binary chunks of a glb
+bool parse_glb(const MappedFile& file, const char** json, size_t* json_size,
+               const uint8_t** bin, size_t* bin_size) {
+  uint32_t header[3] = {};
+  if (file.size() < sizeof(header)) {
+    return false;
+  }
+  memcpy(header, file.data(), sizeof(header));
+  if (header[1] != 2 || header[2] > file.size()) {
+    return false;
+  }
+  const size_t length = header[2];
+  size_t offset = sizeof(header);
+  bool has_json = false;
+  while (offset + 8 <= length) {
+    uint32_t chunk[2] = {};
+    memcpy(chunk, file.data() + offset, sizeof(chunk));
+    offset += sizeof(chunk);
+    if (chunk[0] > length - offset) {
+      return false;
+    }
+    if (chunk[1] == GLB_CHUNK_JSON && !has_json) {
+      *json = reinterpret_cast<const char*>(file.data() + offset);
+      *json_size = chunk[0];
+      has_json = true;
+    } else if (chunk[1] == GLB_CHUNK_BIN && !*bin) {
+      *bin = file.data() + offset;
+      *bin_size = chunk[0];
+    }
+    offset += (size_t(chunk[0]) + 3) & ~size_t(3);
+  }
+  return has_json;
+}
+
+//----
+// accessors
+
+// elements of an accessor, bounds checked against its buffer
+struct GltfAccessor {
+  std::shared_ptr<const void> keep_alive;
+  const uint8_t* data{nullptr};
+  size_t count{0};
+  size_t stride{0};
+  uint32_t component_type{0};
+  uint32_t components{0};
+  bool normalized{false};
+
+  // tightly packed and aligned elements of type T, usable in place
+  template <typename T>
+  [[nodiscard]] bool packed(uint32_t type, uint32_t n) const {
+    return component_type == type && components == n &&
+           stride == sizeof(T) &&
+           reinterpret_cast<uintptr_t>(data) % alignof(T) == 0;
+  }
+  template <typename T>
+  [[nodiscard]] MappedArray<T> mapped() const {
+    return MappedArray<T>(keep_alive, reinterpret_cast<const T*>(data),
+                          count);
+  }
+};
+
+uint32_t component_size(uint32_t type) {
+  switch (type) {
+    case 5120:  // byte
+    case GLTF_UNSIGNED_BYTE:
+      return 1;
+    case 5122:  // short
+    case GLTF_UNSIGNED_SHORT:
+      return 2;
+    case GLTF_UNSIGNED_INT:
+    case GLTF_FLOAT:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+uint32_t component_count(const std::string& type) {
+  if (type == "SCALAR") {
+    return 1;
+  }
+  if (type.size() == 4 && type.compare(0, 3, "VEC") == 0 && type[3] >= '2' &&
+      type[3] <= '4') {
+    return uint32_t(type[3] - '0');
+  }
+  return 0;
+}
+
+bool resolve_accessor(const JsonValue& gltf,
+                      const std::vector<GltfBuffer>& buffers, int64_t index,
+                      GltfAccessor* out) {
+  const JsonValue& accessor = gltf["accessors"].at(index);
+  const JsonValue& view =
+      gltf["bufferViews"].at(accessor["bufferView"].integer());
+  const int64_t buffer = view["buffer"].integer();
+  if (accessor.type != JsonValue::OBJECT || view.type != JsonValue::OBJECT ||
+      accessor["sparse"].type != JsonValue::NUL || buffer < 0 ||
+      size_t(buffer) >= buffers.size()) {
+    return false;
+  }
+
+  out->component_type = uint32_t(accessor["componentType"].integer(0));
+  out->components = component_count(accessor["type"].string);
+  out->normalized = accessor["normalized"].boolean;
+  const uint64_t element_size =
+      uint64_t(component_size(out->component_type)) * out->components;
+  const int64_t count = accessor["count"].integer();
+  const int64_t accessor_offset = accessor["byteOffset"].integer(0);
+  const int64_t view_offset = view["byteOffset"].integer(0);
+  const int64_t view_length = view["byteLength"].integer();
+  const int64_t stride = view["byteStride"].integer(0);
+  if (element_size == 0 || count < 0 || accessor_offset < 0 ||
+      view_offset < 0 || view_length < 0 || stride < 0 ||
+      uint64_t(stride) > GLTF_MAX_STRIDE) {
+    return false;
+  }
+  out->count = size_t(count);
+  out->stride = stride > 0 ? size_t(stride) : size_t(element_size);
+
+  const GltfBuffer& source = buffers[buffer];
+  const uint64_t last = count > 0 ? uint64_t(accessor_offset) +
+                                        uint64_t(count - 1) * out->stride +
+                                        element_size
+                                  : 0;
+  if (out->stride < element_size ||
+      uint64_t(view_offset) + uint64_t(view_length) > source.size ||
+      last > uint64_t(view_length)) {
+    return false;
+  }
+  out->keep_alive = source.keep_alive;
+  out->data = source.data + view_offset + accessor_offset;
+  return true;
+}
+
+// float vec3 positions or normals
+bool convert_vec3(const GltfAccessor& a, Vec3f* out) {
+  if (a.component_type != GLTF_FLOAT || a.components != 3) {
+    return false;
+  }
+  parallel_for(0, a.count, GLTF_MIN_CHUNK, [&](size_t b, size_t e, uint32_t) {
+    for (size_t i = b; i < e; ++i) {
+      memcpy(&out[i], a.data + i * a.stride, sizeof(Vec3f));
+    }
+  });
+  return true;
+}
+
+// float or normalized unsigned uvs
+bool convert_vec2(const GltfAccessor& a, Vec2f* out) {
+  const uint32_t type = a.component_type;
+  if (a.components != 2 ||
+      (type != GLTF_FLOAT &&
+       !(a.normalized &&
+         (type == GLTF_UNSIGNED_BYTE || type == GLTF_UNSIGNED_SHORT)))) {
+    return false;
+  }
+  parallel_for(0, a.count, GLTF_MIN_CHUNK, [&](size_t b, size_t e, uint32_t) {
+    for (size_t i = b; i < e; ++i) {
+      const uint8_t* p = a.data + i * a.stride;
+      if (type == GLTF_FLOAT) {
+        memcpy(&out[i], p, sizeof(Vec2f));
+      } else if (type == GLTF_UNSIGNED_BYTE) {
+        out[i] = Vec2f(float(p[0]) / 255.0f, float(p[1]) / 255.0f);
+      } else {
+        uint16_t v[2];
+        memcpy(v, p, sizeof(v));
+        out[i] = Vec2f(float(v[0]) / 65535.0f, float(v[1]) / 65535.0f);
+      }
+    }
+  });
+  return true;
+}
+
+// indices of a primitive whose vertices start at base. false on an index
+// that is not below vertex_count.
+bool convert_indices(const GltfAccessor& a, uint32_t base, size_t vertex_count,
+                     uint32_t* out) {
+  const uint32_t type = a.component_type;
+  if (a.components != 1 ||
+      (type != GLTF_UNSIGNED_BYTE && type != GLTF_UNSIGNED_SHORT &&
+       type != GLTF_UNSIGNED_INT)) {
+    return false;
+  }
+  std::atomic<bool> ok(true);
+  parallel_for(0, a.count, GLTF_MIN_CHUNK, [&](size_t b, size_t e, uint32_t) {
+    bool chunk_ok = true;
+    for (size_t i = b; i < e; ++i) {
+      const uint8_t* p = a.data + i * a.stride;
+      uint32_t index = 0;
+      if (type == GLTF_UNSIGNED_BYTE) {
+        index = *p;
+      } else if (type == GLTF_UNSIGNED_SHORT) {
+        uint16_t v = 0;
+        memcpy(&v, p, sizeof(v));
+        index = v;
+      } else {
+        memcpy(&index, p, sizeof(index));
+      }
+      chunk_ok &= index < vertex_count;
+      out[i] = base + index;
+    }
+    if (!chunk_ok) {
+      ok = false;
+    }
+  });
+  return ok;
+}
+
+bool indices_in_range(const MappedArray<uint32_t>& indices,
+                      size_t vertex_count) {
+  std::atomic<bool> ok(true);
+  parallel_for(0, indices.size(), GLTF_MIN_CHUNK,
+               [&](size_t b, size_t e, uint32_t) {
+                 bool chunk_ok = true;
+                 for (size_t i = b; i < e; ++i) {
+                   chunk_ok &= indices[i] < vertex_count;
+                 }
+                 if (!chunk_ok) {
+                   ok = false;
+                 }
+               });
+  return ok;
+}
+
+//----
+// scene
+
+struct GltfPrimitive {
+  GltfAccessor positions;
+  GltfAccessor normals;
+  GltfAccessor uvs;
+  GltfAccessor indices;
+  bool has_normals{false};
+  bool has_uvs{false};
+  bool indexed{false};
+  uint32_t material{NO_MATERIAL};
+  size_t first_vertex{0};
+  size_t first_index{0};
+  size_t index_count{0};
+};
+
+Material gltf_material(const JsonValue& material) {
+  const JsonValue& pbr = material["pbrMetallicRoughness"];
+  const float strength = float(material["extensions"]
+                                       ["KHR_materials_emissive_strength"]
+                                       ["emissiveStrength"]
+                                           .number_or(1.0));
+  Material out;
+  for (int c = 0; c < 3; ++c) {
+    out.base_color[c] = float(pbr["baseColorFactor"].at(c).number_or(1.0));
+    out.emission[c] =
+        float(material["emissiveFactor"].at(c).number_or(0.0)) * strength;
+  }
+  out.metallic = float(pbr["metallicFactor"].number_or(1.0));
+  out.roughness = float(pbr["roughnessFactor"].number_or(1.0));
+  return out;
+}
+
+// local transform of a node, a column major matrix or translation, rotation
+// and scale
+Transform node_transform(const JsonValue& node) {
+  Transform out;
+  const JsonValue& matrix = node["matrix"];
+  if (matrix.size() == 16) {
+    for (int r = 0; r < 3; ++r) {
+      for (int c = 0; c < 4; ++c) {
+        out.m[r][c] = float(matrix.at(c * 4 + r).number_or(0.0));
+      }
+    }
+    return out;
+  }
+
+  const JsonValue& t = node["translation"];
+  const JsonValue& q = node["rotation"];
+  const JsonValue& s = node["scale"];
+  const float x = float(q.at(0).number_or(0.0));
+  const float y = float(q.at(1).number_or(0.0));
+  const float z = float(q.at(2).number_or(0.0));
+  const float w = float(q.at(3).number_or(1.0));
+  const float rotation[3][3] = {
+      {1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y - w * z),
+       2.0f * (x * z + w * y)},
+      {2.0f * (x * y + w * z), 1.0f - 2.0f * (x * x + z * z),
+       2.0f * (y * z - w * x)},
+      {2.0f * (x * z - w * y), 2.0f * (y * z + w * x),
+       1.0f - 2.0f * (x * x + y * y)}};
+  for (int r = 0; r < 3; ++r) {
+    for (int c = 0; c < 3; ++c) {
+      out.m[r][c] = rotation[r][c] * float(s.at(c).number_or(1.0));
+    }
+    out.m[r][3] = float(t.at(r).number_or(0.0));
+  }
+  return out;
+}
+
+Transform multiply(const Transform& a, const Transform& b) {
+  Transform out;
+  for (int r = 0; r < 3; ++r) {
+    for (int c = 0; c < 4; ++c) {
+      out.m[r][c] = a.m[r][0] * b.m[0][c] + a.m[r][1] * b.m[1][c] +
+                    a.m[r][2] * b.m[2][c] + (c == 3 ? a.m[r][3] : 0.0f);
+    }
+  }
+  return out;
+}
+
+// world transforms of the nodes of the default scene that reference a
+// mesh. false on a hierarchy that is not a forest.
+bool collect_instances(const JsonValue& gltf,
+                       std::vector<std::pair<int64_t, Transform>>* out) {
+  const JsonValue& nodes = gltf["nodes"];
+  std::vector<int64_t> roots;
+  const JsonValue& scenes = gltf["scenes"];
+  if (scenes.size() > 0) {
+    const JsonValue& root_list =
+        scenes.at(gltf["scene"].integer(0))["nodes"];
+    for (size_t i = 0; i < root_list.size(); ++i) {
+      roots.push_back(root_list.at(i).integer());
+    }
+  } else {
+    // without scenes every node that is nobody's child is a root
+    std::vector<bool> is_child(nodes.size(), false);
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      const JsonValue& children = nodes.at(i)["children"];
+      for (size_t j = 0; j < children.size(); ++j) {
+        const int64_t child = children.at(j).integer();
+        if (child >= 0 && size_t(child) < nodes.size()) {
+          is_child[child] = true;
+        }
+      }
+    }
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      if (!is_child[i]) {
+        roots.push_back(int64_t(i));
+      }
+    }
+  }
+
+  // every node is reached at most once in a forest, more visits mean a
+  // cycle or a shared child
+  std::vector<std::pair<int64_t, Transform>> stack;
+  for (auto root = roots.rbegin(); root != roots.rend(); ++root) {
+    stack.emplace_back(*root, Transform());
+  }
+  size_t visits = 0;
+  while (!stack.empty()) {
+    const int64_t index = stack.back().first;
+    const JsonValue& node = nodes.at(index);
+    if (node.type != JsonValue::OBJECT || ++visits > nodes.size()) {
+      return false;
+    }
+    const Transform world = multiply(stack.back().second, node_transform(node));
+    stack.pop_back();
+    if (node["mesh"].type != JsonValue::NUL) {
+      out->emplace_back(node["mesh"].integer(), world);
+    }
+    const JsonValue& children = node["children"];
+    for (size_t i = children.size(); i-- > 0;) {
+      stack.emplace_back(children.at(i).integer(), world);
+    }
+  }
+  return true;
+}
+
+bool is_identity(const Transform& transform) {
+  const Transform identity;
+  return memcmp(&transform, &identity, sizeof(Transform)) == 0;
+}
+
+}  // namespace
+
+bool load_gltf(const char* path, Scene* scene) {
+  auto start = std::chrono::steady_clock::now();
+  auto file = std::make_shared<MappedFile>();
+  if (!file->open(path)) {
+    printf("gltf: can't open %s\n", path);
+    return false;
+  }
+
+  // a .gltf is all json, a .glb wraps the json and the first buffer
+  const char* json = reinterpret_cast<const char*>(file->data());
+  size_t json_size = file->size();
+  const uint8_t* bin = nullptr;
+  size_t bin_size = 0;
+  uint32_t magic = 0;
+  memcpy(&magic, file->data(), std::min<size_t>(sizeof(magic), file->size()));
+  if (magic == GLB_MAGIC &&
+      !parse_glb(*file, &json, &json_size, &bin, &bin_size)) {
+    printf("gltf: %s is not a valid glb\n", path);
+    return false;
+  }
+  JsonValue gltf;
+  const char* json_end = parse_json(json, json + json_size, 0, &gltf);
+  if (!json_end || gltf.type != JsonValue::OBJECT ||
+      skip_space(json_end, json + json_size) != json + json_size) {
+    printf("gltf: %s has malformed json\n", path);
+    return false;
+  }
+  if (gltf["asset"]["version"].string.compare(0, 2, "2.") != 0) {
+    printf("gltf: %s is not gltf 2.0\n", path);
+    return false;
+  }
+  const JsonValue& required = gltf["extensionsRequired"];
+  for (size_t i = 0; i < required.size(); ++i) {
+    for (const char* extension : GLTF_UNSUPPORTED_EXTENSIONS) {
+      if (required.at(i).string == extension) {
+        printf("gltf: %s needs %s\n", path, extension);
+        return false;
+      }
+    }
+  }
+
+  std::vector<GltfBuffer> buffers;
+  if (!load_buffers(gltf, path, file, bin, bin_size, &buffers)) {
+    return false;
+  }
+
+  // lay the triangle primitives of all meshes out back to back
+  const JsonValue& meshes = gltf["meshes"];
+  const auto material_count = uint32_t(gltf["materials"].size());
+  std::vector<GltfPrimitive> primitives;
+  std::vector<Mesh> mesh_ranges(meshes.size());
+  size_t vertex_count = 0;
+  size_t index_count = 0;
+  size_t skipped = 0;
+  for (size_t m = 0; m < meshes.size(); ++m) {
+    const JsonValue& primitive_list = meshes.at(m)["primitives"];
+    mesh_ranges[m].first_triangle = uint32_t(index_count / 3);
+    for (size_t i = 0; i < primitive_list.size(); ++i) {
+      const JsonValue& primitive = primitive_list.at(i);
+      const JsonValue& attributes = primitive["attributes"];
+      const int64_t mode = primitive["mode"].integer(GLTF_TRIANGLES);
+      if (mode != int64_t(GLTF_TRIANGLES) ||
+          attributes["POSITION"].type == JsonValue::NUL) {
+        ++skipped;
+        continue;
+      }
+
+      GltfPrimitive p;
+      p.has_normals = attributes["NORMAL"].type != JsonValue::NUL;
+      p.has_uvs = attributes["TEXCOORD_0"].type != JsonValue::NUL;
+      p.indexed = primitive["indices"].type != JsonValue::NUL;
+      const int64_t material = primitive["material"].integer(NO_MATERIAL);
+      bool ok =
+          resolve_accessor(gltf, buffers, attributes["POSITION"].integer(),
+                           &p.positions) &&
+          (!p.has_normals ||
+           (resolve_accessor(gltf, buffers, attributes["NORMAL"].integer(),
+                             &p.normals) &&
+            p.normals.count == p.positions.count)) &&
+          (!p.has_uvs ||
+           (resolve_accessor(gltf, buffers,
+                             attributes["TEXCOORD_0"].integer(), &p.uvs) &&
+            p.uvs.count == p.positions.count)) &&
+          (!p.indexed ||
+           resolve_accessor(gltf, buffers, primitive["indices"].integer(),
+                            &p.indices)) &&
+          (material == NO_MATERIAL ||
+           (material >= 0 && material < material_count));
+      p.index_count = p.indexed ? p.indices.count : p.positions.count;
+      if (!ok || p.index_count % 3 != 0) {
+        printf("gltf: %s: mesh %zu primitive %zu is malformed\n", path, m, i);
+        return false;
+      }
+      p.material = uint32_t(material);
+      p.first_vertex = vertex_count;
+      p.first_index = index_count;
+      vertex_count += p.positions.count;
+      index_count += p.index_count;
+      primitives.push_back(p);
+    }
+    mesh_ranges[m].triangle_count =
+        uint32_t(index_count / 3) - mesh_ranges[m].first_triangle;
+  }
+  if (vertex_count > UINT32_MAX || index_count > UINT32_MAX) {
+    printf("gltf: %s has more than 2^32 vertices or indices\n", path);
+    return false;
+  }
+
+  std::vector<std::pair<int64_t, Transform>> instances;
+  if (!collect_instances(gltf, &instances)) {
+    printf("gltf: %s has a malformed node hierarchy\n", path);
+    return false;
+  }
+  for (const auto& instance : instances) {
+    if (instance.first < 0 || size_t(instance.first) >= meshes.size()) {
+      printf("gltf: %s has a node with a missing mesh\n", path);
+      return false;
+    }
+  }
+
+  // a stream is used in place when a single primitive stores it in the
+  // scene's layout, otherwise every primitive is converted into it
+  bool has_normals = false;
+  bool has_uvs = false;
+  for (const auto& p : primitives) {
+    has_normals |= p.has_normals;
+    has_uvs |= p.has_uvs;
+  }
+  const GltfPrimitive* single =
+      primitives.size() == 1 ? &primitives[0] : nullptr;
+  int streams_in_place = 0;
+  bool ok = true;
+
+  MappedArray<Vec3f> positions;
+  if (single && single->positions.packed<Vec3f>(GLTF_FLOAT, 3)) {
+    positions = single->positions.mapped<Vec3f>();
+    ++streams_in_place;
+  } else {
+    std::vector<Vec3f> converted(vertex_count);
+    for (const auto& p : primitives) {
+      ok = ok && convert_vec3(p.positions, converted.data() + p.first_vertex);
+    }
+    positions = MappedArray<Vec3f>(std::move(converted));
+  }
+
+  MappedArray<Vec3f> normals;
+  if (single && has_normals && single->normals.packed<Vec3f>(GLTF_FLOAT, 3)) {
+    normals = single->normals.mapped<Vec3f>();
+    ++streams_in_place;
+  } else if (has_normals) {
+    std::vector<Vec3f> converted(vertex_count);
+    for (const auto& p : primitives) {
+      ok = ok && (!p.has_normals ||
+                  convert_vec3(p.normals, converted.data() + p.first_vertex));
+    }
+    normals = MappedArray<Vec3f>(std::move(converted));
+  }
+
+  MappedArray<Vec2f> uvs;
+  if (single && has_uvs && single->uvs.packed<Vec2f>(GLTF_FLOAT, 2)) {
+    uvs = single->uvs.mapped<Vec2f>();
+    ++streams_in_place;
+  } else if (has_uvs) {
+    std::vector<Vec2f> converted(vertex_count);
+    for (const auto& p : primitives) {
+      ok = ok && (!p.has_uvs ||
+                  convert_vec2(p.uvs, converted.data() + p.first_vertex));
+    }
+    uvs = MappedArray<Vec2f>(std::move(converted));
+  }
+
+  MappedArray<uint32_t> indices;
+  if (single && single->indexed &&
+      single->indices.packed<uint32_t>(GLTF_UNSIGNED_INT, 1)) {
+    indices = single->indices.mapped<uint32_t>();
+    ok = ok && indices_in_range(indices, vertex_count);
+    ++streams_in_place;
+  } else {
+    std::vector<uint32_t> converted(index_count);
+    for (const auto& p : primitives) {
+      const auto base = uint32_t(p.first_vertex);
+      if (p.indexed) {
+        ok = ok && convert_indices(p.indices, base, p.positions.count,
+                                   converted.data() + p.first_index);
+      } else {
+        for (size_t i = 0; i < p.index_count; ++i) {
+          converted[p.first_index + i] = base + uint32_t(i);
+        }
+      }
+    }
+    indices = MappedArray<uint32_t>(std::move(converted));
+  }
+  if (!ok) {
+    printf("gltf: %s has an accessor of an unsupported format or an index "
+           "out of range\n",
+           path);
+    return false;
+  }
+
+  *scene = Scene();
+  scene->assign_geometry(std::move(positions), std::move(normals),
+                         std::move(uvs), std::move(indices));
+  const JsonValue& materials = gltf["materials"];
+  for (size_t i = 0; i < materials.size(); ++i) {
+    scene->add_material(gltf_material(materials.at(i)));
+  }
+  for (const auto& p : primitives) {
+    if (p.material != NO_MATERIAL) {
+      scene->set_material(uint32_t(p.first_index / 3),
+                          uint32_t(p.index_count / 3), p.material);
+    }
+  }
+  for (const auto& range : mesh_ranges) {
+    scene->add_mesh(range.first_triangle, range.triangle_count);
+  }
+  // a single untransformed mesh holding everything needs no top level bvh
+  const bool flat = instances.size() == 1 && is_identity(instances[0].second) &&
+                    mesh_ranges[instances[0].first].triangle_count ==
+                        scene->triangle_count();
+  for (const auto& instance : instances) {
+    if (!flat && mesh_ranges[instance.first].triangle_count > 0) {
+      scene->add_instance(uint32_t(instance.first), instance.second);
+    }
+  }
+
+  const double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+  printf("gltf: %s, %.1f MiB, %zu vertices, %zu triangles, %zu meshes, %zu "
+         "instances, %d of %d streams in place, %.2f ms\n",
+         path, double(file->size()) / (1024.0 * 1024.0), vertex_count,
+         index_count / 3, meshes.size(), scene->instances().size(),
+         streams_in_place, 2 + int(has_normals) + int(has_uvs), ms);
+  if (skipped > 0) {
+    printf("gltf: %s: skipped %zu primitives without triangles\n", path,
+           skipped);
+  }
+  return true;
+}
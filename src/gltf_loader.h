@@ -0,0 +1,18 @@
+#ifndef GLTF_LOADER_H
+#define GLTF_LOADER_H
+
+#include "scene.h"
+
+// replaces scene with the triangles of a gltf 2.0 file, either a .glb or a
+// .gltf with external or data uri buffers. every gltf mesh becomes a scene
+// mesh holding the triangles of its primitives, every node of the default
+// scene that references a mesh becomes an instance with the node's world
+// transform, and the pbr factors of the materials become scene materials.
+// a file with a single primitive keeps its tightly packed float positions,
+// normals, uvs and 32 bit indices in the mapped buffers, everything else is
+// converted in parallel. textures, skins, morph targets and non-triangle
+// primitives are ignored. returns false on a malformed file, sparse
+// accessors or a required compression extension.
+bool load_gltf(const char* path, Scene* scene);
+
+#endif  // GLTF_LOADER_H
@@ -0,0 +1,289 @@
+#include "gpu_bvh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "vkut/common.h"
+
+namespace {
+
+const uint32_t GROUP_SIZE = 256;  // local_size_x of every kernel
+// dispatches past the guaranteed maxComputeWorkGroupCount[0] are 2d
+const uint32_t MAX_GROUPS_X = 65535;
+const uint32_t RADIX_BITS = 4;
+const uint32_t RADIX_PASSES = 32 / RADIX_BITS;
+
+}  // namespace
+
+GpuBvhBuilder::GpuBvhBuilder(VkPhysicalDevice physical_device,
+                             VkDevice device, uint32_t queue_family,
+                             const std::string& shader_dir)
+    : vk_physical_device_(physical_device),
+      vk_device_(device),
+      queue_family_(queue_family) {
+  VkDescriptorSetLayoutBinding bindings[BINDING_COUNT] = {};
+  for (uint32_t i = 0; i < BINDING_COUNT; ++i) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+  VkDescriptorSetLayoutCreateInfo layout_info = {};
+  layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layout_info.bindingCount = BINDING_COUNT;
+  layout_info.pBindings = bindings;
+  VKUT_CHECK_RESULT(vkCreateDescriptorSetLayout(
+      device, &layout_info, nullptr, &vk_descriptor_set_layout_));
+
+  VkDescriptorPoolSize pool_size = {};
+  pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  pool_size.descriptorCount = BINDING_COUNT;
+  VkDescriptorPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  pool_info.maxSets = 1;
+  pool_info.poolSizeCount = 1;
+  pool_info.pPoolSizes = &pool_size;
+  VKUT_CHECK_RESULT(vkCreateDescriptorPool(device, &pool_info, nullptr,
+                                           &vk_descriptor_pool_));
+
+  VkDescriptorSetAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  alloc_info.descriptorPool = vk_descriptor_pool_;
+  alloc_info.descriptorSetCount = 1;
+  alloc_info.pSetLayouts = &vk_descriptor_set_layout_;
+  VKUT_CHECK_RESULT(
+      vkAllocateDescriptorSets(device, &alloc_info, &vk_descriptor_set_));
+
+  auto create_pipeline = [&](const char* name) {
+    return std::make_unique<vkut::ComputePipeline>(
+        device, shader_dir + "/" + name + ".comp.spv",
+        vk_descriptor_set_layout_, uint32_t(sizeof(GpuBvhConstants)));
+  };
+  centroid_bounds_ = create_pipeline("bvh_centroid_bounds");
+  morton_ = create_pipeline("bvh_morton");
+  radix_histogram_ = create_pipeline("bvh_radix_histogram");
+  radix_scan_ = create_pipeline("bvh_radix_scan");
+  radix_scatter_ = create_pipeline("bvh_radix_scatter");
+  hierarchy_ = create_pipeline("bvh_hierarchy");
+  fit_ = create_pipeline("bvh_fit");
+  emit_ = create_pipeline("bvh_emit");
+}
+
+GpuBvhBuilder::~GpuBvhBuilder() {
+  for (auto& buffer : buffers_) {
+    buffer.reset();
+  }
+  centroid_bounds_.reset();
+  morton_.reset();
+  radix_histogram_.reset();
+  radix_scan_.reset();
+  radix_scatter_.reset();
+  hierarchy_.reset();
+  fit_.reset();
+  emit_.reset();
+  // the set is freed together with its pool
+  vkDestroyDescriptorPool(vk_device_, vk_descriptor_pool_, nullptr);
+  vkDestroyDescriptorSetLayout(vk_device_, vk_descriptor_set_layout_, nullptr);
+}
+
+void GpuBvhBuilder::build(const Scene& scene, bool watertight) {
+  auto start = std::chrono::steady_clock::now();
+
+  prim_count_ = static_cast<uint32_t>(scene.triangle_count());
+  node_count_ = prim_count_ > 0 ? 2 * prim_count_ - 1 : 0;
+  create_buffers(scene);
+  if (prim_count_ == 0) {
+    return;
+  }
+
+  vkut::OneTimeCommands commands(vk_device_, queue_family_);
+  VkCommandBuffer command_buffer = commands.vk_command_buffer();
+
+  // centroid bounds start empty, every node starts without a parent and
+  // every internal node without a visited child
+  vkCmdFillBuffer(command_buffer, buffers_[BUILD_STATE]->vk_buffer(), 0, 12,
+                  0xffffffffu);
+  vkCmdFillBuffer(command_buffer, buffers_[BUILD_STATE]->vk_buffer(), 12, 12,
+                  0);
+  vkCmdFillBuffer(command_buffer, buffers_[PARENTS]->vk_buffer(), 0,
+                  VK_WHOLE_SIZE, 0xffffffffu);
+  vkCmdFillBuffer(command_buffer, buffers_[VISITS]->vk_buffer(), 0,
+                  VK_WHOLE_SIZE, 0);
+  VkMemoryBarrier fill_barrier = {};
+  fill_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  fill_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  fill_barrier.dstAccessMask =
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                       &fill_barrier, 0, nullptr, 0, nullptr);
+
+  GpuBvhConstants constants = {};
+  constants.prim_count = prim_count_;
+  constants.group_count = (prim_count_ + GROUP_SIZE - 1) / GROUP_SIZE;
+  constants.watertight = watertight ? 1 : 0;
+  dispatch(command_buffer, *centroid_bounds_, constants, prim_count_);
+  dispatch(command_buffer, *morton_, constants, prim_count_);
+
+  // an even number of passes leaves the sorted keys in the first half
+  for (uint32_t pass = 0; pass < RADIX_PASSES; ++pass) {
+    constants.shift = pass * RADIX_BITS;
+    constants.in_offset = pass % 2 == 0 ? 0 : prim_count_;
+    constants.out_offset = pass % 2 == 0 ? prim_count_ : 0;
+    const uint32_t sort_invocations = constants.group_count * GROUP_SIZE;
+    dispatch(command_buffer, *radix_histogram_, constants, sort_invocations);
+    dispatch(command_buffer, *radix_scan_, constants, GROUP_SIZE);
+    dispatch(command_buffer, *radix_scatter_, constants, sort_invocations);
+  }
+
+  dispatch(command_buffer, *hierarchy_, constants, prim_count_ - 1);
+  dispatch(command_buffer, *fit_, constants, prim_count_);
+  dispatch(command_buffer, *emit_, constants, node_count_);
+
+  // the outputs are read by the traversal shaders and by downloads
+  VkMemoryBarrier output_barrier = {};
+  output_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  output_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  output_barrier.dstAccessMask =
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                           VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       0, 1, &output_barrier, 0, nullptr, 0, nullptr);
+  commands.submit_and_wait();
+
+  // inputs and scratch buffers are only needed during the build
+  for (uint32_t binding = 0; binding < NODES; ++binding) {
+    buffers_[binding].reset();
+  }
+
+  build_time_ms_ = std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  printf("bvh: device lbvh, %u triangles, %u nodes, build %.2f ms\n",
+         prim_count_, node_count_, build_time_ms_);
+}
+
+void GpuBvhBuilder::create_buffers(const Scene& scene) {
+  const size_t n = prim_count_;
+  size_t sizes[BINDING_COUNT] = {};
+  sizes[POSITIONS] = scene.positions().size() * sizeof(Vec3f);
+  sizes[INDICES] = scene.indices().size() * sizeof(uint32_t);
+  sizes[BUILD_STATE] = 6 * sizeof(uint32_t);
+  sizes[KEYS] = 2 * n * sizeof(uint32_t);
+  sizes[VALUES] = 2 * n * sizeof(uint32_t);
+  sizes[HISTOGRAM] =
+      (size_t(1) << RADIX_BITS) * ((n + GROUP_SIZE - 1) / GROUP_SIZE) *
+      sizeof(uint32_t);
+  sizes[INTERNAL_NODES] = (n > 0 ? n - 1 : 0) * 4 * sizeof(uint32_t);
+  sizes[PARENTS] = node_count_ * sizeof(uint32_t);
+  sizes[BOUNDS] = node_count_ * 6 * sizeof(float);
+  sizes[VISITS] = (n > 0 ? n - 1 : 0) * sizeof(uint32_t);
+  sizes[NODES] = node_count_ * sizeof(BvhNode);
+  sizes[PRIM_INDICES] = n * sizeof(uint32_t);
+  // uint count padded to 16 bytes, then three streams, see TriangleRecords
+  sizes[TRIANGLES] = 16 + 3 * n * sizeof(TriangleVec);
+
+  for (uint32_t binding = 0; binding < BINDING_COUNT; ++binding) {
+    // an empty array still gets a valid buffer to bind
+    const size_t size = std::max<size_t>(sizes[binding], 16);
+    if (binding == POSITIONS || binding == INDICES) {
+      const void* data = binding == POSITIONS
+                             ? static_cast<const void*>(
+                                   scene.positions().data())
+                             : scene.indices().data();
+      buffers_[binding] = std::make_unique<vkut::Buffer>(
+          vk_physical_device_, vk_device_, size,
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, nullptr);
+      if (sizes[binding] > 0) {
+        buffers_[binding]->update(data, sizes[binding]);
+      }
+    } else {
+      buffers_[binding] = std::make_unique<vkut::Buffer>(
+          vk_physical_device_, vk_device_, size,
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+              VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+              VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+          nullptr, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    }
+
+    VkDescriptorBufferInfo buffer_info = {};
+    buffer_info.buffer = buffers_[binding]->vk_buffer();
+    buffer_info.offset = 0;
+    buffer_info.range = VK_WHOLE_SIZE;
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = vk_descriptor_set_;
+    write.dstBinding = binding;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &buffer_info;
+    vkUpdateDescriptorSets(vk_device_, 1, &write, 0, nullptr);
+  }
+}
+
+void GpuBvhBuilder::dispatch(VkCommandBuffer command_buffer,
+                             const vkut::ComputePipeline& pipeline,
+                             const GpuBvhConstants& constants,
+                             uint32_t invocations) {
+  if (invocations == 0) {
+    return;
+  }
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    pipeline.vk_pipeline());
+  vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          pipeline.vk_pipeline_layout(), 0, 1,
+                          &vk_descriptor_set_, 0, nullptr);
+  vkCmdPushConstants(command_buffer, pipeline.vk_pipeline_layout(),
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants),
+                     &constants);
+  const uint32_t groups = (invocations + GROUP_SIZE - 1) / GROUP_SIZE;
+  vkCmdDispatch(command_buffer, std::min(groups, MAX_GROUPS_X),
+                (groups + MAX_GROUPS_X - 1) / MAX_GROUPS_X, 1);
+
+  // every kernel reads what the previous one wrote
+  VkMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask =
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0,
+                       nullptr, 0, nullptr);
+}
+
+Blob GpuBvhBuilder::download(Binding binding, size_t size) const {
+  Blob data(size);
+  if (size == 0) {
+    return data;
+  }
+  vkut::Buffer staging(vk_physical_device_, vk_device_, size,
+                       VK_BUFFER_USAGE_TRANSFER_DST_BIT, nullptr);
+  vkut::OneTimeCommands commands(vk_device_, queue_family_);
+  VkBufferCopy region = {};
+  region.size = size;
+  vkCmdCopyBuffer(commands.vk_command_buffer(),
+                  buffers_[binding]->vk_buffer(), staging.vk_buffer(), 1,
+                  &region);
+  commands.submit_and_wait();
+  staging.read(data.data(), size);
+  return data;
+}
+
+Bvh GpuBvhBuilder::download_bvh() const {
+  Blob node_data = download(NODES, node_count_ * sizeof(BvhNode));
+  Blob prim_data = download(PRIM_INDICES, prim_count_ * sizeof(uint32_t));
+  std::vector<BvhNode> nodes(node_count_);
+  std::vector<uint32_t> prim_indices(prim_count_);
+  memcpy(nodes.data(), node_data.data(), node_data.size());
+  memcpy(prim_indices.data(), prim_data.data(), prim_data.size());
+  return Bvh::from_arrays(std::move(nodes), std::move(prim_indices));
+}
+
+Blob GpuBvhBuilder::download_triangles() const {
+  return download(TRIANGLES,
+                  16 + 3 * size_t(prim_count_) * sizeof(TriangleVec));
+}
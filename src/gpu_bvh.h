@@ -0,0 +1,111 @@
+#ifndef GPU_BVH_H
+#define GPU_BVH_H
+
+#include <memory>
+#include <string>
+
+#include "bvh.h"
+#include "scene.h"
+#include "vkut/buffer.h"
+#include "vkut/compute.h"
+
+// spir-v of the build kernels, cmake points it at the build tree
+#ifndef GPU_BVH_SHADER_DIR
+#define GPU_BVH_SHADER_DIR "shader"
+#endif
+
+// push constants of the build kernels, matches BuildConstants in
+// shader/bvh_*.comp.glsl
+struct GpuBvhConstants {
+  uint32_t prim_count;
+  uint32_t shift;        // lowest key bit of the radix sort pass
+  uint32_t in_offset;    // keys and values are read from this half
+  uint32_t out_offset;   // and written to this one
+  uint32_t group_count;  // of the radix sort passes
+  uint32_t watertight;
+};
+
+// linear bvh built by compute shaders, so large scenes never round-trip
+// through host memory: centroids sorted along a 30-bit morton curve by a
+// 4-bit radix sort, the hierarchy emitted per internal node (karras 2012),
+// bounds fitted bottom up and the tree written depth first in the BvhNode
+// layout, one triangle per leaf, together with the leaf ordered
+// TriangleRecords. the outputs stay in device local memory.
+class GpuBvhBuilder {
+ public:
+  NOCOPYABLE(GpuBvhBuilder)
+
+  GpuBvhBuilder(VkPhysicalDevice physical_device, VkDevice device,
+                uint32_t queue_family,
+                const std::string& shader_dir = GPU_BVH_SHADER_DIR);
+  ~GpuBvhBuilder();
+
+  // builds over every triangle of the scene, instances are ignored. only
+  // the positions and indices are uploaded, waits for the device.
+  void build(const Scene& scene, bool watertight);
+
+  [[nodiscard]] uint32_t node_count() const { return node_count_; }
+  [[nodiscard]] double build_time_ms() const { return build_time_ms_; }
+
+  // outputs of the last build, bindable as BVH_BINDING_NODES and
+  // BVH_BINDING_TRIANGLES
+  std::unique_ptr<vkut::Buffer> take_nodes() {
+    return std::move(buffers_[NODES]);
+  }
+  std::unique_ptr<vkut::Buffer> take_triangles() {
+    return std::move(buffers_[TRIANGLES]);
+  }
+
+  // copies of the outputs in host memory, for verification. call before
+  // taking the buffers.
+  [[nodiscard]] Bvh download_bvh() const;
+  [[nodiscard]] Blob download_triangles() const;
+
+ private:
+  // storage buffers of the kernels, set 0 of every pipeline
+  enum Binding : uint32_t {
+    POSITIONS,
+    INDICES,
+    BUILD_STATE,  // centroid bounds
+    KEYS,         // morton codes, two halves for the radix sort
+    VALUES,       // triangles, two halves
+    HISTOGRAM,    // radix sort digit counts, then offsets
+    INTERNAL_NODES,
+    PARENTS,
+    BOUNDS,
+    VISITS,
+    NODES,
+    PRIM_INDICES,
+    TRIANGLES,
+    BINDING_COUNT,
+  };
+
+  VkPhysicalDevice vk_physical_device_{VK_NULL_HANDLE};
+  VkDevice vk_device_{VK_NULL_HANDLE};
+  uint32_t queue_family_{0};
+
+  VkDescriptorSetLayout vk_descriptor_set_layout_{VK_NULL_HANDLE};
+  VkDescriptorPool vk_descriptor_pool_{VK_NULL_HANDLE};
+  VkDescriptorSet vk_descriptor_set_{VK_NULL_HANDLE};
+  std::unique_ptr<vkut::ComputePipeline> centroid_bounds_;
+  std::unique_ptr<vkut::ComputePipeline> morton_;
+  std::unique_ptr<vkut::ComputePipeline> radix_histogram_;
+  std::unique_ptr<vkut::ComputePipeline> radix_scan_;
+  std::unique_ptr<vkut::ComputePipeline> radix_scatter_;
+  std::unique_ptr<vkut::ComputePipeline> hierarchy_;
+  std::unique_ptr<vkut::ComputePipeline> fit_;
+  std::unique_ptr<vkut::ComputePipeline> emit_;
+
+  std::unique_ptr<vkut::Buffer> buffers_[BINDING_COUNT];
+  uint32_t prim_count_{0};
+  uint32_t node_count_{0};
+  double build_time_ms_{0.0};
+
+  void create_buffers(const Scene& scene);
+  void dispatch(VkCommandBuffer command_buffer,
+                const vkut::ComputePipeline& pipeline,
+                const GpuBvhConstants& constants, uint32_t invocations);
+  [[nodiscard]] Blob download(Binding binding, size_t size) const;
+};
+
+#endif  // GPU_BVH_H
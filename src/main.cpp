@@ -2,7 +2,155 @@
 // Created by murmur.wheel@gmail.com on 2020/5/23.
 //
 
+#include <gflags/gflags.h>
+
 #include "app.h"
+#include "bench.h"
+#include "model_loader.h"
+#include "scene_file.h"
+
+#ifndef BVH_SHADER_WIDTH
+#define BVH_SHADER_WIDTH 2
+#endif
+#ifndef BVH_SHADER_QUANTIZED
+#define BVH_SHADER_QUANTIZED 0
+#endif
+#ifndef BVH_SHADER_STACKLESS
+#define BVH_SHADER_STACKLESS 0
+#endif
+#ifndef BVH_SHADER_WATERTIGHT
+#define BVH_SHADER_WATERTIGHT 0
+#endif
+#ifndef BVH_SHADER_COMPACT_VERTICES
+#define BVH_SHADER_COMPACT_VERTICES 0
+#endif
+
+DEFINE_uint32(bvh_width, BVH_SHADER_WIDTH,
+              "children per bvh node: 2, 4 or 8. the viewer needs the "
+              "BVH_WIDTH the shaders were compiled with");
+DEFINE_validator(bvh_width, [](const char*, uint32_t value) {
+  return value == 2 || value == 4 || value == 8;
+});
+
+DEFINE_bool(bvh_quantized, BVH_SHADER_QUANTIZED != 0,
+            "quantize the child bounds of 4 and 8 wide nodes to 8 bits. the "
+            "viewer needs the BVH_QUANTIZED the shaders were compiled with");
+
+DEFINE_bool(bvh_stackless, BVH_SHADER_STACKLESS != 0,
+            "traverse the binary bvh over skip links instead of a stack. the "
+            "viewer needs the BVH_STACKLESS the shaders were compiled with");
+
+DEFINE_bool(bvh_watertight, BVH_SHADER_WATERTIGHT != 0,
+            "watertight triangle test, no ray slips through a shared edge. "
+            "the viewer needs the BVH_WATERTIGHT the shaders were compiled "
+            "with");
+
+DEFINE_bool(compact_vertices, BVH_SHADER_COMPACT_VERTICES != 0,
+            "upload the vertices as 16 bit fixed point positions, octahedral "
+            "normals and half float uvs, about 2.3x smaller. the viewer "
+            "needs the BVH_COMPACT_VERTICES the shaders were compiled with");
+
+DEFINE_string(bvh_builder, "sah",
+              "bvh build mode: sah, lbvh (fastest build), sbvh (spatial "
+              "splits, best traversal) or ploc (clustering, between lbvh and "
+              "sah in build time and quality)");
+DEFINE_validator(bvh_builder, [](const char*, const std::string& value) {
+  BvhBuildMode mode;
+  return parse_build_mode(value.c_str(), &mode);
+});
+
+DEFINE_double(sbvh_max_duplication, 0.3,
+              "extra primitive references the sbvh builder may create, as a "
+              "fraction of the primitive count");
+
+DEFINE_double(bvh_optimize_ms, 0.0,
+              "time budget of the treelet restructuring pass that lowers the "
+              "sah cost after a build, 0 disables it");
+
+DEFINE_string(model, "",
+              "obj, ply, glb, gltf or rtscene file to show, also replaces "
+              "the random scene of --bench and --bvh_stats");
+DEFINE_uint32(preview_triangles, 500000,
+              "the viewer traces models of more triangles simplified to "
+              "about this many while the camera moves, 0 disables it");
+DEFINE_uint32(memory_budget_mb, 0,
+              "page rtscene models through a memory mapping that keeps at "
+              "most this many MiB resident, for scenes larger than memory. "
+              "0 maps them whole");
+DEFINE_string(convert, "",
+              "write the --model scene to this rtscene file, which loads "
+              "without parsing, and exit");
+DEFINE_bool(convert_bvh, false,
+            "--convert builds a bvh with the --bvh_* settings and stores it "
+            "in the scene file");
+
+DEFINE_bool(bench, false, "run the cpu traversal benchmark and exit");
+DEFINE_uint32(bench_rays, 1000000, "rays traced per layout by --bench");
+DEFINE_uint32(bench_triangles, 1000000,
+              "triangles in the random scene traced by --bench");
+DEFINE_uint32(bench_spheres, 0,
+              "analytic spheres added to the random scene traced by --bench");
+DEFINE_string(bench_cache, "",
+              "--bench writes every layout to this bvh cache file and traces "
+              "the tree loaded back from it");
+DEFINE_bool(bench_builders, false,
+            "build the --bench scene with every --bvh_builder, print build "
+            "time, sah cost and traversal throughput, and exit");
+DEFINE_bool(bvh_stats, false,
+            "build the --bench scene, print node count, leaf size and depth "
+            "histograms, sah cost, epo and memory, and exit");
+DEFINE_string(heatmap, "",
+              "with --bvh_stats, write the per pixel node visits of a view "
+              "of the scene to this ppm file");
+DEFINE_bool(heatmap_prims, false,
+            "the --heatmap shows triangle visits instead of node visits");
+DEFINE_bool(self_check, false,
+            "check the analytic intersectors, heatmap counters and lod "
+            "reduction against known answers and exit, nonzero on a "
+            "failure");
+DEFINE_bool(check_device_build, false,
+            "build the --bench_triangles scene with compute shaders, compare "
+            "the tree with the cpu lbvh and exit, nonzero on a mismatch");
+
+size_t memory_budget() { return size_t(FLAGS_memory_budget_mb) << 20; }
+
+// the --model file, or a random scene of --bench_triangles triangles and
+// --bench_spheres spheres
+bool make_scene(Scene* scene) {
+  if (!FLAGS_model.empty()) {
+    if (!load_model_file(FLAGS_model.c_str(), scene, memory_budget())) {
+      return false;
+    }
+  } else {
+    make_random_scene(scene, FLAGS_bench_triangles);
+    make_random_spheres(scene, FLAGS_bench_spheres);
+  }
+  // traced on the grid the shaders would decode
+  if (FLAGS_compact_vertices) {
+    scene->encode_compact_vertices();
+  }
+  return true;
+}
+
+// page and io counters of a paged --model
+void report_pager(const Scene& scene) {
+  PagedFile* pager = scene.pager();
+  if (!pager) {
+    return;
+  }
+  pager->trim();
+  const PagedFileStats stats = pager->stats();
+  const double mib = 1024.0 * 1024.0;
+  printf("pager: %zu page ins, %zu evictions, %.1f MiB resident, %.1f MiB "
+         "peak of %.1f MiB budget, %.1f MiB file\n",
+         size_t(stats.page_ins), size_t(stats.evictions),
+         double(stats.resident_bytes) / mib,
+         double(stats.peak_resident_bytes) / mib,
+         double(pager->budget()) / mib, double(pager->size()) / mib);
+  printf("pager: %zu major faults, %zu minor faults, %.1f MiB read\n",
+         size_t(stats.major_faults), size_t(stats.minor_faults),
+         double(stats.read_bytes) / mib);
+}
 
 void test_vulkan() {
   VkInstance instance;
@@ -21,9 +169,84 @@ void test_vulkan() {
   vkDestroyInstance(instance, nullptr);
 }
 
-int main() {
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  BvhBuildSettings bvh_settings;
+  bvh_settings.width = FLAGS_bvh_width;
+  bvh_settings.quantized = FLAGS_bvh_quantized;
+  bvh_settings.stackless = FLAGS_bvh_stackless;
+  bvh_settings.watertight = FLAGS_bvh_watertight;
+  bvh_settings.compact_vertices = FLAGS_compact_vertices;
+  parse_build_mode(FLAGS_bvh_builder.c_str(), &bvh_settings.mode);
+  bvh_settings.sbvh_max_duplication = float(FLAGS_sbvh_max_duplication);
+  bvh_settings.optimize_budget_ms = float(FLAGS_bvh_optimize_ms);
+
+  if (FLAGS_self_check) {
+    return run_self_checks() ? 0 : 1;
+  }
+
+  if (FLAGS_check_device_build) {
+    Scene scene;
+    make_random_scene(&scene, FLAGS_bench_triangles);
+    return check_device_build(&scene, bvh_settings, FLAGS_bench_rays) ? 0 : 1;
+  }
+
+  if (!FLAGS_convert.empty()) {
+    Scene scene;
+    if (FLAGS_model.empty() || !load_model_file(FLAGS_model.c_str(), &scene)) {
+      return 1;
+    }
+    Blob bvh_cache;
+    if (FLAGS_convert_bvh) {
+      bvh_cache = BvhScene(&scene, bvh_settings).cache_data();
+    }
+    if (!write_scene_file(FLAGS_convert.c_str(), scene, &bvh_cache)) {
+      printf("scene: can't write %s\n", FLAGS_convert.c_str());
+      return 1;
+    }
+    return 0;
+  }
+
+  if (FLAGS_bvh_stats) {
+    Scene scene;
+    if (!make_scene(&scene)) {
+      return 1;
+    }
+    report_bvh_stats(&scene, bvh_settings, FLAGS_heatmap,
+                     FLAGS_heatmap_prims);
+    report_pager(scene);
+    return 0;
+  }
+
+  if (FLAGS_bench_builders) {
+    Scene scene;
+    if (!make_scene(&scene)) {
+      return 1;
+    }
+    bench_builders(&scene, bvh_settings, FLAGS_bench_rays);
+    report_pager(scene);
+    return 0;
+  }
+
+  if (FLAGS_bench) {
+    Scene scene;
+    if (!make_scene(&scene)) {
+      return 1;
+    }
+    bench_traversal(&scene, bvh_settings, FLAGS_bench_rays,
+                    FLAGS_bench_cache);
+    report_pager(scene);
+    return 0;
+  }
+
   App app;
   app.startup(640, 480);
+  app.set_memory_budget(memory_budget());
+  if (!FLAGS_model.empty()) {
+    app.load_model(FLAGS_model.c_str(), bvh_settings,
+                   FLAGS_preview_triangles);
+  }
 
   app.run();
 
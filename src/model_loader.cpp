@@ -0,0 +1,205 @@
+#include "model_loader.h"
+
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#include "bvh_cache.h"
+#include "gltf_loader.h"
+#include "obj_loader.h"
+#include "ply_loader.h"
+#include "scene_file.h"
+#include "simplify.h"
+
+namespace {
+
+// case insensitive suffix match
+bool has_extension(const char* path, const char* extension) {
+  const size_t path_length = strlen(path);
+  const size_t length = strlen(extension);
+  if (path_length < length) {
+    return false;
+  }
+  const char* suffix = path + path_length - length;
+  for (size_t i = 0; i < length; ++i) {
+    if (tolower(static_cast<unsigned char>(suffix[i])) != extension[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// merges duplicated vertices and reports the saving
+void weld(Scene* scene) {
+  auto start = std::chrono::steady_clock::now();
+  const size_t vertex_count = scene->positions().size();
+  const size_t vertex_size =
+      sizeof(Vec3f) + (scene->normals().empty() ? 0 : sizeof(Vec3f)) +
+      (scene->uvs().empty() ? 0 : sizeof(Vec2f));
+  const size_t removed = scene->weld_vertices();
+  const double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+  printf("model: welded %zu to %zu vertices, %.1f MiB saved, %.2f ms\n",
+         vertex_count, vertex_count - removed,
+         double(removed * vertex_size) / (1024.0 * 1024.0), ms);
+}
+
+// encodes the vertices for the gpu and reports the saving over floats
+void compact(Scene* scene) {
+  auto start = std::chrono::steady_clock::now();
+  const size_t vertex_count = scene->positions().size();
+  const size_t float_size =
+      vertex_count * (sizeof(Vec3f) +
+                      (scene->normals().empty() ? 0 : sizeof(Vec3f)) +
+                      (scene->uvs().empty() ? 0 : sizeof(Vec2f)));
+  scene->encode_compact_vertices();
+  const double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+  printf("model: compact vertices %.1f MiB -> %.1f MiB, %.2f ms\n",
+         double(float_size) / (1024.0 * 1024.0),
+         double(scene->compact_vertices().packed_size()) / (1024.0 * 1024.0),
+         ms);
+}
+
+// the coarse copy of scene traced while the camera moves
+std::unique_ptr<Scene> simplify(const Scene& scene, size_t target) {
+  auto start = std::chrono::steady_clock::now();
+  auto lod = std::make_unique<Scene>();
+  simplify_scene(scene, target, lod.get());
+  const double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+  printf("model: lod %zu -> %zu triangles, %.2f ms\n", scene.triangle_count(),
+         lod->triangle_count(), ms);
+  return lod;
+}
+
+}  // namespace
+
+bool load_model_file(const char* path, Scene* scene, size_t memory_budget) {
+  // scene files were welded when they were written
+  if (has_extension(path, SCENE_FILE_EXTENSION)) {
+    return load_scene_file(path, scene, memory_budget);
+  }
+  if (memory_budget > 0) {
+    printf("model: only %s files are paged, convert %s first\n",
+           SCENE_FILE_EXTENSION, path);
+  }
+  bool loaded = false;
+  if (has_extension(path, ".glb") || has_extension(path, ".gltf")) {
+    loaded = load_gltf(path, scene);
+  } else if (has_extension(path, ".obj")) {
+    loaded = load_obj(path, scene);
+  } else if (has_extension(path, ".ply")) {
+    loaded = load_ply(path, scene);
+  } else {
+    printf("model: unknown file type %s\n", path);
+  }
+  if (loaded) {
+    weld(scene);
+  }
+  return loaded;
+}
+
+void AsyncModelLoader::load(const std::string& path,
+                            const BvhBuildSettings& settings,
+                            size_t preview_triangles,
+                            std::function<void(BvhScene*)> prepare) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  request_ = Request{path, settings, preview_triangles, memory_budget_,
+                     std::move(prepare)};
+  has_request_ = true;
+  stopping_ = false;
+  ++generation_;
+  if (!thread_.joinable()) {
+    thread_ = std::thread([this] { work(); });
+  }
+  wake_.notify_one();
+}
+
+std::unique_ptr<LoadedModel> AsyncModelLoader::take() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return std::move(ready_);
+}
+
+void AsyncModelLoader::set_memory_budget(size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  memory_budget_ = bytes;
+}
+
+bool AsyncModelLoader::busy() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return has_request_ || running_;
+}
+
+void AsyncModelLoader::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    has_request_ = false;
+    wake_.notify_one();
+  }
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  ready_.reset();
+}
+
+void AsyncModelLoader::work() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    wake_.wait(lock, [this] { return stopping_ || has_request_; });
+    if (stopping_) {
+      return;
+    }
+    Request request = std::move(request_);
+    const uint64_t generation = generation_;
+    has_request_ = false;
+    running_ = true;
+    lock.unlock();
+
+    auto model = std::make_unique<LoadedModel>();
+    model->path = request.path;
+    auto scene = std::make_unique<Scene>();
+    if (load_model_file(request.path.c_str(), scene.get(),
+                        request.memory_budget)) {
+      // simplified from the full precision vertices
+      if (request.preview_triangles > 0 &&
+          scene->triangle_count() > request.preview_triangles) {
+        model->preview_scene = simplify(*scene, request.preview_triangles);
+        if (request.settings.compact_vertices) {
+          compact(model->preview_scene.get());
+        }
+        model->preview_bvh_scene = std::make_unique<BvhScene>(
+            model->preview_scene.get(), request.settings);
+        if (request.prepare) {
+          request.prepare(model->preview_bvh_scene.get());
+        }
+      }
+      if (request.settings.compact_vertices) {
+        compact(scene.get());
+      }
+      model->scene = std::move(scene);
+      model->bvh_scene = std::make_unique<BvhScene>(
+          model->scene.get(), request.settings,
+          bvh_cache_path(request.path.c_str()));
+      if (request.prepare) {
+        request.prepare(model->bvh_scene.get());
+      }
+    }
+
+    lock.lock();
+    running_ = false;
+    if (generation == generation_ && !stopping_) {
+      std::swap(ready_, model);
+    }
+    // a superseded or untaken model is freed without holding the lock
+    lock.unlock();
+    model.reset();
+    lock.lock();
+  }
+}
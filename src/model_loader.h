@@ -0,0 +1,90 @@
+#ifndef MODEL_LOADER_H
+#define MODEL_LOADER_H
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "bvh.h"
+#include "scene.h"
+
+// loads the model at path into an empty scene, the format is picked by the
+// file extension: .obj, .ply, .glb, .gltf or .rtscene. the vertices of all
+// but scene files are welded, see Scene::weld_vertices. scene files are
+// paged with a memory_budget in bytes, see load_scene_file, the other
+// formats are parsed into memory. returns false on an unknown extension or
+// when the loader fails.
+bool load_model_file(const char* path, Scene* scene,
+                     size_t memory_budget = 0);
+
+// a model loaded by AsyncModelLoader. scene and bvh_scene are null when the
+// file could not be loaded, preview_scene and preview_bvh_scene when the
+// model is small enough to trace as is. members are destroyed in reverse
+// order, so the bvhs go before the scenes they reference.
+struct LoadedModel {
+  std::string path;
+  std::unique_ptr<Scene> scene;
+  std::unique_ptr<BvhScene> bvh_scene;
+  std::unique_ptr<Scene> preview_scene;
+  std::unique_ptr<BvhScene> preview_bvh_scene;
+};
+
+// loads models and builds their bvhs on a worker thread while the render
+// loop keeps drawing the current scene, which polls take() once per frame
+// and swaps the result in. a request made while another one runs supersedes
+// it: the running load completes and its result is dropped.
+class AsyncModelLoader {
+ public:
+  NOCOPYABLE(AsyncModelLoader)
+
+  AsyncModelLoader() = default;
+  ~AsyncModelLoader() { stop(); }
+
+  // prepare runs on the worker after the build, e.g. to create the device
+  // objects of the bvh, and again for the preview bvh. the bvh is cached
+  // next to the file. a model of more than preview_triangles triangles gets
+  // a simplified preview of about that many, 0 disables it. the vertices
+  // are encoded first with settings.compact_vertices.
+  void load(const std::string& path, const BvhBuildSettings& settings,
+            size_t preview_triangles = 0,
+            std::function<void(BvhScene*)> prepare = nullptr);
+
+  // the latest finished model, each one is handed out once
+  std::unique_ptr<LoadedModel> take();
+
+  // memory budget of the scene files loaded from now on, 0 maps them whole
+  void set_memory_budget(size_t bytes);
+
+  // a load is queued or running
+  [[nodiscard]] bool busy();
+
+  // waits for the running load and drops every result
+  void stop();
+
+ private:
+  struct Request {
+    std::string path;
+    BvhBuildSettings settings;
+    size_t preview_triangles;
+    size_t memory_budget;
+    std::function<void(BvhScene*)> prepare;
+  };
+
+  void work();
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::thread thread_;
+  Request request_;
+  bool has_request_{false};
+  bool running_{false};
+  bool stopping_{false};
+  uint64_t generation_{0};  // of the latest request
+  size_t memory_budget_{0};
+  std::unique_ptr<LoadedModel> ready_;
+};
+
+#endif  // MODEL_LOADER_H
@@ -0,0 +1,456 @@
+#include "obj_loader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+// smaller files are parsed on one thread
+const size_t OBJ_MIN_CHUNK_SIZE = 1 << 20;
+
+// index of a corner attribute the face leaves out
+const uint32_t OBJ_NO_INDEX = ~0u;
+
+// attributes of a corner, in the order of "v/vt/vn"
+const int OBJ_POSITION = 0;
+const int OBJ_UV = 1;
+const int OBJ_NORMAL = 2;
+
+// what a chunk of lines holds. face corners keep the raw 1-based obj
+// indices until the vertex counts of the chunks before are known.
+struct ObjChunk {
+  std::vector<Vec3f> positions;
+  std::vector<Vec2f> uvs;
+  std::vector<Vec3f> normals;
+  // 3 ints per corner and 3 corners per triangle. negative obj indices are
+  // stored 0-based relative to the chunk and listed in relative
+  std::vector<int32_t> corners;
+  std::vector<uint32_t> relative;
+  size_t error_line{0};  // 1-based line in the chunk, 0 without errors
+};
+
+bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+const char* skip_blanks(const char* p, const char* end) {
+  while (p < end && is_blank(*p)) {
+    ++p;
+  }
+  return p;
+}
+
+const char* parse_int(const char* p, const char* end, int32_t* out) {
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    ++p;
+  }
+  const char* digits = p;
+  int64_t value = 0;
+  while (p < end && *p >= '0' && *p <= '9' && value <= INT32_MAX) {
+    value = value * 10 + (*p - '0');
+    ++p;
+  }
+  if (p == digits || value > INT32_MAX) {
+    return nullptr;
+  }
+  *out = static_cast<int32_t>(negative ? -value : value);
+  return p;
+}
+
+// up to n floats separated by blanks, extra components such as w or vertex
+// colors are skipped with the rest of the line
+const char* parse_floats(const char* p, const char* end, float* out, int n) {
+  for (int i = 0; i < n; ++i) {
+    p = skip_blanks(p, end);
+    p = parse_float(p, end, out + i);
+    if (!p) {
+      return nullptr;
+    }
+  }
+  return p;
+}
+
+// one "v/vt/vn", "v//vn", "v/vt" or "v" corner, a missing uv or normal
+// reads as 0
+struct ObjCorner {
+  int32_t index[3];
+  uint32_t relative;  // bit per attribute stored chunk relative
+};
+
+const char* parse_corner(const char* p, const char* end, ObjCorner* corner) {
+  corner->index[OBJ_UV] = 0;
+  corner->index[OBJ_NORMAL] = 0;
+  p = parse_int(p, end, &corner->index[OBJ_POSITION]);
+  if (!p || p == end || *p != '/') {
+    return p;
+  }
+  ++p;
+  if (p < end && *p != '/') {
+    p = parse_int(p, end, &corner->index[OBJ_UV]);
+    if (!p) {
+      return nullptr;
+    }
+  }
+  if (p < end && *p == '/') {
+    p = parse_int(p + 1, end, &corner->index[OBJ_NORMAL]);
+  }
+  return p;
+}
+
+void parse_chunk(const char* p, const char* end, ObjChunk* chunk) {
+  // first, previous and current corner of the polygon being fanned
+  ObjCorner polygon[3];
+  size_t line = 0;
+  while (p < end) {
+    ++line;
+    const char* line_end =
+        static_cast<const char*>(memchr(p, '\n', size_t(end - p)));
+    if (!line_end) {
+      line_end = end;
+    }
+    p = skip_blanks(p, line_end);
+
+    const char* q = p;
+    bool ok = true;
+    if (line_end - p >= 2 && p[0] == 'v' && is_blank(p[1])) {
+      Vec3f v;
+      q = parse_floats(p + 2, line_end, &v.x, 3);
+      chunk->positions.push_back(v);
+    } else if (line_end - p >= 3 && p[0] == 'v' && p[1] == 't' &&
+               is_blank(p[2])) {
+      Vec2f uv;
+      q = parse_floats(p + 3, line_end, &uv.x, 1);
+      if (q) {
+        // a 1d texture coordinate leaves v at 0
+        const char* r = skip_blanks(q, line_end);
+        if (r < line_end && parse_float(r, line_end, &uv.y)) {
+          q = r;
+        }
+      }
+      chunk->uvs.push_back(uv);
+    } else if (line_end - p >= 3 && p[0] == 'v' && p[1] == 'n' &&
+               is_blank(p[2])) {
+      Vec3f n;
+      q = parse_floats(p + 3, line_end, &n.x, 3);
+      chunk->normals.push_back(n);
+    } else if (line_end - p >= 2 && p[0] == 'f' && is_blank(p[1])) {
+      q = p + 2;
+      int corner_count = 0;
+      while (true) {
+        q = skip_blanks(q, line_end);
+        if (q == line_end) {
+          break;
+        }
+        // a polygon is fanned around its first corner
+        ObjCorner& corner = polygon[std::min(corner_count, 2)];
+        q = parse_corner(q, line_end, &corner);
+        if (!q || corner.index[OBJ_POSITION] == 0) {
+          ok = false;
+          break;
+        }
+
+        // negative indices count back from the last element read so far
+        const int32_t counts[3] = {int32_t(chunk->positions.size()),
+                                   int32_t(chunk->uvs.size()),
+                                   int32_t(chunk->normals.size())};
+        corner.relative = 0;
+        for (int a = 0; a < 3; ++a) {
+          if (corner.index[a] < 0) {
+            corner.index[a] += counts[a];
+            corner.relative |= 1u << a;
+          }
+        }
+        if (corner_count >= 2) {
+          for (const auto& c : polygon) {
+            for (int a = 0; a < 3; ++a) {
+              if (c.relative & (1u << a)) {
+                chunk->relative.push_back(uint32_t(chunk->corners.size()));
+              }
+              chunk->corners.push_back(c.index[a]);
+            }
+          }
+          polygon[1] = polygon[2];
+        }
+        ++corner_count;
+      }
+      if (ok && corner_count < 3) {
+        ok = false;
+      }
+    }
+    // comments, objects, groups, materials, lines and points are skipped
+    if (!q || !ok) {
+      if (chunk->error_line == 0) {
+        chunk->error_line = line;
+      }
+    }
+    p = line_end + 1;
+  }
+}
+
+}  // namespace
+
+const char* parse_float(const char* p, const char* end, float* out) {
+  // exact powers of ten, products with a mantissa below 2^53 round once
+  static const double POW10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                 1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                 1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                 1e18, 1e19, 1e20, 1e21, 1e22};
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    ++p;
+  }
+
+  uint64_t mantissa = 0;
+  int exponent = 0;
+  int digits = 0;
+  // digits past the 19th no longer fit and only shift the exponent
+  for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digits) {
+    if (mantissa < 1000000000000000000ull) {
+      mantissa = mantissa * 10 + uint64_t(*p - '0');
+    } else {
+      ++exponent;
+    }
+  }
+  if (p < end && *p == '.') {
+    for (++p; p < end && *p >= '0' && *p <= '9'; ++p, ++digits) {
+      if (mantissa < 1000000000000000000ull) {
+        mantissa = mantissa * 10 + uint64_t(*p - '0');
+        --exponent;
+      }
+    }
+  }
+  if (digits == 0) {
+    return nullptr;
+  }
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    int32_t e = 0;
+    const char* q = parse_int(p + 1, end, &e);
+    if (q) {
+      exponent += std::max(std::min(e, 1000), -1000);
+      p = q;
+    }
+  }
+
+  double value = double(mantissa);
+  if (mantissa == 0) {
+    value = 0.0;
+  } else if (exponent >= 0 && exponent <= 22) {
+    value *= POW10[exponent];
+  } else if (exponent < 0 && exponent >= -22) {
+    value /= POW10[-exponent];
+  } else {
+    value *= std::pow(10.0, double(exponent));
+  }
+  *out = static_cast<float>(negative ? -value : value);
+  return p;
+}
+
+bool load_obj(const char* path, Scene* scene) {
+  auto start = std::chrono::steady_clock::now();
+  MappedFile file;
+  if (!file.open(path)) {
+    printf("obj: can't open %s\n", path);
+    return false;
+  }
+  const char* data = reinterpret_cast<const char*>(file.data());
+  const size_t size = file.size();
+
+  // chunks start after a line break, so no line is split
+  const size_t chunk_count = std::max<size_t>(
+      1, std::min<size_t>(worker_count(), size / OBJ_MIN_CHUNK_SIZE));
+  std::vector<size_t> chunk_begin(chunk_count + 1, size);
+  chunk_begin[0] = 0;
+  for (size_t i = 1; i < chunk_count; ++i) {
+    const size_t from = std::max(chunk_begin[i - 1], size / chunk_count * i);
+    const void* line_break = memchr(data + from, '\n', size - from);
+    chunk_begin[i] =
+        line_break ? size_t(static_cast<const char*>(line_break) - data) + 1
+                   : size;
+  }
+
+  std::vector<ObjChunk> chunks(chunk_count);
+  parallel_for(0, chunk_count, 1, [&](size_t begin, size_t end, uint32_t) {
+    for (size_t i = begin; i < end; ++i) {
+      parse_chunk(data + chunk_begin[i], data + chunk_begin[i + 1],
+                  &chunks[i]);
+    }
+  });
+  auto parse_end = std::chrono::steady_clock::now();
+
+  // element offsets of every chunk
+  std::vector<size_t> bases[3];
+  std::vector<size_t> corner_bases(chunk_count + 1, 0);
+  for (auto& b : bases) {
+    b.assign(chunk_count + 1, 0);
+  }
+  for (size_t i = 0; i < chunk_count; ++i) {
+    const ObjChunk& chunk = chunks[i];
+    if (chunk.error_line != 0) {
+      size_t line = chunk.error_line;
+      for (size_t j = chunk_begin[i]; j > 0; --j) {
+        line += data[j - 1] == '\n' ? 1 : 0;
+      }
+      printf("obj: %s:%zu: can't parse the line\n", path, line);
+      return false;
+    }
+    bases[OBJ_POSITION][i + 1] = bases[OBJ_POSITION][i] + chunk.positions.size();
+    bases[OBJ_UV][i + 1] = bases[OBJ_UV][i] + chunk.uvs.size();
+    bases[OBJ_NORMAL][i + 1] = bases[OBJ_NORMAL][i] + chunk.normals.size();
+    corner_bases[i + 1] = corner_bases[i] + chunk.corners.size() / 3;
+  }
+  const size_t position_count = bases[OBJ_POSITION][chunk_count];
+  const size_t corner_count = corner_bases[chunk_count];
+  if (position_count > OBJ_NO_INDEX || corner_count > OBJ_NO_INDEX) {
+    printf("obj: %s has more than 2^32 vertices or corners\n", path);
+    return false;
+  }
+
+  // global 0-based indices of every corner, OBJ_NO_INDEX for a left out uv
+  // or normal, and the merged attribute arrays
+  std::vector<uint32_t> corners(corner_count * 3);
+  std::vector<Vec3f> obj_positions(position_count);
+  std::vector<Vec2f> obj_uvs(bases[OBJ_UV][chunk_count]);
+  std::vector<Vec3f> obj_normals(bases[OBJ_NORMAL][chunk_count]);
+  std::vector<uint8_t> chunk_errors(chunk_count, 0);
+  parallel_for(0, chunk_count, 1, [&](size_t begin, size_t end, uint32_t) {
+    for (size_t i = begin; i < end; ++i) {
+      ObjChunk& chunk = chunks[i];
+      std::copy(chunk.positions.begin(), chunk.positions.end(),
+                obj_positions.begin() + bases[OBJ_POSITION][i]);
+      std::copy(chunk.uvs.begin(), chunk.uvs.end(),
+                obj_uvs.begin() + bases[OBJ_UV][i]);
+      std::copy(chunk.normals.begin(), chunk.normals.end(),
+                obj_normals.begin() + bases[OBJ_NORMAL][i]);
+
+      uint32_t* out = corners.data() + corner_bases[i] * 3;
+      for (size_t j = 0; j < chunk.corners.size(); ++j) {
+        const int32_t index = chunk.corners[j];
+        out[j] = index > 0 ? uint32_t(index - 1) : OBJ_NO_INDEX;
+      }
+      for (uint32_t slot : chunk.relative) {
+        const int64_t index =
+            int64_t(bases[slot % 3][i]) + int64_t(chunk.corners[slot]);
+        // points before the first element of the file
+        out[slot] = index >= 0 ? uint32_t(index) : OBJ_NO_INDEX - 1;
+      }
+      for (size_t j = 0; j < chunk.corners.size(); ++j) {
+        const bool optional = j % 3 != OBJ_POSITION;
+        if (out[j] >= bases[j % 3][chunk_count] &&
+            !(optional && out[j] == OBJ_NO_INDEX)) {
+          chunk_errors[i] = 1;
+        }
+      }
+      chunk = ObjChunk();
+    }
+  });
+  if (std::find(chunk_errors.begin(), chunk_errors.end(), 1) !=
+      chunk_errors.end()) {
+    printf("obj: %s has a face index out of range\n", path);
+    return false;
+  }
+
+  const bool has_uvs = !obj_uvs.empty();
+  const bool has_normals = !obj_normals.empty();
+  std::vector<Vec3f> positions;
+  std::vector<Vec3f> normals;
+  std::vector<Vec2f> uvs;
+  std::vector<uint32_t> indices(corner_count);
+  if (!has_uvs && !has_normals) {
+    // positions are the vertices
+    positions = std::move(obj_positions);
+    parallel_for(0, corner_count, 1 << 16, [&](size_t b, size_t e, uint32_t) {
+      for (size_t c = b; c < e; ++c) {
+        indices[c] = corners[c * 3 + OBJ_POSITION];
+      }
+    });
+  } else {
+    // corners bucketed by position, a vertex per distinct uv and normal
+    // pair in a bucket. buckets are short, so a linear search is enough.
+    std::vector<uint32_t> bucket_begin(position_count + 1, 0);
+    for (size_t c = 0; c < corner_count; ++c) {
+      ++bucket_begin[corners[c * 3 + OBJ_POSITION] + 1];
+    }
+    for (size_t v = 0; v < position_count; ++v) {
+      bucket_begin[v + 1] += bucket_begin[v];
+    }
+    std::vector<uint32_t> bucket_corners(corner_count);
+    {
+      std::vector<uint32_t> fill(bucket_begin.begin(), bucket_begin.end() - 1);
+      for (size_t c = 0; c < corner_count; ++c) {
+        bucket_corners[fill[corners[c * 3 + OBJ_POSITION]]++] = uint32_t(c);
+      }
+    }
+
+    // vertex of a corner relative to its bucket, and the first corner of
+    // every vertex, which writes its attributes
+    std::vector<uint32_t> vertex_base(position_count + 1, 0);
+    std::vector<uint8_t> first_use(corner_count, 0);
+    parallel_for(0, position_count, 1 << 14, [&](size_t b, size_t e,
+                                                 uint32_t) {
+      // uv and normal of every vertex of the bucket
+      std::vector<std::pair<uint32_t, uint32_t>> unique;
+      for (size_t v = b; v < e; ++v) {
+        unique.clear();
+        for (uint32_t i = bucket_begin[v]; i < bucket_begin[v + 1]; ++i) {
+          const uint32_t c = bucket_corners[i];
+          const std::pair<uint32_t, uint32_t> key(
+              corners[c * 3 + OBJ_UV], corners[c * 3 + OBJ_NORMAL]);
+          auto it = std::find(unique.begin(), unique.end(), key);
+          if (it == unique.end()) {
+            first_use[c] = 1;
+            it = unique.insert(unique.end(), key);
+          }
+          indices[c] = uint32_t(it - unique.begin());
+        }
+        vertex_base[v + 1] = uint32_t(unique.size());
+      }
+    });
+    for (size_t v = 0; v < position_count; ++v) {
+      vertex_base[v + 1] += vertex_base[v];
+    }
+
+    const size_t vertex_count = vertex_base[position_count];
+    positions.resize(vertex_count);
+    normals.resize(has_normals ? vertex_count : 0);
+    uvs.resize(has_uvs ? vertex_count : 0);
+    parallel_for(0, corner_count, 1 << 16, [&](size_t b, size_t e, uint32_t) {
+      for (size_t c = b; c < e; ++c) {
+        const uint32_t* corner = &corners[c * 3];
+        const uint32_t vertex =
+            vertex_base[corner[OBJ_POSITION]] + indices[c];
+        indices[c] = vertex;
+        if (!first_use[c]) {
+          continue;
+        }
+        positions[vertex] = obj_positions[corner[OBJ_POSITION]];
+        if (has_normals && corner[OBJ_NORMAL] != OBJ_NO_INDEX) {
+          normals[vertex] = obj_normals[corner[OBJ_NORMAL]];
+        }
+        if (has_uvs && corner[OBJ_UV] != OBJ_NO_INDEX) {
+          uvs[vertex] = obj_uvs[corner[OBJ_UV]];
+        }
+      }
+    });
+  }
+
+  const size_t vertex_count = positions.size();
+  scene->add_triangles(std::move(positions), std::move(normals),
+                       std::move(uvs), indices);
+
+  auto end = std::chrono::steady_clock::now();
+  const double parse_ms =
+      std::chrono::duration<double, std::milli>(parse_end - start).count();
+  const double total_ms =
+      std::chrono::duration<double, std::milli>(end - start).count();
+  const double mb = double(size) / (1024.0 * 1024.0);
+  printf("obj: %s, %.1f MiB, %zu vertices, %zu triangles, parse %.2f ms "
+         "(%.0f MiB/s), total %.2f ms (%.0f MiB/s)\n",
+         path, mb, vertex_count, corner_count / 3, parse_ms,
+         mb * 1000.0 / std::max(parse_ms, 1e-3), total_ms,
+         mb * 1000.0 / std::max(total_ms, 1e-3));
+  return true;
+}
@@ -0,0 +1,20 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include "scene.h"
+
+// appends the triangles of a wavefront obj file to scene. the mapped file is
+// split into one chunk per worker at line boundaries and the chunks are
+// parsed in parallel, then vertex, uv and normal indices are merged into one
+// index per unique combination, so the scene gets compact per vertex
+// arrays. polygons are fanned into triangles, negative indices are
+// resolved, objects, groups and materials are ignored. prints the parse
+// throughput, returns false on a malformed file and leaves scene untouched.
+bool load_obj(const char* path, Scene* scene);
+
+// decimal float of an obj or ply file starting at p, without locale or
+// errno. returns the first character after the number, or nullptr when
+// there is none.
+const char* parse_float(const char* p, const char* end, float* out);
+
+#endif  // OBJ_LOADER_H
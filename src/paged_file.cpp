@@ -0,0 +1,196 @@
+#include "paged_file.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// starts reading the range in the background
+void will_need(const uint8_t* data, size_t size) {
+#ifdef _WIN32
+  (void)data;
+  (void)size;
+#else
+  madvise(const_cast<uint8_t*>(data), size, MADV_WILLNEED);
+#endif
+}
+
+// drops the range from the process, the next access reads it again
+void drop(const uint8_t* data, size_t size) {
+#ifdef _WIN32
+  // unlocking pages that are not locked removes them from the working set
+  VirtualUnlock(const_cast<uint8_t*>(data), size);
+#else
+  madvise(const_cast<uint8_t*>(data), size, MADV_DONTNEED);
+#endif
+}
+
+// any page of the range is resident, always false on windows
+bool any_resident(const uint8_t* data, size_t size,
+                  std::vector<unsigned char>* scratch) {
+#ifdef _WIN32
+  (void)data;
+  (void)size;
+  (void)scratch;
+  return false;
+#else
+  const auto os_page = size_t(sysconf(_SC_PAGESIZE));
+  scratch->resize((size + os_page - 1) / os_page);
+  if (mincore(const_cast<uint8_t*>(data), size, scratch->data()) != 0) {
+    return false;
+  }
+  return std::any_of(scratch->begin(), scratch->end(),
+                     [](unsigned char v) { return (v & 1) != 0; });
+#endif
+}
+
+// process wide fault and io counters
+void process_counters(PagedFileStats* stats) {
+#ifndef _WIN32
+  struct rusage usage = {};
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    stats->major_faults = uint64_t(usage.ru_majflt);
+    stats->minor_faults = uint64_t(usage.ru_minflt);
+    stats->read_bytes = uint64_t(usage.ru_inblock) * 512;
+  }
+#else
+  (void)stats;
+#endif
+}
+
+}  // namespace
+
+bool PagedFile::open(const char* path, size_t budget) {
+  if (!file_.open(path)) {
+    return false;
+  }
+  if (budget > 0 && budget < PAGED_FILE_PAGE_SIZE) {
+    // a smaller budget would evict every page as soon as it is touched
+    printf("paged file: a budget of %zu bytes is less than a page, keeping "
+           "%zu\n",
+           budget, PAGED_FILE_PAGE_SIZE);
+    budget = PAGED_FILE_PAGE_SIZE;
+  }
+  budget_ = budget;
+  const size_t page_count =
+      (file_.size() + PAGED_FILE_PAGE_SIZE - 1) / PAGED_FILE_PAGE_SIZE;
+  prev_.assign(page_count, PAGED_FILE_NO_PAGE);
+  next_.assign(page_count, PAGED_FILE_NO_PAGE);
+  resident_.assign(page_count, 0);
+  head_ = PAGED_FILE_NO_PAGE;
+  tail_ = PAGED_FILE_NO_PAGE;
+  stats_ = PagedFileStats();
+  process_counters(&base_);
+  return true;
+}
+
+size_t PagedFile::page_bytes(uint32_t page) const {
+  return std::min(PAGED_FILE_PAGE_SIZE,
+                  file_.size() - size_t(page) * PAGED_FILE_PAGE_SIZE);
+}
+
+void PagedFile::unlink(uint32_t page) {
+  const uint32_t prev = prev_[page];
+  const uint32_t next = next_[page];
+  (prev == PAGED_FILE_NO_PAGE ? head_ : next_[prev]) = next;
+  (next == PAGED_FILE_NO_PAGE ? tail_ : prev_[next]) = prev;
+  prev_[page] = PAGED_FILE_NO_PAGE;
+  next_[page] = PAGED_FILE_NO_PAGE;
+}
+
+void PagedFile::push_front(uint32_t page) {
+  next_[page] = head_;
+  (head_ == PAGED_FILE_NO_PAGE ? tail_ : prev_[head_]) = page;
+  head_ = page;
+}
+
+void PagedFile::evict(uint32_t page) {
+  drop(file_.data() + size_t(page) * PAGED_FILE_PAGE_SIZE, page_bytes(page));
+  ++stats_.evictions;
+  if (resident_[page]) {
+    unlink(page);
+    resident_[page] = 0;
+    stats_.resident_bytes -= page_bytes(page);
+  }
+}
+
+void PagedFile::evict_to_budget() {
+  // the most recently touched page stays
+  while (stats_.resident_bytes > budget_ && tail_ != head_) {
+    evict(tail_);
+  }
+}
+
+void PagedFile::touch(const void* data, size_t size) {
+  const auto* begin = static_cast<const uint8_t*>(data);
+  if (budget_ == 0 || size == 0 || begin < file_.data() ||
+      begin >= file_.data() + file_.size()) {
+    return;
+  }
+  const size_t offset = size_t(begin - file_.data());
+  const auto first = uint32_t(offset / PAGED_FILE_PAGE_SIZE);
+  const auto last = uint32_t(
+      (std::min(offset + size, file_.size()) - 1) / PAGED_FILE_PAGE_SIZE);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (uint32_t page = first; page <= last; ++page) {
+    if (resident_[page]) {
+      unlink(page);
+    } else {
+      will_need(file_.data() + size_t(page) * PAGED_FILE_PAGE_SIZE,
+                page_bytes(page));
+      resident_[page] = 1;
+      stats_.resident_bytes += page_bytes(page);
+      ++stats_.page_ins;
+    }
+    push_front(page);
+    stats_.peak_resident_bytes =
+        std::max(stats_.peak_resident_bytes, stats_.resident_bytes);
+    evict_to_budget();
+  }
+}
+
+void PagedFile::trim() {
+  if (budget_ == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<uint32_t> untracked;
+  std::vector<unsigned char> scratch;
+  uint64_t untracked_bytes = 0;
+  for (uint32_t page = 0; page < resident_.size(); ++page) {
+    if (!resident_[page] &&
+        any_resident(file_.data() + size_t(page) * PAGED_FILE_PAGE_SIZE,
+                     page_bytes(page), &scratch)) {
+      untracked.push_back(page);
+      untracked_bytes += page_bytes(page);
+    }
+  }
+  for (uint32_t page : untracked) {
+    if (stats_.resident_bytes + untracked_bytes <= budget_) {
+      break;
+    }
+    evict(page);
+    untracked_bytes -= page_bytes(page);
+  }
+  evict_to_budget();
+}
+
+PagedFileStats PagedFile::stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  PagedFileStats out = stats_;
+  process_counters(&out);
+  out.major_faults -= base_.major_faults;
+  out.minor_faults -= base_.minor_faults;
+  out.read_bytes -= base_.read_bytes;
+  return out;
+}
@@ -0,0 +1,76 @@
+#ifndef PAGED_FILE_H
+#define PAGED_FILE_H
+
+#include <mutex>
+#include <vector>
+
+#include "util.h"
+
+// granularity of the residency tracking, a multiple of the os page size
+const size_t PAGED_FILE_PAGE_SIZE = size_t(1) << 22;
+const uint32_t PAGED_FILE_NO_PAGE = ~0u;
+
+struct PagedFileStats {
+  uint64_t page_ins{0};   // pages brought in by touch
+  uint64_t evictions{0};  // pages dropped to stay in the budget
+  uint64_t resident_bytes{0};
+  uint64_t peak_resident_bytes{0};
+  // of the whole process since the file was opened, zero on windows
+  uint64_t major_faults{0};
+  uint64_t minor_faults{0};
+  uint64_t read_bytes{0};
+};
+
+// read only mapping of a file that keeps at most budget bytes of it
+// resident. the users of the data touch() the ranges they are about to read,
+// which moves their pages to the front of an lru list and evicts the least
+// recently used pages past the budget. evicted pages are read back from the
+// file, or the page cache, on their next access. a budget of 0 keeps
+// everything and makes touch() free.
+class PagedFile {
+ public:
+  NOCOPYABLE(PagedFile)
+
+  PagedFile() = default;
+  ~PagedFile() = default;
+
+  // a budget below one PAGED_FILE_PAGE_SIZE page is rounded up to a page
+  bool open(const char* path, size_t budget);
+
+  [[nodiscard]] const uint8_t* data() const { return file_.data(); }
+  [[nodiscard]] size_t size() const { return file_.size(); }
+  [[nodiscard]] size_t budget() const { return budget_; }
+
+  // marks the pages of [data, data + size) as used, ranges outside the
+  // mapping are ignored. callable from any thread. a range larger than the
+  // budget evicts its own first pages.
+  void touch(const void* data, size_t size);
+
+  // evicts until the resident pages fit the budget, also those faulted in by
+  // reads that were not touched, e.g. random accesses during traversal. the
+  // untouched pages go first.
+  void trim();
+
+  [[nodiscard]] PagedFileStats stats();
+
+ private:
+  MappedFile file_;
+  size_t budget_{0};
+  std::mutex mutex_;
+  // lru list over the resident pages, head_ is the most recently used
+  std::vector<uint32_t> prev_;
+  std::vector<uint32_t> next_;
+  std::vector<uint8_t> resident_;
+  uint32_t head_{PAGED_FILE_NO_PAGE};
+  uint32_t tail_{PAGED_FILE_NO_PAGE};
+  PagedFileStats stats_;
+  PagedFileStats base_;  // process counters when the file was opened
+
+  [[nodiscard]] size_t page_bytes(uint32_t page) const;
+  void unlink(uint32_t page);
+  void push_front(uint32_t page);
+  void evict(uint32_t page);
+  void evict_to_budget();
+};
+
+#endif  // PAGED_FILE_H
@@ -0,0 +1,577 @@
+#include "ply_loader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+
+namespace {
+
+// records decoded per parallel chunk
+const size_t PLY_MIN_CHUNK = 1 << 16;
+
+enum PlyType : uint8_t {
+  PLY_NONE,
+  PLY_INT8,
+  PLY_UINT8,
+  PLY_INT16,
+  PLY_UINT16,
+  PLY_INT32,
+  PLY_UINT32,
+  PLY_FLOAT32,
+  PLY_FLOAT64,
+};
+
+uint32_t type_size(PlyType type) {
+  static const uint32_t sizes[] = {0, 1, 1, 2, 2, 4, 4, 4, 8};
+  return sizes[type];
+}
+
+bool is_integer(PlyType type) {
+  return type != PLY_NONE && type != PLY_FLOAT32 && type != PLY_FLOAT64;
+}
+
+PlyType parse_type(const std::string& name) {
+  static const char* const names[][2] = {
+      {"char", "int8"},     {"uchar", "uint8"}, {"short", "int16"},
+      {"ushort", "uint16"}, {"int", "int32"},   {"uint", "uint32"},
+      {"float", "float32"}, {"double", "float64"}};
+  for (int i = 0; i < 8; ++i) {
+    if (name == names[i][0] || name == names[i][1]) {
+      return PlyType(i + 1);
+    }
+  }
+  return PLY_NONE;
+}
+
+struct PlyProperty {
+  std::string name;
+  PlyType type{PLY_NONE};        // of the value or of the list items
+  PlyType count_type{PLY_NONE};  // of the list length, none for scalars
+};
+
+struct PlyElement {
+  std::string name;
+  uint64_t count{0};
+  std::vector<PlyProperty> properties;
+
+  // record size, 0 when a list makes it vary
+  [[nodiscard]] size_t fixed_size() const {
+    size_t size = 0;
+    for (const auto& p : properties) {
+      if (p.count_type != PLY_NONE) {
+        return 0;
+      }
+      size += type_size(p.type);
+    }
+    return size;
+  }
+};
+
+// a value in the byte order of the file
+template <typename T>
+T load(const uint8_t* p, bool swap) {
+  uint8_t bytes[sizeof(T)];
+  memcpy(bytes, p, sizeof(T));
+  if (swap) {
+    std::reverse(bytes, bytes + sizeof(T));
+  }
+  T value;
+  memcpy(&value, bytes, sizeof(T));
+  return value;
+}
+
+float load_float(PlyType type, const uint8_t* p, bool swap) {
+  switch (type) {
+    case PLY_INT8:
+      return float(int8_t(*p));
+    case PLY_UINT8:
+      return float(*p);
+    case PLY_INT16:
+      return float(load<int16_t>(p, swap));
+    case PLY_UINT16:
+      return float(load<uint16_t>(p, swap));
+    case PLY_INT32:
+      return float(load<int32_t>(p, swap));
+    case PLY_UINT32:
+      return float(load<uint32_t>(p, swap));
+    case PLY_FLOAT32:
+      return load<float>(p, swap);
+    case PLY_FLOAT64:
+      return float(load<double>(p, swap));
+    default:
+      return 0.0f;
+  }
+}
+
+// a list length or index. negative values turn huge and fail range checks.
+uint64_t load_integer(PlyType type, const uint8_t* p, bool swap) {
+  switch (type) {
+    case PLY_INT8:
+      return uint64_t(int64_t(int8_t(*p)));
+    case PLY_UINT8:
+      return *p;
+    case PLY_INT16:
+      return uint64_t(int64_t(load<int16_t>(p, swap)));
+    case PLY_UINT16:
+      return load<uint16_t>(p, swap);
+    case PLY_INT32:
+      return uint64_t(int64_t(load<int32_t>(p, swap)));
+    case PLY_UINT32:
+      return load<uint32_t>(p, swap);
+    default:
+      return ~0ull;
+  }
+}
+
+// the elements of the header, returns the size of the header or 0 when it
+// is malformed
+size_t parse_header(const char* data, size_t size, std::string* format,
+                    std::vector<PlyElement>* elements) {
+  const char* p = data;
+  const char* end = data + size;
+  bool first = true;
+  while (p < end) {
+    const char* line_end =
+        static_cast<const char*>(memchr(p, '\n', size_t(end - p)));
+    if (!line_end) {
+      return 0;
+    }
+    std::vector<std::string> tokens;
+    for (const char* q = p; q < line_end;) {
+      while (q < line_end && (*q == ' ' || *q == '\t' || *q == '\r')) {
+        ++q;
+      }
+      const char* token = q;
+      while (q < line_end && *q != ' ' && *q != '\t' && *q != '\r') {
+        ++q;
+      }
+      if (q > token) {
+        tokens.emplace_back(token, q);
+      }
+    }
+    p = line_end + 1;
+
+    if (first) {
+      if (tokens.size() != 1 || tokens[0] != "ply") {
+        return 0;
+      }
+      first = false;
+    } else if (tokens.empty() || tokens[0] == "comment" ||
+               tokens[0] == "obj_info") {
+      continue;
+    } else if (tokens[0] == "end_header") {
+      return size_t(p - data);
+    } else if (tokens[0] == "format" && tokens.size() >= 2) {
+      *format = tokens[1];
+    } else if (tokens[0] == "element" && tokens.size() == 3) {
+      PlyElement element;
+      element.name = tokens[1];
+      char* count_end = nullptr;
+      element.count = strtoull(tokens[2].c_str(), &count_end, 10);
+      if (*count_end != '\0') {
+        return 0;
+      }
+      elements->push_back(element);
+    } else if (tokens[0] == "property" && !elements->empty()) {
+      PlyProperty property;
+      if (tokens.size() == 5 && tokens[1] == "list") {
+        property.count_type = parse_type(tokens[2]);
+        property.type = parse_type(tokens[3]);
+        property.name = tokens[4];
+        if (!is_integer(property.count_type)) {
+          return 0;
+        }
+      } else if (tokens.size() == 3) {
+        property.type = parse_type(tokens[1]);
+        property.name = tokens[2];
+      }
+      if (property.type == PLY_NONE) {
+        return 0;
+      }
+      elements->back().properties.push_back(property);
+    } else {
+      return 0;
+    }
+  }
+  return 0;
+}
+
+// steps over one record of an element with lists, calls on_list(property,
+// count, items) for every list. returns nullptr when the record is cut off.
+template <typename OnList>
+const uint8_t* walk_record(const PlyElement& element, const uint8_t* p,
+                           const uint8_t* end, bool swap, OnList on_list) {
+  for (size_t i = 0; i < element.properties.size(); ++i) {
+    const PlyProperty& property = element.properties[i];
+    if (property.count_type == PLY_NONE) {
+      if (size_t(end - p) < type_size(property.type)) {
+        return nullptr;
+      }
+      p += type_size(property.type);
+      continue;
+    }
+    const uint32_t count_size = type_size(property.count_type);
+    if (size_t(end - p) < count_size) {
+      return nullptr;
+    }
+    const uint64_t count = load_integer(property.count_type, p, swap);
+    p += count_size;
+    if (count > size_t(end - p) / type_size(property.type)) {
+      return nullptr;
+    }
+    on_list(i, count, p);
+    p += count * type_size(property.type);
+  }
+  return p;
+}
+
+// scene attributes of the vertex element, the first name present is used
+const int PLY_ATTRIBUTE_COUNT = 8;
+const char* const PLY_ATTRIBUTE_NAMES[PLY_ATTRIBUTE_COUNT][3] = {
+    {"x", "x", "x"},
+    {"y", "y", "y"},
+    {"z", "z", "z"},
+    {"nx", "nx", "nx"},
+    {"ny", "ny", "ny"},
+    {"nz", "nz", "nz"},
+    {"u", "s", "texture_u"},
+    {"v", "t", "texture_v"}};
+
+// where the scene attributes sit in a fixed size vertex record
+struct PlyVertexDecoder {
+  bool swap{false};
+  size_t stride{0};
+  size_t offsets[PLY_ATTRIBUTE_COUNT]{};
+  PlyType types[PLY_ATTRIBUTE_COUNT]{};  // none when missing
+  bool has_normals{false};
+  bool has_uvs{false};
+  // x y z are adjacent host order floats, copied in one go
+  bool packed_positions{false};
+
+  bool compile(const PlyElement& element, bool file_swap) {
+    swap = file_swap;
+    stride = element.fixed_size();
+    size_t offset = 0;
+    for (const auto& property : element.properties) {
+      for (int a = 0; a < PLY_ATTRIBUTE_COUNT; ++a) {
+        for (const char* name : PLY_ATTRIBUTE_NAMES[a]) {
+          if (property.name == name && types[a] == PLY_NONE) {
+            types[a] = property.type;
+            offsets[a] = offset;
+          }
+        }
+      }
+      offset += type_size(property.type);
+    }
+    has_normals = types[3] && types[4] && types[5];
+    has_uvs = types[6] && types[7];
+    packed_positions = !swap && types[0] == PLY_FLOAT32 &&
+                       types[1] == PLY_FLOAT32 && types[2] == PLY_FLOAT32 &&
+                       offsets[1] == offsets[0] + 4 &&
+                       offsets[2] == offsets[0] + 8;
+    return stride > 0 && types[0] && types[1] && types[2];
+  }
+
+  [[nodiscard]] float value(const uint8_t* record, int attribute) const {
+    return load_float(types[attribute], record + offsets[attribute], swap);
+  }
+
+  void decode(const uint8_t* data, size_t begin, size_t end,
+              Vec3f* positions, Vec3f* normals, Vec2f* uvs) const {
+    for (size_t i = begin; i < end; ++i) {
+      const uint8_t* record = data + i * stride;
+      if (packed_positions) {
+        memcpy(&positions[i], record + offsets[0], sizeof(Vec3f));
+      } else {
+        positions[i] =
+            Vec3f(value(record, 0), value(record, 1), value(record, 2));
+      }
+      if (normals) {
+        normals[i] =
+            Vec3f(value(record, 3), value(record, 4), value(record, 5));
+      }
+      if (uvs) {
+        uvs[i] = Vec2f(value(record, 6), value(record, 7));
+      }
+    }
+  }
+};
+
+// where the vertex index list sits in a face record
+struct PlyFaceDecoder {
+  bool swap{false};
+  size_t list{0};  // property index
+  PlyType count_type{PLY_NONE};
+  PlyType index_type{PLY_NONE};
+  // the list is the only one, between prefix and suffix bytes of scalars
+  bool single_list{false};
+  size_t prefix{0};
+  size_t suffix{0};
+
+  bool compile(const PlyElement& element, bool file_swap) {
+    swap = file_swap;
+    size_t lists = 0;
+    bool found = false;
+    for (size_t i = 0; i < element.properties.size(); ++i) {
+      const PlyProperty& property = element.properties[i];
+      if (property.count_type != PLY_NONE) {
+        ++lists;
+      }
+      if (!found && property.count_type != PLY_NONE &&
+          (property.name == "vertex_indices" ||
+           property.name == "vertex_index")) {
+        found = true;
+        list = i;
+        count_type = property.count_type;
+        index_type = property.type;
+      } else if (property.count_type == PLY_NONE) {
+        (found ? suffix : prefix) += type_size(property.type);
+      }
+    }
+    single_list = lists == 1;
+    return found && is_integer(index_type);
+  }
+
+  // record size when every face is a triangle
+  [[nodiscard]] size_t triangle_stride() const {
+    return prefix + type_size(count_type) + 3 * type_size(index_type) +
+           suffix;
+  }
+};
+
+// faces of fixed triangle records, false in *all_triangles when a record
+// holds another polygon, false in *in_range on a bad index
+void decode_triangles(const PlyFaceDecoder& decoder, const uint8_t* data,
+                      size_t face_count, uint64_t vertex_count,
+                      uint32_t* indices, bool* all_triangles,
+                      bool* in_range) {
+  const size_t stride = decoder.triangle_stride();
+  const uint32_t index_size = type_size(decoder.index_type);
+  const size_t first_index = decoder.prefix + type_size(decoder.count_type);
+  std::atomic<bool> triangles(true);
+  std::atomic<bool> valid(true);
+  parallel_for(0, face_count, PLY_MIN_CHUNK, [&](size_t b, size_t e,
+                                                 uint32_t) {
+    bool chunk_triangles = true;
+    bool chunk_valid = true;
+    for (size_t i = b; i < e && chunk_triangles; ++i) {
+      const uint8_t* record = data + i * stride;
+      chunk_triangles =
+          load_integer(decoder.count_type, record + decoder.prefix,
+                       decoder.swap) == 3;
+      for (int c = 0; c < 3; ++c) {
+        const uint64_t index =
+            load_integer(decoder.index_type, record + first_index +
+                                                 c * index_size,
+                         decoder.swap);
+        chunk_valid &= index < vertex_count;
+        indices[i * 3 + c] = uint32_t(index);
+      }
+    }
+    if (!chunk_triangles) {
+      triangles = false;
+    }
+    if (!chunk_valid) {
+      valid = false;
+    }
+  });
+  *all_triangles = triangles;
+  *in_range = valid;
+}
+
+// faces of any size, fanned into triangles. counts the triangles when
+// indices is null. returns the end of the element or nullptr on a cut off
+// record or a bad index.
+const uint8_t* scan_faces(const PlyFaceDecoder& decoder,
+                          const PlyElement& element, const uint8_t* p,
+                          const uint8_t* end, uint64_t vertex_count,
+                          uint32_t* indices, size_t* triangle_count) {
+  const uint32_t index_size = type_size(decoder.index_type);
+  size_t triangles = 0;
+  bool valid = true;
+  for (uint64_t f = 0; f < element.count && p; ++f) {
+    p = walk_record(element, p, end, decoder.swap,
+                    [&](size_t property, uint64_t count, const uint8_t* items) {
+                      if (property != decoder.list || count < 3) {
+                        return;
+                      }
+                      if (!indices) {
+                        triangles += count - 2;
+                        return;
+                      }
+                      auto index = [&](uint64_t c) {
+                        const uint64_t value =
+                            load_integer(decoder.index_type,
+                                         items + c * index_size, decoder.swap);
+                        valid &= value < vertex_count;
+                        return uint32_t(value);
+                      };
+                      const uint32_t first = index(0);
+                      uint32_t previous = index(1);
+                      for (uint64_t c = 2; c < count; ++c) {
+                        const uint32_t current = index(c);
+                        uint32_t* out = indices + triangles * 3;
+                        out[0] = first;
+                        out[1] = previous;
+                        out[2] = current;
+                        previous = current;
+                        ++triangles;
+                      }
+                    });
+  }
+  *triangle_count = triangles;
+  return valid ? p : nullptr;
+}
+
+// steps over an element that is not used
+const uint8_t* skip_element(const PlyElement& element, const uint8_t* p,
+                            const uint8_t* end, bool swap) {
+  const size_t size = element.fixed_size();
+  if (size > 0) {
+    return element.count <= size_t(end - p) / size ? p + element.count * size
+                                                   : nullptr;
+  }
+  for (uint64_t i = 0; i < element.count && p; ++i) {
+    p = walk_record(element, p, end, swap,
+                    [](size_t, uint64_t, const uint8_t*) {});
+  }
+  return p;
+}
+
+}  // namespace
+
+bool load_ply(const char* path, Scene* scene) {
+  auto start = std::chrono::steady_clock::now();
+  MappedFile file;
+  if (!file.open(path)) {
+    printf("ply: can't open %s\n", path);
+    return false;
+  }
+
+  std::string format;
+  std::vector<PlyElement> elements;
+  const size_t header_size =
+      parse_header(reinterpret_cast<const char*>(file.data()), file.size(),
+                   &format, &elements);
+  if (header_size == 0) {
+    printf("ply: %s has a malformed header\n", path);
+    return false;
+  }
+  // hosts are little endian
+  if (format != "binary_little_endian" && format != "binary_big_endian") {
+    printf("ply: %s is %s, only binary ply is supported\n", path,
+           format.c_str());
+    return false;
+  }
+  const bool swap = format == "binary_big_endian";
+
+  const PlyElement* vertex_element = nullptr;
+  const PlyElement* face_element = nullptr;
+  for (const auto& element : elements) {
+    if (element.name == "vertex" && !vertex_element) {
+      vertex_element = &element;
+    } else if (element.name == "face" && !face_element) {
+      face_element = &element;
+    }
+  }
+  PlyVertexDecoder vertex_decoder;
+  PlyFaceDecoder face_decoder;
+  if (!vertex_element || !vertex_decoder.compile(*vertex_element, swap) ||
+      (face_element && !face_decoder.compile(*face_element, swap))) {
+    printf("ply: %s has no fixed size vertices with x y z or no face "
+           "vertex indices\n",
+           path);
+    return false;
+  }
+  const uint64_t vertex_count = vertex_element->count;
+  if (vertex_count > UINT32_MAX) {
+    printf("ply: %s has more than 2^32 vertices\n", path);
+    return false;
+  }
+
+  std::vector<Vec3f> positions;
+  std::vector<Vec3f> normals;
+  std::vector<Vec2f> uvs;
+  std::vector<uint32_t> indices;
+  const uint8_t* p = file.data() + header_size;
+  const uint8_t* end = file.data() + file.size();
+  bool in_range = true;
+  for (const auto& element : elements) {
+    if (&element == vertex_element) {
+      const size_t stride = vertex_decoder.stride;
+      if (vertex_count > size_t(end - p) / stride) {
+        p = nullptr;
+        break;
+      }
+      positions.resize(vertex_count);
+      normals.resize(vertex_decoder.has_normals ? vertex_count : 0);
+      uvs.resize(vertex_decoder.has_uvs ? vertex_count : 0);
+      parallel_for(0, vertex_count, PLY_MIN_CHUNK,
+                   [&](size_t b, size_t e, uint32_t) {
+                     vertex_decoder.decode(
+                         p, b, e, positions.data(),
+                         normals.empty() ? nullptr : normals.data(),
+                         uvs.empty() ? nullptr : uvs.data());
+                   });
+      p += vertex_count * stride;
+    } else if (&element == face_element) {
+      // scans are triangle meshes, so first try the fixed size records
+      const size_t stride = face_decoder.triangle_stride();
+      bool all_triangles = false;
+      if (face_decoder.single_list &&
+          element.count <= size_t(end - p) / stride &&
+          element.count * 3 <= UINT32_MAX) {
+        indices.resize(element.count * 3);
+        decode_triangles(face_decoder, p, element.count, vertex_count,
+                         indices.data(), &all_triangles, &in_range);
+      }
+      if (all_triangles) {
+        p += element.count * stride;
+      } else {
+        size_t triangle_count = 0;
+        if (!scan_faces(face_decoder, element, p, end, vertex_count, nullptr,
+                        &triangle_count) ||
+            triangle_count * 3 > UINT32_MAX) {
+          p = nullptr;
+          break;
+        }
+        std::vector<uint32_t>(triangle_count * 3).swap(indices);
+        p = scan_faces(face_decoder, element, p, end, vertex_count,
+                       indices.data(), &triangle_count);
+        in_range = p != nullptr;
+      }
+    } else {
+      p = skip_element(element, p, end, swap);
+    }
+    if (!p || !in_range) {
+      break;
+    }
+  }
+  if (!p || !in_range) {
+    printf("ply: %s is truncated, has more than 2^32 indices or an index "
+           "out of range\n",
+           path);
+    return false;
+  }
+
+  const size_t triangle_count = indices.size() / 3;
+  *scene = Scene();
+  scene->assign_geometry(MappedArray<Vec3f>(std::move(positions)),
+                         MappedArray<Vec3f>(std::move(normals)),
+                         MappedArray<Vec2f>(std::move(uvs)),
+                         MappedArray<uint32_t>(std::move(indices)));
+
+  const double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+  const double mb = double(file.size()) / (1024.0 * 1024.0);
+  printf("ply: %s, %.1f MiB, %zu vertices, %zu triangles, %.2f ms "
+         "(%.0f MiB/s)\n",
+         path, mb, size_t(vertex_count), triangle_count, ms,
+         mb * 1000.0 / std::max(ms, 1e-3));
+  return true;
+}
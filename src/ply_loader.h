@@ -0,0 +1,16 @@
+#ifndef PLY_LOADER_H
+#define PLY_LOADER_H
+
+#include "scene.h"
+
+// replaces scene with the triangles of a binary little or big endian ply
+// file. the header is compiled once into a decoder per element: fixed size
+// records are decoded in parallel chunks of the mapped file straight into
+// arrays allocated at their final size, faces that are all triangles take
+// the same path, other polygon lists are fanned in a counting pass and a
+// filling pass. x y z, nx ny nz and u v (or s t) are read from the vertex
+// element in any numeric type, other properties and elements are skipped.
+// returns false on an ascii or malformed file or an index out of range.
+bool load_ply(const char* path, Scene* scene);
+
+#endif  // PLY_LOADER_H
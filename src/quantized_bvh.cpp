@@ -0,0 +1,129 @@
+#include "quantized_bvh.h"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+namespace {
+
+// smallest exponent whose 255 steps reach from lo to hi after float rounding
+int grid_exponent(float lo, float hi) {
+  int exponent = -126;
+  if (hi > lo) {
+    std::frexp((hi - lo) / 255.0f, &exponent);
+    exponent = std::max(exponent, -126);
+  }
+  while (exponent < 127 && lo + 255.0f * std::ldexp(1.0f, exponent) < hi) {
+    ++exponent;
+  }
+  return exponent;
+}
+
+template <uint32_t N>
+void quantize_bounds(const WideBvhNode<N>& src, const bool* occupied,
+                     QuantizedBvhNode<N>& dst) {
+  for (int axis = 0; axis < 3; ++axis) {
+    float lo = std::numeric_limits<float>::max();
+    float hi = -std::numeric_limits<float>::max();
+    for (uint32_t i = 0; i < N; ++i) {
+      if (occupied[i]) {
+        lo = std::min(lo, src.bounds_min[axis][i]);
+        hi = std::max(hi, src.bounds_max[axis][i]);
+      }
+    }
+
+    const int exponent = grid_exponent(lo, hi);
+    const float scale = std::ldexp(1.0f, exponent);
+    const float inv_scale = std::ldexp(1.0f, -exponent);
+    dst.origin[axis] = lo;
+    dst.exponent[axis] = static_cast<int8_t>(exponent);
+
+    for (uint32_t i = 0; i < N; ++i) {
+      if (!occupied[i]) {
+        dst.lo[axis][i] = 0xff;
+        dst.hi[axis][i] = 0;
+        continue;
+      }
+      // round outward, then fix up the few cases float rounding of the
+      // decode would still cut into the box
+      const float child_lo = src.bounds_min[axis][i];
+      const float child_hi = src.bounds_max[axis][i];
+      auto q_lo = static_cast<int>(std::floor((child_lo - lo) * inv_scale));
+      auto q_hi = static_cast<int>(std::ceil((child_hi - lo) * inv_scale));
+      q_lo = std::min(std::max(q_lo, 0), 255);
+      q_hi = std::min(std::max(q_hi, 0), 255);
+      while (q_lo > 0 && lo + float(q_lo) * scale > child_lo) {
+        --q_lo;
+      }
+      while (q_hi < 255 && lo + float(q_hi) * scale < child_hi) {
+        ++q_hi;
+      }
+      dst.lo[axis][i] = static_cast<uint8_t>(q_lo);
+      dst.hi[axis][i] = static_cast<uint8_t>(q_hi);
+    }
+  }
+}
+
+}  // namespace
+
+template <uint32_t N>
+QuantizedBvh<N> QuantizedBvh<N>::quantize(const WideBvh<N>& wide) {
+  QuantizedBvh quantized;
+  const auto& wide_nodes = wide.nodes();
+  const auto& wide_prims = wide.prim_indices();
+  if (wide_nodes.empty()) {
+    return quantized;
+  }
+  quantized.nodes_.resize(wide_nodes.size());
+  quantized.prim_indices_.reserve(wide_prims.size());
+
+  // breadth first, so the interior children of a node get consecutive
+  // indices. pairs of (wide node, quantized node).
+  std::vector<std::pair<uint32_t, uint32_t>> queue;
+  queue.reserve(wide_nodes.size());
+  queue.emplace_back(0, 0);
+  auto next_node = static_cast<uint32_t>(1);
+  for (size_t head = 0; head < queue.size(); ++head) {
+    const WideBvhNode<N>& src = wide_nodes[queue[head].first];
+    QuantizedBvhNode<N>& dst = quantized.nodes_[queue[head].second];
+
+    // empty slots have inverted bounds
+    bool occupied[N];
+    for (uint32_t i = 0; i < N; ++i) {
+      occupied[i] = src.bounds_min[0][i] <= src.bounds_max[0][i];
+    }
+    quantize_bounds(src, occupied, dst);
+    dst.pad = 0;
+    dst.child_base = next_node;
+    dst.prim_base = static_cast<uint32_t>(quantized.prim_indices_.size());
+
+    for (uint32_t i = 0; i < N; ++i) {
+      if (!occupied[i]) {
+        dst.meta[i] = QUANTIZED_BVH_EMPTY;
+      } else if (src.prim_count[i] == 0) {
+        dst.meta[i] = QUANTIZED_BVH_INTERIOR;
+        queue.emplace_back(src.child[i], next_node++);
+      } else {
+        assert(src.prim_count[i] <= QUANTIZED_BVH_MAX_LEAF_SIZE);
+        dst.meta[i] = static_cast<uint8_t>(src.prim_count[i]);
+        quantized.prim_indices_.insert(
+            quantized.prim_indices_.end(), wide_prims.begin() + src.child[i],
+            wide_prims.begin() + src.child[i] + src.prim_count[i]);
+      }
+    }
+  }
+  return quantized;
+}
+
+template <uint32_t N>
+QuantizedBvh<N> QuantizedBvh<N>::from_arrays(
+    std::vector<QuantizedBvhNode<N>> nodes,
+    std::vector<uint32_t> prim_indices) {
+  QuantizedBvh quantized;
+  quantized.nodes_ = std::move(nodes);
+  quantized.prim_indices_ = std::move(prim_indices);
+  return quantized;
+}
+
+template class QuantizedBvh<4>;
+template class QuantizedBvh<8>;
@@ -0,0 +1,165 @@
+#ifndef QUANTIZED_BVH_H
+#define QUANTIZED_BVH_H
+
+#include "wide_bvh.h"
+
+// largest leaf a quantized node can reference, meta stores the prim count
+const uint32_t QUANTIZED_BVH_MAX_LEAF_SIZE = 254;
+
+// N-wide node with child bounds quantized to 8 bits on a per node grid,
+// matches BvhQuantizedNode in rt.frag.glsl (std430). a child box decodes to
+// origin + q * 2^exponent and always contains the original box. interior
+// children are stored consecutively from child_base and the prims of leaf
+// children consecutively from prim_base, both in slot order.
+template <uint32_t N>
+struct alignas(16) QuantizedBvhNode {
+  float origin[3];
+  int8_t exponent[3];
+  uint8_t pad;
+  uint32_t child_base;
+  uint32_t prim_base;
+  uint8_t meta[N];    // 0 empty, 0xff interior, otherwise leaf prim count
+  uint8_t lo[3][N];   // [axis][child]
+  uint8_t hi[3][N];
+};
+static_assert(sizeof(QuantizedBvhNode<4>) == 64,
+              "quantized BVH4 node must be 64 bytes");
+static_assert(sizeof(QuantizedBvhNode<8>) == 80,
+              "quantized BVH8 node must be 80 bytes");
+
+const uint8_t QUANTIZED_BVH_EMPTY = 0;
+const uint8_t QUANTIZED_BVH_INTERIOR = 0xff;
+
+// WideBvh<N> with quantized child bounds and implicit child indices. trades
+// a few alu ops per child for a 2x (N = 4) or 3.2x (N = 8) smaller node array
+template <uint32_t N>
+class QuantizedBvh {
+ public:
+  // the leaves of wide must hold at most QUANTIZED_BVH_MAX_LEAF_SIZE prims,
+  // prim_indices are reordered so each node's leaves are contiguous
+  static QuantizedBvh quantize(const WideBvh<N>& wide);
+  // arrays of a previous quantize, e.g. from the bvh cache
+  static QuantizedBvh from_arrays(std::vector<QuantizedBvhNode<N>> nodes,
+                                  std::vector<uint32_t> prim_indices);
+
+  [[nodiscard]] const std::vector<QuantizedBvhNode<N>>& nodes() const {
+    return nodes_;
+  }
+  [[nodiscard]] const std::vector<uint32_t>& prim_indices() const {
+    return prim_indices_;
+  }
+
+  // same contract as Bvh::traverse
+  template <typename IntersectPrim>
+  void traverse(Ray ray, IntersectPrim&& intersect_prim,
+                TraversalCounters* counters = nullptr) const;
+
+ private:
+  std::vector<QuantizedBvhNode<N>> nodes_;
+  std::vector<uint32_t> prim_indices_;
+};
+
+// child bounds of node as floats. the product is exact since the scale is a
+// power of two, so the shader decodes to the same floats with or without fma
+template <uint32_t N>
+inline void decode_children(const QuantizedBvhNode<N>& node,
+                            WideBvhNode<N>& out) {
+  for (int axis = 0; axis < 3; ++axis) {
+    const float scale = std::ldexp(1.0f, node.exponent[axis]);
+    const float origin = node.origin[axis];
+    for (uint32_t i = 0; i < N; ++i) {
+      out.bounds_min[axis][i] = origin + float(node.lo[axis][i]) * scale;
+      out.bounds_max[axis][i] = origin + float(node.hi[axis][i]) * scale;
+    }
+  }
+}
+
+template <uint32_t N>
+template <typename IntersectPrim>
+void QuantizedBvh<N>::traverse(Ray ray, IntersectPrim&& intersect_prim,
+                               TraversalCounters* counters) const {
+  if (nodes_.empty()) {
+    return;
+  }
+
+  struct Entry {
+    uint32_t child;
+    uint32_t prim_count;
+    float t;
+  };
+
+  Vec3f inv_dir(1.0f / ray.direction.x, 1.0f / ray.direction.y,
+                1.0f / ray.direction.z);
+  int near_planes[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    near_planes[axis] = std::signbit(inv_dir[axis]) ? 1 : 0;
+  }
+
+  Entry stack[BVH_MAX_DEPTH * (N - 1) + 1];
+  uint32_t stack_size = 0;
+  stack[stack_size++] = Entry{0, 0, 0.0f};
+  alignas(32) float t_near[N];
+  WideBvhNode<N> decoded;
+
+  while (stack_size > 0) {
+    const Entry entry = stack[--stack_size];
+    if (entry.t > ray.t_max) {
+      continue;
+    }
+    if (counters) {
+      counters->nodes += entry.prim_count > 0 ? 0 : 1;
+      counters->prims += entry.prim_count;
+    }
+    if (entry.prim_count > 0) {
+      for (uint32_t i = 0; i < entry.prim_count; ++i) {
+        ray.t_max = intersect_prim(prim_indices_[entry.child + i], ray);
+      }
+      continue;
+    }
+
+    const QuantizedBvhNode<N>& node = nodes_[entry.child];
+    decode_children(node, decoded);
+    uint32_t mask = intersect_children(decoded, ray.origin, inv_dir,
+                                       near_planes, ray.t_max, t_near);
+
+    // child indices follow from the slots before the hit one, empty slots
+    // are masked out since their boxes are not meaningful
+    uint32_t occupied = 0;
+    uint32_t child_index[N];
+    uint32_t next_child = node.child_base;
+    uint32_t next_prim = node.prim_base;
+    for (uint32_t i = 0; i < N; ++i) {
+      const uint8_t meta = node.meta[i];
+      if (meta == QUANTIZED_BVH_INTERIOR) {
+        child_index[i] = next_child++;
+      } else {
+        child_index[i] = next_prim;
+        next_prim += meta;
+      }
+      occupied |= (meta != QUANTIZED_BVH_EMPTY ? 1u : 0u) << i;
+    }
+    mask &= occupied;
+
+    // push far to near so the closest child is popped first
+    const uint32_t first = stack_size;
+    while (mask) {
+      uint32_t i = 0;
+      while (!(mask & (1u << i))) {
+        ++i;
+      }
+      mask &= mask - 1;
+
+      const uint8_t meta = node.meta[i];
+      Entry e{child_index[i], meta == QUANTIZED_BVH_INTERIOR ? 0u : meta,
+              t_near[i]};
+      uint32_t j = stack_size++;
+      while (j > first && stack[j - 1].t < e.t) {
+        stack[j] = stack[j - 1];
+        --j;
+      }
+      stack[j] = e;
+    }
+  }
+}
+
+#endif  // QUANTIZED_BVH_H
@@ -8,8 +8,17 @@
 
 #include "bvh.h"
 
+Renderer::Renderer() = default;
+
+Renderer::~Renderer() = default;
+
 void Renderer::reset_trace_buffer() {
-  // TODO: reset epoch, clear color image
+  // epoch 0 overwrites the color image, so it needs no clear
+  trace_epoch_ = 0;
 }
 
-void Renderer::dispatch_trace_unit(BvhScene* bvh_scene, Camera* camera) {}
+void Renderer::dispatch_trace_unit(BvhScene* bvh_scene, Camera* camera) {
+  bvh_scene_ = bvh_scene;
+  camera_ = camera;
+  ++trace_epoch_;
+}
@@ -14,12 +14,18 @@ class Renderer {
   explicit Renderer();
   ~Renderer();
 
+  // the next trace unit starts a new accumulation instead of blending into
+  // the frames traced so far
   void reset_trace_buffer();
   virtual void dispatch_trace_unit(BvhScene* bvh_scene, Camera* camera);
 
+  // trace units accumulated since the last reset
+  [[nodiscard]] uint32_t trace_epoch() const { return trace_epoch_; }
+
  private:
   BvhScene* bvh_scene_{nullptr};
   Camera* camera_{nullptr};
+  uint32_t trace_epoch_{0};
 };
 
 class ClearScreen : public Renderer {
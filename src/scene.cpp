@@ -3,3 +3,438 @@
 //
 
 #include "scene.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+// vertices hashed or remapped per parallel chunk
+const size_t WELD_MIN_CHUNK = 1 << 16;
+
+// the hash range is split into 2^WELD_SHARD_BITS shards
+const uint32_t WELD_SHARD_BITS = 8;
+const uint32_t WELD_NO_VERTEX = ~0u;
+
+// vertices checked or snapped per parallel chunk by encode_compact_vertices
+const size_t COMPACT_MIN_CHUNK = 1 << 16;
+
+// the attributes of a vertex as compared by weld_vertices
+struct WeldKey {
+  float values[8];
+
+  bool operator==(const WeldKey& other) const {
+    return memcmp(values, other.values, sizeof(values)) == 0;
+  }
+};
+
+// first item of chunk i of count chunks over n items
+size_t chunk_begin(size_t i, size_t count, size_t n) { return n * i / count; }
+
+}  // namespace
+
+uint32_t Scene::add_vertex(const Vec3f& position) {
+  compact_vertices_ = CompactVertices();
+  positions_.edit().push_back(position);
+  if (!normals_.empty()) {
+    normals_.edit().emplace_back();
+  }
+  if (!uvs_.empty()) {
+    uvs_.edit().emplace_back();
+  }
+  return static_cast<uint32_t>(positions_.size() - 1);
+}
+
+void Scene::add_triangle(uint32_t v0, uint32_t v1, uint32_t v2) {
+  auto& indices = indices_.edit();
+  indices.push_back(v0);
+  indices.push_back(v1);
+  indices.push_back(v2);
+  if (!material_ids_.empty()) {
+    material_ids_.edit().push_back(NO_MATERIAL);
+  }
+}
+
+uint32_t Scene::add_triangles(std::vector<Vec3f> positions,
+                              std::vector<Vec3f> normals,
+                              std::vector<Vec2f> uvs,
+                              const std::vector<uint32_t>& indices) {
+  const auto first_triangle = static_cast<uint32_t>(triangle_count());
+  const auto base = static_cast<uint32_t>(positions_.size());
+  const size_t vertex_count = positions.size();
+  compact_vertices_ = CompactVertices();
+
+  // an attribute only one side has is zero filled on the other
+  if (!normals.empty() || !normals_.empty()) {
+    normals_.edit().resize(base);
+    normals.resize(vertex_count);
+  }
+  if (!uvs.empty() || !uvs_.empty()) {
+    uvs_.edit().resize(base);
+    uvs.resize(vertex_count);
+  }
+
+  if (positions_.empty()) {
+    positions_ = MappedArray<Vec3f>(std::move(positions));
+    normals_ = MappedArray<Vec3f>(std::move(normals));
+    uvs_ = MappedArray<Vec2f>(std::move(uvs));
+  } else {
+    auto append = [](auto& to, const auto& from) {
+      to.edit().insert(to.edit().end(), from.begin(), from.end());
+    };
+    append(positions_, positions);
+    append(normals_, normals);
+    append(uvs_, uvs);
+  }
+
+  auto& all_indices = indices_.edit();
+  const size_t first_index = all_indices.size();
+  all_indices.resize(first_index + indices.size());
+  for (size_t i = 0; i < indices.size(); ++i) {
+    all_indices[first_index + i] = base + indices[i];
+  }
+  if (!material_ids_.empty()) {
+    material_ids_.edit().resize(triangle_count(), NO_MATERIAL);
+  }
+  return first_triangle;
+}
+
+void Scene::assign_geometry(MappedArray<Vec3f> positions,
+                            MappedArray<Vec3f> normals,
+                            MappedArray<Vec2f> uvs,
+                            MappedArray<uint32_t> indices) {
+  positions_ = std::move(positions);
+  normals_ = std::move(normals);
+  uvs_ = std::move(uvs);
+  indices_ = std::move(indices);
+  material_ids_ = MappedArray<uint32_t>();
+  compact_vertices_ = CompactVertices();
+}
+
+uint32_t Scene::add_material(const Material& material) {
+  materials_.push_back(material);
+  return static_cast<uint32_t>(materials_.size() - 1);
+}
+
+void Scene::set_material(uint32_t first_triangle, uint32_t count,
+                         uint32_t material) {
+  auto& ids = material_ids_.edit();
+  ids.resize(triangle_count(), NO_MATERIAL);
+  std::fill(ids.begin() + first_triangle,
+            ids.begin() + first_triangle + count, material);
+}
+
+void Scene::assign_material_ids(MappedArray<uint32_t> material_ids) {
+  material_ids_ = std::move(material_ids);
+}
+
+void Scene::set_bvh_cache(MappedArray<uint8_t> bvh_cache) {
+  bvh_cache_ = std::move(bvh_cache);
+}
+
+void Scene::set_pager(std::shared_ptr<PagedFile> pager) {
+  pager_ = std::move(pager);
+}
+
+void Scene::page_in(size_t first_triangle, size_t count) const {
+  if (!pager_ || first_triangle >= triangle_count()) {
+    return;
+  }
+  count = std::min(count, triangle_count() - first_triangle);
+  if (count == 0) {
+    return;
+  }
+  const uint32_t* indices = indices_.data() + first_triangle * 3;
+  pager_->touch(indices, count * 3 * sizeof(uint32_t));
+  const auto bounds = std::minmax_element(indices, indices + count * 3);
+  pager_->touch(positions_.data() + *bounds.first,
+                (size_t(*bounds.second) - *bounds.first + 1) * sizeof(Vec3f));
+}
+
+uint32_t Scene::add_sphere(const Vec3f& center, float radius,
+                          uint32_t material) {
+  spheres_.edit().push_back(Sphere{center, radius, material});
+  return static_cast<uint32_t>(spheres_.size() - 1);
+}
+
+uint32_t Scene::add_box(const Aabb& bounds, uint32_t material) {
+  boxes_.edit().push_back(Box{bounds.min, bounds.max, material});
+  return static_cast<uint32_t>(boxes_.size() - 1);
+}
+
+uint32_t Scene::add_quad(const Vec3f& corner, const Vec3f& edge_u,
+                         const Vec3f& edge_v, uint32_t material) {
+  quads_.edit().push_back(Quad{corner, edge_u, edge_v, material});
+  return static_cast<uint32_t>(quads_.size() - 1);
+}
+
+void Scene::assign_primitives(MappedArray<Sphere> spheres,
+                              MappedArray<Box> boxes,
+                              MappedArray<Quad> quads) {
+  spheres_ = std::move(spheres);
+  boxes_ = std::move(boxes);
+  quads_ = std::move(quads);
+}
+
+uint32_t Scene::add_mesh(uint32_t first_triangle, uint32_t triangle_count) {
+  meshes_.push_back(Mesh{first_triangle, triangle_count});
+  return static_cast<uint32_t>(meshes_.size() - 1);
+}
+
+uint32_t Scene::add_instance(uint32_t mesh, const Transform& transform) {
+  instances_.push_back(Instance{mesh, transform});
+  return static_cast<uint32_t>(instances_.size() - 1);
+}
+
+void Scene::set_instance_transform(uint32_t instance,
+                                   const Transform& transform) {
+  instances_[instance].transform = transform;
+}
+
+size_t Scene::weld_vertices() {
+  const size_t vertex_count = positions_.size();
+  if (vertex_count < 2) {
+    return 0;
+  }
+  auto weld_key = [&](size_t v) {
+    WeldKey key = {};
+    const Vec3f& p = positions_[v];
+    key.values[0] = p.x;
+    key.values[1] = p.y;
+    key.values[2] = p.z;
+    if (!normals_.empty()) {
+      key.values[3] = normals_[v].x;
+      key.values[4] = normals_[v].y;
+      key.values[5] = normals_[v].z;
+    }
+    if (!uvs_.empty()) {
+      key.values[6] = uvs_[v].x;
+      key.values[7] = uvs_[v].y;
+    }
+    for (float& value : key.values) {
+      value = value == 0.0f ? 0.0f : value;
+    }
+    return key;
+  };
+
+  // chunks of vertices, each counted and scattered by one thread
+  const size_t chunk_count = std::max<size_t>(
+      1, std::min<size_t>(worker_count(), vertex_count / WELD_MIN_CHUNK));
+  const size_t shard_count = size_t(1) << WELD_SHARD_BITS;
+  std::vector<uint64_t> hashes(vertex_count);
+  std::vector<size_t> offsets(shard_count * chunk_count + 1, 0);
+  auto shard_of = [&](size_t v) {
+    return size_t(hashes[v] >> (64 - WELD_SHARD_BITS));
+  };
+  parallel_for(0, chunk_count, 1, [&](size_t b, size_t e, uint32_t) {
+    for (size_t c = b; c < e; ++c) {
+      const size_t end = chunk_begin(c + 1, chunk_count, vertex_count);
+      for (size_t v = chunk_begin(c, chunk_count, vertex_count); v < end;
+           ++v) {
+        const WeldKey key = weld_key(v);
+        hashes[v] = hash_bytes(&key, sizeof(key));
+        ++offsets[shard_of(v) * chunk_count + c + 1];
+      }
+    }
+  });
+
+  // vertices grouped by shard, in their original order within a shard
+  for (size_t i = 1; i < offsets.size(); ++i) {
+    offsets[i] += offsets[i - 1];
+  }
+  std::vector<uint32_t> sorted(vertex_count);
+  parallel_for(0, chunk_count, 1, [&](size_t b, size_t e, uint32_t) {
+    for (size_t c = b; c < e; ++c) {
+      const size_t end = chunk_begin(c + 1, chunk_count, vertex_count);
+      for (size_t v = chunk_begin(c, chunk_count, vertex_count); v < end;
+           ++v) {
+        sorted[offsets[shard_of(v) * chunk_count + c]++] = uint32_t(v);
+      }
+    }
+  });
+
+  // the scatter moved every offset to the end of its bucket. every shard
+  // owns its vertices, so the remap is written without locks.
+  std::vector<uint32_t> remap(vertex_count);
+  parallel_for(0, shard_count, 1, [&](size_t b, size_t e, uint32_t) {
+    std::vector<uint32_t> table;
+    for (size_t shard = b; shard < e; ++shard) {
+      const size_t first = shard == 0 ? 0 : offsets[shard * chunk_count - 1];
+      const size_t last = offsets[(shard + 1) * chunk_count - 1];
+      size_t capacity = 16;
+      while (capacity < (last - first) * 2) {
+        capacity *= 2;
+      }
+      table.assign(capacity, WELD_NO_VERTEX);
+      for (size_t i = first; i < last; ++i) {
+        const uint32_t v = sorted[i];
+        // the shard took the top bits, the slot takes the low ones. both
+        // depend on every key byte since hash_bytes mixes each word.
+        size_t slot = size_t(hashes[v]) & (capacity - 1);
+        while (table[slot] != WELD_NO_VERTEX &&
+               (hashes[table[slot]] != hashes[v] ||
+                !(weld_key(table[slot]) == weld_key(v)))) {
+          slot = (slot + 1) & (capacity - 1);
+        }
+        if (table[slot] == WELD_NO_VERTEX) {
+          table[slot] = v;
+        }
+        remap[v] = table[slot];
+      }
+    }
+  });
+
+  // survivors keep their order
+  std::vector<size_t> kept(chunk_count + 1, 0);
+  parallel_for(0, chunk_count, 1, [&](size_t b, size_t e, uint32_t) {
+    for (size_t c = b; c < e; ++c) {
+      const size_t end = chunk_begin(c + 1, chunk_count, vertex_count);
+      for (size_t v = chunk_begin(c, chunk_count, vertex_count); v < end;
+           ++v) {
+        kept[c + 1] += remap[v] == v ? 1 : 0;
+      }
+    }
+  });
+  for (size_t c = 0; c < chunk_count; ++c) {
+    kept[c + 1] += kept[c];
+  }
+  const size_t welded_count = kept[chunk_count];
+  if (welded_count == vertex_count) {
+    return 0;
+  }
+
+  std::vector<Vec3f> positions(welded_count);
+  std::vector<Vec3f> normals(normals_.empty() ? 0 : welded_count);
+  std::vector<Vec2f> uvs(uvs_.empty() ? 0 : welded_count);
+  std::vector<uint32_t> new_index(vertex_count);
+  parallel_for(0, chunk_count, 1, [&](size_t b, size_t e, uint32_t) {
+    for (size_t c = b; c < e; ++c) {
+      size_t next = kept[c];
+      const size_t end = chunk_begin(c + 1, chunk_count, vertex_count);
+      for (size_t v = chunk_begin(c, chunk_count, vertex_count); v < end;
+           ++v) {
+        if (remap[v] != v) {
+          continue;
+        }
+        positions[next] = positions_[v];
+        if (!normals.empty()) {
+          normals[next] = normals_[v];
+        }
+        if (!uvs.empty()) {
+          uvs[next] = uvs_[v];
+        }
+        new_index[v] = uint32_t(next++);
+      }
+    }
+  });
+
+  // a merged vertex points at an earlier survivor
+  auto& indices = indices_.edit();
+  parallel_for(0, indices.size(), WELD_MIN_CHUNK,
+               [&](size_t b, size_t e, uint32_t) {
+                 for (size_t i = b; i < e; ++i) {
+                   indices[i] = new_index[remap[indices[i]]];
+                 }
+               });
+  positions_ = MappedArray<Vec3f>(std::move(positions));
+  normals_ = MappedArray<Vec3f>(std::move(normals));
+  uvs_ = MappedArray<Vec2f>(std::move(uvs));
+  compact_vertices_ = CompactVertices();
+  return vertex_count - welded_count;
+}
+
+bool Scene::update_positions(const std::vector<Vec3f>& positions) {
+  if (positions.size() != positions_.size()) {
+    return false;
+  }
+  positions_ = MappedArray<Vec3f>(positions);
+  if (!compact_vertices_.empty()) {
+    encode_compact_vertices();
+  }
+  return true;
+}
+
+void Scene::encode_compact_vertices() {
+  compact_vertices_.encode(positions_, normals_, uvs_);
+
+  // positions that are on the grid already, e.g. from a scene file written
+  // after an encoding, stay in place
+  const size_t vertex_count = positions_.size();
+  std::atomic<bool> on_grid(true);
+  parallel_for(0, vertex_count, COMPACT_MIN_CHUNK,
+               [&](size_t b, size_t e, uint32_t) {
+                 for (size_t i = b; i < e && on_grid; ++i) {
+                   const Vec3f p = compact_vertices_.position(i);
+                   if (memcmp(&p, &positions_[i], sizeof(p)) != 0) {
+                     on_grid = false;
+                   }
+                 }
+               });
+  if (on_grid) {
+    return;
+  }
+  std::vector<Vec3f> positions(vertex_count);
+  parallel_for(0, vertex_count, COMPACT_MIN_CHUNK,
+               [&](size_t b, size_t e, uint32_t) {
+                 for (size_t i = b; i < e; ++i) {
+                   positions[i] = compact_vertices_.position(i);
+                 }
+               });
+  positions_ = MappedArray<Vec3f>(std::move(positions));
+}
+
+Aabb Scene::triangle_bounds(size_t triangle) const {
+  Aabb bounds;
+  for (size_t i = 0; i < 3; ++i) {
+    bounds.grow(positions_[indices_[triangle * 3 + i]]);
+  }
+  return bounds;
+}
+
+PrimitiveKind Scene::primitive_kind(size_t prim, size_t* index) const {
+  *index = prim;
+  if (*index < triangle_count()) {
+    return PRIMITIVE_TRIANGLE;
+  }
+  *index -= triangle_count();
+  if (*index < spheres_.size()) {
+    return PRIMITIVE_SPHERE;
+  }
+  *index -= spheres_.size();
+  if (*index < boxes_.size()) {
+    return PRIMITIVE_BOX;
+  }
+  *index -= boxes_.size();
+  return PRIMITIVE_QUAD;
+}
+
+Aabb Scene::primitive_bounds(size_t prim) const {
+  size_t index = 0;
+  Aabb bounds;
+  switch (primitive_kind(prim, &index)) {
+    case PRIMITIVE_TRIANGLE:
+      return triangle_bounds(index);
+    case PRIMITIVE_SPHERE: {
+      const Sphere& s = spheres_[index];
+      const Vec3f r(s.radius, s.radius, s.radius);
+      bounds.grow(s.center - r);
+      bounds.grow(s.center + r);
+      break;
+    }
+    case PRIMITIVE_BOX:
+      bounds.grow(boxes_[index].min);
+      bounds.grow(boxes_[index].max);
+      break;
+    case PRIMITIVE_QUAD: {
+      const Quad& q = quads_[index];
+      bounds.grow(q.corner);
+      bounds.grow(q.corner + q.edge_u);
+      bounds.grow(q.corner + q.edge_v);
+      bounds.grow(q.corner + q.edge_u + q.edge_v);
+      break;
+    }
+  }
+  return bounds;
+}
@@ -5,8 +5,204 @@
 #ifndef SCENE_H
 #define SCENE_H
 
+#include "compact_vertices.h"
+#include "paged_file.h"
+#include "util.h"
+
+// a range of triangles that can be instanced
+struct Mesh {
+  uint32_t first_triangle{0};
+  uint32_t triangle_count{0};
+};
+
+struct Instance {
+  uint32_t mesh{0};
+  Transform transform;  // object to world
+};
+
+// surface parameters of a triangle, metallic roughness model
+struct Material {
+  float base_color[3]{0.8f, 0.8f, 0.8f};
+  float metallic{0.0f};
+  float emission[3]{0.0f, 0.0f, 0.0f};
+  float roughness{0.5f};
+};
+
+// material id of triangles without one
+const uint32_t NO_MATERIAL = ~0u;
+
+// analytic primitives, intersected exactly instead of tessellated. a bvh
+// over the whole scene numbers its primitives triangles first, then the
+// spheres, boxes and quads.
+struct Sphere {
+  Vec3f center;
+  float radius{0.0f};
+  uint32_t material{NO_MATERIAL};
+};
+
+// axis aligned
+struct Box {
+  Vec3f min;
+  Vec3f max;
+  uint32_t material{NO_MATERIAL};
+};
+
+// parallelogram corner + s * edge_u + t * edge_v, s and t in [0, 1]
+struct Quad {
+  Vec3f corner;
+  Vec3f edge_u;
+  Vec3f edge_v;
+  uint32_t material{NO_MATERIAL};
+};
+
+enum PrimitiveKind : uint32_t {
+  PRIMITIVE_TRIANGLE,
+  PRIMITIVE_SPHERE,
+  PRIMITIVE_BOX,
+  PRIMITIVE_QUAD,
+};
+
+// an indexed triangle list and analytic primitives. without instances every
+// triangle and primitive is placed in world space as it is, otherwise only
+// the instanced meshes are visible.
+// normals and uvs are either empty or hold one entry per vertex, material
+// ids are either empty or hold one entry per triangle. the arrays may live
+// in a mapped scene file and are copied out by the first edit. adding or
+// welding vertices drops the compact encoding of the vertices. a scene file
+// loaded with a memory budget is paged, passes that stream over the
+// triangles page_in() each batch before reading it.
 class Scene {
  public:
+  uint32_t add_vertex(const Vec3f& position);
+  void add_triangle(uint32_t v0, uint32_t v1, uint32_t v2);
+
+  // appends whole vertex arrays and triangles indexing them from 0, e.g. the
+  // output of a loader. normals and uvs may be empty, missing attributes are
+  // zero filled. returns the first new triangle.
+  uint32_t add_triangles(std::vector<Vec3f> positions,
+                         std::vector<Vec3f> normals, std::vector<Vec2f> uvs,
+                         const std::vector<uint32_t>& indices);
+
+  // replaces the vertices and triangles with arrays used in place, e.g. the
+  // sections of a mapped scene file. the material ids are reset.
+  void assign_geometry(MappedArray<Vec3f> positions, MappedArray<Vec3f> normals,
+                       MappedArray<Vec2f> uvs, MappedArray<uint32_t> indices);
+
+  uint32_t add_material(const Material& material);
+  // triangles [first_triangle, first_triangle + count) use material
+  void set_material(uint32_t first_triangle, uint32_t count,
+                    uint32_t material);
+  // one material per triangle, or empty
+  void assign_material_ids(MappedArray<uint32_t> material_ids);
+
+  // analytic primitives, return the index among their kind
+  uint32_t add_sphere(const Vec3f& center, float radius,
+                      uint32_t material = NO_MATERIAL);
+  uint32_t add_box(const Aabb& bounds, uint32_t material = NO_MATERIAL);
+  uint32_t add_quad(const Vec3f& corner, const Vec3f& edge_u,
+                    const Vec3f& edge_v, uint32_t material = NO_MATERIAL);
+  // replaces the analytic primitives, e.g. with the sections of a mapped
+  // scene file
+  void assign_primitives(MappedArray<Sphere> spheres, MappedArray<Box> boxes,
+                         MappedArray<Quad> quads);
+
+  uint32_t add_mesh(uint32_t first_triangle, uint32_t triangle_count);
+  uint32_t add_instance(uint32_t mesh, const Transform& transform);
+  // BvhScene::update_instances picks the change up
+  void set_instance_transform(uint32_t instance, const Transform& transform);
+
+  // merges vertices whose position, normal and uv are bitwise equal (-0 and
+  // +0 count as equal) and remaps the indices. vertices are hashed in
+  // parallel and each shard of the hash range is deduplicated on its own
+  // thread, the first vertex of a group survives, so the result does not
+  // depend on the thread count. the scene is left untouched when there is
+  // nothing to merge. returns the number of vertices removed.
+  size_t weld_vertices();
+
+  // moves existing vertices, the vertex count must not change. a compact
+  // encoding is redone. BvhScene::update picks the change up.
+  bool update_positions(const std::vector<Vec3f>& positions);
+
+  // encodes the vertices into compact_vertices() for the gpu and snaps the
+  // positions to the decoded values, so a bvh built afterwards bounds
+  // exactly the triangles the shaders decode. normals and uvs keep their
+  // full precision on the host.
+  void encode_compact_vertices();
+
+  // bvh cache bytes that travel with the scene, see BvhScene. set by scene
+  // files written with a bvh.
+  void set_bvh_cache(MappedArray<uint8_t> bvh_cache);
+
+  // the paged file the mapped arrays live in, see load_scene_file
+  void set_pager(std::shared_ptr<PagedFile> pager);
+  [[nodiscard]] PagedFile* pager() const { return pager_.get(); }
+  // touches the indices of triangles [first_triangle, first_triangle +
+  // count) and the positions between the lowest and highest index they use,
+  // what bounds and intersections read. analytic primitives past the
+  // triangles are skipped. does nothing without a pager.
+  void page_in(size_t first_triangle, size_t count) const;
+
+  [[nodiscard]] const MappedArray<Vec3f>& positions() const {
+    return positions_;
+  }
+  [[nodiscard]] const MappedArray<Vec3f>& normals() const { return normals_; }
+  [[nodiscard]] const MappedArray<Vec2f>& uvs() const { return uvs_; }
+  [[nodiscard]] const MappedArray<uint32_t>& indices() const {
+    return indices_;
+  }
+  [[nodiscard]] size_t triangle_count() const { return indices_.size() / 3; }
+  [[nodiscard]] const MappedArray<Sphere>& spheres() const { return spheres_; }
+  [[nodiscard]] const MappedArray<Box>& boxes() const { return boxes_; }
+  [[nodiscard]] const MappedArray<Quad>& quads() const { return quads_; }
+  [[nodiscard]] size_t analytic_count() const {
+    return spheres_.size() + boxes_.size() + quads_.size();
+  }
+  // triangles and analytic primitives
+  [[nodiscard]] size_t primitive_count() const {
+    return triangle_count() + analytic_count();
+  }
+  // empty unless encode_compact_vertices was called
+  [[nodiscard]] const CompactVertices& compact_vertices() const {
+    return compact_vertices_;
+  }
+  [[nodiscard]] const std::vector<Material>& materials() const {
+    return materials_;
+  }
+  [[nodiscard]] const MappedArray<uint32_t>& material_ids() const {
+    return material_ids_;
+  }
+  [[nodiscard]] const MappedArray<uint8_t>& bvh_cache() const {
+    return bvh_cache_;
+  }
+  [[nodiscard]] const std::vector<Mesh>& meshes() const { return meshes_; }
+  [[nodiscard]] const std::vector<Instance>& instances() const {
+    return instances_;
+  }
+
+  [[nodiscard]] Aabb triangle_bounds(size_t triangle) const;
+  // the kind of primitive prim of the whole scene numbering and its index
+  // among that kind
+  [[nodiscard]] PrimitiveKind primitive_kind(size_t prim,
+                                             size_t* index) const;
+  [[nodiscard]] Aabb primitive_bounds(size_t prim) const;
+
+ private:
+  // triangle list, 3 indices per triangle
+  MappedArray<Vec3f> positions_;
+  MappedArray<Vec3f> normals_;
+  MappedArray<Vec2f> uvs_;
+  MappedArray<uint32_t> indices_;
+  CompactVertices compact_vertices_;
+  MappedArray<Sphere> spheres_;
+  MappedArray<Box> boxes_;
+  MappedArray<Quad> quads_;
+
+  std::vector<Material> materials_;
+  MappedArray<uint32_t> material_ids_;
+  std::vector<Mesh> meshes_;
+  std::vector<Instance> instances_;
+  MappedArray<uint8_t> bvh_cache_;
+  std::shared_ptr<PagedFile> pager_;
 };
 
 #endif  // SCENE_H
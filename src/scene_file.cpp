@@ -0,0 +1,314 @@
+#include "scene_file.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+const uint32_t SCENE_FILE_MAGIC = 0x4e435352;  // "RSCN"
+const uint64_t SCENE_FILE_ALIGNMENT = 32;
+
+// the section elements are written as they are in memory
+static_assert(sizeof(Vec3f) == 12, "scene file positions");
+static_assert(sizeof(Vec2f) == 8, "scene file uvs");
+static_assert(sizeof(Material) == 32, "scene file materials");
+static_assert(sizeof(Mesh) == 8, "scene file meshes");
+static_assert(sizeof(Instance) == 52, "scene file instances");
+static_assert(sizeof(Sphere) == 20, "scene file spheres");
+static_assert(sizeof(Box) == 28, "scene file boxes");
+static_assert(sizeof(Quad) == 40, "scene file quads");
+
+uint64_t align_up(uint64_t offset) {
+  return (offset + SCENE_FILE_ALIGNMENT - 1) & ~(SCENE_FILE_ALIGNMENT - 1);
+}
+
+struct SectionSource {
+  uint32_t kind;
+  uint32_t element_size;
+  const void* data;
+  uint64_t size;
+};
+
+template <typename Array>
+SectionSource section(uint32_t kind, const Array& array) {
+  const auto element_size = uint32_t(sizeof(*array.data()));
+  return SectionSource{kind, element_size, array.data(),
+                       uint64_t(array.size()) * element_size};
+}
+
+// the elements of a section, false if the element size does not match T
+template <typename T>
+bool mapped_section(const std::shared_ptr<const PagedFile>& file,
+                    const SceneFileSection& s, MappedArray<T>* out) {
+  if (s.element_size != sizeof(T) || s.size % sizeof(T) != 0) {
+    return false;
+  }
+  *out = MappedArray<T>(
+      file, reinterpret_cast<const T*>(file->data() + s.offset),
+      s.size / sizeof(T));
+  return true;
+}
+
+template <typename T>
+bool copied_section(const PagedFile& file, const SceneFileSection& s,
+                    std::vector<T>* out) {
+  if (s.element_size != sizeof(T) || s.size % sizeof(T) != 0) {
+    return false;
+  }
+  out->resize(s.size / sizeof(T));
+  if (s.size > 0) {
+    memcpy(out->data(), file.data() + s.offset, s.size);
+  }
+  return true;
+}
+
+// every value below limit, or NO_MATERIAL when allow_no_material is set. the
+// values are paged in a page at a time.
+bool all_below(const MappedArray<uint32_t>& values, uint64_t limit,
+               bool allow_no_material, PagedFile* file) {
+  const size_t page_values = PAGED_FILE_PAGE_SIZE / sizeof(uint32_t);
+  std::atomic<bool> ok(true);
+  parallel_for(0, values.size(), 1 << 20, [&](size_t b, size_t e, uint32_t) {
+    bool chunk_ok = true;
+    for (size_t i = b; i < e;) {
+      const size_t page_end = std::min(e, (i / page_values + 1) * page_values);
+      file->touch(values.data() + i, (page_end - i) * sizeof(uint32_t));
+      for (; i < page_end; ++i) {
+        chunk_ok &= values[i] < limit ||
+                    (allow_no_material && values[i] == NO_MATERIAL);
+      }
+    }
+    if (!chunk_ok) {
+      ok = false;
+    }
+  });
+  return ok;
+}
+
+// materials of analytic primitives, which are few enough to check in one go
+template <typename T>
+bool materials_below(const MappedArray<T>& prims, uint64_t limit) {
+  return std::all_of(prims.begin(), prims.end(), [limit](const T& prim) {
+    return prim.material < limit || prim.material == NO_MATERIAL;
+  });
+}
+
+}  // namespace
+
+bool write_scene_file(const char* path, const Scene& scene,
+                      const Blob* bvh_cache) {
+  std::vector<SectionSource> sources = {
+      section(SCENE_SECTION_POSITIONS, scene.positions()),
+      section(SCENE_SECTION_NORMALS, scene.normals()),
+      section(SCENE_SECTION_UVS, scene.uvs()),
+      section(SCENE_SECTION_INDICES, scene.indices()),
+      section(SCENE_SECTION_MATERIALS, scene.materials()),
+      section(SCENE_SECTION_MATERIAL_IDS, scene.material_ids()),
+      section(SCENE_SECTION_MESHES, scene.meshes()),
+      section(SCENE_SECTION_INSTANCES, scene.instances()),
+      section(SCENE_SECTION_SPHERES, scene.spheres()),
+      section(SCENE_SECTION_BOXES, scene.boxes()),
+      section(SCENE_SECTION_QUADS, scene.quads()),
+  };
+  if (bvh_cache && !bvh_cache->empty()) {
+    sources.push_back(section(SCENE_SECTION_BVH_CACHE, *bvh_cache));
+  }
+
+  SceneFileHeader header = {};
+  header.magic = SCENE_FILE_MAGIC;
+  header.version = SCENE_FILE_VERSION;
+  header.section_count = static_cast<uint32_t>(sources.size());
+  std::vector<SceneFileSection> table(sources.size());
+  uint64_t offset =
+      align_up(sizeof(header) + table.size() * sizeof(SceneFileSection));
+  for (size_t i = 0; i < sources.size(); ++i) {
+    table[i].kind = sources[i].kind;
+    table[i].element_size = sources[i].element_size;
+    table[i].offset = offset;
+    table[i].size = sources[i].size;
+    offset = align_up(offset + table[i].size);
+  }
+
+  // written under a temporary name so a crash never leaves a truncated file
+  std::string temp_path = std::string(path) + ".tmp";
+  FILE* file = fopen(temp_path.c_str(), "wb");
+  if (!file) {
+    return false;
+  }
+  const uint8_t zeros[SCENE_FILE_ALIGNMENT] = {};
+  uint64_t written = 0;
+  auto put = [&](const void* data, uint64_t size) {
+    if (size > 0 && fwrite(data, 1, size, file) != size) {
+      return false;
+    }
+    written += size;
+    return true;
+  };
+  bool ok = put(&header, sizeof(header)) &&
+            put(table.data(), table.size() * sizeof(SceneFileSection));
+  for (size_t i = 0; i < sources.size() && ok; ++i) {
+    ok = put(zeros, table[i].offset - written) &&
+         put(sources[i].data, sources[i].size);
+  }
+  ok = ok && put(zeros, offset - written);
+  ok = fclose(file) == 0 && ok;
+  if (!ok) {
+    remove(temp_path.c_str());
+    return false;
+  }
+  remove(path);
+  return rename(temp_path.c_str(), path) == 0;
+}
+
+bool load_scene_file(const char* path, Scene* scene, size_t memory_budget) {
+  auto start = std::chrono::steady_clock::now();
+  auto file = std::make_shared<PagedFile>();
+  if (!file->open(path, memory_budget)) {
+    printf("scene: can't open %s\n", path);
+    return false;
+  }
+
+  SceneFileHeader header = {};
+  if (file->size() < sizeof(header)) {
+    printf("scene: %s is truncated\n", path);
+    return false;
+  }
+  memcpy(&header, file->data(), sizeof(header));
+  const uint64_t table_end = sizeof(header) + uint64_t(header.section_count) *
+                                                  sizeof(SceneFileSection);
+  if (header.magic != SCENE_FILE_MAGIC || table_end > file->size()) {
+    printf("scene: %s is not a scene file\n", path);
+    return false;
+  }
+  if (header.version != SCENE_FILE_VERSION) {
+    printf("scene: %s has version %u, expected %u\n", path, header.version,
+           SCENE_FILE_VERSION);
+    return false;
+  }
+
+  // the mapping is page aligned, so the table can be used in place
+  const auto* table =
+      reinterpret_cast<const SceneFileSection*>(file->data() + sizeof(header));
+  MappedArray<Vec3f> positions;
+  MappedArray<Vec3f> normals;
+  MappedArray<Vec2f> uvs;
+  MappedArray<uint32_t> indices;
+  MappedArray<uint32_t> material_ids;
+  MappedArray<uint8_t> bvh_cache;
+  MappedArray<Sphere> spheres;
+  MappedArray<Box> boxes;
+  MappedArray<Quad> quads;
+  std::vector<Material> materials;
+  std::vector<Mesh> meshes;
+  std::vector<Instance> instances;
+  bool ok = true;
+  for (uint32_t i = 0; i < header.section_count && ok; ++i) {
+    const SceneFileSection& s = table[i];
+    if (s.offset > file->size() || s.size > file->size() - s.offset ||
+        s.offset % SCENE_FILE_ALIGNMENT != 0) {
+      ok = false;
+      break;
+    }
+    switch (s.kind) {
+      case SCENE_SECTION_POSITIONS:
+        ok = mapped_section(file, s, &positions);
+        break;
+      case SCENE_SECTION_NORMALS:
+        ok = mapped_section(file, s, &normals);
+        break;
+      case SCENE_SECTION_UVS:
+        ok = mapped_section(file, s, &uvs);
+        break;
+      case SCENE_SECTION_INDICES:
+        ok = mapped_section(file, s, &indices);
+        break;
+      case SCENE_SECTION_MATERIALS:
+        ok = copied_section(*file, s, &materials);
+        break;
+      case SCENE_SECTION_MATERIAL_IDS:
+        ok = mapped_section(file, s, &material_ids);
+        break;
+      case SCENE_SECTION_MESHES:
+        ok = copied_section(*file, s, &meshes);
+        break;
+      case SCENE_SECTION_INSTANCES:
+        ok = copied_section(*file, s, &instances);
+        break;
+      case SCENE_SECTION_BVH_CACHE:
+        ok = mapped_section(file, s, &bvh_cache);
+        break;
+      case SCENE_SECTION_SPHERES:
+        ok = mapped_section(file, s, &spheres);
+        break;
+      case SCENE_SECTION_BOXES:
+        ok = mapped_section(file, s, &boxes);
+        break;
+      case SCENE_SECTION_QUADS:
+        ok = mapped_section(file, s, &quads);
+        break;
+      default:
+        break;
+    }
+  }
+
+  // the renderer indexes with these without further checks
+  const size_t vertex_count = positions.size();
+  const size_t triangle_count = indices.size() / 3;
+  ok = ok && indices.size() % 3 == 0 &&
+       (normals.empty() || normals.size() == vertex_count) &&
+       (uvs.empty() || uvs.size() == vertex_count) &&
+       (material_ids.empty() || material_ids.size() == triangle_count) &&
+       all_below(indices, vertex_count, false, file.get()) &&
+       all_below(material_ids, materials.size(), true, file.get()) &&
+       materials_below(spheres, materials.size()) &&
+       materials_below(boxes, materials.size()) &&
+       materials_below(quads, materials.size());
+  for (const auto& mesh : meshes) {
+    ok = ok && uint64_t(mesh.first_triangle) + mesh.triangle_count <=
+                   triangle_count;
+  }
+  for (const auto& instance : instances) {
+    ok = ok && instance.mesh < meshes.size();
+  }
+  if (!ok) {
+    printf("scene: %s is corrupt\n", path);
+    return false;
+  }
+
+  *scene = Scene();
+  scene->assign_geometry(std::move(positions), std::move(normals),
+                         std::move(uvs), std::move(indices));
+  for (const auto& material : materials) {
+    scene->add_material(material);
+  }
+  scene->assign_material_ids(std::move(material_ids));
+  scene->assign_primitives(std::move(spheres), std::move(boxes),
+                           std::move(quads));
+  for (const auto& mesh : meshes) {
+    scene->add_mesh(mesh.first_triangle, mesh.triangle_count);
+  }
+  for (const auto& instance : instances) {
+    scene->add_instance(instance.mesh, instance.transform);
+  }
+  scene->set_bvh_cache(std::move(bvh_cache));
+  if (memory_budget > 0) {
+    scene->set_pager(file);
+    file->trim();
+  }
+
+  const double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+  printf("scene: %s, %.1f MiB, %zu vertices, %zu triangles, %zu analytic, "
+         "%.2f ms\n",
+         path, double(file->size()) / (1024.0 * 1024.0), vertex_count,
+         triangle_count, scene->analytic_count(), ms);
+  if (memory_budget > 0) {
+    printf("scene: paged, %.1f MiB budget\n",
+           double(file->budget()) / (1024.0 * 1024.0));
+  }
+  return true;
+}
@@ -0,0 +1,70 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include <string>
+
+#include "paged_file.h"
+#include "scene.h"
+#include "util.h"
+
+// native scene container. the arrays are stored as they are in memory, so
+// a loaded scene uses them in place from the mapping and uploads read them
+// straight from the page cache. bump the version whenever the layout of a
+// section element changes.
+const uint32_t SCENE_FILE_VERSION = 1;
+
+// file extension of scene files
+const char* const SCENE_FILE_EXTENSION = ".rtscene";
+
+// file layout, little endian, every section starts 32 byte aligned:
+//   SceneFileHeader
+//   SceneFileSection[section_count]
+//   section data
+struct SceneFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t section_count;
+  uint32_t pad;
+};
+
+// sections a reader does not know are skipped
+enum SceneFileSectionKind : uint32_t {
+  SCENE_SECTION_POSITIONS = 1,  // Vec3f per vertex
+  SCENE_SECTION_NORMALS,        // Vec3f per vertex, optional
+  SCENE_SECTION_UVS,            // Vec2f per vertex, optional
+  SCENE_SECTION_INDICES,        // 3 uint32_t per triangle
+  SCENE_SECTION_MATERIALS,      // Material
+  SCENE_SECTION_MATERIAL_IDS,   // uint32_t per triangle, optional
+  SCENE_SECTION_MESHES,         // Mesh
+  SCENE_SECTION_INSTANCES,      // Instance
+  SCENE_SECTION_BVH_CACHE,      // bvh cache file bytes, optional
+  SCENE_SECTION_SPHERES,        // Sphere, optional
+  SCENE_SECTION_BOXES,          // Box, optional
+  SCENE_SECTION_QUADS,          // Quad, optional
+};
+
+struct SceneFileSection {
+  uint32_t kind;
+  uint32_t element_size;  // checked against the reader's type
+  uint64_t offset;        // from the start of the file
+  uint64_t size;          // in bytes
+};
+
+// writes scene, and the bvh cache bytes of BvhScene::cache_data() when
+// given. sections are streamed to a temporary file that replaces path once
+// complete.
+bool write_scene_file(const char* path, const Scene& scene,
+                      const Blob* bvh_cache = nullptr);
+
+// replaces scene with the contents of a scene file. vertex, index and
+// material id arrays and the bvh cache stay in the mapping, only the small
+// tables are copied. indices and ids are range checked, which reads them
+// once. returns false on a missing, truncated, corrupt or newer file. with
+// a memory_budget in bytes the file is a PagedFile that keeps at most that
+// much of it resident, see Scene::pager, so scenes larger than memory load
+// and build. the budget should hold a few PAGED_FILE_PAGE_SIZE pages per
+// worker thread.
+bool load_scene_file(const char* path, Scene* scene,
+                     size_t memory_budget = 0);
+
+#endif  // SCENE_FILE_H
@@ -0,0 +1,619 @@
+#include "simplify.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <utility>
+
+namespace {
+
+// triangles per spatial chunk, chunks are simplified independently
+const size_t SIMPLIFY_CHUNK_TRIANGLES = 1 << 16;
+// the grid that sorts the triangles of a mesh into chunks has up to
+// 2^SIMPLIFY_MAX_GRID_BITS cells per axis
+const uint32_t SIMPLIFY_MAX_GRID_BITS = 6;
+// the borders of the chunks of a pass are simplified by the next one, on a
+// grid shifted by half a cell
+const int SIMPLIFY_MAX_PASSES = 3;
+
+// owner of a vertex no triangle uses, and of one used by several chunks
+const uint32_t NO_CHUNK = ~0u;
+const uint32_t SHARED_CHUNK = ~0u - 1;
+const uint32_t NO_VERTEX = ~0u;
+
+// sum of squared distances to a set of planes, the upper triangle of a
+// symmetric 4x4 matrix: xx xy xz xw yy yz yw zz zw ww
+struct Quadric {
+  double m[10]{};
+
+  void add_plane(const double plane[4], double weight) {
+    int k = 0;
+    for (int i = 0; i < 4; ++i) {
+      for (int j = i; j < 4; ++j) {
+        m[k++] += weight * plane[i] * plane[j];
+      }
+    }
+  }
+
+  Quadric& operator+=(const Quadric& other) {
+    for (int i = 0; i < 10; ++i) {
+      m[i] += other.m[i];
+    }
+    return *this;
+  }
+
+  [[nodiscard]] double error(const Vec3f& p) const {
+    const double x = p.x;
+    const double y = p.y;
+    const double z = p.z;
+    return m[0] * x * x + m[4] * y * y + m[7] * z * z + m[9] +
+           2.0 * (m[1] * x * y + m[2] * x * z + m[5] * y * z + m[3] * x +
+                  m[6] * y + m[8] * z);
+  }
+};
+
+// moves from onto to, valid while neither vertex changed since the push
+struct Collapse {
+  double cost;
+  uint32_t from;
+  uint32_t to;
+  uint32_t from_version;
+  uint32_t to_version;
+
+  bool operator>(const Collapse& other) const { return cost > other.cost; }
+};
+
+// greedy edge collapses over the triangles of one chunk, in local vertex
+// ids. vertices shared with other chunks are locked.
+class ChunkSimplifier {
+ public:
+  ChunkSimplifier(const Scene& scene, const uint32_t* triangles, size_t count,
+                  const std::atomic<uint32_t>* owners);
+
+  void simplify(size_t target_triangle_count);
+
+  // scene vertex indices and the scene triangle of every live triangle
+  void emit(std::vector<uint32_t>* indices,
+            std::vector<uint32_t>* sources) const;
+
+ private:
+  const uint32_t* triangles_{nullptr};
+  size_t live_count_{0};
+  std::vector<uint32_t> vertices_;  // scene vertex of each local vertex
+  std::vector<Vec3f> positions_;    // relative to the first vertex
+  std::vector<Quadric> quadrics_;
+  std::vector<uint8_t> locked_;
+  std::vector<uint8_t> removed_;
+  std::vector<uint32_t> versions_;
+  std::vector<std::vector<uint32_t>> vertex_triangles_;
+  std::vector<uint32_t> corners_;  // 3 local vertices per triangle
+  std::vector<uint8_t> live_;
+  std::priority_queue<Collapse, std::vector<Collapse>, std::greater<>>
+      queue_;
+  std::vector<uint32_t> ring_from_;
+  std::vector<uint32_t> ring_to_;
+
+  [[nodiscard]] bool contains(uint32_t triangle, uint32_t vertex) const {
+    const uint32_t* c = &corners_[3 * triangle];
+    return c[0] == vertex || c[1] == vertex || c[2] == vertex;
+  }
+  void push(uint32_t from, uint32_t to);
+  void ring(uint32_t vertex, std::vector<uint32_t>* out) const;
+  bool can_collapse(uint32_t from, uint32_t to);
+  void collapse(uint32_t from, uint32_t to);
+};
+
+ChunkSimplifier::ChunkSimplifier(const Scene& scene, const uint32_t* triangles,
+                                 size_t count,
+                                 const std::atomic<uint32_t>* owners)
+    : triangles_(triangles) {
+  const auto& indices = scene.indices();
+  vertices_.resize(3 * count);
+  for (size_t i = 0; i < count; ++i) {
+    for (size_t k = 0; k < 3; ++k) {
+      vertices_[3 * i + k] = indices[size_t(triangles[i]) * 3 + k];
+    }
+  }
+  corners_ = vertices_;
+  std::sort(vertices_.begin(), vertices_.end());
+  vertices_.erase(std::unique(vertices_.begin(), vertices_.end()),
+                  vertices_.end());
+  for (auto& corner : corners_) {
+    corner = uint32_t(
+        std::lower_bound(vertices_.begin(), vertices_.end(), corner) -
+        vertices_.begin());
+  }
+
+  const size_t vertex_count = vertices_.size();
+  // relative positions keep the quadrics of far away chunks precise
+  const Vec3f origin = scene.positions()[vertices_[0]];
+  positions_.resize(vertex_count);
+  for (size_t v = 0; v < vertex_count; ++v) {
+    positions_[v] = scene.positions()[vertices_[v]] - origin;
+  }
+  quadrics_.resize(vertex_count);
+  locked_.assign(vertex_count, 0);
+  removed_.assign(vertex_count, 0);
+  versions_.assign(vertex_count, 0);
+  vertex_triangles_.resize(vertex_count);
+  live_.assign(count, 0);
+
+  std::vector<uint64_t> edges;
+  edges.reserve(3 * count);
+  for (uint32_t t = 0; t < count; ++t) {
+    const uint32_t* c = &corners_[3 * t];
+    if (c[0] == c[1] || c[1] == c[2] || c[2] == c[0]) {
+      continue;  // dropped from the lod
+    }
+    live_[t] = 1;
+    ++live_count_;
+    for (int k = 0; k < 3; ++k) {
+      vertex_triangles_[c[k]].push_back(t);
+      const uint32_t a = c[k];
+      const uint32_t b = c[(k + 1) % 3];
+      edges.push_back(uint64_t(std::min(a, b)) << 32 | std::max(a, b));
+    }
+
+    // the plane of the triangle, weighted by its area
+    const Vec3f n = Vec3f::cross(positions_[c[1]] - positions_[c[0]],
+                                 positions_[c[2]] - positions_[c[0]]);
+    const double length = std::sqrt(double(Vec3f::dot(n, n)));
+    if (length > 0.0) {
+      double plane[4] = {n.x / length, n.y / length, n.z / length, 0.0};
+      plane[3] = -(plane[0] * positions_[c[0]].x +
+                   plane[1] * positions_[c[0]].y +
+                   plane[2] * positions_[c[0]].z);
+      for (int k = 0; k < 3; ++k) {
+        quadrics_[c[k]].add_plane(plane, 0.5 * length);
+      }
+    }
+  }
+
+  // vertices of other chunks, on open or non-manifold edges and between
+  // materials stay where they are
+  for (size_t v = 0; v < vertex_count; ++v) {
+    locked_[v] = owners[vertices_[v]].load(std::memory_order_relaxed) ==
+                 SHARED_CHUNK;
+  }
+  std::sort(edges.begin(), edges.end());
+  for (size_t i = 0; i < edges.size();) {
+    size_t j = i + 1;
+    while (j < edges.size() && edges[j] == edges[i]) {
+      ++j;
+    }
+    if (j - i != 2) {
+      locked_[edges[i] >> 32] = 1;
+      locked_[edges[i] & 0xffffffff] = 1;
+    }
+    i = j;
+  }
+  const auto& material_ids = scene.material_ids();
+  if (!material_ids.empty()) {
+    for (size_t v = 0; v < vertex_count; ++v) {
+      const auto& around = vertex_triangles_[v];
+      for (size_t i = 1; i < around.size() && !locked_[v]; ++i) {
+        locked_[v] = material_ids[triangles[around[i]]] !=
+                     material_ids[triangles[around[0]]];
+      }
+    }
+  }
+}
+
+void ChunkSimplifier::push(uint32_t from, uint32_t to) {
+  if (locked_[from]) {
+    return;
+  }
+  Quadric quadric = quadrics_[from];
+  quadric += quadrics_[to];
+  queue_.push(Collapse{quadric.error(positions_[to]), from, to,
+                       versions_[from], versions_[to]});
+}
+
+void ChunkSimplifier::ring(uint32_t vertex, std::vector<uint32_t>* out) const {
+  out->clear();
+  for (uint32_t t : vertex_triangles_[vertex]) {
+    if (!live_[t]) {
+      continue;
+    }
+    for (int k = 0; k < 3; ++k) {
+      if (corners_[3 * t + k] != vertex) {
+        out->push_back(corners_[3 * t + k]);
+      }
+    }
+  }
+  std::sort(out->begin(), out->end());
+  out->erase(std::unique(out->begin(), out->end()), out->end());
+}
+
+bool ChunkSimplifier::can_collapse(uint32_t from, uint32_t to) {
+  // link condition: the edge is interior and its two triangles are the only
+  // ones the rings share, otherwise the mesh would fold onto itself
+  ring(from, &ring_from_);
+  ring(to, &ring_to_);
+  size_t common = 0;
+  for (size_t i = 0, j = 0; i < ring_from_.size() && j < ring_to_.size();) {
+    if (ring_from_[i] < ring_to_[j]) {
+      ++i;
+    } else if (ring_to_[j] < ring_from_[i]) {
+      ++j;
+    } else {
+      ++common;
+      ++i;
+      ++j;
+    }
+  }
+
+  // two locked vertices of a chunk border that get connected could get
+  // connected by the neighbor chunk as well, which pinches the surface
+  if (locked_[to]) {
+    for (uint32_t w : ring_from_) {
+      if (locked_[w] && w != to &&
+          !std::binary_search(ring_to_.begin(), ring_to_.end(), w)) {
+        return false;
+      }
+    }
+  }
+
+  size_t shared = 0;
+  for (uint32_t t : vertex_triangles_[from]) {
+    if (!live_[t]) {
+      continue;
+    }
+    if (contains(t, to)) {
+      ++shared;
+      continue;
+    }
+    // the remaining triangles must not flip
+    Vec3f p[3];
+    for (int k = 0; k < 3; ++k) {
+      p[k] = positions_[corners_[3 * t + k]];
+    }
+    const Vec3f before = Vec3f::cross(p[1] - p[0], p[2] - p[0]);
+    for (int k = 0; k < 3; ++k) {
+      if (corners_[3 * t + k] == from) {
+        p[k] = positions_[to];
+      }
+    }
+    const Vec3f after = Vec3f::cross(p[1] - p[0], p[2] - p[0]);
+    if (Vec3f::dot(before, after) <= 0.0f &&
+        Vec3f::dot(before, before) > 0.0f) {
+      return false;
+    }
+  }
+  return shared == 2 && common == 2;
+}
+
+void ChunkSimplifier::collapse(uint32_t from, uint32_t to) {
+  auto& around = vertex_triangles_[to];
+  for (uint32_t t : vertex_triangles_[from]) {
+    if (!live_[t]) {
+      continue;
+    }
+    if (contains(t, to)) {
+      live_[t] = 0;
+      --live_count_;
+      continue;
+    }
+    for (int k = 0; k < 3; ++k) {
+      if (corners_[3 * t + k] == from) {
+        corners_[3 * t + k] = to;
+      }
+    }
+    around.push_back(t);
+  }
+  std::vector<uint32_t>().swap(vertex_triangles_[from]);
+  removed_[from] = 1;
+  quadrics_[to] += quadrics_[from];
+  ++versions_[to];
+  around.erase(std::remove_if(around.begin(), around.end(),
+                              [&](uint32_t t) { return !live_[t]; }),
+               around.end());
+
+  // the costs of the edges around to changed with its quadric
+  ring(to, &ring_to_);
+  for (uint32_t w : ring_to_) {
+    push(w, to);
+    push(to, w);
+  }
+}
+
+void ChunkSimplifier::simplify(size_t target_triangle_count) {
+  for (uint32_t v = 0; v < vertices_.size(); ++v) {
+    if (!locked_[v]) {
+      ring(v, &ring_from_);
+      for (uint32_t w : ring_from_) {
+        push(v, w);
+      }
+    }
+  }
+  while (live_count_ > target_triangle_count && !queue_.empty()) {
+    const Collapse c = queue_.top();
+    queue_.pop();
+    if (removed_[c.from] || removed_[c.to] ||
+        versions_[c.from] != c.from_version ||
+        versions_[c.to] != c.to_version || !can_collapse(c.from, c.to)) {
+      continue;
+    }
+    collapse(c.from, c.to);
+  }
+  queue_ = decltype(queue_)();
+}
+
+void ChunkSimplifier::emit(std::vector<uint32_t>* indices,
+                           std::vector<uint32_t>* sources) const {
+  indices->reserve(3 * live_count_);
+  sources->reserve(live_count_);
+  for (uint32_t t = 0; t < live_.size(); ++t) {
+    if (live_[t]) {
+      for (int k = 0; k < 3; ++k) {
+        indices->push_back(vertices_[corners_[3 * t + k]]);
+      }
+      sources->push_back(triangles_[t]);
+    }
+  }
+}
+
+// interleaves the low bits of x, y and z
+uint32_t grid_cell(uint32_t x, uint32_t y, uint32_t z, uint32_t bits) {
+  uint32_t cell = 0;
+  for (uint32_t i = 0; i < bits; ++i) {
+    cell |= ((x >> i) & 1) << (3 * i + 2) | ((y >> i) & 1) << (3 * i + 1) |
+            ((z >> i) & 1) << (3 * i);
+  }
+  return cell;
+}
+
+// writes the triangles [first, first + count) to order sorted by the cell of
+// their centroid on a morton ordered grid, moved by shift cells, and appends
+// the first triangle of every chunk, a run of whole cells, to chunk_begins
+void sort_into_chunks(const Scene& scene, uint32_t first, size_t count,
+                      float shift, uint32_t* order,
+                      std::vector<size_t>* chunk_begins) {
+  if (count <= SIMPLIFY_CHUNK_TRIANGLES) {
+    for (size_t i = 0; i < count; ++i) {
+      order[i] = first + uint32_t(i);
+    }
+    chunk_begins->push_back(first);
+    return;
+  }
+
+  const auto& positions = scene.positions();
+  const auto& indices = scene.indices();
+  auto centroid = [&](uint32_t triangle) {
+    const size_t i = size_t(triangle) * 3;
+    return (positions[indices[i]] + positions[indices[i + 1]] +
+            positions[indices[i + 2]]) *
+           (1.0f / 3.0f);
+  };
+  std::vector<Aabb> partial(worker_count());
+  parallel_for(0, count, 4096, [&](size_t b, size_t e, uint32_t worker) {
+    for (size_t i = b; i < e; ++i) {
+      partial[worker].grow(centroid(first + uint32_t(i)));
+    }
+  });
+  Aabb bounds;
+  for (const auto& b : partial) {
+    bounds.grow(b);
+  }
+
+  // surfaces fill only a part of the cells, so there are many more cells
+  // than chunks
+  uint32_t bits = 1;
+  while (bits < SIMPLIFY_MAX_GRID_BITS &&
+         (size_t(1) << (3 * bits)) < 64 * count / SIMPLIFY_CHUNK_TRIANGLES) {
+    ++bits;
+  }
+  const uint32_t cell_count = 1u << (3 * bits);
+  const float resolution = float(1u << bits);
+  const Vec3f extent = bounds.extent();
+  const Vec3f scale(extent.x > 0.0f ? resolution / extent.x : 0.0f,
+                    extent.y > 0.0f ? resolution / extent.y : 0.0f,
+                    extent.z > 0.0f ? resolution / extent.z : 0.0f);
+  std::vector<uint32_t> cells(count);
+  std::vector<size_t> histograms(size_t(worker_count()) * cell_count);
+  parallel_for(0, count, 4096, [&](size_t b, size_t e, uint32_t worker) {
+    size_t* histogram = &histograms[size_t(worker) * cell_count];
+    auto quantize = [&](float x) {
+      return uint32_t(std::min(std::max(x + shift, 0.0f), resolution - 1.0f));
+    };
+    for (size_t i = b; i < e; ++i) {
+      const Vec3f p = centroid(first + uint32_t(i)) - bounds.min;
+      cells[i] = grid_cell(quantize(p.x * scale.x), quantize(p.y * scale.y),
+                           quantize(p.z * scale.z), bits);
+      ++histogram[cells[i]];
+    }
+  });
+
+  // exclusive prefix over (cell, worker) keeps the order stable, chunks are
+  // cut after the cell that fills them
+  size_t offset = 0;
+  size_t chunk_size = 0;
+  chunk_begins->push_back(first);
+  for (uint32_t cell = 0; cell < cell_count; ++cell) {
+    size_t cell_size = 0;
+    for (uint32_t w = 0; w < worker_count(); ++w) {
+      const size_t n = histograms[size_t(w) * cell_count + cell];
+      histograms[size_t(w) * cell_count + cell] = offset;
+      offset += n;
+      cell_size += n;
+    }
+    chunk_size += cell_size;
+    if (chunk_size >= SIMPLIFY_CHUNK_TRIANGLES && offset < count) {
+      chunk_begins->push_back(first + offset);
+      chunk_size = 0;
+    }
+  }
+  parallel_for(0, count, 4096, [&](size_t b, size_t e, uint32_t worker) {
+    size_t* offsets = &histograms[size_t(worker) * cell_count];
+    for (size_t i = b; i < e; ++i) {
+      order[offsets[cells[i]]++] = first + uint32_t(i);
+    }
+  });
+}
+
+void simplify_pass(const Scene& scene, size_t target_triangle_count,
+                   float shift, Scene* lod) {
+  const auto triangle_count = uint32_t(scene.triangle_count());
+  const size_t vertex_count = scene.positions().size();
+
+  // the triangles between mesh boundaries are simplified on their own, so
+  // every mesh stays a range of the lod
+  std::vector<uint32_t> cuts = {0, triangle_count};
+  for (const auto& mesh : scene.meshes()) {
+    cuts.push_back(std::min(mesh.first_triangle, triangle_count));
+    cuts.push_back(
+        std::min(mesh.first_triangle + mesh.triangle_count, triangle_count));
+  }
+  std::sort(cuts.begin(), cuts.end());
+  cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+
+  // chunk i is order[chunk_begins[i], chunk_begins[i + 1])
+  std::vector<uint32_t> order(triangle_count);
+  std::vector<size_t> chunk_begins;
+  std::vector<size_t> cut_chunks;  // first chunk of the segment at each cut
+  for (size_t s = 0; s + 1 < cuts.size(); ++s) {
+    cut_chunks.push_back(chunk_begins.size());
+    sort_into_chunks(scene, cuts[s], cuts[s + 1] - cuts[s], shift,
+                     order.data() + cuts[s], &chunk_begins);
+  }
+  const size_t chunk_count = chunk_begins.size();
+  cut_chunks.push_back(chunk_count);
+  chunk_begins.push_back(triangle_count);
+
+  // a vertex used by two chunks is locked in both
+  std::unique_ptr<std::atomic<uint32_t>[]> owners(
+      new std::atomic<uint32_t>[vertex_count]);
+  parallel_for(0, vertex_count, 1 << 16, [&](size_t b, size_t e, uint32_t) {
+    for (size_t v = b; v < e; ++v) {
+      owners[v].store(NO_CHUNK, std::memory_order_relaxed);
+    }
+  });
+  const auto& indices = scene.indices();
+  auto for_each_chunk = [&](const std::function<void(size_t)>& body) {
+    // chunks differ in cost, so the workers take them one at a time
+    std::atomic<size_t> next(0);
+    parallel_for(0, worker_count(), 1, [&](size_t, size_t, uint32_t) {
+      for (size_t c = next++; c < chunk_count; c = next++) {
+        body(c);
+      }
+    });
+  };
+  for_each_chunk([&](size_t c) {
+    const auto chunk = uint32_t(c);
+    for (size_t i = chunk_begins[c]; i < chunk_begins[c + 1]; ++i) {
+      for (size_t k = 0; k < 3; ++k) {
+        auto& owner = owners[indices[size_t(order[i]) * 3 + k]];
+        uint32_t expected = NO_CHUNK;
+        if (!owner.compare_exchange_strong(expected, chunk) &&
+            expected != chunk) {
+          owner.store(SHARED_CHUNK, std::memory_order_relaxed);
+        }
+      }
+    }
+  });
+
+  const double ratio =
+      triangle_count > 0
+          ? std::min(1.0, double(target_triangle_count) / triangle_count)
+          : 1.0;
+  std::vector<std::vector<uint32_t>> chunk_indices(chunk_count);
+  std::vector<std::vector<uint32_t>> chunk_sources(chunk_count);
+  for_each_chunk([&](size_t c) {
+    const size_t count = chunk_begins[c + 1] - chunk_begins[c];
+    ChunkSimplifier simplifier(scene, order.data() + chunk_begins[c], count,
+                               owners.get());
+    simplifier.simplify(size_t(double(count) * ratio + 0.5));
+    simplifier.emit(&chunk_indices[c], &chunk_sources[c]);
+  });
+  owners.reset();
+  std::vector<uint32_t>().swap(order);
+
+  // the lod keeps the used vertices in their order
+  std::vector<uint32_t> remap(vertex_count, NO_VERTEX);
+  std::vector<size_t> chunk_offsets(chunk_count + 1, 0);
+  for (size_t c = 0; c < chunk_count; ++c) {
+    chunk_offsets[c + 1] = chunk_offsets[c] + chunk_sources[c].size();
+    for (uint32_t v : chunk_indices[c]) {
+      remap[v] = 0;
+    }
+  }
+  std::vector<Vec3f> positions;
+  std::vector<Vec3f> normals;
+  std::vector<Vec2f> uvs;
+  for (size_t v = 0; v < vertex_count; ++v) {
+    if (remap[v] == NO_VERTEX) {
+      continue;
+    }
+    remap[v] = uint32_t(positions.size());
+    positions.push_back(scene.positions()[v]);
+    if (!scene.normals().empty()) {
+      normals.push_back(scene.normals()[v]);
+    }
+    if (!scene.uvs().empty()) {
+      uvs.push_back(scene.uvs()[v]);
+    }
+  }
+
+  const size_t lod_triangle_count = chunk_offsets[chunk_count];
+  std::vector<uint32_t> lod_indices(3 * lod_triangle_count);
+  std::vector<uint32_t> material_ids(
+      scene.material_ids().empty() ? 0 : lod_triangle_count);
+  for_each_chunk([&](size_t c) {
+    const size_t offset = chunk_offsets[c];
+    for (size_t i = 0; i < chunk_indices[c].size(); ++i) {
+      lod_indices[3 * offset + i] = remap[chunk_indices[c][i]];
+    }
+    for (size_t i = 0; i < material_ids.size() && i < chunk_sources[c].size();
+         ++i) {
+      material_ids[offset + i] = scene.material_ids()[chunk_sources[c][i]];
+    }
+  });
+
+  *lod = Scene();
+  lod->add_triangles(std::move(positions), std::move(normals), std::move(uvs),
+                     lod_indices);
+  for (const auto& material : scene.materials()) {
+    lod->add_material(material);
+  }
+  lod->assign_material_ids(MappedArray<uint32_t>(std::move(material_ids)));
+  for (const auto& mesh : scene.meshes()) {
+    auto lod_offset = [&](uint32_t triangle) {
+      const size_t cut =
+          std::lower_bound(cuts.begin(), cuts.end(),
+                           std::min(triangle, triangle_count)) -
+          cuts.begin();
+      return uint32_t(chunk_offsets[cut_chunks[cut]]);
+    };
+    const uint32_t lod_first = lod_offset(mesh.first_triangle);
+    lod->add_mesh(lod_first,
+                  lod_offset(mesh.first_triangle + mesh.triangle_count) -
+                      lod_first);
+  }
+  for (const auto& instance : scene.instances()) {
+    lod->add_instance(instance.mesh, instance.transform);
+  }
+  // already as cheap as they get, a mapping stays shared
+  lod->assign_primitives(scene.spheres(), scene.boxes(), scene.quads());
+}
+
+}  // namespace
+
+void simplify_scene(const Scene& scene, size_t target_triangle_count,
+                    Scene* lod) {
+  simplify_pass(scene, target_triangle_count, 0.0f, lod);
+  for (int pass = 1; pass < SIMPLIFY_MAX_PASSES &&
+                     lod->triangle_count() >
+                         target_triangle_count + target_triangle_count / 20;
+       ++pass) {
+    Scene coarser;
+    simplify_pass(*lod, target_triangle_count, pass % 2 ? 0.5f : 0.0f,
+                  &coarser);
+    if (coarser.triangle_count() >= lod->triangle_count()) {
+      break;
+    }
+    *lod = std::move(coarser);
+  }
+}
@@ -0,0 +1,20 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include "scene.h"
+
+// replaces lod with a coarse copy of scene of about target_triangle_count
+// triangles, e.g. to trace while the camera moves. the triangles of every
+// mesh are sorted into spatial chunks that are simplified in parallel by
+// quadric error edge collapses (garland and heckbert 1997). a collapse moves
+// a vertex onto a neighbor, so the lod uses a subset of the vertices and
+// keeps their normals and uvs. vertices on chunk, mesh, material and open
+// boundaries never move, so chunks don't crack apart and the meshes,
+// instances, materials and analytic primitives carry over. up to two more
+// passes on shifted chunks simplify the chunk borders, the lod keeps more
+// triangles than the target when the locked vertices still stop the
+// collapses early. the result does not depend on the thread count.
+void simplify_scene(const Scene& scene, size_t target_triangle_count,
+                    Scene* lod);
+
+#endif  // SIMPLIFY_H
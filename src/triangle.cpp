@@ -0,0 +1,167 @@
+#include "triangle.h"
+
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+void TriangleRecords::append(const Scene& scene,
+                             const std::vector<uint32_t>& prims,
+                             uint32_t first_triangle) {
+  const auto& positions = scene.positions();
+  const auto& indices = scene.indices();
+  const size_t base = a_.size();
+  a_.resize(base + prims.size());
+  b_.resize(base + prims.size());
+  c_.resize(base + prims.size());
+  first_sphere_ = uint32_t(scene.triangle_count());
+  first_box_ = first_sphere_ + uint32_t(scene.spheres().size());
+  first_quad_ = first_box_ + uint32_t(scene.boxes().size());
+
+  auto vec = [](const Vec3f& p, uint32_t w) {
+    return TriangleVec{p.x, p.y, p.z, w};
+  };
+  parallel_for(0, prims.size(), 4096, [&](size_t begin, size_t end, uint32_t) {
+    for (size_t i = begin; i < end; ++i) {
+      const uint32_t prim = first_triangle + prims[i];
+      TriangleVec& a = a_[base + i];
+      TriangleVec& b = b_[base + i];
+      TriangleVec& c = c_[base + i];
+      size_t index = 0;
+      switch (scene.primitive_kind(prim, &index)) {
+        case PRIMITIVE_TRIANGLE: {
+          const Vec3f& p0 = positions[indices[index * 3 + 0]];
+          Vec3f p1 = positions[indices[index * 3 + 1]];
+          Vec3f p2 = positions[indices[index * 3 + 2]];
+          if (!watertight_) {
+            p1 -= p0;
+            p2 -= p0;
+          }
+          a = vec(p0, prim);
+          b = vec(p1, 0);
+          c = vec(p2, 0);
+          break;
+        }
+        case PRIMITIVE_SPHERE: {
+          const Sphere& sphere = scene.spheres()[index];
+          a = vec(sphere.center, prim);
+          b = vec(Vec3f(sphere.radius, 0.0f, 0.0f), 0);
+          c = vec(Vec3f(), 0);
+          break;
+        }
+        case PRIMITIVE_BOX:
+          a = vec(scene.boxes()[index].min, prim);
+          b = vec(scene.boxes()[index].max, 0);
+          c = vec(Vec3f(), 0);
+          break;
+        case PRIMITIVE_QUAD: {
+          const Quad& quad = scene.quads()[index];
+          a = vec(quad.corner, prim);
+          b = vec(quad.edge_u, 0);
+          c = vec(quad.edge_v, 0);
+          break;
+        }
+      }
+    }
+  });
+}
+
+Blob TriangleRecords::pack() const {
+  const size_t header_size = 16;
+  const size_t stream_size = a_.size() * sizeof(TriangleVec);
+  Blob data(header_size + 3 * stream_size);
+  const uint32_t header[4] = {static_cast<uint32_t>(a_.size()),
+                              first_sphere_, first_box_, first_quad_};
+  memcpy(data.data(), header, sizeof(header));
+  if (stream_size > 0) {
+    memcpy(data.data() + header_size, a_.data(), stream_size);
+    memcpy(data.data() + header_size + stream_size, b_.data(), stream_size);
+    memcpy(data.data() + header_size + 2 * stream_size, c_.data(),
+           stream_size);
+  }
+  return data;
+}
+
+Blob pack_triangle_indices(const Scene& scene,
+                           const std::vector<uint32_t>& triangles) {
+  const size_t header_size = 16;
+  Blob data(header_size + triangles.size() * 4 * sizeof(uint32_t));
+  const auto count = static_cast<uint32_t>(triangles.size());
+  memcpy(data.data(), &count, sizeof(count));
+  const auto& indices = scene.indices();
+  auto* records = reinterpret_cast<uint32_t*>(data.data() + header_size);
+  parallel_for(0, triangles.size(), 4096, [&](size_t b, size_t e, uint32_t) {
+    for (size_t i = b; i < e; ++i) {
+      const uint32_t triangle = triangles[i];
+      records[4 * i + 0] = indices[triangle * 3 + 0];
+      records[4 * i + 1] = indices[triangle * 3 + 1];
+      records[4 * i + 2] = indices[triangle * 3 + 2];
+      records[4 * i + 3] = triangle;
+    }
+  });
+  return data;
+}
+
+WatertightRay::WatertightRay(const Vec3f& direction) {
+  Vec3f d(std::abs(direction.x), std::abs(direction.y),
+          std::abs(direction.z));
+  kz = d.x > d.y ? (d.x > d.z ? 0 : 2) : (d.y > d.z ? 1 : 2);
+  kx = (kz + 1) % 3;
+  ky = (kx + 1) % 3;
+  // keeps the winding of the triangle when the ray looks down z
+  if (direction[kz] < 0.0f) {
+    std::swap(kx, ky);
+  }
+  sx = direction[kx] / direction[kz];
+  sy = direction[ky] / direction[kz];
+  sz = 1.0f / direction[kz];
+}
+
+bool intersect_triangle_watertight(const Vec3f& p0, const Vec3f& p1,
+                                   const Vec3f& p2, const Ray& ray,
+                                   const WatertightRay& shear, float* t,
+                                   float* u, float* v) {
+  const int kx = shear.kx;
+  const int ky = shear.ky;
+  const int kz = shear.kz;
+  const Vec3f a = p0 - ray.origin;
+  const Vec3f b = p1 - ray.origin;
+  const Vec3f c = p2 - ray.origin;
+
+  // vertices in ray space, the ray is the z axis
+  const float ax = a[kx] - shear.sx * a[kz];
+  const float ay = a[ky] - shear.sy * a[kz];
+  const float bx = b[kx] - shear.sx * b[kz];
+  const float by = b[ky] - shear.sy * b[kz];
+  const float cx = c[kx] - shear.sx * c[kz];
+  const float cy = c[ky] - shear.sy * c[kz];
+
+  // scaled barycentrics, the edge functions of bc, ca and ab
+  float e0 = cx * by - cy * bx;
+  float e1 = ax * cy - ay * cx;
+  float e2 = bx * ay - by * ax;
+  if (e0 == 0.0f || e1 == 0.0f || e2 == 0.0f) {
+    // the ray passes through an edge in float, double decides the side
+    e0 = float(double(cx) * double(by) - double(cy) * double(bx));
+    e1 = float(double(ax) * double(cy) - double(ay) * double(cx));
+    e2 = float(double(bx) * double(ay) - double(by) * double(ax));
+  }
+  if ((e0 < 0.0f || e1 < 0.0f || e2 < 0.0f) &&
+      (e0 > 0.0f || e1 > 0.0f || e2 > 0.0f)) {
+    return false;
+  }
+  float det = e0 + e1 + e2;
+  if (det == 0.0f) {
+    return false;
+  }
+
+  const float inv_det = 1.0f / det;
+  const float hit_t =
+      shear.sz * (e0 * a[kz] + e1 * b[kz] + e2 * c[kz]) * inv_det;
+  if (hit_t <= 0.0f || hit_t >= ray.t_max) {
+    return false;
+  }
+  *t = hit_t;
+  *u = e1 * inv_det;
+  *v = e2 * inv_det;
+  return true;
+}
@@ -0,0 +1,112 @@
+#ifndef TRIANGLE_H
+#define TRIANGLE_H
+
+#include "scene.h"
+#include "util.h"
+
+// one element of a triangle stream, a vec4 in rt.frag.glsl
+struct TriangleVec {
+  float x, y, z;
+  uint32_t w;
+};
+static_assert(sizeof(TriangleVec) == 16, "TriangleVec must be a vec4");
+
+// triangles in the order the leaves reference them, as three streams of
+// TriangleVec so a leaf test reads three consecutive vec4 loads. a.w is the
+// scene triangle. without watertight b and c are the precomputed edges
+// p1 - p0 and p2 - p0, with watertight they are p1 and p2. the analytic
+// primitives of a bvh over the whole scene are records too, a.w is then
+// their primitive number, which is at least first_sphere():
+//   sphere: a.xyz center, b.x radius
+//   box:    a.xyz min, b.xyz max
+//   quad:   a.xyz corner, b.xyz edge_u, c.xyz edge_v
+class TriangleRecords {
+ public:
+  explicit TriangleRecords(bool watertight = false)
+      : watertight_(watertight) {}
+
+  // appends the records of first_triangle + prims[i], numbered as in
+  // Scene::primitive_kind
+  void append(const Scene& scene, const std::vector<uint32_t>& prims,
+              uint32_t first_triangle = 0);
+
+  [[nodiscard]] bool watertight() const { return watertight_; }
+  [[nodiscard]] size_t size() const { return a_.size(); }
+  [[nodiscard]] const std::vector<TriangleVec>& a() const { return a_; }
+  [[nodiscard]] const std::vector<TriangleVec>& b() const { return b_; }
+  [[nodiscard]] const std::vector<TriangleVec>& c() const { return c_; }
+  // primitive numbers where the spheres, boxes and quads of the appended
+  // scene begin
+  [[nodiscard]] uint32_t first_sphere() const { return first_sphere_; }
+  [[nodiscard]] uint32_t first_box() const { return first_box_; }
+  [[nodiscard]] uint32_t first_quad() const { return first_quad_; }
+
+  // uint count, first_sphere, first_box and first_quad, then the a, b and c
+  // streams, matches BvhTriangles in rt.frag.glsl
+  [[nodiscard]] Blob pack() const;
+
+ private:
+  bool watertight_{false};
+  uint32_t first_sphere_{~0u};
+  uint32_t first_box_{~0u};
+  uint32_t first_quad_{~0u};
+  std::vector<TriangleVec> a_;
+  std::vector<TriangleVec> b_;
+  std::vector<TriangleVec> c_;
+};
+
+// uint count padded to 16 bytes, then a uvec4 per triangle of its three
+// vertex indices and the scene triangle, matches BvhTriangles in
+// rt.frag.glsl with BVH_COMPACT_VERTICES
+Blob pack_triangle_indices(const Scene& scene,
+                           const std::vector<uint32_t>& triangles);
+
+// per ray part of the watertight test of woop et al. 2013: the axes are
+// permuted so that z is the largest direction component and the shear
+// maps the direction to (0, 0, 1)
+struct WatertightRay {
+  int kx{0}, ky{1}, kz{2};
+  float sx{0.0f}, sy{0.0f}, sz{1.0f};
+
+  explicit WatertightRay(const Vec3f& direction);
+};
+
+// moller-trumbore on precomputed edges, u and v are the weights of p0 + e1
+// and p0 + e2. returns false for t outside (0, t_max).
+inline bool intersect_triangle_edges(const Vec3f& p0, const Vec3f& e1,
+                                     const Vec3f& e2, const Ray& ray,
+                                     float* t, float* u, float* v) {
+  Vec3f p = Vec3f::cross(ray.direction, e2);
+  float det = Vec3f::dot(e1, p);
+  if (det == 0.0f) {
+    return false;
+  }
+  float inv_det = 1.0f / det;
+  Vec3f s = ray.origin - p0;
+  float bu = Vec3f::dot(s, p) * inv_det;
+  if (bu < 0.0f || bu > 1.0f) {
+    return false;
+  }
+  Vec3f q = Vec3f::cross(s, e1);
+  float bv = Vec3f::dot(ray.direction, q) * inv_det;
+  if (bv < 0.0f || bu + bv > 1.0f) {
+    return false;
+  }
+  float bt = Vec3f::dot(e2, q) * inv_det;
+  if (bt <= 0.0f || bt >= ray.t_max) {
+    return false;
+  }
+  *t = bt;
+  *u = bu;
+  *v = bv;
+  return true;
+}
+
+// watertight test, a ray through a shared edge or vertex always hits at
+// least one of the triangles. same outputs as intersect_triangle_edges.
+bool intersect_triangle_watertight(const Vec3f& p0, const Vec3f& p1,
+                                   const Vec3f& p2, const Ray& ray,
+                                   const WatertightRay& shear, float* t,
+                                   float* u, float* v);
+
+#endif  // TRIANGLE_H
@@ -4,7 +4,97 @@
 
 #include "util.h"
 
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+Aabb Transform::apply(const Aabb &b) const {
+  Aabb out;
+  if (b.empty()) {
+    return out;
+  }
+  for (int corner = 0; corner < 8; ++corner) {
+    out.grow(apply_point(Vec3f(corner & 1 ? b.max.x : b.min.x,
+                               corner & 2 ? b.max.y : b.min.y,
+                               corner & 4 ? b.max.z : b.min.z)));
+  }
+  return out;
+}
+
+Transform Transform::inverse() const {
+  // adjugate of the linear part, then the translation
+  const float a = m[0][0], b = m[0][1], c = m[0][2];
+  const float d = m[1][0], e = m[1][1], f = m[1][2];
+  const float g = m[2][0], h = m[2][1], i = m[2][2];
+  const float det = a * (e * i - f * h) - b * (d * i - f * g) +
+                    c * (d * h - e * g);
+  const float inv_det = det != 0.0f ? 1.0f / det : 0.0f;
+
+  Transform out;
+  out.m[0][0] = (e * i - f * h) * inv_det;
+  out.m[0][1] = (c * h - b * i) * inv_det;
+  out.m[0][2] = (b * f - c * e) * inv_det;
+  out.m[1][0] = (f * g - d * i) * inv_det;
+  out.m[1][1] = (a * i - c * g) * inv_det;
+  out.m[1][2] = (c * d - a * f) * inv_det;
+  out.m[2][0] = (d * h - e * g) * inv_det;
+  out.m[2][1] = (b * g - a * h) * inv_det;
+  out.m[2][2] = (a * e - b * d) * inv_det;
+
+  Vec3f t = out.apply_vector(Vec3f(m[0][3], m[1][3], m[2][3]));
+  out.m[0][3] = -t.x;
+  out.m[1][3] = -t.y;
+  out.m[2][3] = -t.z;
+  return out;
+}
+
+uint32_t worker_count() {
+  static const uint32_t count =
+      std::max(1u, std::thread::hardware_concurrency());
+  return count;
+}
+
+void parallel_for(
+    size_t begin, size_t end, size_t min_chunk,
+    const std::function<void(size_t, size_t, uint32_t)> &body) {
+  if (begin >= end) {
+    return;
+  }
+  const size_t total = end - begin;
+  const size_t chunk_limit = total / std::max<size_t>(1, min_chunk);
+  const size_t chunks =
+      std::min<size_t>(worker_count(), std::max<size_t>(1, chunk_limit));
+  if (chunks <= 1) {
+    body(begin, end, 0);
+    return;
+  }
+
+  const size_t step = (total + chunks - 1) / chunks;
+  std::vector<std::thread> threads;
+  threads.reserve(chunks - 1);
+  for (size_t i = 1; i < chunks; ++i) {
+    size_t b = begin + i * step;
+    size_t e = std::min(end, b + step);
+    if (b < e) {
+      threads.emplace_back(body, b, e, static_cast<uint32_t>(i));
+    }
+  }
+  body(begin, std::min(end, begin + step), 0);
+  for (auto &t : threads) {
+    t.join();
+  }
+}
 
 bool read_file(const char *path, Blob &out_blob) {
   FILE *fp = fopen(path, "rb");
@@ -21,4 +111,112 @@ bool read_file(const char *path, Blob &out_blob) {
   fclose(fp);
 
   return file_size == read_size;
-}
\ No newline at end of file
+}
+
+bool write_file(const char *path, const void *data, size_t size) {
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    return false;
+  }
+  auto write_size = fwrite(data, 1, size, fp);
+  return fclose(fp) == 0 && write_size == size;
+}
+
+bool MappedFile::open(const char *path) {
+  close();
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+  HANDLE mapping =
+      CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  const void *view =
+      mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+  if (!view) {
+    if (mapping) {
+      CloseHandle(mapping);
+    }
+    CloseHandle(file);
+    return false;
+  }
+  file_ = file;
+  mapping_ = mapping;
+  data_ = static_cast<const uint8_t *>(view);
+  size_ = static_cast<size_t>(file_size.QuadPart);
+#else
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st = {};
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+  void *view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps the file alive
+  ::close(fd);
+  if (view == MAP_FAILED) {
+    return false;
+  }
+  data_ = static_cast<const uint8_t *>(view);
+  size_ = static_cast<size_t>(st.st_size);
+#endif
+  return true;
+}
+
+void MappedFile::close() {
+  if (!data_) {
+    return;
+  }
+#ifdef _WIN32
+  UnmapViewOfFile(data_);
+  CloseHandle(mapping_);
+  CloseHandle(file_);
+  file_ = nullptr;
+  mapping_ = nullptr;
+#else
+  munmap(const_cast<uint8_t *>(data_), size_);
+#endif
+  data_ = nullptr;
+  size_ = 0;
+}
+
+namespace {
+
+// murmur3 fmix64, a bijection with full avalanche
+uint64_t mix64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ull;
+  x ^= x >> 33;
+  return x;
+}
+
+}  // namespace
+
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed) {
+  const auto *bytes = static_cast<const uint8_t *>(data);
+  uint64_t hash = seed;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, bytes + i, 8);
+    hash = mix64(hash ^ word);
+  }
+  if (i < size) {
+    // the tail length goes into the top byte, which the tail never fills
+    uint64_t word = uint64_t(size - i) << 56;
+    memcpy(&word, bytes + i, size - i);
+    hash = mix64(hash ^ word);
+  }
+  return hash;
+}
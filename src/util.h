@@ -7,6 +7,10 @@
 
 #include <cmath>
 #include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <utility>
 #include <vector>
 
 // macros
@@ -68,6 +72,64 @@ struct Vec3f {
     float a = 1.0f / len;
     return v * a;
   }
+
+  [[nodiscard]] static Vec3f min(const Vec3f &v1, const Vec3f &v2) {
+    return Vec3f(v1.x < v2.x ? v1.x : v2.x, v1.y < v2.y ? v1.y : v2.y,
+                 v1.z < v2.z ? v1.z : v2.z);
+  }
+
+  [[nodiscard]] static Vec3f max(const Vec3f &v1, const Vec3f &v2) {
+    return Vec3f(v1.x > v2.x ? v1.x : v2.x, v1.y > v2.y ? v1.y : v2.y,
+                 v1.z > v2.z ? v1.z : v2.z);
+  }
+};
+
+struct Vec2f {
+  float x, y;
+
+  Vec2f() : x(0.0f), y(0.0f) {}
+  explicit Vec2f(float x, float y) : x(x), y(y) {}
+};
+
+// axis aligned bounding box, empty by default
+struct Aabb {
+  Vec3f min{std::numeric_limits<float>::max(),
+            std::numeric_limits<float>::max(),
+            std::numeric_limits<float>::max()};
+  Vec3f max{-std::numeric_limits<float>::max(),
+            -std::numeric_limits<float>::max(),
+            -std::numeric_limits<float>::max()};
+
+  void grow(const Vec3f &p) {
+    min = Vec3f::min(min, p);
+    max = Vec3f::max(max, p);
+  }
+  void grow(const Aabb &b) {
+    min = Vec3f::min(min, b.min);
+    max = Vec3f::max(max, b.max);
+  }
+
+  [[nodiscard]] bool empty() const {
+    return min.x > max.x || min.y > max.y || min.z > max.z;
+  }
+  [[nodiscard]] Vec3f extent() const { return max - min; }
+  [[nodiscard]] Vec3f centroid() const { return (min + max) * 0.5f; }
+
+  [[nodiscard]] float surface_area() const {
+    if (empty()) {
+      return 0.0f;
+    }
+    Vec3f d = extent();
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+  }
+
+  [[nodiscard]] int max_axis() const {
+    Vec3f d = extent();
+    if (d.x > d.y && d.x > d.z) {
+      return 0;
+    }
+    return d.y > d.z ? 1 : 2;
+  }
 };
 
 // refcounted
@@ -85,10 +147,140 @@ class RefCounted {
   int ref_count_{1};
 };
 
+struct Ray {
+  Vec3f origin;
+  Vec3f direction;
+  float t_max{std::numeric_limits<float>::max()};
+};
+
+// scaling the far distance of a slab test by 1 + 2 * gamma(3) keeps it
+// conservative under float rounding (ize 2013), a ray through a box face,
+// edge or corner is never culled
+const float SLAB_T_FAR_SCALE = 1.0000004f;
+
+// deepest leaf of any bvh, the root is 0. a traversal stack needs
+// BVH_MAX_DEPTH * (width - 1) + 1 entries. matches BVH_MAX_DEPTH in
+// rt.frag.glsl.
+const uint32_t BVH_MAX_DEPTH = 64;
+
+// debug counts of one traversal, see the traverse functions of the bvh
+// layouts: nodes whose bounds or child bounds were tested and primitives
+// handed to the intersection callback
+struct TraversalCounters {
+  uint32_t nodes{0};
+  uint32_t prims{0};
+};
+
+// row major 3x4 affine transform, the last row is implicitly (0, 0, 0, 1)
+struct Transform {
+  float m[3][4]{{1.0f, 0.0f, 0.0f, 0.0f},
+                {0.0f, 1.0f, 0.0f, 0.0f},
+                {0.0f, 0.0f, 1.0f, 0.0f}};
+
+  [[nodiscard]] Vec3f apply_vector(const Vec3f &v) const {
+    return Vec3f(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+                 m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+                 m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+  }
+  [[nodiscard]] Vec3f apply_point(const Vec3f &p) const {
+    return apply_vector(p) + Vec3f(m[0][3], m[1][3], m[2][3]);
+  }
+
+  // bounds of the transformed box
+  [[nodiscard]] Aabb apply(const Aabb &b) const;
+  [[nodiscard]] Transform inverse() const;
+};
+
+//----
+// parallel
+
+// number of worker threads used by parallel_for and the builders
+uint32_t worker_count();
+
+// splits [begin, end) into contiguous chunks of at least min_chunk items and
+// calls body(chunk_begin, chunk_end, worker) on every worker thread
+void parallel_for(
+    size_t begin, size_t end, size_t min_chunk,
+    const std::function<void(size_t, size_t, uint32_t)> &body);
+
 //----
 // io
 using Blob = std::vector<uint8_t>;
 
 bool read_file(const char *path, Blob &out_blob);
+bool write_file(const char *path, const void *data, size_t size);
+
+// read only memory mapping of a whole file
+class MappedFile {
+ public:
+  NOCOPYABLE(MappedFile)
+
+  MappedFile() = default;
+  ~MappedFile() { close(); }
+
+  bool open(const char *path);
+  void close();
+
+  [[nodiscard]] const uint8_t *data() const { return data_; }
+  [[nodiscard]] size_t size() const { return size_; }
+
+ private:
+  const uint8_t *data_{nullptr};
+  size_t size_{0};
+#ifdef _WIN32
+  void *file_{nullptr};
+  void *mapping_{nullptr};
+#endif
+};
+
+// read only array that is either owned or lives in memory kept alive by
+// someone else, e.g. a section of a mapped file. mapped arrays are used in
+// place and copied out on the first edit.
+template <typename T>
+class MappedArray {
+ public:
+  MappedArray() = default;
+  explicit MappedArray(std::vector<T> owned) : owned_(std::move(owned)) {}
+  MappedArray(std::shared_ptr<const void> keep_alive, const T *data,
+              size_t size)
+      : keep_alive_(std::move(keep_alive)), data_(data), size_(size) {}
+
+  [[nodiscard]] bool mapped() const { return keep_alive_ != nullptr; }
+  [[nodiscard]] const T *data() const {
+    return mapped() ? data_ : owned_.data();
+  }
+  [[nodiscard]] size_t size() const { return mapped() ? size_ : owned_.size(); }
+  [[nodiscard]] bool empty() const { return size() == 0; }
+  const T &operator[](size_t i) const { return data()[i]; }
+  [[nodiscard]] const T *begin() const { return data(); }
+  [[nodiscard]] const T *end() const { return data() + size(); }
+
+  // the owned array, a mapping is copied out and released first
+  std::vector<T> &edit() {
+    if (mapped()) {
+      owned_.assign(data_, data_ + size_);
+      keep_alive_.reset();
+      data_ = nullptr;
+      size_ = 0;
+    }
+    return owned_;
+  }
+
+ private:
+  std::vector<T> owned_;
+  std::shared_ptr<const void> keep_alive_;
+  const T *data_{nullptr};
+  size_t size_{0};
+};
+
+//----
+// hash
+
+// every 8 byte word is xored in and mixed with the murmur3 finalizer, so
+// each input bit reaches every output bit. hashing in pieces that are a
+// multiple of 8 bytes, the result of one piece seeding the next, gives the
+// same hash as a single call. not for anything adversarial.
+uint64_t hash_bytes(const void *data, size_t size,
+                    uint64_t seed = 0xcbf29ce484222325ull);
 
 #endif  // UTIL_H
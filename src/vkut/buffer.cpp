@@ -0,0 +1,52 @@
+#include "buffer.h"
+
+#include <cstring>
+
+#include "common.h"
+
+namespace vkut {
+Buffer::Buffer(VkPhysicalDevice physical_device, VkDevice device,
+               VkDeviceSize size, VkBufferUsageFlags usage, const void* data,
+               VkMemoryPropertyFlags properties)
+    : vk_device_(device), size_(size) {
+  VkBufferCreateInfo buffer_info = {};
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.size = size;
+  buffer_info.usage = usage;
+  buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  VKUT_CHECK_RESULT(vkCreateBuffer(device, &buffer_info, nullptr, &vk_buffer_));
+
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(device, vk_buffer_, &requirements);
+
+  VkMemoryAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  alloc_info.allocationSize = requirements.size;
+  alloc_info.memoryTypeIndex = find_memory_type(
+      physical_device, requirements.memoryTypeBits, properties);
+  VKUT_CHECK_RESULT(vkAllocateMemory(device, &alloc_info, nullptr, &vk_memory_));
+  VKUT_CHECK_RESULT(vkBindBufferMemory(device, vk_buffer_, vk_memory_, 0));
+
+  if (data) {
+    update(data, size);
+  }
+}
+
+Buffer::~Buffer() {
+  vkDestroyBuffer(vk_device_, vk_buffer_, nullptr);
+  vkFreeMemory(vk_device_, vk_memory_, nullptr);
+}
+void Buffer::update(const void* data, VkDeviceSize size) {
+  void* mapped = nullptr;
+  VKUT_CHECK_RESULT(vkMapMemory(vk_device_, vk_memory_, 0, size, 0, &mapped));
+  memcpy(mapped, data, size);
+  vkUnmapMemory(vk_device_, vk_memory_);
+}
+
+void Buffer::read(void* data, VkDeviceSize size) const {
+  void* mapped = nullptr;
+  VKUT_CHECK_RESULT(vkMapMemory(vk_device_, vk_memory_, 0, size, 0, &mapped));
+  memcpy(data, mapped, size);
+  vkUnmapMemory(vk_device_, vk_memory_);
+}
+}  // namespace vkut
@@ -0,0 +1,38 @@
+#ifndef VKUT_BUFFER_H
+#define VKUT_BUFFER_H
+
+#include <vulkan/vulkan.h>
+
+namespace vkut {
+// host visible buffer, filled with a single memcpy on creation. buffers
+// that only the device touches pass VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT as
+// properties, they can't be updated from the host and data must be null.
+class Buffer {
+ public:
+  Buffer(VkPhysicalDevice physical_device, VkDevice device, VkDeviceSize size,
+         VkBufferUsageFlags usage, const void* data,
+         VkMemoryPropertyFlags properties =
+             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  ~Buffer();
+
+  Buffer(const Buffer&) = delete;
+  Buffer& operator=(const Buffer&) = delete;
+
+  // memcpy of size bytes to the start of the buffer
+  void update(const void* data, VkDeviceSize size);
+  // memcpy of size bytes from the start of the buffer
+  void read(void* data, VkDeviceSize size) const;
+
+  [[nodiscard]] const VkBuffer& vk_buffer() const { return vk_buffer_; }
+  [[nodiscard]] VkDeviceSize size() const { return size_; }
+
+ private:
+  VkDevice vk_device_{VK_NULL_HANDLE};
+  VkBuffer vk_buffer_{VK_NULL_HANDLE};
+  VkDeviceMemory vk_memory_{VK_NULL_HANDLE};
+  VkDeviceSize size_{0};
+};
+}  // namespace vkut
+
+#endif  // VKUT_BUFFER_H
@@ -5,3 +5,17 @@
 #include "common.h"
 
 const char* get_result_string(VkResult result) { return "undefined"; }
+
+uint32_t find_memory_type(VkPhysicalDevice physical_device, uint32_t type_bits,
+                          VkMemoryPropertyFlags properties) {
+  VkPhysicalDeviceMemoryProperties memory_properties;
+  vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+  for (uint32_t i = 0; i < memory_properties.memoryTypeCount; ++i) {
+    if ((type_bits & (1u << i)) &&
+        (memory_properties.memoryTypes[i].propertyFlags & properties) ==
+            properties) {
+      return i;
+    }
+  }
+  std::abort();
+}
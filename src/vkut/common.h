@@ -7,10 +7,16 @@
 
 #include <vulkan/vulkan.h>
 
+#include <cstdlib>
 #include <exception>
 
 const char* get_result_string(VkResult result);
 
+// index of a memory type allowed by type_bits with all of properties,
+// aborts if there is none
+uint32_t find_memory_type(VkPhysicalDevice physical_device, uint32_t type_bits,
+                          VkMemoryPropertyFlags properties);
+
 #define VKUT_CHECK_RESULT(EXPR) \
   do {                          \
     VkResult result = EXPR;     \
@@ -0,0 +1,181 @@
+#include "compute.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "../util.h"
+#include "common.h"
+
+namespace vkut {
+ComputeDevice::~ComputeDevice() {
+  if (vk_device_ != VK_NULL_HANDLE) {
+    vkDestroyDevice(vk_device_, nullptr);
+  }
+  if (vk_instance_ != VK_NULL_HANDLE) {
+    vkDestroyInstance(vk_instance_, nullptr);
+  }
+}
+
+bool ComputeDevice::create() {
+  VkApplicationInfo app_info = {};
+  app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+  app_info.pApplicationName = "glsl-raytracing";
+  app_info.apiVersion = VK_API_VERSION_1_0;
+
+  VkInstanceCreateInfo instance_info = {};
+  instance_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+  instance_info.pApplicationInfo = &app_info;
+  if (vkCreateInstance(&instance_info, nullptr, &vk_instance_) !=
+      VK_SUCCESS) {
+    vk_instance_ = VK_NULL_HANDLE;
+    return false;
+  }
+
+  uint32_t device_count = 0;
+  vkEnumeratePhysicalDevices(vk_instance_, &device_count, nullptr);
+  std::vector<VkPhysicalDevice> devices(device_count);
+  vkEnumeratePhysicalDevices(vk_instance_, &device_count, devices.data());
+  for (VkPhysicalDevice device : devices) {
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &family_count, nullptr);
+    std::vector<VkQueueFamilyProperties> families(family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &family_count,
+                                             families.data());
+    for (uint32_t family = 0; family < family_count; ++family) {
+      if (families[family].queueFlags & VK_QUEUE_COMPUTE_BIT) {
+        vk_physical_device_ = device;
+        queue_family_ = family;
+        break;
+      }
+    }
+    if (vk_physical_device_ != VK_NULL_HANDLE) {
+      break;
+    }
+  }
+  if (vk_physical_device_ == VK_NULL_HANDLE) {
+    return false;
+  }
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(vk_physical_device_, &properties);
+  memcpy(name_, properties.deviceName, sizeof(name_));
+
+  const float priority = 1.0f;
+  VkDeviceQueueCreateInfo queue_info = {};
+  queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+  queue_info.queueFamilyIndex = queue_family_;
+  queue_info.queueCount = 1;
+  queue_info.pQueuePriorities = &priority;
+
+  VkDeviceCreateInfo device_info = {};
+  device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  device_info.queueCreateInfoCount = 1;
+  device_info.pQueueCreateInfos = &queue_info;
+  if (vkCreateDevice(vk_physical_device_, &device_info, nullptr,
+                     &vk_device_) != VK_SUCCESS) {
+    vk_device_ = VK_NULL_HANDLE;
+    return false;
+  }
+  return true;
+}
+
+ComputePipeline::ComputePipeline(VkDevice device,
+                                 const std::string& spirv_path,
+                                 VkDescriptorSetLayout set_layout,
+                                 uint32_t push_constant_size)
+    : vk_device_(device) {
+  Blob code;
+  if (!read_file(spirv_path.c_str(), code) || code.size() % 4 != 0) {
+    printf("vkut: can't read spir-v %s\n", spirv_path.c_str());
+    std::abort();
+  }
+  VkShaderModuleCreateInfo module_info = {};
+  module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  module_info.codeSize = code.size();
+  module_info.pCode = reinterpret_cast<const uint32_t*>(code.data());
+  VkShaderModule module = VK_NULL_HANDLE;
+  VKUT_CHECK_RESULT(
+      vkCreateShaderModule(device, &module_info, nullptr, &module));
+
+  VkPushConstantRange push_constant_range = {};
+  push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  push_constant_range.size = push_constant_size;
+
+  VkPipelineLayoutCreateInfo layout_info = {};
+  layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layout_info.setLayoutCount = 1;
+  layout_info.pSetLayouts = &set_layout;
+  layout_info.pushConstantRangeCount = push_constant_size > 0 ? 1 : 0;
+  layout_info.pPushConstantRanges = &push_constant_range;
+  VKUT_CHECK_RESULT(vkCreatePipelineLayout(device, &layout_info, nullptr,
+                                           &vk_pipeline_layout_));
+
+  VkComputePipelineCreateInfo pipeline_info = {};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipeline_info.stage.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipeline_info.stage.module = module;
+  pipeline_info.stage.pName = "main";
+  pipeline_info.layout = vk_pipeline_layout_;
+  VKUT_CHECK_RESULT(vkCreateComputePipelines(
+      device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &vk_pipeline_));
+
+  // the pipeline keeps what it needs of the module
+  vkDestroyShaderModule(device, module, nullptr);
+}
+
+ComputePipeline::~ComputePipeline() {
+  vkDestroyPipeline(vk_device_, vk_pipeline_, nullptr);
+  vkDestroyPipelineLayout(vk_device_, vk_pipeline_layout_, nullptr);
+}
+
+OneTimeCommands::OneTimeCommands(VkDevice device, uint32_t queue_family)
+    : vk_device_(device), queue_family_(queue_family) {
+  VkCommandPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  pool_info.queueFamilyIndex = queue_family;
+  VKUT_CHECK_RESULT(
+      vkCreateCommandPool(device, &pool_info, nullptr, &vk_command_pool_));
+
+  VkCommandBufferAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  alloc_info.commandPool = vk_command_pool_;
+  alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  alloc_info.commandBufferCount = 1;
+  VKUT_CHECK_RESULT(
+      vkAllocateCommandBuffers(device, &alloc_info, &vk_command_buffer_));
+
+  VkCommandBufferBeginInfo begin_info = {};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  VKUT_CHECK_RESULT(vkBeginCommandBuffer(vk_command_buffer_, &begin_info));
+}
+
+OneTimeCommands::~OneTimeCommands() {
+  // the command buffer is freed together with its pool
+  vkDestroyCommandPool(vk_device_, vk_command_pool_, nullptr);
+}
+
+void OneTimeCommands::submit_and_wait() {
+  VKUT_CHECK_RESULT(vkEndCommandBuffer(vk_command_buffer_));
+
+  VkFenceCreateInfo fence_info = {};
+  fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  VkFence fence = VK_NULL_HANDLE;
+  VKUT_CHECK_RESULT(vkCreateFence(vk_device_, &fence_info, nullptr, &fence));
+
+  VkSubmitInfo submit_info = {};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &vk_command_buffer_;
+  VkQueue queue = VK_NULL_HANDLE;
+  vkGetDeviceQueue(vk_device_, queue_family_, 0, &queue);
+  VKUT_CHECK_RESULT(vkQueueSubmit(queue, 1, &submit_info, fence));
+  VKUT_CHECK_RESULT(
+      vkWaitForFences(vk_device_, 1, &fence, VK_TRUE, UINT64_MAX));
+  vkDestroyFence(vk_device_, fence, nullptr);
+}
+}  // namespace vkut
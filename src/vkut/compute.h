@@ -0,0 +1,87 @@
+#ifndef VKUT_COMPUTE_H
+#define VKUT_COMPUTE_H
+
+#include <vulkan/vulkan.h>
+
+#include <string>
+
+namespace vkut {
+// headless instance and device with a single compute queue, for tools that
+// run compute shaders without a window. any implementation works,
+// including software ones such as lavapipe.
+class ComputeDevice {
+ public:
+  ComputeDevice() = default;
+  ~ComputeDevice();
+
+  ComputeDevice(const ComputeDevice&) = delete;
+  ComputeDevice& operator=(const ComputeDevice&) = delete;
+
+  // picks the first device with a compute queue, returns false if there is
+  // no vulkan implementation or no such device
+  bool create();
+
+  [[nodiscard]] VkPhysicalDevice vk_physical_device() const {
+    return vk_physical_device_;
+  }
+  [[nodiscard]] VkDevice vk_device() const { return vk_device_; }
+  [[nodiscard]] uint32_t queue_family() const { return queue_family_; }
+  [[nodiscard]] const char* name() const { return name_; }
+
+ private:
+  VkInstance vk_instance_{VK_NULL_HANDLE};
+  VkPhysicalDevice vk_physical_device_{VK_NULL_HANDLE};
+  VkDevice vk_device_{VK_NULL_HANDLE};
+  uint32_t queue_family_{0};
+  char name_[VK_MAX_PHYSICAL_DEVICE_NAME_SIZE]{};
+};
+
+// compute pipeline of one spir-v module. set 0 of the pipeline layout is
+// set_layout, push constants are visible to the compute stage.
+class ComputePipeline {
+ public:
+  ComputePipeline(VkDevice device, const std::string& spirv_path,
+                  VkDescriptorSetLayout set_layout,
+                  uint32_t push_constant_size);
+  ~ComputePipeline();
+
+  ComputePipeline(const ComputePipeline&) = delete;
+  ComputePipeline& operator=(const ComputePipeline&) = delete;
+
+  [[nodiscard]] VkPipeline vk_pipeline() const { return vk_pipeline_; }
+  [[nodiscard]] VkPipelineLayout vk_pipeline_layout() const {
+    return vk_pipeline_layout_;
+  }
+
+ private:
+  VkDevice vk_device_{VK_NULL_HANDLE};
+  VkPipelineLayout vk_pipeline_layout_{VK_NULL_HANDLE};
+  VkPipeline vk_pipeline_{VK_NULL_HANDLE};
+};
+
+// primary command buffer of its own pool that is submitted once and waited
+// for, e.g. for builds and downloads outside of a frame
+class OneTimeCommands {
+ public:
+  OneTimeCommands(VkDevice device, uint32_t queue_family);
+  ~OneTimeCommands();
+
+  OneTimeCommands(const OneTimeCommands&) = delete;
+  OneTimeCommands& operator=(const OneTimeCommands&) = delete;
+
+  [[nodiscard]] VkCommandBuffer vk_command_buffer() const {
+    return vk_command_buffer_;
+  }
+
+  // ends recording, submits to queue 0 of the family and waits
+  void submit_and_wait();
+
+ private:
+  VkDevice vk_device_{VK_NULL_HANDLE};
+  uint32_t queue_family_{0};
+  VkCommandPool vk_command_pool_{VK_NULL_HANDLE};
+  VkCommandBuffer vk_command_buffer_{VK_NULL_HANDLE};
+};
+}  // namespace vkut
+
+#endif  // VKUT_COMPUTE_H
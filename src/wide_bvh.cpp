@@ -0,0 +1,96 @@
+#include "wide_bvh.h"
+
+#include "bvh.h"
+
+template <uint32_t N>
+WideBvh<N> WideBvh<N>::collapse(const Bvh& bvh) {
+  WideBvh wide;
+  if (bvh.empty()) {
+    return wide;
+  }
+  wide.prim_indices_ = bvh.prim_indices();
+  wide.nodes_.reserve(bvh.nodes().size() / (N - 1) + 1);
+  wide.nodes_.emplace_back();
+  wide.collapse_node(bvh, 0, 0);
+  return wide;
+}
+
+template <uint32_t N>
+WideBvh<N> WideBvh<N>::from_arrays(std::vector<WideBvhNode<N>> nodes,
+                                   std::vector<uint32_t> prim_indices) {
+  WideBvh wide;
+  wide.nodes_ = std::move(nodes);
+  wide.prim_indices_ = std::move(prim_indices);
+  return wide;
+}
+
+template <uint32_t N>
+void WideBvh<N>::collapse_node(const Bvh& bvh, uint32_t bvh_index,
+                               uint32_t index) {
+  const auto& bvh_nodes = bvh.nodes();
+
+  // open the interior child with the largest surface area until the node is
+  // full, a leaf root becomes the only child of the root
+  uint32_t children[N];
+  uint32_t child_count = 0;
+  if (bvh_nodes[bvh_index].is_leaf()) {
+    children[child_count++] = bvh_index;
+  } else {
+    children[child_count++] = bvh_index + 1;
+    children[child_count++] = bvh_nodes[bvh_index].offset;
+  }
+  while (child_count < N) {
+    int largest = -1;
+    float largest_area = -1.0f;
+    for (uint32_t i = 0; i < child_count; ++i) {
+      const BvhNode& node = bvh_nodes[children[i]];
+      float area = node.bounds().surface_area();
+      if (!node.is_leaf() && area > largest_area) {
+        largest = static_cast<int>(i);
+        largest_area = area;
+      }
+    }
+    if (largest < 0) {
+      break;
+    }
+    uint32_t opened = children[largest];
+    children[largest] = opened + 1;
+    children[child_count++] = bvh_nodes[opened].offset;
+  }
+
+  uint32_t child_nodes[N];
+  WideBvhNode<N> node;
+  for (uint32_t i = 0; i < N; ++i) {
+    for (int axis = 0; axis < 3; ++axis) {
+      node.bounds_min[axis][i] = std::numeric_limits<float>::max();
+      node.bounds_max[axis][i] = -std::numeric_limits<float>::max();
+    }
+    node.child[i] = 0;
+    node.prim_count[i] = 0;
+  }
+  for (uint32_t i = 0; i < child_count; ++i) {
+    const BvhNode& child = bvh_nodes[children[i]];
+    for (int axis = 0; axis < 3; ++axis) {
+      node.bounds_min[axis][i] = child.bounds_min[axis];
+      node.bounds_max[axis][i] = child.bounds_max[axis];
+    }
+    if (child.is_leaf()) {
+      node.child[i] = child.offset;
+      node.prim_count[i] = child.prim_count;
+    } else {
+      child_nodes[i] = static_cast<uint32_t>(nodes_.size());
+      node.child[i] = child_nodes[i];
+      nodes_.emplace_back();
+    }
+  }
+  nodes_[index] = node;
+
+  for (uint32_t i = 0; i < child_count; ++i) {
+    if (!bvh_nodes[children[i]].is_leaf()) {
+      collapse_node(bvh, children[i], child_nodes[i]);
+    }
+  }
+}
+
+template class WideBvh<4>;
+template class WideBvh<8>;
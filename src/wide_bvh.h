@@ -0,0 +1,199 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define WIDE_BVH_SSE
+#endif
+
+#include <cmath>
+
+#include "util.h"
+
+class Bvh;
+
+// N children per node stored SoA, matches BvhWideNode in rt.frag.glsl.
+// unused slots have inverted bounds and are never hit.
+template <uint32_t N>
+struct alignas(32) WideBvhNode {
+  float bounds_min[3][N];  // [axis][child]
+  float bounds_max[3][N];
+  uint32_t child[N];       // node index, or first prim_indices entry of a leaf
+  uint32_t prim_count[N];  // 0 for interior children
+};
+static_assert(sizeof(WideBvhNode<4>) == 128, "BVH4 node must be 128 bytes");
+static_assert(sizeof(WideBvhNode<8>) == 256, "BVH8 node must be 256 bytes");
+
+// binary bvh collapsed into N-wide nodes, N is 4 or 8
+template <uint32_t N>
+class WideBvh {
+ public:
+  static_assert(N == 4 || N == 8, "wide bvh supports 4 or 8 children");
+
+  // keeps the leaves of bvh, prim_indices are copied as they are
+  static WideBvh collapse(const Bvh& bvh);
+  // arrays of a previous collapse, e.g. from the bvh cache
+  static WideBvh from_arrays(std::vector<WideBvhNode<N>> nodes,
+                             std::vector<uint32_t> prim_indices);
+
+  [[nodiscard]] const std::vector<WideBvhNode<N>>& nodes() const {
+    return nodes_;
+  }
+  [[nodiscard]] const std::vector<uint32_t>& prim_indices() const {
+    return prim_indices_;
+  }
+
+  // same contract as Bvh::traverse
+  template <typename IntersectPrim>
+  void traverse(Ray ray, IntersectPrim&& intersect_prim,
+                TraversalCounters* counters = nullptr) const;
+
+ private:
+  std::vector<WideBvhNode<N>> nodes_;
+  std::vector<uint32_t> prim_indices_;
+
+  void collapse_node(const Bvh& bvh, uint32_t bvh_index, uint32_t index);
+};
+
+// slab test of a ray against every child of node. near_planes[axis] is 0
+// when inv_dir is positive on that axis, which picks bounds_min as the entry
+// plane. the sign must come from inv_dir, a -0 direction has an inv_dir of
+// -inf. returns a bit mask of hit children and their entry t.
+template <uint32_t N>
+inline uint32_t intersect_children(const WideBvhNode<N>& node,
+                                   const Vec3f& origin, const Vec3f& inv_dir,
+                                   const int* near_planes, float t_max,
+                                   float* t_near) {
+  const float* entry_planes[3];
+  const float* exit_planes[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    entry_planes[axis] =
+        near_planes[axis] ? node.bounds_max[axis] : node.bounds_min[axis];
+    exit_planes[axis] =
+        near_planes[axis] ? node.bounds_min[axis] : node.bounds_max[axis];
+  }
+
+  uint32_t mask = 0;
+#if defined(__AVX__)
+  if constexpr (N == 8) {
+    __m256 t0 = _mm256_setzero_ps();
+    __m256 t1 = _mm256_set1_ps(t_max);
+    for (int axis = 0; axis < 3; ++axis) {
+      __m256 o = _mm256_set1_ps(origin[axis]);
+      __m256 inv = _mm256_set1_ps(inv_dir[axis]);
+      __m256 t_enter = _mm256_mul_ps(
+          _mm256_sub_ps(_mm256_load_ps(entry_planes[axis]), o), inv);
+      __m256 t_exit = _mm256_mul_ps(
+          _mm256_sub_ps(_mm256_load_ps(exit_planes[axis]), o), inv);
+      t0 = _mm256_max_ps(t0, t_enter);
+      t1 = _mm256_min_ps(t1, t_exit);
+    }
+    t1 = _mm256_mul_ps(t1, _mm256_set1_ps(SLAB_T_FAR_SCALE));
+    _mm256_storeu_ps(t_near, t0);
+    return static_cast<uint32_t>(
+        _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ)));
+  }
+#endif
+#if defined(WIDE_BVH_SSE)
+  for (uint32_t group = 0; group < N; group += 4) {
+    __m128 t0 = _mm_setzero_ps();
+    __m128 t1 = _mm_set1_ps(t_max);
+    for (int axis = 0; axis < 3; ++axis) {
+      __m128 o = _mm_set1_ps(origin[axis]);
+      __m128 inv = _mm_set1_ps(inv_dir[axis]);
+      __m128 t_enter = _mm_mul_ps(
+          _mm_sub_ps(_mm_load_ps(entry_planes[axis] + group), o), inv);
+      __m128 t_exit = _mm_mul_ps(
+          _mm_sub_ps(_mm_load_ps(exit_planes[axis] + group), o), inv);
+      t0 = _mm_max_ps(t0, t_enter);
+      t1 = _mm_min_ps(t1, t_exit);
+    }
+    t1 = _mm_mul_ps(t1, _mm_set1_ps(SLAB_T_FAR_SCALE));
+    _mm_storeu_ps(t_near + group, t0);
+    mask |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(t0, t1)))
+            << group;
+  }
+#else
+  for (uint32_t i = 0; i < N; ++i) {
+    float t0 = 0.0f;
+    float t1 = t_max;
+    for (int axis = 0; axis < 3; ++axis) {
+      float t_enter = (entry_planes[axis][i] - origin[axis]) * inv_dir[axis];
+      float t_exit = (exit_planes[axis][i] - origin[axis]) * inv_dir[axis];
+      t0 = t_enter > t0 ? t_enter : t0;
+      t1 = t_exit < t1 ? t_exit : t1;
+    }
+    t_near[i] = t0;
+    mask |= (t0 <= t1 * SLAB_T_FAR_SCALE ? 1u : 0u) << i;
+  }
+#endif
+  return mask;
+}
+
+template <uint32_t N>
+template <typename IntersectPrim>
+void WideBvh<N>::traverse(Ray ray, IntersectPrim&& intersect_prim,
+                          TraversalCounters* counters) const {
+  if (nodes_.empty()) {
+    return;
+  }
+
+  struct Entry {
+    uint32_t child;
+    uint32_t prim_count;
+    float t;
+  };
+
+  Vec3f inv_dir(1.0f / ray.direction.x, 1.0f / ray.direction.y,
+                1.0f / ray.direction.z);
+  int near_planes[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    near_planes[axis] = std::signbit(inv_dir[axis]) ? 1 : 0;
+  }
+
+  Entry stack[BVH_MAX_DEPTH * (N - 1) + 1];
+  uint32_t stack_size = 0;
+  stack[stack_size++] = Entry{0, 0, 0.0f};
+  alignas(32) float t_near[N];
+
+  while (stack_size > 0) {
+    const Entry entry = stack[--stack_size];
+    if (entry.t > ray.t_max) {
+      continue;
+    }
+    if (counters) {
+      counters->nodes += entry.prim_count > 0 ? 0 : 1;
+      counters->prims += entry.prim_count;
+    }
+    if (entry.prim_count > 0) {
+      for (uint32_t i = 0; i < entry.prim_count; ++i) {
+        ray.t_max = intersect_prim(prim_indices_[entry.child + i], ray);
+      }
+      continue;
+    }
+
+    const WideBvhNode<N>& node = nodes_[entry.child];
+    uint32_t mask = intersect_children(node, ray.origin, inv_dir, near_planes,
+                                       ray.t_max, t_near);
+
+    // push far to near so the closest child is popped first
+    const uint32_t first = stack_size;
+    while (mask) {
+      uint32_t i = 0;
+      while (!(mask & (1u << i))) {
+        ++i;
+      }
+      mask &= mask - 1;
+
+      Entry e{node.child[i], node.prim_count[i], t_near[i]};
+      uint32_t j = stack_size++;
+      while (j > first && stack[j - 1].t < e.t) {
+        stack[j] = stack[j - 1];
+        --j;
+      }
+      stack[j] = e;
+    }
+  }
+}
+
+#endif  // WIDE_BVH_H